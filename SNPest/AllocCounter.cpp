@@ -0,0 +1,158 @@
+#include "AllocCounter.h"
+#include <cstdlib>
+#include <new>
+
+#if __cplusplus >= 201103L
+#define ALLOC_THROW
+#define ALLOC_NOTHROW noexcept
+#else
+#define ALLOC_THROW throw(std::bad_alloc)
+#define ALLOC_NOTHROW throw()
+#endif
+
+static unsigned long allocationCount = 0;
+
+
+unsigned long heapAllocationCount()
+{
+  return __sync_fetch_and_add(& allocationCount, 0);
+}
+
+
+static void * countedAlloc(std::size_t size)
+{
+  __sync_fetch_and_add(& allocationCount, 1);
+  return std::malloc(size == 0 ? 1 : size);
+}
+
+
+void * operator new(std::size_t size) ALLOC_THROW
+{
+  void * p = countedAlloc(size);
+  if (p == NULL)
+    throw std::bad_alloc();
+  return p;
+}
+
+
+void * operator new[](std::size_t size) ALLOC_THROW
+{
+  void * p = countedAlloc(size);
+  if (p == NULL)
+    throw std::bad_alloc();
+  return p;
+}
+
+
+void * operator new(std::size_t size, std::nothrow_t const &) ALLOC_NOTHROW
+{
+  return countedAlloc(size);
+}
+
+
+void * operator new[](std::size_t size, std::nothrow_t const &) ALLOC_NOTHROW
+{
+  return countedAlloc(size);
+}
+
+
+void operator delete(void * p) ALLOC_NOTHROW
+{
+  std::free(p);
+}
+
+
+void operator delete[](void * p) ALLOC_NOTHROW
+{
+  std::free(p);
+}
+
+
+void operator delete(void * p, std::nothrow_t const &) ALLOC_NOTHROW
+{
+  std::free(p);
+}
+
+
+void operator delete[](void * p, std::nothrow_t const &) ALLOC_NOTHROW
+{
+  std::free(p);
+}
+
+
+#if __cpp_aligned_new
+// the allocations of over-aligned types, which do not go through the
+// versions above
+static void * countedAlignedAlloc(std::size_t size, std::align_val_t alignment)
+{
+  __sync_fetch_and_add(& allocationCount, 1);
+  std::size_t a = static_cast<std::size_t>(alignment);
+  return std::aligned_alloc( a, (size == 0) ? a : (size + a - 1) / a * a );
+}
+
+
+void * operator new(std::size_t size, std::align_val_t alignment)
+{
+  void * p = countedAlignedAlloc(size, alignment);
+  if (p == NULL)
+    throw std::bad_alloc();
+  return p;
+}
+
+
+void * operator new[](std::size_t size, std::align_val_t alignment)
+{
+  void * p = countedAlignedAlloc(size, alignment);
+  if (p == NULL)
+    throw std::bad_alloc();
+  return p;
+}
+
+
+void * operator new(std::size_t size, std::align_val_t alignment, std::nothrow_t const &) noexcept
+{
+  return countedAlignedAlloc(size, alignment);
+}
+
+
+void * operator new[](std::size_t size, std::align_val_t alignment, std::nothrow_t const &) noexcept
+{
+  return countedAlignedAlloc(size, alignment);
+}
+
+
+void operator delete(void * p, std::align_val_t) noexcept
+{
+  std::free(p);
+}
+
+
+void operator delete[](void * p, std::align_val_t) noexcept
+{
+  std::free(p);
+}
+
+
+void operator delete(void * p, std::align_val_t, std::nothrow_t const &) noexcept
+{
+  std::free(p);
+}
+
+
+void operator delete[](void * p, std::align_val_t, std::nothrow_t const &) noexcept
+{
+  std::free(p);
+}
+
+
+void operator delete(void * p, std::size_t, std::align_val_t) noexcept
+{
+  std::free(p);
+}
+
+
+void operator delete[](void * p, std::size_t, std::align_val_t) noexcept
+{
+  std::free(p);
+}
+#endif
@@ -0,0 +1,20 @@
+#ifndef __AllocCounter_h
+#define __AllocCounter_h
+
+// Count of the heap allocations made through the global operator new
+// (and so by the standard containers, strings and streams) since
+// program start. Used to check that the site evaluation loop does not
+// allocate in steady state. Only builds with ALLOC_COUNTER defined
+// (dfgEval_SNPest_alloc, 'make alloccheck') link AllocCounter.cpp, which
+// replaces operator new and delete by counting versions on top of
+// malloc and free; other builds keep the allocator of the C++ library,
+// as the counter is shared by all threads, and count nothing.
+#ifdef ALLOC_COUNTER
+bool const HEAP_ALLOCATIONS_COUNTED = true;
+unsigned long heapAllocationCount();
+#else
+bool const HEAP_ALLOCATIONS_COUNTED = false;
+inline unsigned long heapAllocationCount() {return 0;}
+#endif
+
+#endif  // __AllocCounter_h
@@ -0,0 +1,223 @@
+#include "BamPileup.h"
+#include "phy/utils.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cctype>
+#include <climits>
+#include <algorithm>
+
+using namespace phy;
+
+// largest quality in 'samtools mpileup -s' output (ASCII 126 - 33)
+static int const BAM_MAX_QUAL = 93;
+// reads skipped as by default in samtools mpileup
+static unsigned const BAM_SKIP_FLAGS = BAM_FUNMAP | BAM_FSECONDARY | BAM_FQCFAIL | BAM_FDUP;
+// length of the reference windows read from the FASTA file
+static int const REF_WINDOW = 1 << 16;
+
+
+BamPileupReader::BamPileupReader(string const & file, string const & reference, string const & region, unsigned maxDepth, unsigned minBaseQ, unsigned minMapQ, bool noRef)
+  : PileupReader(maxDepth, 33, noRef), file_(file), minBaseQ_(minBaseQ), minMapQ_(minMapQ),
+    in_(NULL), header_(NULL), index_(NULL), iter_(NULL), pileup_(NULL), fai_(NULL), refTid_(-1), refBeg_(0)
+{
+  in_ = sam_open(file.c_str(), "r");
+  if (in_ == NULL)
+    errorAbort("From BamPileupReader: cannot open alignment file '" + file + "'.");
+  if ( not reference.empty() ) {
+    if (hts_set_fai_filename(in_, reference.c_str()) != 0)
+      errorAbort("From BamPileupReader: cannot use reference '" + reference + "' for '" + file + "'.");
+    fai_ = fai_load( reference.c_str() );
+    if (fai_ == NULL)
+      errorAbort("From BamPileupReader: cannot load the reference '" + reference + "' (or its .fai index).");
+  }
+  header_ = sam_hdr_read(in_);
+  if (header_ == NULL)
+    errorAbort("From BamPileupReader: cannot read the header of '" + file + "'.");
+
+  if ( not region.empty() ) {
+    index_ = sam_index_load(in_, file.c_str());
+    if (index_ == NULL)
+      errorAbort("From BamPileupReader: a region requires an index of '" + file + "' (samtools index).");
+    iter_ = sam_itr_querys(index_, header_, region.c_str());
+    if (iter_ == NULL)
+      errorAbort("From BamPileupReader: cannot parse region '" + region + "' or it is not in the header of '" + file + "'.");
+  }
+
+  pileup_ = bam_plp_init(& BamPileupReader::readAlignment, this);
+  // down sampling to maxDepth is done on the whole pileup, as with the text input
+  bam_plp_set_maxcnt(pileup_, INT_MAX);
+}
+
+
+BamPileupReader::~BamPileupReader()
+{
+  if (pileup_ != NULL)
+    bam_plp_destroy(pileup_);
+  if (iter_ != NULL)
+    hts_itr_destroy(iter_);
+  if (index_ != NULL)
+    hts_idx_destroy(index_);
+  if (header_ != NULL)
+    sam_hdr_destroy(header_);
+  if (in_ != NULL)
+    sam_close(in_);
+  if (fai_ != NULL)
+    fai_destroy(fai_);
+}
+
+
+int BamPileupReader::readAlignment(void * data, bam1_t * b)
+{
+  BamPileupReader * r = (BamPileupReader *) data;
+  while (true) {
+    int ret = (r->iter_ != NULL) ? sam_itr_next(r->in_, r->iter_, b) : sam_read1(r->in_, r->header_, b);
+    if (ret < -1)
+      errorAbort("From BamPileupReader: error reading alignments of '" + r->file_ + "'.");
+    if (ret < 0)
+      return ret;
+    unsigned flag = b->core.flag;
+    if ( (flag & BAM_SKIP_FLAGS) != 0 )
+      continue;
+    if ( (flag & BAM_FPAIRED) != 0 and (flag & BAM_FPROPER_PAIR) == 0 )
+      continue;
+    if (b->core.qual < r->minMapQ_)
+      continue;
+    return ret;
+  }
+}
+
+
+char BamPileupReader::refBase(int tid, hts_pos_t pos)
+{
+  if (fai_ == NULL)
+    return 'N';
+  if (tid != refTid_ or pos < refBeg_ or pos >= refBeg_ + REF_WINDOW) {
+    int len = 0;
+    char * seq = faidx_fetch_seq(fai_, sam_hdr_tid2name(header_, tid), pos, pos + REF_WINDOW - 1, & len);
+    refSeq_.assign( seq != NULL ? seq : "", (seq != NULL and len > 0) ? len : 0 );
+    free(seq);
+    refTid_ = tid;
+    refBeg_ = pos;
+  }
+  hts_pos_t i = pos - refBeg_;
+  return (i < (hts_pos_t) refSeq_.size()) ? toupper(refSeq_[i]) : 'N';
+}
+
+
+// Collect the reads of the next covered position. A read gives its base
+// (or '*' inside a deletion) and the inserted sequence following the
+// base, if any; reference skips (N in the CIGAR) are ignored. Positions
+// where no read passes the filters are skipped (mpileup prints them as
+// a line without reads).
+bool BamPileupReader::readSite()
+{
+  int tid, n;
+  hts_pos_t pos;
+  bam_pileup1_t const * plp;
+  while ( (plp = bam_plp_auto(pileup_, & tid, & pos, & n)) != NULL ) {
+    if (iter_ != NULL and (pos < iter_->beg or pos >= iter_->end))
+      continue;
+
+    reads_.clear();
+    baseQ_.clear();
+    mapQ_.clear();
+    unsigned insCount = 0;
+    maxInsLength_ = 0;
+    for (int i = 0; i < n; i++) {
+      bam_pileup1_t const & p = plp[i];
+      bam1_t * b = p.b;
+      if (p.is_refskip)
+	continue;
+      // as samtools mpileup -Q, only bases are filtered on their quality:
+      // in a deletion, qpos is the base after it
+      int bq = (p.qpos < b->core.l_qseq) ? bam_get_qual(b)[p.qpos] : 0;
+      if (not p.is_del and bq < (int) minBaseQ_)
+	continue;
+      uint8_t * seq = bam_get_seq(b);
+      reads_ += p.is_del ? '*' : seq_nt16_str[ bam_seqi(seq, p.qpos) ];
+      baseQ_.push_back( std::min(bq, BAM_MAX_QUAL) );
+      mapQ_.push_back( std::min( (int) b->core.qual, BAM_MAX_QUAL) );
+
+      if (p.indel > 0 and not p.is_del) {
+	if (insCount == insertions_.size())
+	  insertions_.push_back("");
+	string & ins = insertions_[insCount++];
+	ins.resize(p.indel);
+	for (int k = 0; k < p.indel; k++)
+	  ins[k] = normalizeBase( seq_nt16_str[ bam_seqi(seq, p.qpos + 1 + k) ] );
+	if ( (unsigned) p.indel > maxInsLength_ )
+	  maxInsLength_ = p.indel;
+      }
+    }
+    insertions_.resize(insCount);
+    if ( reads_.empty() )
+      continue;
+
+    chrom_.assign( sam_hdr_tid2name(header_, tid) );
+    char buf[24];
+    sprintf(buf, "%lld", (long long) pos + 1);
+    pos_.assign(buf);
+    ref_ = refBase(tid, pos);
+    return true;
+  }
+  if (n < 0)
+    errorAbort("From BamPileupReader: error in the pileup of '" + file_ + "' (is it sorted by coordinate?).");
+  return false;
+}
+
+
+vector<GenomicRegion> mkBamShards(string const & file, GenomicRegion const & region, unsigned long shardSize)
+{
+  samFile * in = sam_open(file.c_str(), "r");
+  if (in == NULL)
+    errorAbort("From mkBamShards: cannot open alignment file '" + file + "'.");
+  sam_hdr_t * header = sam_hdr_read(in);
+  if (header == NULL)
+    errorAbort("From mkBamShards: cannot read the header of '" + file + "'.");
+
+  vector<GenomicRegion> shards;
+  bool found = false;
+  for (int tid = 0; tid < sam_hdr_nref(header); tid++) {
+    GenomicRegion contig;
+    contig.chrom = sam_hdr_tid2name(header, tid);
+    contig.end = sam_hdr_tid2len(header, tid);
+    if ( not region.empty() ) {
+      if (region.chrom != contig.chrom)
+	continue;
+      found = true;
+      contig.beg = region.beg;
+      contig.end = std::min(region.end, contig.end);
+    }
+    for (unsigned long beg = contig.beg; beg <= contig.end; ) {
+      GenomicRegion shard = contig;
+      shard.beg = beg;
+      if (shardSize > 0 and contig.end - beg >= shardSize)
+	shard.end = beg + shardSize - 1;
+      shards.push_back(shard);
+      beg = shard.end + 1;
+    }
+  }
+  if (not region.empty() and not found)
+    errorAbort("From mkBamShards: contig '" + region.chrom + "' is not in the header of '" + file + "'.");
+
+  sam_hdr_destroy(header);
+  sam_close(in);
+  return shards;
+}
+
+
+vector<GenomicRegion> readFastaContigs(string const & reference)
+{
+  faidx_t * fai = fai_load( reference.c_str() );
+  if (fai == NULL)
+    errorAbort("From readFastaContigs: cannot load the reference '" + reference + "' (or its .fai index).");
+  vector<GenomicRegion> contigs;
+  for (int i = 0; i < faidx_nseq(fai); i++) {
+    GenomicRegion contig;
+    contig.chrom = faidx_iseq(fai, i);
+    contig.end = faidx_seq_len64( fai, contig.chrom.c_str() );
+    contigs.push_back(contig);
+  }
+  fai_destroy(fai);
+  return contigs;
+}
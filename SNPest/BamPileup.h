@@ -0,0 +1,69 @@
+#ifndef __BamPileup_h
+#define __BamPileup_h
+
+#include "Pileup.h"
+#include <htslib/sam.h>
+#include <htslib/faidx.h>
+#include <string>
+#include <vector>
+
+// Site evidence read directly from a coordinate sorted BAM or CRAM file
+// with the htslib pileup engine, giving the same site records as
+// 'samtools mpileup -B -s -f reference' piped into MpileupReader:
+// reads that are unmapped, secondary, QC failed, duplicates, or paired
+// but not in a proper pair are skipped, as are reads with mapping
+// quality below minMapQ and bases (not deletions) with base quality
+// below minBaseQ.
+// Base alignment qualities (BAQ) are not computed. Qualities are capped
+// at 93 as in the text output.
+//
+// With a region ('chr', 'chr:beg' or 'chr:beg-end', 1-based) only the
+// alignments overlapping it are read, using the index of the file, and
+// only the positions inside it give sites. The reference (FASTA with
+// .fai index) gives the reference base of each site and is needed to
+// decode CRAM; without it the reference base is N.
+class BamPileupReader : public PileupReader {
+public:
+  BamPileupReader(std::string const & file, std::string const & reference, std::string const & region, unsigned maxDepth, unsigned minBaseQ = 13, unsigned minMapQ = 0, bool noRef = false);
+  virtual ~BamPileupReader();
+
+protected:
+  virtual bool readSite();
+
+private:
+  BamPileupReader(BamPileupReader const &);
+  BamPileupReader & operator=(BamPileupReader const &);
+
+  // alignment source of the pileup engine; skips filtered reads
+  static int readAlignment(void * data, bam1_t * b);
+
+  char refBase(int tid, hts_pos_t pos);
+
+  std::string file_;
+  unsigned minBaseQ_, minMapQ_;
+
+  samFile * in_;
+  sam_hdr_t * header_;
+  hts_idx_t * index_;
+  hts_itr_t * iter_;    // NULL without a region
+  bam_plp_t pileup_;
+
+  faidx_t * fai_;       // NULL without a reference
+  int refTid_;          // contig and start of the cached reference window
+  hts_pos_t refBeg_;
+  std::string refSeq_;
+};
+
+
+// Split the contigs in the header of the alignment file (restricted to
+// region, unless empty) into shards of at most shardSize bases, or one
+// per contig if shardSize is 0. The shards are in the order of the
+// sorted file, so evaluating them one after the other gives the sites
+// in the same order as the whole file.
+std::vector<GenomicRegion> mkBamShards(std::string const & file, GenomicRegion const & region, unsigned long shardSize);
+
+// The contigs of a FASTA file (with .fai index) in file order, as
+// regions covering each contig.
+std::vector<GenomicRegion> readFastaContigs(std::string const & reference);
+
+#endif  // __BamPileup_h
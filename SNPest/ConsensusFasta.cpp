@@ -0,0 +1,277 @@
+#include "ConsensusFasta.h"
+#include "phy/utils.h"
+#include <fstream>
+#include <cstdlib>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace phy;
+
+// bytes of output buffered between writes
+size_t const FASTA_WRITE_BUFFER = 1 << 20;
+
+
+IndexedFasta::IndexedFasta(string const & file)
+  : file_(file), data_(NULL), size_(0)
+{
+  string indexFile = file + ".fai";
+  ifstream index( indexFile.c_str() );
+  if (not index)
+    errorAbort("From IndexedFasta: cannot open the index '" + indexFile + "' of the reference; make it with 'samtools faidx " + file + "'.");
+  string line;
+  while ( getline(index, line) ) {
+    if ( line.empty() )
+      continue;
+    vector<string> f = split(line, "\t");
+    if (f.size() < 5)
+      errorAbort("From IndexedFasta: malformed line in '" + indexFile + "': " + line);
+    FastaContig contig;
+    contig.name = f[0];
+    contig.length = strtoul(f[1].c_str(), NULL, 10);
+    contig.offset = strtoul(f[2].c_str(), NULL, 10);
+    contig.lineBases = strtoul(f[3].c_str(), NULL, 10);
+    contig.lineWidth = strtoul(f[4].c_str(), NULL, 10);
+    if (contig.lineBases == 0 or contig.lineWidth < contig.lineBases)
+      errorAbort("From IndexedFasta: malformed line in '" + indexFile + "': " + line);
+    if ( contigIndex_.count(contig.name) )
+      errorAbort("From IndexedFasta: contig '" + contig.name + "' is twice in '" + indexFile + "'.");
+    contigIndex_[contig.name] = contigs_.size();
+    contigs_.push_back(contig);
+  }
+
+  int fd = open(file.c_str(), O_RDONLY);
+  if (fd < 0)
+    errorAbort("From IndexedFasta: cannot open file '" + file + "'.");
+  struct stat st;
+  if (fstat(fd, & st) != 0) {
+    close(fd);
+    errorAbort("From IndexedFasta: cannot open file '" + file + "'.");
+  }
+  size_ = st.st_size;
+  if (size_ > 0) {
+    void * p = mmap(NULL, size_, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+      close(fd);
+      errorAbort("From IndexedFasta: cannot map file '" + file + "'.");
+    }
+    data_ = (char const *) p;
+    // the contigs are read once, in order
+    madvise( (void *) data_, size_, MADV_SEQUENTIAL );
+  }
+  close(fd);
+
+  for (unsigned c = 0; c < contigs_.size(); c++) {
+    FastaContig const & contig = contigs_[c];
+    if (contig.length == 0)
+      continue;
+    unsigned long last = contig.offset + (contig.length - 1) / contig.lineBases * contig.lineWidth + (contig.length - 1) % contig.lineBases;
+    if (last >= size_)
+      errorAbort("From IndexedFasta: contig '" + contig.name + "' ends beyond the end of '" + file + "'; is the index '" + indexFile + "' out of date?");
+  }
+}
+
+
+IndexedFasta::~IndexedFasta()
+{
+  if (data_ != NULL)
+    munmap( (void *) data_, size_ );
+}
+
+
+int IndexedFasta::contigIndex(string const & name) const
+{
+  map<string, unsigned>::const_iterator it = contigIndex_.find(name);
+  return (it == contigIndex_.end()) ? -1 : (int) it->second;
+}
+
+
+void IndexedFasta::release(unsigned c, unsigned long end) const
+{
+  // the whole pages from the start of the contig to the byte of base end
+  FastaContig const & contig = contigs_[c];
+  unsigned long page = sysconf(_SC_PAGESIZE);
+  unsigned long first = contig.offset / page * page;
+  unsigned long last = std::min( contig.offset + end / contig.lineBases * contig.lineWidth + end % contig.lineBases, (unsigned long) size_ ) / page * page;
+  if (data_ != NULL and last > first)
+    madvise( (void *) (data_ + first), last - first, MADV_DONTNEED );
+}
+
+
+FastaLineWriter::FastaLineWriter(FILE * out, unsigned lineWidth)
+  : out_(out), lineWidth_(lineWidth), column_(0), inSequence_(false)
+{
+  buf_.reserve(FASTA_WRITE_BUFFER + 256);
+}
+
+
+FastaLineWriter::~FastaLineWriter()
+{
+  finish();
+}
+
+
+void FastaLineWriter::header(string const & line)
+{
+  endSequence();
+  buf_ += '>';
+  buf_ += line;
+  buf_ += '\n';
+  inSequence_ = true;
+  column_ = 0;
+  if (buf_.size() >= FASTA_WRITE_BUFFER)
+    flush();
+}
+
+
+void FastaLineWriter::append(char const * bases, size_t n)
+{
+  while (n > 0) {
+    size_t take = n;
+    if (lineWidth_ > 0)
+      take = std::min(take, (size_t) (lineWidth_ - column_) );
+    buf_.append(bases, take);
+    bases += take;
+    n -= take;
+    column_ += take;
+    if (lineWidth_ > 0 and column_ == lineWidth_) {
+      buf_ += '\n';
+      column_ = 0;
+    }
+    if (buf_.size() >= FASTA_WRITE_BUFFER)
+      flush();
+  }
+}
+
+
+// the last line of a sequence; with lineWidth 0, the one line
+void FastaLineWriter::endSequence()
+{
+  if (inSequence_ and (column_ > 0 or lineWidth_ == 0) )
+    buf_ += '\n';
+  inSequence_ = false;
+  column_ = 0;
+}
+
+
+void FastaLineWriter::flush()
+{
+  if (not buf_.empty() and fwrite(buf_.data(), 1, buf_.size(), out_) != buf_.size() )
+    errorAbort("From FastaLineWriter: could not write the output.");
+  buf_.clear();
+}
+
+
+void FastaLineWriter::finish()
+{
+  endSequence();
+  flush();
+  fflush(out_);
+}
+
+
+ConsensusBuilder::ConsensusBuilder(IndexedFasta const & reference, FastaLineWriter & out)
+  : reference_(reference), out_(out), next_(0), current_(-1), variantCount_(0), insertions_(0), deletions_(0), substitutions_(0)
+{}
+
+
+void ConsensusBuilder::add(string const & line)
+{
+  // CHROM, POS, ID, REF, ALT, QUAL, FILTER, INFO
+  fields_.clear();
+  size_t b = 0;
+  while (fields_.size() < 8) {
+    size_t e = line.find('\t', b);
+    fields_.push_back( line.substr(b, e == string::npos ? string::npos : e - b) );
+    if (e == string::npos)
+      break;
+    b = e + 1;
+  }
+  fields_.resize(8);
+
+  int c = reference_.contigIndex(fields_[0]);
+  if (c < 0)
+    errorAbort("From ConsensusBuilder: contig '" + fields_[0] + "' of the VCF is not in the reference '" + reference_.file() + "'.");
+  if (c != current_) {
+    if (c < (int) next_)
+      errorAbort("From ConsensusBuilder: the lines of contig '" + fields_[0] + "' are not together in the VCF, or the contigs are not in the order of the reference '" + reference_.file() + "'.");
+    writeContigs(c);
+    current_ = c;
+  }
+
+  if (variantCount_ == variants_.size())
+    variants_.resize(variantCount_ + 1);
+  Variant & v = variants_[variantCount_++];
+  v.pos = strtoul(fields_[1].c_str(), NULL, 10);
+  if (v.pos == 0 or v.pos > reference_.contigs()[c].length)
+    errorAbort("From ConsensusBuilder: position '" + fields_[1] + "' is not in contig '" + fields_[0] + "' of the reference '" + reference_.file() + "'.");
+  v.refLength = fields_[3].size();
+  v.alt = fields_[4];
+  string const & info = fields_[7];
+  if (info.find("FRACINS=") != string::npos)
+    v.kind = INSERTION;
+  else if (info.find("DEL") != string::npos)
+    v.kind = DELETION;
+  else
+    v.kind = SUBSTITUTION;
+}
+
+
+void ConsensusBuilder::finish()
+{
+  writeContigs( reference_.contigs().size() );
+  current_ = -1;
+}
+
+
+// the contigs from next_ up to end, the current one with its variants
+void ConsensusBuilder::writeContigs(unsigned end)
+{
+  for (; next_ < end; next_++)
+    writeContig(next_);
+  variantCount_ = 0;
+}
+
+
+void ConsensusBuilder::writeContig(unsigned c)
+{
+  FastaContig const & contig = reference_.contigs()[c];
+  unsigned variantCount = ( (int) c == current_ ) ? variantCount_ : 0;
+
+  // the counts go in the header, before the sequence
+  unsigned long insertions = 0, deletions = 0, substitutions = 0;
+  for (unsigned i = 0; i < variantCount; i++) {
+    Variant const & v = variants_[i];
+    if (v.kind == INSERTION)
+      insertions += v.alt.size() - 1;
+    else if (v.kind == DELETION)
+      deletions += v.refLength - 1;
+    else
+      substitutions++;
+  }
+  insertions_ += insertions;
+  deletions_ += deletions;
+  substitutions_ += substitutions;
+  out_.header(contig.name + " My sequenced genome: " + reference_.file() + " Number of insertions: " + toString(insertions) + " Number of deletions: " + toString(deletions) + " Number of SNPs: " + toString(substitutions) );
+
+  // the reference up to each variant, which covers the bases up to covered
+  unsigned long covered = 0;
+  for (unsigned i = 0; i <= variantCount; i++) {
+    unsigned long end = (i < variantCount) ? variants_[i].pos - 1 : contig.length;
+    for (unsigned long b = covered; b < end; ) {
+      unsigned long e = std::min(end, (b / CONSENSUS_RELEASE_BASES + 1) * CONSENSUS_RELEASE_BASES);
+      reference_.appendBases(c, b, e, out_);
+      if (e % CONSENSUS_RELEASE_BASES == 0)
+	reference_.release(c, e);
+      b = e;
+    }
+    if (i == variantCount)
+      break;
+    Variant const & v = variants_[i];
+    out_.append(v.alt);
+    covered = (v.kind == DELETION) ? v.pos + v.refLength - 1 : v.pos;
+  }
+  reference_.release(c, contig.length);
+}
@@ -0,0 +1,142 @@
+#ifndef __ConsensusFasta_h
+#define __ConsensusFasta_h
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <map>
+
+// The consensus genome of a filtered VCF (from cleanupvcf), as
+// vcf2fasta.pl makes it for a reference of one sequence, for references
+// of any number of contigs: the reference with the ALT of each line of
+// the VCF at its position. A deletion line (INFO with DEL) replaces the
+// bases of its REF, an insertion line (INFO with FRACINS) adds the bases
+// of its ALT after the first. The ALT is written as it is in the VCF.
+
+
+// One sequence of a FASTA file, as a line of its .fai index (samtools
+// faidx): the bases start at offset, with lineBases bases in each line
+// of lineWidth bytes.
+struct FastaContig {
+  std::string name;
+  unsigned long length, offset, lineBases, lineWidth;
+};
+
+
+// A FASTA file with a .fai index, read through mmap.
+class IndexedFasta {
+public:
+  // Aborts if the file or its index (file + ".fai") cannot be read.
+  IndexedFasta(std::string const & file);
+  ~IndexedFasta();
+
+  std::string const & file() const {return file_;}
+  std::vector<FastaContig> const & contigs() const {return contigs_;}
+  // index of the contig, or -1
+  int contigIndex(std::string const & name) const;
+
+  // Append the bases [begin, end) (0-based) of contig c to out, which
+  // must have a member append(char const *, size_t).
+  template<class Out>
+  void appendBases(unsigned c, unsigned long begin, unsigned long end, Out & out) const
+  {
+    FastaContig const & contig = contigs_[c];
+    while (begin < end) {
+      unsigned long inLine = begin % contig.lineBases;
+      unsigned long n = std::min(contig.lineBases - inLine, end - begin);
+      out.append(data_ + contig.offset + begin / contig.lineBases * contig.lineWidth + inLine, n);
+      begin += n;
+    }
+  }
+
+  // Drop the pages of the bases of contig c before end (0-based) from
+  // memory, when they are no longer needed.
+  void release(unsigned c, unsigned long end) const;
+
+private:
+  IndexedFasta(IndexedFasta const &);
+  IndexedFasta & operator=(IndexedFasta const &);
+
+  std::string file_;
+  char const * data_;
+  std::size_t size_;
+  std::vector<FastaContig> contigs_;
+  std::map<std::string, unsigned> contigIndex_;
+};
+
+
+// FASTA output with lines of lineWidth bases (0 for one line per
+// sequence), buffered and written to a FILE as it fills up.
+class FastaLineWriter {
+public:
+  FastaLineWriter(FILE * out, unsigned lineWidth);
+  ~FastaLineWriter();
+
+  // start a sequence, ending the one before
+  void header(std::string const & line);
+  void append(char const * bases, std::size_t n);
+  void append(std::string const & bases) {append( bases.data(), bases.size() );}
+  // end the last sequence and write the buffer
+  void finish();
+
+private:
+  void endSequence();
+  void flush();
+
+  FILE * out_;
+  unsigned lineWidth_;
+  unsigned long column_;
+  bool inSequence_;
+  std::string buf_;
+};
+
+
+// bases of the reference written between dropping their pages
+unsigned long const CONSENSUS_RELEASE_BASES = 1 << 24;
+
+
+// Builds the consensus of each contig of the reference, in the order of
+// the index, from the VCF lines given in order. The lines of a contig
+// must be in order of position, and the contigs of the VCF in the order
+// of the reference. Only the lines of the current contig are kept (the
+// position, kind, REF length and ALT of each), not its sequence, which
+// is written when the next contig starts.
+class ConsensusBuilder {
+public:
+  ConsensusBuilder(IndexedFasta const & reference, FastaLineWriter & out);
+
+  // a data line of the VCF (not a header line)
+  void add(std::string const & line);
+  // write the contigs still pending
+  void finish();
+
+  unsigned long insertions() const {return insertions_;}
+  unsigned long deletions() const {return deletions_;}
+  unsigned long substitutions() const {return substitutions_;}
+
+private:
+  enum Kind {SUBSTITUTION, INSERTION, DELETION};
+  struct Variant {
+    unsigned long pos;
+    Kind kind;
+    unsigned long refLength;
+    std::string alt;
+  };
+
+  // write the contigs up to (not including) contig end
+  void writeContigs(unsigned end);
+  void writeContig(unsigned c);
+
+  IndexedFasta const & reference_;
+  FastaLineWriter & out_;
+  unsigned next_;     // the next contig to write
+  int current_;       // the contig of the variants, or -1
+  std::vector<Variant> variants_;
+  unsigned variantCount_;
+  unsigned long insertions_, deletions_, substitutions_;
+  std::vector<std::string> fields_;  // scratch
+};
+
+#endif  // __ConsensusFasta_h
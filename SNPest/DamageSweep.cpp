@@ -0,0 +1,176 @@
+#include "DamageSweep.h"
+#include "phy/utils.h"
+#include <boost/thread.hpp>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+using namespace phy;
+
+static char const SWEEP_BASES[] = "ACGT";
+static unsigned const SWEEP_QUALS = 50;
+
+
+PotentialSpec mkDamageObservation(double tau, double delta)
+{
+  if ( not (tau >= 0 and delta >= 0 and tau + delta < 1) )
+    errorAbort("From mkDamageObservation: the damage rates must be non-negative with tau + delta below 1, not tau = " + toString(tau) + ", delta = " + toString(delta) + ".");
+  double error[4][4] = {{1 - tau - delta,        3.0 / 7 * tau, 3.0 / 7 * tau, 1.0 / 7 * tau},
+			{3.0 / 7 * tau,          1 - tau,       1.0 / 7 * tau, 3.0 / 7 * tau + delta},
+			{3.0 / 7 * tau + delta,  1.0 / 7 * tau, 1 - tau,       3.0 / 7 * tau},
+			{1.0 / 7 * tau,          3.0 / 7 * tau, 3.0 / 7 * tau, 1 - tau - delta}};
+
+  PotentialSpec pot;
+  pot.name = "observation";
+  pot.rows = 4;
+  pot.cols = 4 * SWEEP_QUALS;
+  pot.values.resize(pot.rows * pot.cols);
+  // column of observed base i with quality j + 1: the Phred error
+  // probabilities, corrected for the error rates
+  for (unsigned i = 0; i < 4; i++)
+    for (unsigned j = 0; j < SWEEP_QUALS; j++) {
+      double pe = pow(10, -0.1 * (j + 1.0));
+      double phred[4];
+      for (unsigned l = 0; l < 4; l++)
+	phred[l] = (l == i) ? 1 - pe : pe / 3;
+      for (unsigned k = 0; k < 4; k++) {
+	double x = 0;
+	for (unsigned l = 0; l < 4; l++)
+	  x += error[k][l] * phred[l];
+	pot.values[k * pot.cols + j + SWEEP_QUALS * i] = x;
+      }
+    }
+  return pot;
+}
+
+
+void checkDamageInputMap(map<string, StateMapSpec> const & maps, string const & source)
+{
+  map<string, StateMapSpec>::const_iterator nucMap = maps.find("nucleotideMap");
+  map<string, StateMapSpec>::const_iterator inputMap = maps.find("inputMap");
+  bool ok = ( nucMap != maps.end() and nucMap->second.symbols.size() == 4 and inputMap != maps.end() and inputMap->second.symbols.size() == 4 * SWEEP_QUALS );
+  for (unsigned k = 0; ok and k < 4; k++)
+    ok = ( nucMap->second.symbols[k] == string(1, SWEEP_BASES[k]) );
+  for (unsigned k = 0; ok and k < 4 * SWEEP_QUALS; k++)
+    ok = ( inputMap->second.symbols[k] == mkObsSymbol(SWEEP_BASES[k / SWEEP_QUALS], k % SWEEP_QUALS + 1) );
+  if (not ok)
+    errorAbort("From checkDamageInputMap: the nucleotideMap and inputMap of '" + source + "' are not A, C, G, T and A1..A50, C1..C50, G1..G50, T1..T50, as the damage model needs.");
+}
+
+
+static bool isTransition(char a, char b)
+{
+  return (a == 'A' and b == 'G') or (a == 'G' and b == 'A') or (a == 'C' and b == 'T') or (a == 'T' and b == 'C');
+}
+
+
+DamageSweep::DamageSweep(map<string, StateMapSpec> const & maps, map<string, PotentialSpec> const & pots, string const & source, vector< pair<double, double> > const & grid)
+  : grid_(grid), summaries_( grid.size() )
+{
+  if ( grid.empty() )
+    errorAbort("From DamageSweep: no damage rates given.");
+  checkDamageInputMap(maps, source);
+  map<string, PotentialSpec> modelPots = pots;
+  for (unsigned m = 0; m < grid.size(); m++) {
+    modelPots["observation"] = mkDamageObservation(grid[m].first, grid[m].second);
+    models_.push_back( boost::shared_ptr<StarModel>( new StarModel(maps, modelPots, source) ) );
+  }
+
+  // classes of the calls at each reference base
+  vector<string> const & genotypes = models_[0]->genotypeSymbols();
+  callClass_.resize(4);
+  transitions_.resize(4);
+  transversions_.resize(4);
+  for (unsigned r = 0; r < 4; r++) {
+    char ref = SWEEP_BASES[r];
+    for (unsigned g = 0; g < genotypes.size(); g++) {
+      string const & alleles = genotypes[g];
+      bool hom = true, hasRef = false;
+      unsigned ti = 0, tv = 0;
+      for (unsigned k = 0; k < alleles.size(); k++) {
+	hom = hom and alleles[k] == alleles[0];
+	if (alleles[k] == ref)
+	  hasRef = true;
+	else if ( alleles.find(alleles[k]) == k )
+	  (isTransition(ref, alleles[k]) ? ti : tv)++;
+      }
+      callClass_[r].push_back( not hom ? CALL_HET : (hasRef ? CALL_HOM_REF : CALL_HOM_ALT) );
+      transitions_[r].push_back(ti);
+      transversions_[r].push_back(tv);
+    }
+  }
+}
+
+
+void DamageSweep::addSites(vector<SiteRecord> const & sites, vector<unsigned> const & depths, unsigned siteCount, unsigned threadCount)
+{
+  unsigned n = std::min( threadCount, modelCount() );
+  if (n <= 1) {
+    addModels(sites, depths, siteCount, 0, 1);
+    return;
+  }
+  boost::thread_group threads;
+  for (unsigned t = 0; t < n; t++)
+    threads.add_thread( new boost::thread(& DamageSweep::addModels, this, boost::cref(sites), boost::cref(depths), siteCount, t, n) );
+  threads.join_all();
+}
+
+
+// add the sites to the summaries of the models first, first + step, ...
+void DamageSweep::addModels(vector<SiteRecord> const & sites, vector<unsigned> const & depths, unsigned siteCount, unsigned first, unsigned step)
+{
+  SymbolHistogram hist;
+  xvector_t pp( models_[0]->genotypeCount() );
+  string chrom;
+  for (unsigned i = 0; i < siteCount; i++) {
+    // the reference base of the id, also with --noRef; not of insertions
+    // or of sites whose reads are all deleted
+    SiteIdFields f;
+    if ( not parseSiteId(sites[i].id, chrom, f) )
+      errorAbort("From DamageSweep: site id '" + sites[i].id + "' is not of the form chrom_pos_ref_avmapq_depth.");
+    char const * refPos = strchr(SWEEP_BASES, f.ref);
+    if (f.kind != SITE_ID_SITE or f.ref == '\0' or refPos == NULL or depths[i] == 0)
+      continue;
+    unsigned r = refPos - SWEEP_BASES;
+
+    // the models have the same symbols, so the counts are of all of them
+    models_[0]->countSymbols(sites[i], depths[i], hist);
+    for (unsigned m = first; m < models_.size(); m += step) {
+      models_[m]->calcPosterior(hist, pp);
+      unsigned best = 0;
+      for (unsigned g = 1; g < pp.size(); g++)
+	if (pp[g] > pp[best])
+	  best = g;
+      double p = (double) pp[best];
+      SweepSummary & s = summaries_[m];
+      s.sites++;
+      s.ppSum += p;
+      if (callClass_[r][best] == CALL_HOM_REF)
+	continue;
+      s.variants++;
+      s.variantPPSum += p;
+      if (callClass_[r][best] == CALL_HET)
+	s.hets++;
+      else
+	s.homAlts++;
+      if (p >= SWEEP_CONFIDENT_PP)
+	s.confidentVariants++;
+      s.transitions += transitions_[r][best];
+      s.transversions += transversions_[r][best];
+    }
+  }
+}
+
+
+void DamageSweep::writeSummaries(ostream & str) const
+{
+  str << "tau\tdelta\tsites\tvariants\thet\thomAlt\tconfidentVariants\tmeanPP\tmeanVariantPP\ttransitions\ttransversions\ttiTv\n";
+  for (unsigned m = 0; m < grid_.size(); m++) {
+    SweepSummary const & s = summaries_[m];
+    char buf[256];
+    sprintf(buf, "%g\t%g\t%lu\t%lu\t%lu\t%lu\t%lu\t%.6g\t%.6g\t%lu\t%lu\t%.4g\n", grid_[m].first, grid_[m].second, s.sites, s.variants, s.hets, s.homAlts, s.confidentVariants,
+	    (s.sites > 0) ? s.ppSum / s.sites : 0.0, (s.variants > 0) ? s.variantPPSum / s.variants : 0.0,
+	    s.transitions, s.transversions, (s.transversions > 0) ? (double) s.transitions / s.transversions : 0.0);
+    str << buf;
+  }
+}
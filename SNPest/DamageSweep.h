@@ -0,0 +1,78 @@
+#ifndef __DamageSweep_h
+#define __DamageSweep_h
+
+#include "StarModel.h"
+#include "Pileup.h"
+#include <boost/shared_ptr.hpp>
+#include <string>
+#include <vector>
+#include <map>
+#include <ostream>
+
+// The observation potential [4, 200] of the damage model with the
+// rates tau (errors) and delta (deamination, C->T and G->A), as printed
+// by dfgspec/CalculateDamageMatrix for the damage factorPotentials.txt
+// files, but in full precision. Aborts unless 0 <= tau, delta and
+// tau + delta < 1.
+PotentialSpec mkDamageObservation(double tau, double delta);
+
+// Abort unless the nucleotideMap of maps is A, C, G, T and the inputMap
+// A1..A50, C1..C50, G1..G50, T1..T50, the rows and columns of
+// mkDamageObservation (source names the maps).
+void checkDamageInputMap(std::map<std::string, StateMapSpec> const & maps, std::string const & source);
+
+
+// Calls of one model of a sweep, over the sites with a reference base
+// A, C, G or T. A site is called as its most probable genotype; a call
+// is confident with a posterior of at least SWEEP_CONFIDENT_PP. Each
+// alternative allele of a variant call is a transition (A<->G, C<->T)
+// or a transversion.
+double const SWEEP_CONFIDENT_PP = 0.99;
+
+struct SweepSummary {
+  unsigned long sites, variants, hets, homAlts, confidentVariants, transitions, transversions;
+  double ppSum, variantPPSum;  // posteriors of the calls, of all and of the variant calls
+
+  SweepSummary() : sites(0), variants(0), hets(0), homAlts(0), confidentVariants(0), transitions(0), transversions(0), ppSum(0), variantPPSum(0) {}
+};
+
+
+// Genotype the sites under the damage model of each (tau, delta) of a
+// grid in one pass over the input. The models are the base model (e.g.
+// diploid_error) with its observation potential replaced by
+// mkDamageObservation; each is a StarModel, evaluated on the read
+// counts of the site, which are collected once. The models are split
+// over the threads, so the summaries do not depend on the number of
+// threads.
+class DamageSweep {
+public:
+  // The base model has the state maps and potentials of SNPest with the
+  // inputMap A1..A50, C1..C50, G1..G50, T1..T50 (the columns of
+  // mkDamageObservation); source names it in error messages.
+  DamageSweep(std::map<std::string, StateMapSpec> const & maps, std::map<std::string, PotentialSpec> const & pots, std::string const & source, std::vector< std::pair<double, double> > const & grid);
+
+  unsigned modelCount() const {return grid_.size();}
+
+  // Genotype the first siteCount sites (of the given depths) under all
+  // models on threadCount threads.
+  void addSites(std::vector<SiteRecord> const & sites, std::vector<unsigned> const & depths, unsigned siteCount, unsigned threadCount);
+
+  // one line per model: tau, delta and its summary
+  void writeSummaries(std::ostream & str) const;
+
+private:
+  enum CallClass {CALL_HOM_REF, CALL_HET, CALL_HOM_ALT};
+
+  void addModels(std::vector<SiteRecord> const & sites, std::vector<unsigned> const & depths, unsigned siteCount, unsigned first, unsigned step);
+
+  std::vector< std::pair<double, double> > grid_;
+  std::vector< boost::shared_ptr<StarModel> > models_;
+  std::vector<SweepSummary> summaries_;
+
+  // by reference base index (A, C, G, T) and genotype: the class of
+  // the call and its transitions and transversions
+  std::vector< std::vector<CallClass> > callClass_;
+  std::vector< std::vector<unsigned> > transitions_, transversions_;
+};
+
+#endif  // __DamageSweep_h
@@ -0,0 +1,92 @@
+#include "DepthModels.h"
+#include <sstream>
+
+using namespace phy;
+
+
+string mkDepthVariablesSpec(unsigned depth)
+{
+  ostringstream str;
+  str << "STATE_MAP_NAME:\tnucleotideMap\nVAR_NAMES:\tC ";
+  for (unsigned i = 1; i <= depth; i++)
+    str << "A" << i << " ";
+  str << "\nSTATE_MAP_NAME:\tgenotypeMap\nVAR_NAMES:\tG\n\n";
+  str << "STATE_MAP_NAME:\tinputMap\nVAR_NAMES:\t";
+  for (unsigned i = 1; i <= depth; i++)
+    str << "O" << i << " ";
+  str << "\n\n";
+  return str.str();
+}
+
+
+string mkDepthFactorGraphSpec(unsigned depth)
+{
+  ostringstream str;
+  str << "NAME:\t\tC.prior\nNB1:\t\tC\nPOT:\t\tprior\n\n";
+  str << "NAME:\t\tC.G\nNB1:\t\tC\nNB2:\t\tG\nPOT:\t\tgenotype\n\n";
+  for (unsigned i = 1; i <= depth; i++) {
+    str << "# Read depth " << i << "\n";
+    str << "NAME:\t\tG.A" << i << "\nNB1:\t\tG\nNB2:\t\tA" << i << "\nPOT:\t\toriginal\n\n";
+    str << "NAME:\t\tA" << i << ".O" << i << "\nNB1:\t\tA" << i << "\nNB2:\t\tO" << i << "\nPOT:\t\tobservation\n\n";
+  }
+  return str.str();
+}
+
+
+DepthModels::DepthModels(string const & stateMapsFile, string const & potentialsFile)
+  : stateMapsFile_(stateMapsFile), potentialsFile_(potentialsFile), specsRead_(false), builtCount_(0)
+{}
+
+
+DepthModels::DepthModels(string const & stateMapsFile, string const & potentialsFile, string const & dfgSpecPrefix)
+  : stateMapsFile_(stateMapsFile), potentialsFile_(potentialsFile), dfgSpecPrefix_(dfgSpecPrefix), specsRead_(false), builtCount_(0)
+{}
+
+
+DepthModels::~DepthModels()
+{
+  for (unsigned i = 0; i < models_.size(); i++)
+    if (models_[i] != NULL)
+      delete models_[i];
+}
+
+
+DfgInfo * DepthModels::build(unsigned depth)
+{
+  string n = toString(depth);
+  if ( not dfgSpecPrefix_.empty() )
+    return new DfgInfo( readDfgInfo(stateMapsFile_, potentialsFile_, dfgSpecPrefix_ + "depth" + n + "_variables.txt", dfgSpecPrefix_ + "depth" + n + "_factorGraph.txt") );
+
+  // the state maps and potentials are read with the first graph, so
+  // nothing is parsed if no graph is needed
+  if (not specsRead_) {
+    stateMaps_ = readStateMapFile(stateMapsFile_);
+    factors_ = readFactorFile(potentialsFile_);
+    specsRead_ = true;
+  }
+
+  istringstream varStr( mkDepthVariablesSpec(depth) );
+  map<string, string> var2StateMapName = readVariables(varStr);
+
+  istringstream facStr( mkDepthFactorGraphSpec(depth) );
+  vector<string> varNames, facNames, potNames;
+  vector< vector<unsigned> > facNeighbors;
+  readFactorGraph(facStr, varNames, facNames, potNames, facNeighbors);
+
+  return new DfgInfo(varNames, facNames, potNames, facNeighbors, stateMaps_, factors_, var2StateMapName);
+}
+
+
+DfgInfo const & DepthModels::get(unsigned depth)
+{
+  if (depth == 0)
+    errorAbort("From DepthModels: depth must be positive.");
+  boost::mutex::scoped_lock lock(mutex_);
+  if (models_.size() < depth)
+    models_.resize(depth, (DfgInfo *) NULL);
+  if (models_[depth - 1] == NULL) {
+    models_[depth - 1] = build(depth);
+    builtCount_++;
+  }
+  return *models_[depth - 1];
+}
@@ -0,0 +1,59 @@
+#ifndef __DepthModels_h
+#define __DepthModels_h
+
+#include "phy/DfgIO.h"
+#include <boost/thread/mutex.hpp>
+#include <boost/shared_ptr.hpp>
+#include <string>
+#include <vector>
+#include <map>
+
+// The factor graphs of each read depth, made on first use. The state
+// maps and factor potentials are read once, with the first graph; the
+// variables and factor graph of depth n are generated in memory in the
+// form written by GenerateFactorGraphs.pl:
+//
+//   C.prior, C.G, and for each read i: G.A_i and A_i.O_i
+//
+// so only the depths present in the input are built and there is no
+// upper bound on the depth. Alternatively, the graphs can be read from
+// the depthN_variables.txt and depthN_factorGraph.txt files of a
+// specification directory (also on first use).
+class DepthModels {
+public:
+  // generate the graphs
+  DepthModels(std::string const & stateMapsFile, std::string const & potentialsFile);
+  // read the graphs from files dfgSpecPrefix + "depthN_variables.txt" etc.
+  DepthModels(std::string const & stateMapsFile, std::string const & potentialsFile, std::string const & dfgSpecPrefix);
+  ~DepthModels();
+
+  // model of the given depth (>= 1). Safe to call from several threads;
+  // the returned model must not be changed.
+  phy::DfgInfo const & get(unsigned depth);
+
+  unsigned builtCount() const {return builtCount_;}
+
+private:
+  DepthModels(DepthModels const &);
+  DepthModels & operator=(DepthModels const &);
+
+  phy::DfgInfo * build(unsigned depth);
+
+  std::string stateMapsFile_, potentialsFile_;
+  std::string dfgSpecPrefix_;  // empty when the graphs are generated
+  std::map<std::string, phy::StateMapPtr_t> stateMaps_;
+  std::map<std::string, boost::shared_ptr<phy::AbstractBaseFactor> > factors_;
+  bool specsRead_;
+
+  std::vector<phy::DfgInfo *> models_;  // index depth - 1, NULL until built
+  unsigned builtCount_;
+  boost::mutex mutex_;
+};
+
+// Variables and factor graph specification of the SNPest read model
+// for the given depth, in the format of depthN_variables.txt and
+// depthN_factorGraph.txt.
+std::string mkDepthVariablesSpec(unsigned depth);
+std::string mkDepthFactorGraphSpec(unsigned depth);
+
+#endif  // __DepthModels_h
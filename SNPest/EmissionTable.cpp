@@ -0,0 +1,242 @@
+#include "EmissionTable.h"
+#include "phy/utils.h"
+#include <cmath>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SNPEST_X86_SIMD
+#include <immintrin.h>
+#endif
+
+using namespace phy;
+
+
+SimdLevel detectSimdLevel()
+{
+#ifdef SNPEST_X86_SIMD
+  __builtin_cpu_init();
+  if ( __builtin_cpu_supports("avx512f") )
+    return SIMD_AVX512;
+  if ( __builtin_cpu_supports("avx2") and __builtin_cpu_supports("fma") )
+    return SIMD_AVX2;
+#endif
+  return SIMD_SCALAR;
+}
+
+
+SimdLevel parseSimdLevel(string const & str)
+{
+  SimdLevel best = detectSimdLevel();
+  SimdLevel level;
+  if (str == "auto")
+    return best;
+  else if (str == "scalar")
+    level = SIMD_SCALAR;
+  else if (str == "avx2")
+    level = SIMD_AVX2;
+  else if (str == "avx512")
+    level = SIMD_AVX512;
+  else
+    errorAbort("From parseSimdLevel: unknown instruction set '" + str + "'. Use one of auto, scalar, avx2, or avx512.");
+  if (level > best)
+    errorAbort("From parseSimdLevel: instruction set '" + str + "' is not supported on this machine (best is '" + simdLevelName(best) + "').");
+  return level;
+}
+
+
+string simdLevelName(SimdLevel level)
+{
+  switch (level) {
+  case SIMD_AVX512: return "avx512";
+  case SIMD_AVX2: return "avx2";
+  default: return "scalar";
+  }
+}
+
+
+void SiteBatch::clear()
+{
+  ref_.clear();
+  entryStart_.clear();
+  symbols_.clear();
+  counts_.clear();
+}
+
+
+void SiteBatch::add(SymbolHistogram const & hist)
+{
+  if ( entryStart_.empty() )
+    entryStart_.push_back(0);
+  ref_.push_back(hist.ref);
+  for (unsigned k = 0; k < hist.present.size(); k++) {
+    unsigned o = hist.present[k];
+    symbols_.push_back(o);
+    counts_.push_back(hist.count[o]);
+  }
+  entryStart_.push_back( symbols_.size() );
+}
+
+
+EmissionTable::EmissionTable(StarModel const & starModel, SimdLevel simd)
+  : genotypeCount_( starModel.genotypeCount() ),
+    symbolCount_( starModel.observationSymbolCount() ),
+    stride_(symbolCount_ + 1),
+    simd_(simd)
+{
+  init(starModel);
+
+  // genotype major, so the entries gathered for one genotype share a row
+  vector< vector<double> > const & logE = starModel.logEmissions();
+  logEmission_.assign(genotypeCount_ * stride_, 0.0);
+  for (unsigned o = 0; o < symbolCount_; o++)
+    for (unsigned g = 0; g < genotypeCount_; g++)
+      logEmission_[g * stride_ + o] = logE[o][g];
+  table_ = & logEmission_[0];
+}
+
+
+EmissionTable::EmissionTable(StarModel const & starModel, SimdLevel simd, double const * logEmission)
+  : genotypeCount_( starModel.genotypeCount() ),
+    symbolCount_( starModel.observationSymbolCount() ),
+    stride_(symbolCount_ + 1),
+    simd_(simd),
+    table_(logEmission)
+{
+  init(starModel);
+}
+
+
+void EmissionTable::init(StarModel const & starModel)
+{
+  vector< vector<double> > const & logRef = starModel.logRefFactors();
+  logRef_.resize(logRef.size() * genotypeCount_);
+  for (unsigned c = 0; c < logRef.size(); c++)
+    for (unsigned g = 0; g < genotypeCount_; g++)
+      logRef_[c * genotypeCount_ + g] = logRef[c][g];
+}
+
+
+// acc[g * W + lane] += sum_k counts[k * W + lane] * row_g[ symbols[k * W + lane] ]
+static void accumulateScalar(double const * table, unsigned stride, unsigned nG, unsigned entries, int const * symbols, double const * counts, double * acc)
+{
+  unsigned const W = SITE_BLOCK_WIDTH;
+  for (unsigned g = 0; g < nG; g++) {
+    double const * row = table + g * stride;
+    double * a = acc + g * W;
+    for (unsigned k = 0; k < entries; k++)
+      for (unsigned lane = 0; lane < W; lane++)
+	a[lane] += counts[k * W + lane] * row[ symbols[k * W + lane] ];
+  }
+}
+
+
+#ifdef SNPEST_X86_SIMD
+__attribute__((target("avx2,fma")))
+static void accumulateAvx2(double const * table, unsigned stride, unsigned nG, unsigned entries, int const * symbols, double const * counts, double * acc)
+{
+  unsigned const W = SITE_BLOCK_WIDTH;
+  for (unsigned g = 0; g < nG; g++) {
+    double const * row = table + g * stride;
+    __m256d lo = _mm256_loadu_pd(acc + g * W);
+    __m256d hi = _mm256_loadu_pd(acc + g * W + 4);
+    for (unsigned k = 0; k < entries; k++) {
+      __m128i idxLo = _mm_loadu_si128( (__m128i const *) (symbols + k * W) );
+      __m128i idxHi = _mm_loadu_si128( (__m128i const *) (symbols + k * W + 4) );
+      lo = _mm256_fmadd_pd(_mm256_loadu_pd(counts + k * W), _mm256_i32gather_pd(row, idxLo, 8), lo);
+      hi = _mm256_fmadd_pd(_mm256_loadu_pd(counts + k * W + 4), _mm256_i32gather_pd(row, idxHi, 8), hi);
+    }
+    _mm256_storeu_pd(acc + g * W, lo);
+    _mm256_storeu_pd(acc + g * W + 4, hi);
+  }
+}
+
+
+__attribute__((target("avx512f")))
+static void accumulateAvx512(double const * table, unsigned stride, unsigned nG, unsigned entries, int const * symbols, double const * counts, double * acc)
+{
+  unsigned const W = SITE_BLOCK_WIDTH;
+  for (unsigned g = 0; g < nG; g++) {
+    double const * row = table + g * stride;
+    __m512d a = _mm512_loadu_pd(acc + g * W);
+    for (unsigned k = 0; k < entries; k++) {
+      __m256i idx = _mm256_loadu_si256( (__m256i const *) (symbols + k * W) );
+      a = _mm512_fmadd_pd(_mm512_loadu_pd(counts + k * W), _mm512_i32gather_pd(idx, row, 8), a);
+    }
+    _mm512_storeu_pd(acc + g * W, a);
+  }
+}
+#endif
+
+
+void EmissionTable::evaluateBlock(unsigned entries, int const * symbols, double const * counts, double * acc) const
+{
+#ifdef SNPEST_X86_SIMD
+  if (simd_ == SIMD_AVX512) {
+    accumulateAvx512(table_, stride_, genotypeCount_, entries, symbols, counts, acc);
+    return;
+  }
+  if (simd_ == SIMD_AVX2) {
+    accumulateAvx2(table_, stride_, genotypeCount_, entries, symbols, counts, acc);
+    return;
+  }
+#endif
+  accumulateScalar(table_, stride_, genotypeCount_, entries, symbols, counts, acc);
+}
+
+
+void EmissionTable::evaluate(SiteBatch & batch) const
+{
+  unsigned const W = SITE_BLOCK_WIDTH;
+  unsigned nG = genotypeCount_, n = batch.size();
+  batch.genotypeCount_ = nG;
+  batch.logLik_.resize(n * nG);
+
+  for (unsigned b = 0; b < n; b += W) {
+    unsigned lanes = (n - b < W) ? n - b : W;
+    unsigned entries = 0;
+    for (unsigned lane = 0; lane < lanes; lane++) {
+      unsigned e = batch.entryStart_[b + lane + 1] - batch.entryStart_[b + lane];
+      if (e > entries)
+	entries = e;
+    }
+
+    // transpose the block into structure of arrays; missing entries
+    // point at the all zero padding column with count zero
+    batch.blockSymbols_.assign(entries * W, symbolCount_);
+    batch.blockCounts_.assign(entries * W, 0.0);
+    batch.blockAcc_.assign(nG * W, 0.0);
+    for (unsigned lane = 0; lane < lanes; lane++) {
+      unsigned site = b + lane, start = batch.entryStart_[site], end = batch.entryStart_[site + 1];
+      for (unsigned j = start; j < end; j++) {
+	batch.blockSymbols_[(j - start) * W + lane] = batch.symbols_[j];
+	batch.blockCounts_[(j - start) * W + lane] = batch.counts_[j];
+      }
+      for (unsigned g = 0; g < nG; g++)
+	batch.blockAcc_[g * W + lane] = logRef_[batch.ref_[site] * nG + g];
+    }
+
+    evaluateBlock(entries, & batch.blockSymbols_[0], & batch.blockCounts_[0], & batch.blockAcc_[0]);
+
+    for (unsigned lane = 0; lane < lanes; lane++)
+      for (unsigned g = 0; g < nG; g++)
+	batch.logLik_[(b + lane) * nG + g] = batch.blockAcc_[g * W + lane];
+  }
+}
+
+
+void EmissionTable::calcPosterior(double const * logLik, xvector_t & pp) const
+{
+  unsigned nG = genotypeCount_;
+  assert(pp.size() == nG);
+  double m = -HUGE_VAL;
+  for (unsigned g = 0; g < nG; g++)
+    if (logLik[g] > m)
+      m = logLik[g];
+  if (m == -HUGE_VAL)
+    errorAbort("From EmissionTable: data has zero probability under the model.");
+
+  double sum = 0;
+  for (unsigned g = 0; g < nG; g++)
+    sum += exp(logLik[g] - m);
+  for (unsigned g = 0; g < nG; g++)
+    pp[g] = exp(logLik[g] - m) / sum;
+}
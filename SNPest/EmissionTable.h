@@ -0,0 +1,106 @@
+#ifndef __EmissionTable_h
+#define __EmissionTable_h
+
+#include "StarModel.h"
+#include <string>
+#include <vector>
+
+// Log emission tables of the star model and a batched kernel that
+// evaluates the genotype log likelihoods of many sites at a time.
+//
+// The 'original' and 'observation' potentials are fixed for the whole
+// run, so log sum_A original(g, A) observation(A, o) is tabulated once
+// for every genotype g and input symbol o (a 10 x 250 table for the
+// diploid model including the N meta symbols, 4 x 250 for haploid).
+// Sites are grouped in blocks of SITE_BLOCK_WIDTH and laid out as
+// structure of arrays: entry k of all sites in the block is stored
+// consecutively, so the kernel loads the symbols of SITE_BLOCK_WIDTH
+// sites at once, gathers their table values and accumulates
+//
+//   logLik[g][site] += count[k][site] * logEmission[g][symbol[k][site]]
+//
+// with AVX-512 (8 sites per instruction), AVX2 (4 sites) or plain
+// scalar code.
+
+unsigned const SITE_BLOCK_WIDTH = 8;
+
+enum SimdLevel {SIMD_SCALAR = 0, SIMD_AVX2 = 1, SIMD_AVX512 = 2};
+
+// best instruction set supported by this CPU
+SimdLevel detectSimdLevel();
+// parse "auto", "scalar", "avx2", or "avx512"
+SimdLevel parseSimdLevel(std::string const & str);
+std::string simdLevelName(SimdLevel level);
+
+
+// Sites waiting for evaluation. Each site is its reference symbol and
+// a list of (input symbol, count) entries, as given by a
+// SymbolHistogram.
+class SiteBatch {
+public:
+  SiteBatch() {}
+
+  void clear();
+  unsigned size() const {return ref_.size();}
+
+  void add(SymbolHistogram const & hist);
+
+  // log likelihood of each genotype for site i (after EmissionTable::evaluate)
+  double const * logLik(unsigned i) const {return & logLik_[i * genotypeCount_];}
+
+protected:
+  friend class EmissionTable;
+
+  std::vector<unsigned> ref_;
+  std::vector<unsigned> entryStart_;  // site i has entries [entryStart_[i], entryStart_[i+1])
+  std::vector<int> symbols_;
+  std::vector<double> counts_;
+
+  unsigned genotypeCount_;
+  std::vector<double> logLik_;
+
+  // structure of arrays scratch for one block
+  std::vector<int> blockSymbols_;
+  std::vector<double> blockCounts_;
+  std::vector<double> blockAcc_;
+};
+
+
+class EmissionTable {
+public:
+  EmissionTable(StarModel const & starModel, SimdLevel simd);
+  // use a table of the same layout (e.g. mapped from a model bundle)
+  // instead of computing one; it must stay valid while this is used
+  EmissionTable(StarModel const & starModel, SimdLevel simd, double const * logEmission);
+
+  unsigned genotypeCount() const {return genotypeCount_;}
+  unsigned symbolCount() const {return symbolCount_;}
+  SimdLevel simdLevel() const {return simd_;}
+
+  // log emission of input symbol o given genotype g
+  double logEmission(unsigned g, unsigned o) const {return table_[g * stride_ + o];}
+
+  // the table, genotype major with rows of stride() entries; the last entry of each row is zero (padding)
+  double const * table() const {return table_;}
+  unsigned stride() const {return stride_;}
+
+  // evaluate the log likelihoods of all sites in the batch
+  void evaluate(SiteBatch & batch) const;
+
+  // posterior probabilities from log likelihoods
+  void calcPosterior(double const * logLik, phy::xvector_t & pp) const;
+
+protected:
+  void init(StarModel const & starModel);
+  void evaluateBlock(unsigned entries, int const * symbols, double const * counts, double * acc) const;
+
+  unsigned genotypeCount_;
+  unsigned symbolCount_;
+  unsigned stride_;                  // row length of logEmission_; last column is all zero (padding)
+  SimdLevel simd_;
+  std::vector<double> logRef_;       // [c * genotypeCount_ + g]
+  std::vector<double> logEmission_;  // [g * stride_ + o], unless mapped
+  double const * table_;             // logEmission_ or the mapped table
+};
+
+#endif  // __EmissionTable_h
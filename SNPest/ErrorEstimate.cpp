@@ -0,0 +1,250 @@
+#include "ErrorEstimate.h"
+#include "DamageSweep.h"
+#include "phy/utils.h"
+#include <boost/thread.hpp>
+#include <cmath>
+#include <fstream>
+
+using namespace phy;
+
+
+ErrorEstimator::ErrorEstimator(map<string, StateMapSpec> const & maps, map<string, PotentialSpec> const & pots, string const & source, Parameters params)
+  : maps_(maps), pots_(pots), source_(source), params_(params), tau_(0), delta_(0), meanLogLikelihood_(0), readCount_(0)
+{
+  // checks the dimensions of the potentials
+  model_.reset( new StarModel(maps_, pots_, source_) );
+  PotentialSpec const & observation = pots_["observation"];
+  nN_ = observation.rows;
+  nG_ = model_->genotypeCount();
+  nO_ = observation.cols;
+
+  if (params_ == ESTIMATE_DAMAGE) {
+    checkDamageInputMap(maps_, source_);
+    tau_ = delta_ = 0.01;
+    setObservation( mkDamageObservation(tau_, delta_) );
+  }
+  else {
+    start_.assign(nN_ * nO_, 0);
+    for (unsigned a = 0; a < nN_; a++) {
+      double sum = 0;
+      for (unsigned o = 0; o < nO_; o++)
+	sum += observation(a, o);
+      if ( not (sum > 0) )
+	errorAbort("From ErrorEstimator: row " + toString(a) + " of the observation potential of '" + source_ + "' has no positive entries.");
+      for (unsigned o = 0; o < nO_; o++)
+	start_[a * nO_ + o] = observation(a, o) / sum;
+    }
+    setObservation(observation);
+  }
+}
+
+
+// make the model of the potential and the posteriors of the reads in it
+void ErrorEstimator::setObservation(PotentialSpec const & observation)
+{
+  pots_["observation"] = observation;
+  model_.reset( new StarModel(maps_, pots_, source_) );
+
+  PotentialSpec const & original = pots_["original"];
+  readPosterior_.assign(nO_ * nG_ * nN_, 0);
+  for (unsigned o = 0; o < nO_; o++)
+    for (unsigned g = 0; g < nG_; g++) {
+      double * post = & readPosterior_[(o * nG_ + g) * nN_];
+      double sum = 0;
+      for (unsigned a = 0; a < nN_; a++)
+	sum += post[a] = original(g, a) * observation(a, o);
+      if (sum > 0)
+	for (unsigned a = 0; a < nN_; a++)
+	  post[a] /= sum;
+    }
+}
+
+
+double ErrorEstimator::pass(CountedSites const & sites, unsigned threadCount)
+{
+  unsigned blockCount = (sites.size() + ESTIMATE_BLOCK_SITES - 1) / ESTIMATE_BLOCK_SITES;
+  if (blockCount == 0)
+    errorAbort("From ErrorEstimator: no sites to estimate from.");
+  blockCounts_.assign( blockCount, vector<double>(nN_ * nO_, 0) );
+  blockLogLikelihood_.assign(blockCount, 0);
+
+  // E-step
+  unsigned n = std::min(threadCount, blockCount);
+  if (n <= 1)
+    countBlocks(sites, 0, 1);
+  else {
+    boost::thread_group threads;
+    for (unsigned t = 0; t < n; t++)
+      threads.add_thread( new boost::thread(& ErrorEstimator::countBlocks, this, boost::cref(sites), t, n) );
+    threads.join_all();
+  }
+  vector<double> counts(nN_ * nO_, 0);
+  double logLikelihood = 0;
+  for (unsigned b = 0; b < blockCount; b++) {
+    for (unsigned k = 0; k < counts.size(); k++)
+      counts[k] += blockCounts_[b][k];
+    logLikelihood += blockLogLikelihood_[b];
+  }
+  meanLogLikelihood_ = logLikelihood / sites.size();
+  readCount_ = 0;
+  for (unsigned k = 0; k < counts.size(); k++)
+    readCount_ += counts[k];
+
+  // M-step
+  PotentialSpec old = observation();
+  if (params_ == ESTIMATE_DAMAGE) {
+    double oldTau = tau_, oldDelta = delta_;
+    maximizeDamage(counts);
+    setObservation( mkDamageObservation(tau_, delta_) );
+    return std::max( fabs(tau_ - oldTau), fabs(delta_ - oldDelta) );
+  }
+  PotentialSpec pot = old;
+  for (unsigned a = 0; a < nN_; a++) {
+    double sum = 0;
+    for (unsigned o = 0; o < nO_; o++)
+      sum += counts[a * nO_ + o] + ESTIMATE_PSEUDO_COUNTS * start_[a * nO_ + o];
+    for (unsigned o = 0; o < nO_; o++)
+      pot.values[a * nO_ + o] = (counts[a * nO_ + o] + ESTIMATE_PSEUDO_COUNTS * start_[a * nO_ + o]) / sum;
+  }
+  double change = 0;
+  for (unsigned k = 0; k < pot.values.size(); k++)
+    change = std::max( change, fabs(pot.values[k] - old.values[k]) );
+  setObservation(pot);
+  return change;
+}
+
+
+// expected counts of the blocks first, first + step, ...
+void ErrorEstimator::countBlocks(CountedSites const & sites, unsigned first, unsigned step)
+{
+  SymbolHistogram hist;
+  hist.count.assign(model_->observationSymbolCount(), 0);
+  xvector_t pp(nG_);
+  vector<double> w(nN_), logL(nG_);
+  vector< vector<double> > const & logRef = model_->logRefFactors();
+  vector< vector<double> > const & logEmission = model_->logEmissions();
+
+  for (unsigned b = first; b < blockCounts_.size(); b += step) {
+    vector<double> & counts = blockCounts_[b];
+    double & logLikelihood = blockLogLikelihood_[b];
+    unsigned end = std::min( (b + 1) * ESTIMATE_BLOCK_SITES, sites.size() );
+    for (unsigned i = b * ESTIMATE_BLOCK_SITES; i < end; i++) {
+      sites.get(i, hist);
+      model_->calcPosterior(hist, pp);
+
+      // log P(O_1..O_n | C) up to the constants of the potentials
+      double maxL = -HUGE_VAL;
+      for (unsigned g = 0; g < nG_; g++) {
+	logL[g] = logRef[hist.ref][g];
+	for (unsigned k = 0; k < hist.present.size(); k++)
+	  logL[g] += hist.count[ hist.present[k] ] * logEmission[ hist.present[k] ][g];
+	maxL = std::max(maxL, logL[g]);
+      }
+      if (maxL > -HUGE_VAL) {
+	double sum = 0;
+	for (unsigned g = 0; g < nG_; g++)
+	  sum += exp(logL[g] - maxL);
+	logLikelihood += maxL + log(sum);
+      }
+
+      for (unsigned k = 0; k < hist.present.size(); k++) {
+	unsigned o = hist.present[k];
+	if (o >= nO_)
+	  continue;  // meta symbol
+	w.assign(nN_, 0);
+	for (unsigned g = 0; g < nG_; g++) {
+	  double p = (double) pp[g];
+	  double const * post = & readPosterior_[(o * nG_ + g) * nN_];
+	  for (unsigned a = 0; a < nN_; a++)
+	    w[a] += p * post[a];
+	}
+	for (unsigned a = 0; a < nN_; a++)
+	  counts[a * nO_ + o] += hist.count[o] * w[a];
+      }
+    }
+  }
+}
+
+
+// sum_{A, O} counts(A, O) log P(O | A) under the damage model, where
+// P(O | A) is the potential normalized over the four bases of each
+// quality
+static double damageLogLikelihood(vector<double> const & counts, double tau, double delta)
+{
+  PotentialSpec pot = mkDamageObservation(tau, delta);
+  unsigned nQ = pot.cols / 4;
+  double sum = 0;
+  for (unsigned a = 0; a < pot.rows; a++) {
+    double rowCount = 0;
+    for (unsigned o = 0; o < pot.cols; o++) {
+      double n = counts[a * pot.cols + o];
+      if (n > 0) {
+	sum += n * log( pot(a, o) );
+	rowCount += n;
+      }
+    }
+    double norm = 0;
+    for (unsigned i = 0; i < 4; i++)
+      norm += pot(a, i * nQ);
+    sum -= rowCount * log(norm);
+  }
+  return sum;
+}
+
+
+// Maximize damageLogLikelihood over tau and delta in turn, each by
+// golden section search over [0, 1 - the other rate), starting from the
+// current rates.
+void ErrorEstimator::maximizeDamage(vector<double> const & counts)
+{
+  double const golden = (sqrt(5.0) - 1) / 2;
+  double const margin = 1e-9;
+  for (unsigned round = 0; round < 50; round++) {
+    double oldTau = tau_, oldDelta = delta_;
+    for (unsigned v = 0; v < 2; v++) {
+      double & x = (v == 0) ? tau_ : delta_;
+      double lo = 0, hi = 1 - ( (v == 0) ? delta_ : tau_ ) - margin;
+      double x1 = hi - golden * (hi - lo), x2 = lo + golden * (hi - lo);
+      x = x1;
+      double f1 = damageLogLikelihood(counts, tau_, delta_);
+      x = x2;
+      double f2 = damageLogLikelihood(counts, tau_, delta_);
+      while (hi - lo > 1e-12) {
+	if (f1 < f2) {
+	  lo = x1;
+	  x1 = x2;
+	  f1 = f2;
+	  x = x2 = lo + golden * (hi - lo);
+	  f2 = damageLogLikelihood(counts, tau_, delta_);
+	}
+	else {
+	  hi = x2;
+	  x2 = x1;
+	  f2 = f1;
+	  x = x1 = hi - golden * (hi - lo);
+	  f1 = damageLogLikelihood(counts, tau_, delta_);
+	}
+      }
+      x = (lo + hi) / 2;
+    }
+    if (fabs(tau_ - oldTau) < 1e-12 and fabs(delta_ - oldDelta) < 1e-12)
+      break;
+  }
+}
+
+
+void ErrorEstimator::write(string const & file, string const & comment) const
+{
+  ofstream str( file.c_str() );
+  if (not str)
+    errorAbort("From ErrorEstimator: could not open file '" + file + "'.");
+  str << "# " << comment << "\n\n";
+  for (map<string, PotentialSpec>::const_iterator it = pots_.begin(); it != pots_.end(); ++it) {
+    string type = "rowNorm";
+    if (it->first == "observation" and params_ == ESTIMATE_DAMAGE)
+      type = "colNorm";
+    writePotentialSpec(str, it->second, type);
+  }
+  if (not str)
+    errorAbort("From ErrorEstimator: could not write file '" + file + "'.");
+}
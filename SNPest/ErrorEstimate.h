@@ -0,0 +1,87 @@
+#ifndef __ErrorEstimate_h
+#define __ErrorEstimate_h
+
+#include "StarModel.h"
+#include "ModelSpec.h"
+#include <boost/shared_ptr.hpp>
+#include <string>
+#include <vector>
+#include <map>
+
+// Expectation-maximization of the observation potential of a model from
+// the sites themselves, instead of guessing the rates given to
+// dfgspec/CalculateDamageMatrix. Each pass evaluates the posteriors of
+// G under the current potential (the E-step), collects the expected
+// number of reads with each (original base A, input symbol O), and
+// updates the potential from these counts (the M-step):
+//
+//   ESTIMATE_DAMAGE: the rates tau and delta of mkDamageObservation,
+//     maximizing sum_{A, O} E(A, O) log P(O | A) with P(O | A) the
+//     potential normalized over the bases of each quality; the result
+//     is a damage model as from CalculateDamageMatrix (colNorm).
+//   ESTIMATE_MATRIX: the whole potential as P(O | A) (rowNorm), with
+//     ESTIMATE_PSEUDO_COUNTS reads of each base spread as the starting
+//     potential, so symbols never seen keep their starting values.
+//
+// Reads of meta symbols (e.g. N) are used in the posteriors of G but
+// not counted. The counts of each block of ESTIMATE_BLOCK_SITES sites
+// are collected separately and added in order, so the estimate does not
+// depend on the number of threads.
+unsigned const ESTIMATE_BLOCK_SITES = 4096;
+double const ESTIMATE_PSEUDO_COUNTS = 200;
+
+class ErrorEstimator {
+public:
+  enum Parameters {ESTIMATE_DAMAGE, ESTIMATE_MATRIX};
+
+  // The model as for StarModel (source names it in error messages).
+  // The damage rates start at tau = delta = 0.01, the matrix at the
+  // observation potential of the model.
+  ErrorEstimator(std::map<std::string, StateMapSpec> const & maps, std::map<std::string, PotentialSpec> const & pots, std::string const & source, Parameters params);
+
+  // One EM pass over the sites (counted by a StarModel of the same state
+  // maps) on threadCount threads. Returns the largest change of tau,
+  // delta or an entry of the potential.
+  double pass(CountedSites const & sites, unsigned threadCount);
+
+  // of the last pass: the mean log-likelihood of the sites before the
+  // update, and the reads counted
+  double meanLogLikelihood() const {return meanLogLikelihood_;}
+  double readCount() const {return readCount_;}
+
+  double tau() const {return tau_;}
+  double delta() const {return delta_;}
+  PotentialSpec const & observation() const {return pots_.find("observation")->second;}
+
+  // Write the potentials of the model, with the estimated observation
+  // potential, as a factorPotentials.txt file; comment is written at
+  // the top, after '# '.
+  void write(std::string const & file, std::string const & comment) const;
+
+private:
+  void setObservation(PotentialSpec const & observation);
+  void countBlocks(CountedSites const & sites, unsigned first, unsigned step);
+  void maximizeDamage(std::vector<double> const & counts);
+
+  std::map<std::string, StateMapSpec> maps_;
+  std::map<std::string, PotentialSpec> pots_;
+  std::string source_;
+  Parameters params_;
+  double tau_, delta_;
+  unsigned nN_, nG_, nO_;
+
+  // the model of the current potential, and
+  // readPosterior_[(o * nG + g) * nN + a] = P(A = a | G = g, O = o) in it
+  boost::shared_ptr<StarModel> model_;
+  std::vector<double> readPosterior_;
+  // the row normalized starting potential, for the pseudo counts
+  std::vector<double> start_;
+
+  // expected counts [a * nO + o] and log-likelihood of each block
+  std::vector< std::vector<double> > blockCounts_;
+  std::vector<double> blockLogLikelihood_;
+
+  double meanLogLikelihood_, readCount_;
+};
+
+#endif  // __ErrorEstimate_h
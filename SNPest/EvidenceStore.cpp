@@ -0,0 +1,412 @@
+#include "EvidenceStore.h"
+#include "phy/utils.h"
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <cstdlib>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace phy;
+using boost::uint8_t;
+using boost::uint16_t;
+using boost::uint32_t;
+using boost::uint64_t;
+
+// A block is
+//
+//   u32 lines L, u32 records R, u32 codes C, u32 0
+//   u32 pos[L], u32 recordEnd[L]
+//   u8 ref[R], u8 kind[R], u16 avMapQ[R], u32 depth[R], u32 count[R], u32 codeEnd[R]
+//   u16 codes[C]
+//
+// with each column padded to 8 bytes. The records of line i are
+// [recordEnd[i-1], recordEnd[i]) and the codes of record r (C, O1, ...,
+// On) [codeEnd[r-1], codeEnd[r]), counted from the start of the block.
+
+static char const EVIDENCE_MAGIC[8] = {'S', 'N', 'P', 'E', 'S', 'T', 'E', 'V'};
+static uint32_t const EVIDENCE_BYTE_ORDER = 0x01020304;
+static unsigned const EVIDENCE_HEADER_SIZE = 32;
+static unsigned const EVIDENCE_BLOCK_HEADER_SIZE = 16;
+static unsigned const EVIDENCE_ENTRY_SIZE = 32;
+
+
+static void pad8(string & buf)
+{
+  buf.resize( (buf.size() + 7) / 8 * 8, '\0' );
+}
+
+
+template<class T>
+static void putColumn(string & buf, vector<T> const & x)
+{
+  if ( not x.empty() )
+    buf.append( (char const *) & x[0], x.size() * sizeof(T) );
+  pad8(buf);
+}
+
+
+static void put32(string & buf, uint32_t x) {buf.append( (char const *) & x, sizeof(x) );}
+static void put64(string & buf, uint64_t x) {buf.append( (char const *) & x, sizeof(x) );}
+
+
+EvidenceWriter::EvidenceWriter(string const & file, unsigned sampleCount)
+  : file_(file), lineCount_(0), closed_(false), chrom_(0), lastPos_(0), offset_(EVIDENCE_HEADER_SIZE)
+{
+  str_.open( file.c_str(), ios::out | ios::binary | ios::trunc );
+  if ( not str_ )
+    errorAbort("From EvidenceWriter: cannot open file '" + file + "' for writing.");
+  // the directory offset is set by close
+  string header(EVIDENCE_MAGIC, sizeof(EVIDENCE_MAGIC) );
+  put32(header, EVIDENCE_STORE_VERSION);
+  put32(header, EVIDENCE_BYTE_ORDER);
+  put32(header, sampleCount);
+  put32(header, 0);
+  put64(header, 0);
+  assert(header.size() == EVIDENCE_HEADER_SIZE);
+  str_.write( header.data(), header.size() );
+}
+
+
+void EvidenceWriter::add(vector<SiteRecord> const & records, unsigned recordCount)
+{
+  assert(not closed_ and recordCount > 0);
+  for (unsigned r = 0; r < recordCount; r++) {
+    SiteRecord const & rec = records[r];
+    SiteIdFields f;
+    bool ok = parseSiteId(rec.id, chromName_, f);
+    if (ok)
+      mkSiteId(id_, chromName_, f);
+    if (not ok or id_ != rec.id or rec.codes.empty() or f.avMapQ > USHRT_MAX)
+      errorAbort("From EvidenceWriter: cannot store site '" + rec.id + "'.");
+
+    if (r == 0) {
+      // a new block at each chromosome
+      if ( chroms_.empty() or chromName_ != chroms_[chrom_] ) {
+	flushBlock();
+	if ( chromIndex_.count(chromName_) )
+	  errorAbort("From EvidenceWriter: the lines of chromosome '" + chromName_ + "' are not together in the input.");
+	chrom_ = chroms_.size();
+	chromIndex_[chromName_] = chrom_;
+	chroms_.push_back(chromName_);
+      }
+      else if (f.pos < lastPos_)
+	errorAbort("From EvidenceWriter: the input is not sorted by position at site '" + rec.id + "'.");
+      if (f.pos > UINT_MAX)
+	errorAbort("From EvidenceWriter: cannot store site '" + rec.id + "'.");
+      pos_.push_back(f.pos);
+      lastPos_ = f.pos;
+    }
+
+    ref_.push_back(f.ref);
+    kind_.push_back(f.kind);
+    avMapQ_.push_back(f.avMapQ);
+    depth_.push_back(f.depth);
+    count_.push_back(f.count);
+    codes_.insert( codes_.end(), rec.codes.begin(), rec.codes.end() );
+    codeEnd_.push_back( codes_.size() );
+  }
+  recordEnd_.push_back( ref_.size() );
+  lineCount_++;
+  if (pos_.size() == EVIDENCE_BLOCK_LINES)
+    flushBlock();
+}
+
+
+void EvidenceWriter::flushBlock()
+{
+  if ( pos_.empty() )
+    return;
+  string buf;
+  put32( buf, pos_.size() );
+  put32( buf, ref_.size() );
+  put32( buf, codes_.size() );
+  put32(buf, 0);
+  putColumn(buf, pos_);
+  putColumn(buf, recordEnd_);
+  putColumn(buf, ref_);
+  putColumn(buf, kind_);
+  putColumn(buf, avMapQ_);
+  putColumn(buf, depth_);
+  putColumn(buf, count_);
+  putColumn(buf, codeEnd_);
+  putColumn(buf, codes_);
+  str_.write( buf.data(), buf.size() );
+
+  BlockEntry e;
+  e.chrom = chrom_;
+  e.lines = pos_.size();
+  e.firstPos = pos_.front();
+  e.lastPos = pos_.back();
+  e.offset = offset_;
+  e.size = buf.size();
+  blocks_.push_back(e);
+  offset_ += buf.size();
+
+  pos_.clear();
+  recordEnd_.clear();
+  ref_.clear();
+  kind_.clear();
+  avMapQ_.clear();
+  depth_.clear();
+  count_.clear();
+  codeEnd_.clear();
+  codes_.clear();
+}
+
+
+void EvidenceWriter::close()
+{
+  if (closed_)
+    return;
+  flushBlock();
+  string dir;
+  put32( dir, chroms_.size() );
+  for (unsigned i = 0; i < chroms_.size(); i++) {
+    put32( dir, chroms_[i].size() );
+    dir += chroms_[i];
+    dir.resize( (dir.size() + 3) / 4 * 4, '\0' );
+  }
+  put32( dir, blocks_.size() );
+  put32(dir, 0);
+  for (unsigned i = 0; i < blocks_.size(); i++) {
+    put32(dir, blocks_[i].chrom);
+    put32(dir, blocks_[i].lines);
+    put32(dir, blocks_[i].firstPos);
+    put32(dir, blocks_[i].lastPos);
+    put64(dir, blocks_[i].offset);
+    put64(dir, blocks_[i].size);
+  }
+  str_.write( dir.data(), dir.size() );
+  str_.seekp(EVIDENCE_HEADER_SIZE - 8);
+  string offset;
+  put64(offset, offset_);
+  str_.write( offset.data(), offset.size() );
+  str_.close();
+  if ( str_.fail() )
+    errorAbort("From EvidenceWriter: error writing file '" + file_ + "'.");
+  closed_ = true;
+}
+
+
+// reading
+
+void EvidenceReader::corrupt() const
+{
+  errorAbort("From EvidenceReader: file '" + file_ + "' is truncated or corrupt.");
+}
+
+
+// the u32 at p, which must be in [data, data + size)
+static uint32_t get32(char const * p)
+{
+  uint32_t x;
+  memcpy(& x, p, sizeof(x) );
+  return x;
+}
+
+
+static uint64_t get64(char const * p)
+{
+  uint64_t x;
+  memcpy(& x, p, sizeof(x) );
+  return x;
+}
+
+
+EvidenceReader::EvidenceReader(string const & file, GenomicRegion const & region, unsigned maxDepth)
+  : file_(file), data_(NULL), size_(0), region_(region), maxDepth_(maxDepth), symbolStrings_(true), lineCount_(0), block_(0), line_(0), lines_(0)
+{
+  if (maxDepth_ == 0)
+    errorAbort("From EvidenceReader: maxDepth must be positive.");
+  int fd = open(file.c_str(), O_RDONLY);
+  if (fd < 0)
+    errorAbort("From EvidenceReader: cannot open file '" + file + "'.");
+  struct stat st;
+  if (fstat(fd, & st) != 0 or st.st_size < (off_t) EVIDENCE_HEADER_SIZE) {
+    close(fd);
+    errorAbort("From EvidenceReader: file '" + file + "' is not an evidence store.");
+  }
+  size_ = st.st_size;
+  void * p = mmap(NULL, size_, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED)
+    errorAbort("From EvidenceReader: cannot map file '" + file + "'.");
+  data_ = (char const *) p;
+  // the blocks are read once, in order
+  madvise( (void *) data_, size_, MADV_SEQUENTIAL );
+
+  if (memcmp(data_, EVIDENCE_MAGIC, sizeof(EVIDENCE_MAGIC) ) != 0)
+    errorAbort("From EvidenceReader: file '" + file + "' is not an evidence store.");
+  uint32_t version = get32(data_ + 8);
+  if (get32(data_ + 12) != EVIDENCE_BYTE_ORDER)
+    errorAbort("From EvidenceReader: file '" + file + "' was written on a machine with another byte order.");
+  if (version != EVIDENCE_STORE_VERSION)
+    errorAbort("From EvidenceReader: file '" + file + "' has version " + toString(version) + ", expected " + toString(EVIDENCE_STORE_VERSION) + ". Write it again with --evidenceOut.");
+  sampleCount_ = get32(data_ + 16);
+  uint64_t offset = get64(data_ + 24);
+  if (offset == 0)
+    errorAbort("From EvidenceReader: file '" + file + "' is incomplete (the run writing it did not finish).");
+
+  // directory
+  char const * end = data_ + size_;
+  if (offset > size_ - 4)
+    corrupt();
+  char const * d = data_ + offset;
+  unsigned chromCount = get32(d);
+  d += 4;
+  for (unsigned i = 0; i < chromCount; i++) {
+    if (end - d < 4)
+      corrupt();
+    uint32_t n = get32(d);
+    d += 4;
+    if ( (uint64_t) (end - d) < n)
+      corrupt();
+    chroms_.push_back( string(d, n) );
+    d += (n + 3) / 4 * 4;
+  }
+  if (end - d < 8)
+    corrupt();
+  unsigned blockCount = get32(d);
+  d += 8;
+  if ( (uint64_t) (end - d) < (uint64_t) blockCount * EVIDENCE_ENTRY_SIZE )
+    corrupt();
+  for (unsigned i = 0; i < blockCount; i++, d += EVIDENCE_ENTRY_SIZE) {
+    BlockEntry e;
+    e.chrom = get32(d);
+    e.lines = get32(d + 4);
+    e.firstPos = get32(d + 8);
+    e.lastPos = get32(d + 12);
+    uint64_t blockOffset = get64(d + 16), blockSize = get64(d + 24);
+    if (e.chrom >= chromCount or blockOffset % 8 != 0 or blockOffset > offset or blockSize > offset - blockOffset)
+      corrupt();
+    e.offset = blockOffset;
+    e.size = blockSize;
+    blocks_.push_back(e);
+  }
+
+  // skip to the first block of the region (the blocks of a chromosome are together)
+  if ( not region_.empty() ) {
+    unsigned b = 0;
+    while ( b < blocks_.size() and (chroms_[ blocks_[b].chrom ] != region_.chrom or blocks_[b].lastPos < region_.beg) )
+      b++;
+    block_ = b;
+    if ( b < blocks_.size() and blocks_[b].firstPos > region_.end )
+      block_ = blocks_.size();
+  }
+  if ( block_ < blocks_.size() )
+    openBlock(block_);
+}
+
+
+EvidenceReader::~EvidenceReader()
+{
+  if (data_ != NULL)
+    munmap( (void *) data_, size_ );
+}
+
+
+// column of n entries of type T at p, which is advanced past it
+template<class T>
+static T const * getColumn(char const * & p, char const * end, uint64_t n, bool & ok)
+{
+  uint64_t bytes = (n * sizeof(T) + 7) / 8 * 8;
+  ok = ok and (uint64_t) (end - p) >= bytes;
+  T const * x = ok ? (T const *) p : NULL;
+  if (ok)
+    p += bytes;
+  return x;
+}
+
+
+void EvidenceReader::openBlock(unsigned b)
+{
+  BlockEntry const & e = blocks_[b];
+  char const * p = data_ + e.offset;
+  char const * end = p + e.size;
+  if (e.size < EVIDENCE_BLOCK_HEADER_SIZE)
+    corrupt();
+  lines_ = get32(p);
+  recordCount_ = get32(p + 4);
+  codeCount_ = get32(p + 8);
+  if (lines_ != e.lines or lines_ == 0)
+    corrupt();
+  p += EVIDENCE_BLOCK_HEADER_SIZE;
+  bool ok = true;
+  pos_ = getColumn<uint32_t>(p, end, lines_, ok);
+  recordEnd_ = getColumn<uint32_t>(p, end, lines_, ok);
+  ref_ = getColumn<uint8_t>(p, end, recordCount_, ok);
+  kind_ = getColumn<uint8_t>(p, end, recordCount_, ok);
+  avMapQ_ = getColumn<uint16_t>(p, end, recordCount_, ok);
+  depth_ = getColumn<uint32_t>(p, end, recordCount_, ok);
+  count_ = getColumn<uint32_t>(p, end, recordCount_, ok);
+  codeEnd_ = getColumn<uint32_t>(p, end, recordCount_, ok);
+  codes_ = getColumn<symbol_code_t>(p, end, codeCount_, ok);
+  if (not ok)
+    corrupt();
+
+  // first line of the region
+  line_ = 0;
+  if ( not region_.empty() and e.firstPos < region_.beg )
+    line_ = std::lower_bound(pos_, pos_ + lines_, region_.beg) - pos_;
+}
+
+
+unsigned EvidenceReader::next(vector<SiteRecord> & records)
+{
+  while (block_ < blocks_.size() and line_ == lines_) {
+    block_++;
+    if ( block_ < blocks_.size() and not region_.empty() and (blocks_[block_].chrom != blocks_[block_ - 1].chrom or blocks_[block_].firstPos > region_.end) )
+      block_ = blocks_.size();
+    if ( block_ < blocks_.size() )
+      openBlock(block_);
+  }
+  if ( block_ == blocks_.size() or (not region_.empty() and pos_[line_] > region_.end) ) {
+    block_ = blocks_.size();
+    return 0;
+  }
+
+  unsigned rb = (line_ > 0) ? recordEnd_[line_ - 1] : 0, re = recordEnd_[line_];
+  if (re <= rb or re > recordCount_)
+    corrupt();
+  if (records.size() < re - rb)
+    records.resize(re - rb);
+  string const & chrom = chroms_[ blocks_[block_].chrom ];
+  for (unsigned r = rb; r < re; r++) {
+    SiteRecord & rec = records[r - rb];
+    unsigned cb = (r > 0) ? codeEnd_[r - 1] : 0, ce = codeEnd_[r];
+    if (ce <= cb or ce > codeCount_ or kind_[r] > SITE_ID_INSERTION)
+      corrupt();
+
+    SiteIdFields f;
+    f.pos = pos_[line_];
+    f.ref = ref_[r];
+    f.avMapQ = avMapQ_[r];
+    f.depth = depth_[r];
+    f.kind = (SiteIdKind) kind_[r];
+    f.count = count_[r];
+    mkSiteId(rec.id, chrom, f);
+
+    rec.codes.assign(codes_ + cb, codes_ + ce);
+    unsigned depth = ce - cb - 1;
+    // randomly down sample to maxDepth reads
+    if (depth > maxDepth_) {
+      for (unsigned i = 0; i < maxDepth_; i++) {
+	unsigned j = i + rand() % (depth - i);
+	std::swap(rec.codes[1 + i], rec.codes[1 + j]);
+      }
+      rec.codes.resize(1 + maxDepth_);
+      depth = maxDepth_;
+    }
+    rec.depth = depth;
+    if (symbolStrings_)
+      mkSymbolStrings(rec);
+    else
+      rec.symbols.clear();
+  }
+  line_++;
+  lineCount_++;
+  return re - rb;
+}
@@ -0,0 +1,141 @@
+#ifndef __EvidenceStore_h
+#define __EvidenceStore_h
+
+#include "Pileup.h"
+#include <boost/cstdint.hpp>
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <cstddef>
+
+// The site records of a pileup in one binary file (made with
+// dfgEval_SNPest --evidenceOut), so that the sites can be genotyped
+// again, e.g. with another model, ploidity or prior, without going
+// back to the BAM file or the pileup. A record is stored as the fields
+// of its id (see SiteIdFields) and its symbol codes (see Pileup.h), two
+// bytes per read.
+//
+// The input lines are stored in blocks of at most EVIDENCE_BLOCK_LINES
+// lines of one chromosome, each block column by column: the positions,
+// the number of records of each line, and per record the reference
+// base, kind, average mapping quality, depth, count of the id and the
+// end of its codes, followed by the codes. A directory at the end of
+// the file gives the chromosome and first and last position of each
+// block, so a region is found without reading the blocks before it.
+// The file is read with mmap. Layout (native byte order, checked when
+// opened):
+//
+//   header:    char magic[8] = "SNPESTEV", u32 version, u32 byte order mark, u32 sample count, u32 0, u64 directory offset
+//   blocks:    8 byte aligned, see EvidenceStore.cpp
+//   directory: u32 chromosome count, the names (u32 length, characters, padded to 4 bytes),
+//              u32 block count, u32 0, per block: u32 chromosome, u32 lines, u32 first pos, u32 last pos, u64 offset, u64 size
+unsigned const EVIDENCE_STORE_VERSION = 1;
+unsigned const EVIDENCE_BLOCK_LINES = 4096;
+
+
+// Writes the records of each input line. The input must be sorted by
+// position within each chromosome, with the lines of a chromosome
+// together, as from 'samtools mpileup'.
+class EvidenceWriter {
+public:
+  // sampleCount as the sampleCount argument of MpileupReader
+  EvidenceWriter(std::string const & file, unsigned sampleCount);
+
+  // the records of one input line, as from PileupReader::next
+  void add(std::vector<SiteRecord> const & records, unsigned recordCount);
+  // write the last block and the directory
+  void close();
+
+  unsigned long lineCount() const {return lineCount_;}
+
+private:
+  EvidenceWriter(EvidenceWriter const &);
+  EvidenceWriter & operator=(EvidenceWriter const &);
+
+  void flushBlock();
+
+  std::string file_;
+  std::ofstream str_;
+  unsigned long lineCount_;
+  bool closed_;
+
+  // chromosomes in order, and the chromosome and position of the last line
+  std::vector<std::string> chroms_;
+  std::map<std::string, unsigned> chromIndex_;
+  unsigned chrom_;
+  unsigned long lastPos_;
+
+  // columns of the current block
+  std::vector<boost::uint32_t> pos_, recordEnd_;
+  std::vector<boost::uint8_t> ref_, kind_;
+  std::vector<boost::uint16_t> avMapQ_;
+  std::vector<boost::uint32_t> depth_, count_, codeEnd_;
+  std::vector<symbol_code_t> codes_;
+
+  // directory entries of the blocks written
+  struct BlockEntry {
+    boost::uint32_t chrom, lines, firstPos, lastPos;
+    boost::uint64_t offset, size;
+  };
+  std::vector<BlockEntry> blocks_;
+  boost::uint64_t offset_;
+
+  // scratch data
+  std::string chromName_, id_;
+};
+
+
+// Reads the records of the lines of a store, as a PileupReader does
+// from its input.
+class EvidenceReader {
+public:
+  // Map the file; aborts if it is not a store of this version. Only
+  // the lines in region are read. Sites with more than maxDepth reads
+  // are randomly down sampled.
+  EvidenceReader(std::string const & file, GenomicRegion const & region, unsigned maxDepth);
+  ~EvidenceReader();
+
+  // as PileupReader::next
+  unsigned next(std::vector<SiteRecord> & records);
+
+  unsigned lineCount() const {return lineCount_;}
+  // as the sampleCount argument of MpileupReader: 0 for single-sample input
+  unsigned sampleCount() const {return sampleCount_;}
+  // as PileupReader::setSymbolStrings
+  void setSymbolStrings(bool symbolStrings) {symbolStrings_ = symbolStrings;}
+
+private:
+  EvidenceReader(EvidenceReader const &);
+  EvidenceReader & operator=(EvidenceReader const &);
+
+  struct BlockEntry {
+    unsigned chrom, lines, firstPos, lastPos;
+    std::size_t offset, size;
+  };
+  void openBlock(unsigned b);
+  void corrupt() const;
+
+  std::string file_;
+  char const * data_;
+  std::size_t size_;
+  unsigned sampleCount_;
+  std::vector<std::string> chroms_;
+  std::vector<BlockEntry> blocks_;
+
+  GenomicRegion region_;
+  unsigned maxDepth_;
+  bool symbolStrings_;
+  unsigned lineCount_;
+
+  // the current block and line in it
+  unsigned block_, line_, lines_;
+  boost::uint32_t const * pos_, * recordEnd_;
+  boost::uint8_t const * ref_, * kind_;
+  boost::uint16_t const * avMapQ_;
+  boost::uint32_t const * depth_, * count_, * codeEnd_;
+  symbol_code_t const * codes_;
+  unsigned recordCount_, codeCount_;
+};
+
+#endif  // __EvidenceStore_h
@@ -0,0 +1,158 @@
+#include "GenotypeKernel.h"
+#include "phy/utils.h"
+#include <cmath>
+#include <limits>
+
+using namespace phy;
+
+
+NumericBackend parseNumericBackend(string const & str)
+{
+  if (str == "xnumber")
+    return NUMERIC_XNUMBER;
+  else if (str == "log")
+    return NUMERIC_LOG;
+  else if (str == "logf")
+    return NUMERIC_LOGF;
+  errorAbort("From parseNumericBackend: unknown numeric backend '" + str + "'. Use one of xnumber, log, or logf.");
+  return NUMERIC_XNUMBER;
+}
+
+
+string numericBackendName(NumericBackend backend)
+{
+  switch (backend) {
+  case NUMERIC_LOG: return "log";
+  case NUMERIC_LOGF: return "logf";
+  default: return "xnumber";
+  }
+}
+
+
+// Log space kernel in the floating point type Real for NG genotypes.
+// The tables are copied from the log factors of the star model and laid
+// out genotype minor, so the NG values of a symbol are contiguous.
+template <typename Real, unsigned NG>
+class LogSpaceKernel : public GenotypeKernel {
+public:
+  LogSpaceKernel(StarModel const & starModel, NumericBackend backend);
+
+  virtual void calcLogPosterior(SymbolHistogram const & hist, double * logPP, double * logOther) const;
+
+protected:
+  static void copyTable(vector< vector<double> > const & from, vector<Real> & to);
+
+  vector<Real> logRef_;       // [c * NG + g]
+  vector<Real> logEmission_;  // [o * NG + g]
+};
+
+
+template <typename Real, unsigned NG>
+LogSpaceKernel<Real, NG>::LogSpaceKernel(StarModel const & starModel, NumericBackend backend)
+  : GenotypeKernel(NG, backend)
+{
+  assert(starModel.genotypeCount() == NG);
+  copyTable(starModel.logRefFactors(), logRef_);
+  copyTable(starModel.logEmissions(), logEmission_);
+}
+
+
+template <typename Real, unsigned NG>
+void LogSpaceKernel<Real, NG>::copyTable(vector< vector<double> > const & from, vector<Real> & to)
+{
+  to.resize(from.size() * NG);
+  for (unsigned i = 0; i < from.size(); i++)
+    for (unsigned g = 0; g < NG; g++)
+      to[i * NG + g] = from[i][g];
+}
+
+
+template <typename Real, unsigned NG>
+void LogSpaceKernel<Real, NG>::calcLogPosterior(SymbolHistogram const & hist, double * logPP, double * logOther) const
+{
+  Real const minusInf = - std::numeric_limits<Real>::infinity();
+  Real l[NG];
+  Real const * ref = & logRef_[hist.ref * NG];
+  for (unsigned g = 0; g < NG; g++)
+    l[g] = ref[g];
+  for (unsigned k = 0; k < hist.present.size(); k++) {
+    unsigned o = hist.present[k];
+    Real n = hist.count[o];
+    Real const * e = & logEmission_[o * NG];
+    for (unsigned g = 0; g < NG; g++)
+      l[g] += n * e[g];
+  }
+
+  // log-sum-exp of all genotypes, shifted by the largest term
+  unsigned best = 0;
+  for (unsigned g = 1; g < NG; g++)
+    if (l[g] > l[best])
+      best = g;
+  if ( not (l[best] > minusInf) )
+    errorAbort("From LogSpaceKernel: data has zero probability under the model.");
+  Real x[NG];
+  Real sum = 0;
+  for (unsigned g = 0; g < NG; g++) {
+    x[g] = std::exp(l[g] - l[best]);
+    sum += x[g];
+  }
+  // log posteriors relative to the best term, so the large log
+  // likelihoods cancel before the sums are taken into account
+  Real logSum = std::log(sum);
+
+  // the others of a genotype g other than the best include the best, so
+  // their sum is at least one and sum - x[g] does not cancel
+  Real otherOfBest = 0;
+  for (unsigned g = 0; g < NG; g++) {
+    logPP[g] = (l[g] - l[best]) - logSum;
+    if (g != best) {
+      logOther[g] = std::log(sum - x[g]) - logSum;
+      otherOfBest += x[g];
+    }
+  }
+
+  // the others of the best are summed directly; if their shifted terms
+  // are too small for that, they are shifted by the second largest term
+  // instead, so they do not underflow however close P(G = best) is to one
+  unsigned second = (best == 0) ? 1 : 0;
+  for (unsigned g = 0; g < NG; g++)
+    if (g != best and l[g] > l[second])
+      second = g;
+  if ( x[second] >= std::numeric_limits<Real>::min() / std::numeric_limits<Real>::epsilon() ) {
+    logOther[best] = std::log(otherOfBest) - logSum;
+    return;
+  }
+  if ( not (l[second] > minusInf) ) {
+    logOther[best] = - std::numeric_limits<double>::infinity();
+    return;
+  }
+  otherOfBest = 0;
+  for (unsigned h = 0; h < NG; h++)
+    if (h != best)
+      otherOfBest += std::exp(l[h] - l[second]);
+  logOther[best] = (l[second] - l[best]) + std::log(otherOfBest) - logSum;
+}
+
+
+template <typename Real>
+static GenotypeKernel * mkLogSpaceKernel(StarModel const & starModel, NumericBackend backend)
+{
+  switch ( starModel.genotypeCount() ) {
+  case 4: return new LogSpaceKernel<Real, 4>(starModel, backend);
+  case 10: return new LogSpaceKernel<Real, 10>(starModel, backend);
+  default:
+    errorAbort("From mkGenotypeKernel: the " + numericBackendName(backend) + " backend handles models with 4 or 10 genotypes, not " + toString( starModel.genotypeCount() ) + ".");
+  }
+  return NULL;
+}
+
+
+GenotypeKernel * mkGenotypeKernel(StarModel const & starModel, NumericBackend backend)
+{
+  if (backend == NUMERIC_LOG)
+    return mkLogSpaceKernel<double>(starModel, backend);
+  if (backend == NUMERIC_LOGF)
+    return mkLogSpaceKernel<float>(starModel, backend);
+  errorAbort("From mkGenotypeKernel: the " + numericBackendName(backend) + " backend is the star engine itself.");
+  return NULL;
+}
@@ -0,0 +1,56 @@
+#ifndef __GenotypeKernel_h
+#define __GenotypeKernel_h
+
+#include "StarModel.h"
+#include <string>
+#include <vector>
+
+// Genotype posteriors of the star model from the symbol counts of a
+// site, with the number type and the number of genotypes (4 haploid,
+// 10 diploid) fixed at compile time.
+//
+// The star engine evaluates the posteriors in xnumber_t, which is the
+// extended range xdouble in the usual phy build, and the posterior of
+// the other genotypes, 1 - P(G = g), is then recovered by --ppSumOther.
+// The kernels here work in log space in a plain floating point type
+// instead:
+//
+//   l_g = log r_g(c) + sum_o n_o log e_g(o)
+//
+// and normalize with log-sum-exp. The log posterior of the other
+// genotypes is computed directly as the log-sum-exp of l_h for h != g,
+// shifted by its own largest term, so it keeps full relative precision
+// when P(G = g) is close to one, where 1 - p would cancel.
+
+enum NumericBackend {NUMERIC_XNUMBER = 0, NUMERIC_LOG = 1, NUMERIC_LOGF = 2};
+
+// parse "xnumber", "log" (double) or "logf" (float)
+NumericBackend parseNumericBackend(std::string const & str);
+std::string numericBackendName(NumericBackend backend);
+
+
+class GenotypeKernel {
+public:
+  virtual ~GenotypeKernel() {}
+
+  unsigned genotypeCount() const {return genotypeCount_;}
+  NumericBackend backend() const {return backend_;}
+
+  // log P(G = g | counts) and log P(G != g | counts) of each genotype;
+  // both arrays have genotypeCount() entries
+  virtual void calcLogPosterior(SymbolHistogram const & hist, double * logPP, double * logOther) const = 0;
+
+protected:
+  GenotypeKernel(unsigned genotypeCount, NumericBackend backend) : genotypeCount_(genotypeCount), backend_(backend) {}
+
+  unsigned genotypeCount_;
+  NumericBackend backend_;
+};
+
+
+// Kernel of the log space backends (not NUMERIC_XNUMBER, which is the
+// star engine itself) for a model with 4 or 10 genotypes. The caller
+// deletes it.
+GenotypeKernel * mkGenotypeKernel(StarModel const & starModel, NumericBackend backend);
+
+#endif  // __GenotypeKernel_h
@@ -0,0 +1,314 @@
+#include "ModelBundle.h"
+#include "phy/utils.h"
+#include <boost/cstdint.hpp>
+#include <fstream>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace phy;
+using boost::uint32_t;
+using boost::uint64_t;
+
+// A variant block is
+//
+//   u32 checked sites
+//   u32 state map count, per map:  string name, u32 n, n strings (symbols),
+//                                  u32 m, m times: string meta symbol, u32 k, k x u32 symbol index
+//   u32 potential count, per pot:  string name, u32 rows, u32 cols, (align 8) rows * cols doubles
+//   u32 genotypes, u32 symbols, u32 stride, (align 8) genotypes * stride doubles
+//
+// where a string is a u32 length and the characters, padded to 4 bytes.
+
+static char const BUNDLE_MAGIC[8] = {'S', 'N', 'P', 'E', 'S', 'T', 'M', 'B'};
+static uint32_t const BUNDLE_BYTE_ORDER = 0x01020304;
+static unsigned const BUNDLE_NAME_SIZE = 48;
+static unsigned const BUNDLE_HEADER_SIZE = 24;
+static unsigned const BUNDLE_ENTRY_SIZE = BUNDLE_NAME_SIZE + 16;
+
+
+class BlockWriter {
+public:
+  void align(unsigned n)
+  {
+    while (buf_.size() % n != 0)
+      buf_ += '\0';
+  }
+
+  void put32(uint32_t x) {buf_.append( (char const *) & x, sizeof(x) );}
+  void put64(uint64_t x) {buf_.append( (char const *) & x, sizeof(x) );}
+
+  void putString(string const & s)
+  {
+    put32( s.size() );
+    buf_ += s;
+    align(4);
+  }
+
+  void putDoubles(double const * x, unsigned n)
+  {
+    align(8);
+    buf_.append( (char const *) x, n * sizeof(double) );
+  }
+
+  string const & str() const {return buf_;}
+
+private:
+  string buf_;
+};
+
+
+class BlockReader {
+public:
+  BlockReader(char const * begin, char const * end, string const & file)
+    : begin_(begin), p_(begin), end_(end), file_(file) {}
+
+  void align(unsigned n)
+  {
+    while ( (p_ - begin_) % n != 0 )
+      p_++;
+    need(0);
+  }
+
+  uint32_t get32()
+  {
+    uint32_t x;
+    need( sizeof(x) );
+    memcpy(& x, p_, sizeof(x) );
+    p_ += sizeof(x);
+    return x;
+  }
+
+  string getString()
+  {
+    uint32_t n = get32();
+    need(n);
+    string s(p_, n);
+    p_ += n;
+    align(4);
+    return s;
+  }
+
+  double const * getDoubles(unsigned n)
+  {
+    align(8);
+    need( n * sizeof(double) );
+    double const * x = (double const *) p_;
+    p_ += n * sizeof(double);
+    return x;
+  }
+
+private:
+  void need(size_t n)
+  {
+    if (p_ > end_ or (size_t) (end_ - p_) < n)
+      errorAbort("From ModelBundle: file '" + file_ + "' is truncated or corrupt.");
+  }
+
+  char const * begin_;
+  char const * p_;
+  char const * end_;
+  string const & file_;
+};
+
+
+static string mkVariantBlock(ModelVariant const & v)
+{
+  BlockWriter w;
+  w.put32(v.checkedSites);
+
+  w.put32( v.stateMaps.size() );
+  for (map<string, StateMapSpec>::const_iterator it = v.stateMaps.begin(); it != v.stateMaps.end(); ++it) {
+    StateMapSpec const & sm = it->second;
+    w.putString(sm.name);
+    w.put32( sm.symbols.size() );
+    for (unsigned i = 0; i < sm.symbols.size(); i++)
+      w.putString(sm.symbols[i]);
+    w.put32( sm.metaSymbols.size() );
+    for (map<string, vector<unsigned> >::const_iterator m = sm.metaSymbols.begin(); m != sm.metaSymbols.end(); ++m) {
+      w.putString(m->first);
+      w.put32( m->second.size() );
+      for (unsigned i = 0; i < m->second.size(); i++)
+	w.put32(m->second[i]);
+    }
+  }
+
+  w.put32( v.potentials.size() );
+  for (map<string, PotentialSpec>::const_iterator it = v.potentials.begin(); it != v.potentials.end(); ++it) {
+    PotentialSpec const & pot = it->second;
+    w.putString(pot.name);
+    w.put32(pot.rows);
+    w.put32(pot.cols);
+    w.putDoubles(& pot.values[0], pot.values.size() );
+  }
+
+  w.put32(v.genotypeCount);
+  w.put32(v.symbolCount);
+  w.put32(v.stride);
+  w.putDoubles(v.logEmission, v.genotypeCount * v.stride);
+  return w.str();
+}
+
+
+void writeModelBundle(string const & file, vector<ModelVariant> const & variants)
+{
+  vector<string> blocks;
+  for (unsigned i = 0; i < variants.size(); i++) {
+    if (variants[i].name.size() >= BUNDLE_NAME_SIZE)
+      errorAbort("From writeModelBundle: variant name '" + variants[i].name + "' is too long.");
+    blocks.push_back( mkVariantBlock(variants[i]) );
+  }
+
+  BlockWriter header;
+  header.put32(MODEL_BUNDLE_VERSION);
+  header.put32(BUNDLE_BYTE_ORDER);
+  header.put32( variants.size() );
+  header.put32(0);
+  string out = string(BUNDLE_MAGIC, sizeof(BUNDLE_MAGIC) ) + header.str();
+  assert(out.size() == BUNDLE_HEADER_SIZE);
+
+  // directory, then the blocks at 8 byte aligned offsets
+  uint64_t offset = BUNDLE_HEADER_SIZE + variants.size() * BUNDLE_ENTRY_SIZE;
+  for (unsigned i = 0; i < variants.size(); i++) {
+    string name = variants[i].name;
+    name.resize(BUNDLE_NAME_SIZE, '\0');
+    offset = (offset + 7) / 8 * 8;
+    BlockWriter entry;
+    entry.put64(offset);
+    entry.put64( blocks[i].size() );
+    out += name + entry.str();
+    offset += blocks[i].size();
+  }
+  for (unsigned i = 0; i < variants.size(); i++) {
+    out.resize( (out.size() + 7) / 8 * 8, '\0' );
+    out += blocks[i];
+  }
+
+  ofstream f( file.c_str(), ios::out | ios::binary | ios::trunc );
+  if ( not f )
+    errorAbort("From writeModelBundle: cannot open file '" + file + "' for writing.");
+  f.write( out.data(), out.size() );
+  f.close();
+  if ( f.fail() )
+    errorAbort("From writeModelBundle: error writing file '" + file + "'.");
+}
+
+
+ModelBundle::ModelBundle(string const & file)
+  : file_(file), data_(NULL), size_(0)
+{
+  int fd = open(file.c_str(), O_RDONLY);
+  if (fd < 0)
+    errorAbort("From ModelBundle: cannot open file '" + file + "'.");
+  struct stat st;
+  if (fstat(fd, & st) != 0 or st.st_size < (off_t) BUNDLE_HEADER_SIZE) {
+    close(fd);
+    errorAbort("From ModelBundle: file '" + file + "' is not a model bundle.");
+  }
+  size_ = st.st_size;
+  void * p = mmap(NULL, size_, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED)
+    errorAbort("From ModelBundle: cannot map file '" + file + "'.");
+  data_ = (char const *) p;
+
+  if (memcmp(data_, BUNDLE_MAGIC, sizeof(BUNDLE_MAGIC) ) != 0)
+    errorAbort("From ModelBundle: file '" + file + "' is not a model bundle.");
+  BlockReader r(data_ + sizeof(BUNDLE_MAGIC), data_ + size_, file_);
+  uint32_t version = r.get32();
+  if (r.get32() != BUNDLE_BYTE_ORDER)
+    errorAbort("From ModelBundle: file '" + file + "' was written on a machine with another byte order.");
+  if (version != MODEL_BUNDLE_VERSION)
+    errorAbort("From ModelBundle: file '" + file + "' has version " + toString(version) + ", expected " + toString(MODEL_BUNDLE_VERSION) + ". Recompile it with --compileModel.");
+  uint32_t count = r.get32();
+  r.get32();
+
+  for (unsigned i = 0; i < count; i++) {
+    char const * entry = data_ + BUNDLE_HEADER_SIZE + i * BUNDLE_ENTRY_SIZE;
+    if (entry + BUNDLE_ENTRY_SIZE > data_ + size_)
+      errorAbort("From ModelBundle: file '" + file + "' is truncated or corrupt.");
+    string name( entry, strnlen(entry, BUNDLE_NAME_SIZE) );
+    uint64_t offset, size;
+    memcpy(& offset, entry + BUNDLE_NAME_SIZE, 8);
+    memcpy(& size, entry + BUNDLE_NAME_SIZE + 8, 8);
+    if (offset % 8 != 0 or offset > size_ or size > size_ - offset)
+      errorAbort("From ModelBundle: file '" + file + "' is truncated or corrupt.");
+    directory_[name] = make_pair( (size_t) offset, (size_t) size );
+  }
+}
+
+
+ModelBundle::~ModelBundle()
+{
+  if (data_ != NULL)
+    munmap( (void *) data_, size_ );
+}
+
+
+vector<string> ModelBundle::variantNames() const
+{
+  vector<string> names;
+  for (map<string, pair<size_t, size_t> >::const_iterator it = directory_.begin(); it != directory_.end(); ++it)
+    names.push_back(it->first);
+  return names;
+}
+
+
+ModelVariant ModelBundle::variant(string const & name) const
+{
+  map<string, pair<size_t, size_t> >::const_iterator it = directory_.find(name);
+  if ( it == directory_.end() ) {
+    string names;
+    vector<string> v = variantNames();
+    for (unsigned i = 0; i < v.size(); i++)
+      names += (i > 0 ? ", " : "") + v[i];
+    errorAbort("From ModelBundle: no model '" + name + "' in file '" + file_ + "' (it has " + names + ").");
+  }
+  char const * begin = data_ + it->second.first;
+  BlockReader r(begin, begin + it->second.second, file_);
+
+  ModelVariant v;
+  v.name = name;
+  v.checkedSites = r.get32();
+
+  unsigned mapCount = r.get32();
+  for (unsigned i = 0; i < mapCount; i++) {
+    StateMapSpec sm;
+    sm.name = r.getString();
+    unsigned n = r.get32();
+    for (unsigned j = 0; j < n; j++)
+      sm.symbols.push_back( r.getString() );
+    unsigned m = r.get32();
+    for (unsigned j = 0; j < m; j++) {
+      vector<unsigned> & covered = sm.metaSymbols[ r.getString() ];
+      unsigned k = r.get32();
+      for (unsigned l = 0; l < k; l++) {
+	covered.push_back( r.get32() );
+	if (covered.back() >= n)
+	  errorAbort("From ModelBundle: file '" + file_ + "' is truncated or corrupt.");
+      }
+    }
+    v.stateMaps[sm.name] = sm;
+  }
+
+  unsigned potCount = r.get32();
+  for (unsigned i = 0; i < potCount; i++) {
+    PotentialSpec pot;
+    pot.name = r.getString();
+    pot.rows = r.get32();
+    pot.cols = r.get32();
+    double const * x = r.getDoubles(pot.rows * pot.cols);
+    pot.values.assign(x, x + pot.rows * pot.cols);
+    v.potentials[pot.name] = pot;
+  }
+
+  v.genotypeCount = r.get32();
+  v.symbolCount = r.get32();
+  v.stride = r.get32();
+  if (v.stride != v.symbolCount + 1)
+    errorAbort("From ModelBundle: file '" + file_ + "' is truncated or corrupt.");
+  v.logEmission = r.getDoubles(v.genotypeCount * v.stride);
+  return v;
+}
@@ -0,0 +1,73 @@
+#ifndef __ModelBundle_h
+#define __ModelBundle_h
+
+#include "ModelSpec.h"
+#include <string>
+#include <vector>
+#include <map>
+#include <cstddef>
+
+// Precompiled SNPest models in one binary file (made with
+// dfgEval_SNPest --compileModel). The file holds a variant for each
+// ploidity/model combination of a dfgspec directory (e.g.
+// "diploid_error" for diploid_stateMaps.txt and
+// diploid_error_factorPotentials.txt) with its state maps, potential
+// matrices and log emission table (as used by EmissionTable).
+//
+// The file is opened read only with mmap, so processes using the same
+// bundle share one copy of it in the page cache. Only the emission table
+// is used in place, by the --batch engine (EmissionTable); the state
+// maps and potentials, a few kilobytes, are copied into each process
+// (ModelVariant) and the star engine computes its own factors from
+// them, so without --batch the resident memory of each process is much
+// the same as with the dfgspec files. Layout (native byte order, checked when opened):
+//
+//   header:    char magic[8] = "SNPESTMB", u32 version, u32 byte order mark, u32 variant count, u32 0
+//   directory: per variant: char name[48], u64 offset, u64 size
+//   variants:  8 byte aligned blocks, see ModelBundle.cpp
+unsigned const MODEL_BUNDLE_VERSION = 1;
+
+struct ModelVariant {
+  std::string name;
+  std::map<std::string, StateMapSpec> stateMaps;
+  std::map<std::string, PotentialSpec> potentials;
+
+  // log emission table, genotype major with rows of stride entries (see EmissionTable)
+  unsigned genotypeCount, symbolCount, stride;
+  double const * logEmission;
+
+  // number of sites on which the star engine was checked against the DFG when compiled
+  unsigned checkedSites;
+
+  ModelVariant() : genotypeCount(0), symbolCount(0), stride(0), logEmission(NULL), checkedSites(0) {}
+};
+
+// Write the variants to file (the emission tables are copied).
+void writeModelBundle(std::string const & file, std::vector<ModelVariant> const & variants);
+
+
+class ModelBundle {
+public:
+  // map the file; aborts if it is not a bundle of this version
+  ModelBundle(std::string const & file);
+  ~ModelBundle();
+
+  std::vector<std::string> variantNames() const;
+
+  // the variant with the given name (aborts if missing). The state maps
+  // and potentials are copies; the emission table points into the
+  // mapping and is valid while this object is.
+  ModelVariant variant(std::string const & name) const;
+
+private:
+  ModelBundle(ModelBundle const &);
+  ModelBundle & operator=(ModelBundle const &);
+
+  std::string file_;
+  char const * data_;
+  std::size_t size_;
+  // variant name -> (offset, size) of its block
+  std::map<std::string, std::pair<std::size_t, std::size_t> > directory_;
+};
+
+#endif  // __ModelBundle_h
@@ -0,0 +1,234 @@
+#include "ModelSpec.h"
+#include "phy/utils.h"
+#include <cstdlib>
+#include <cctype>
+#include <cstdio>
+
+using namespace phy;
+
+
+static bool isKeyLine(string const & line, string & key, string & value)
+{
+  string::size_type i = 0;
+  while (i < line.size() and (isupper(line[i]) or isdigit(line[i]) or line[i] == '_') )
+    i++;
+  if (i == 0 or i >= line.size() or line[i] != ':')
+    return false;
+  key = line.substr(0, i);
+  value = line.substr(i + 1);
+  return true;
+}
+
+
+static string stripBlanks(string const & s)
+{
+  string::size_type b = s.find_first_not_of(" \t\r");
+  if (b == string::npos)
+    return "";
+  string::size_type e = s.find_last_not_of(" \t\r");
+  return s.substr(b, e - b + 1);
+}
+
+
+static vector<string> splitBlanks(string const & s)
+{
+  vector<string> v;
+  string::size_type i = 0;
+  while (true) {
+    i = s.find_first_not_of(" \t\r", i);
+    if (i == string::npos)
+      break;
+    string::size_type j = s.find_first_of(" \t\r", i);
+    v.push_back( s.substr(i, j == string::npos ? string::npos : j - i) );
+    if (j == string::npos)
+      break;
+    i = j;
+  }
+  return v;
+}
+
+
+vector<Stanza> readStanzaFile(string const & file)
+{
+  ifstream f;
+  openInFile(f, file);
+
+  vector<Stanza> stanzas;
+  Stanza cur;
+  string lastKey, line, pending;
+  while ( getline(f, line) ) {
+    // line continuation
+    if (line.size() > 0 and line[line.size() - 1] == '\\') {
+      pending += line.substr(0, line.size() - 1);
+      continue;
+    }
+    line = pending + line;
+    pending.clear();
+
+    string s = stripBlanks(line);
+    if (s.size() > 0 and s[0] == '#')
+      continue;
+    if (s.size() == 0) {
+      if (cur.size() > 0)
+	stanzas.push_back(cur);
+      cur.clear();
+      lastKey.clear();
+      continue;
+    }
+    string key, value;
+    if ( isKeyLine(s, key, value) ) {
+      if (cur.count(key) != 0) {
+	// a repeated key starts a new stanza
+	stanzas.push_back(cur);
+	cur.clear();
+      }
+      cur[key] = stripBlanks(value);
+      lastKey = key;
+    }
+    else {
+      if ( lastKey.empty() )
+	errorAbort("From readStanzaFile: unexpected line in file '" + file + "':\n" + line);
+      cur[lastKey] += " " + s;
+    }
+  }
+  if (cur.size() > 0)
+    stanzas.push_back(cur);
+  return stanzas;
+}
+
+
+string const & stanzaValue(Stanza const & stanza, string const & key, string const & file)
+{
+  Stanza::const_iterator it = stanza.find(key);
+  if ( it == stanza.end() )
+    errorAbort("From stanzaValue: missing '" + key + ":' in stanza of file '" + file + "'.");
+  return it->second;
+}
+
+
+map<string, StateMapSpec> readStateMapSpecs(string const & file)
+{
+  map<string, StateMapSpec> specs;
+  vector<Stanza> stanzas = readStanzaFile(file);
+  for (unsigned i = 0; i < stanzas.size(); i++) {
+    StateMapSpec sm;
+    sm.name = stanzaValue(stanzas[i], "NAME", file);
+    sm.symbols = splitBlanks( stanzaValue(stanzas[i], "SYMBOLS", file) );
+    map<string, unsigned> index;
+    for (unsigned j = 0; j < sm.symbols.size(); j++)
+      index[ sm.symbols[j] ] = j;
+
+    if (stanzas[i].count("META_SYMBOLS") != 0) {
+      vector<string> metas = split(stanzas[i]["META_SYMBOLS"], ";");
+      for (unsigned j = 0; j < metas.size(); j++) {
+	if (stripBlanks(metas[j]).empty())
+	  continue;
+	vector<string> v = split(metas[j], "=");
+	if (v.size() != 2)
+	  errorAbort("From readStateMapSpecs: malformed meta symbol '" + metas[j] + "' in file '" + file + "'.");
+	vector<unsigned> & covered = sm.metaSymbols[ stripBlanks(v[0]) ];
+	vector<string> syms = splitBlanks(v[1]);
+	for (unsigned k = 0; k < syms.size(); k++) {
+	  if (index.count(syms[k]) == 0)
+	    errorAbort("From readStateMapSpecs: meta symbol '" + v[0] + "' refers to unknown symbol '" + syms[k] + "' in file '" + file + "'.");
+	  covered.push_back( index[ syms[k] ] );
+	}
+      }
+    }
+    specs[sm.name] = sm;
+  }
+  return specs;
+}
+
+
+PotentialSpec parsePotentialMatrix(string const & str, string const & name)
+{
+  PotentialSpec pot;
+  pot.name = name;
+  string::size_type b = str.find('['), e = str.find(']');
+  if (b == string::npos or e == string::npos or e < b)
+    errorAbort("From parsePotentialMatrix: missing dimensions in matrix of potential '" + name + "'.");
+  vector<string> dims = split(str.substr(b + 1, e - b - 1), ",");
+  if (dims.size() != 2)
+    errorAbort("From parsePotentialMatrix: malformed dimensions in matrix of potential '" + name + "'.");
+  pot.rows = atoi( dims[0].c_str() );
+  pot.cols = atoi( dims[1].c_str() );
+
+  char const * p = str.c_str() + e + 1;
+  while (*p != '\0') {
+    if ( isdigit(*p) or *p == '.' or *p == '-' or *p == '+' ) {
+      char * end;
+      double x = strtod(p, & end);
+      if (end == p)
+	errorAbort("From parsePotentialMatrix: malformed number in matrix of potential '" + name + "'.");
+      pot.values.push_back(x);
+      p = end;
+    }
+    else
+      p++;
+  }
+  if (pot.values.size() != pot.rows * pot.cols)
+    errorAbort("From parsePotentialMatrix: potential '" + name + "' has " + toString(pot.values.size()) + " values but dimensions [" + toString(pot.rows) + ", " + toString(pot.cols) + "].");
+  return pot;
+}
+
+
+map<string, PotentialSpec> readPotentialSpecs(string const & file)
+{
+  map<string, PotentialSpec> specs;
+  vector<Stanza> stanzas = readStanzaFile(file);
+  for (unsigned i = 0; i < stanzas.size(); i++) {
+    string const & name = stanzaValue(stanzas[i], "NAME", file);
+    specs[name] = parsePotentialMatrix( stanzaValue(stanzas[i], "POT_MAT", file), name);
+  }
+  return specs;
+}
+
+
+void writePotentialSpec(ostream & str, PotentialSpec const & pot, string const & type)
+{
+  str << "NAME:\t\t" << pot.name << "\n";
+  str << "TYPE:\t\t" << type << "\n";
+  str << "POT_MAT:\t[" << pot.rows << ", " << pot.cols << "] (";
+  char buf[32];
+  for (unsigned i = 0; i < pot.rows; i++) {
+    str << (i == 0 ? "(" : " (");
+    for (unsigned j = 0; j < pot.cols; j++) {
+      sprintf(buf, "%.10g", pot(i, j) );
+      str << (j == 0 ? "" : ", ") << buf;
+    }
+    str << (i + 1 < pot.rows ? "),\n" : "))\n");
+  }
+  str << "\n";
+}
+
+
+vector<FactorSpec> readFactorGraphSpec(string const & file)
+{
+  vector<FactorSpec> facs;
+  vector<Stanza> stanzas = readStanzaFile(file);
+  for (unsigned i = 0; i < stanzas.size(); i++) {
+    FactorSpec fac;
+    fac.name = stanzaValue(stanzas[i], "NAME", file);
+    fac.potential = stanzaValue(stanzas[i], "POT", file);
+    fac.neighbors.push_back( stanzaValue(stanzas[i], "NB1", file) );
+    if (stanzas[i].count("NB2") != 0)
+      fac.neighbors.push_back( stanzas[i]["NB2"] );
+    facs.push_back(fac);
+  }
+  return facs;
+}
+
+
+map<string, string> readVariablesSpec(string const & file)
+{
+  map<string, string> varMaps;
+  vector<Stanza> stanzas = readStanzaFile(file);
+  for (unsigned i = 0; i < stanzas.size(); i++) {
+    string const & mapName = stanzaValue(stanzas[i], "STATE_MAP_NAME", file);
+    vector<string> vars = splitBlanks( stanzaValue(stanzas[i], "VAR_NAMES", file) );
+    for (unsigned j = 0; j < vars.size(); j++)
+      varMaps[ vars[j] ] = mapName;
+  }
+  return varMaps;
+}
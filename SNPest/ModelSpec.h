@@ -0,0 +1,67 @@
+#ifndef __ModelSpec_h
+#define __ModelSpec_h
+
+#include <string>
+#include <vector>
+#include <map>
+#include <ostream>
+
+// Light-weight readers for the dfgspec files (stateMaps.txt,
+// factorPotentials.txt, variables.txt and factorGraph.txt). The DFG
+// code in phy reads the same files; these readers give direct access
+// to the symbols and potential matrices for the specialized engines.
+
+// A stanza is a set of 'KEY:  value' lines separated from the next
+// stanza by a blank line. Lines starting with '#' are comments, a
+// trailing backslash joins a line with the next, and lines not starting
+// with a key continue the value of the previous key.
+typedef std::map<std::string, std::string> Stanza;
+
+std::vector<Stanza> readStanzaFile(std::string const & file);
+
+// value of key in stanza, aborts if missing
+std::string const & stanzaValue(Stanza const & stanza, std::string const & key, std::string const & file);
+
+
+struct StateMapSpec {
+  std::string name;
+  std::vector<std::string> symbols;
+  // meta symbol -> indices of the symbols it covers
+  std::map<std::string, std::vector<unsigned> > metaSymbols;
+};
+
+std::map<std::string, StateMapSpec> readStateMapSpecs(std::string const & file);
+
+
+// Dense row major matrix as given by POT_MAT in factorPotentials.txt
+struct PotentialSpec {
+  std::string name;
+  unsigned rows, cols;
+  std::vector<double> values;
+
+  double operator()(unsigned i, unsigned j) const {return values[i * cols + j];}
+};
+
+std::map<std::string, PotentialSpec> readPotentialSpecs(std::string const & file);
+
+// parse matrix in ublas format, e.g. "[2, 2] ((1, 0), (0, 1))"
+PotentialSpec parsePotentialMatrix(std::string const & str, std::string const & name);
+
+// write pot as a stanza of factorPotentials.txt of the given TYPE
+// (rowNorm, colNorm or globNorm), one row of the matrix per line
+void writePotentialSpec(std::ostream & str, PotentialSpec const & pot, std::string const & type);
+
+
+// One factor of factorGraph.txt; only one and two neighbor factors are used in the dfgspecs
+struct FactorSpec {
+  std::string name;
+  std::vector<std::string> neighbors;
+  std::string potential;
+};
+
+std::vector<FactorSpec> readFactorGraphSpec(std::string const & file);
+
+// variable name -> state map name
+std::map<std::string, std::string> readVariablesSpec(std::string const & file);
+
+#endif  // __ModelSpec_h
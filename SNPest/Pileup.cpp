@@ -0,0 +1,591 @@
+#include "Pileup.h"
+#include "phy/utils.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cctype>
+#include <algorithm>
+
+using namespace phy;
+
+
+char normalizeBase(char c)
+{
+  switch ( toupper(c) ) {
+  case 'A': return 'A';
+  case 'C': return 'C';
+  case 'G': return 'G';
+  case 'T': return 'T';
+  default:  return 'N';
+  }
+}
+
+
+string mkObsSymbol(char base, unsigned qual)
+{
+  char buf[8];
+  sprintf(buf, "%c%u", base, qual);
+  return string(buf);
+}
+
+
+static char const CODE_BASES[] = "ACGTN";
+
+string nucleotideCodeSymbol(symbol_code_t code)
+{
+  return string(1, CODE_BASES[code]);
+}
+
+
+string obsCodeSymbol(symbol_code_t code)
+{
+  return mkObsSymbol(CODE_BASES[code / SYMBOL_QUALS], code % SYMBOL_QUALS);
+}
+
+
+// split on runs of blanks and tabs (as split(/[ \t]+/) in SNPest.pl)
+// into the ranges [begin[i], end[i]) of line, without copying; returns
+// the number of fields. The vectors are reused.
+static unsigned splitFields(string const & line, vector<string::size_type> & begin, vector<string::size_type> & end)
+{
+  unsigned count = 0;
+  string::size_type i = 0, n = line.size();
+  while (i < n) {
+    while (i < n and (line[i] == ' ' or line[i] == '\t'))
+      i++;
+    if (i == n)
+      break;
+    string::size_type j = i;
+    while (j < n and line[j] != ' ' and line[j] != '\t')
+      j++;
+    if (begin.size() <= count) {
+      begin.resize(count + 1);
+      end.resize(count + 1);
+    }
+    begin[count] = i;
+    end[count++] = j;
+    i = j;
+  }
+  return count;
+}
+
+
+static void appendUnsigned(string & s, unsigned long x)
+{
+  char buf[24];
+  int n = sprintf(buf, "%lu", x);
+  s.append(buf, n);
+}
+
+
+// same formatting of real numbers as perl uses when printing
+static void appendPerlNumber(string & s, double x)
+{
+  char buf[32];
+  int n = sprintf(buf, "%.15g", x);
+  s.append(buf, n);
+}
+
+
+// id prefix chrom_pos_ref_
+static void assignIdPrefix(string & id, string const & chrom, string const & pos, char ref)
+{
+  id.assign(chrom);
+  id += '_';
+  id += pos;
+  id += '_';
+  id += ref;
+  id += '_';
+}
+
+
+void mkSiteId(string & id, string const & chrom, SiteIdFields const & f)
+{
+  id.assign(chrom);
+  id += '_';
+  appendUnsigned(id, f.pos);
+  id += '_';
+  id += f.ref;
+  id += '_';
+  appendUnsigned(id, f.avMapQ);
+  id += '_';
+  appendUnsigned(id, f.depth);
+  if (f.kind == SITE_ID_INSERTION) {
+    id += ";INS=";
+    appendUnsigned(id, f.count);
+  }
+  else if (f.kind == SITE_ID_DELETED or f.count > 0) {
+    id += ";DEL=";
+    appendUnsigned(id, f.count);
+    id += ";FRACDEL=";
+    if (f.kind == SITE_ID_DELETED)
+      id += "1.0";
+    else
+      appendPerlNumber(id, (double) f.count / (f.count + f.depth) );
+  }
+}
+
+
+// the decimal number in [b, e) of s
+static bool parseUnsigned(string const & s, string::size_type b, string::size_type e, unsigned long & x)
+{
+  if (b >= e or e - b > 10)
+    return false;
+  x = 0;
+  for (string::size_type i = b; i < e; i++) {
+    if ( not isdigit(s[i]) )
+      return false;
+    x = 10 * x + (s[i] - '0');
+  }
+  return true;
+}
+
+
+bool parseSiteId(string const & id, string & chrom, SiteIdFields & f)
+{
+  // chrom_pos_ref_avmapq_depth, then the INFO fields
+  string::size_type end = id.find(';');
+  if (end == string::npos)
+    end = id.size();
+  string::size_type sep[4];
+  string::size_type e = end;
+  for (unsigned k = 4; k-- > 0; ) {
+    sep[k] = (e == 0) ? string::npos : id.rfind('_', e - 1);
+    if (sep[k] == string::npos)
+      return false;
+    e = sep[k];
+  }
+  unsigned long avMapQ, depth, count = 0;
+  if ( sep[2] != sep[1] + 2 or not parseUnsigned(id, sep[0] + 1, sep[1], f.pos) or not parseUnsigned(id, sep[2] + 1, sep[3], avMapQ) or not parseUnsigned(id, sep[3] + 1, end, depth) )
+    return false;
+  chrom.assign(id, 0, sep[0]);
+  f.ref = id[sep[1] + 1];
+  f.avMapQ = avMapQ;
+  f.depth = depth;
+  f.kind = SITE_ID_SITE;
+  if (end < id.size()) {
+    string::size_type b = end + 5, e = id.find(';', b);
+    if (e == string::npos)
+      e = id.size();
+    if ( not parseUnsigned(id, b, e, count) )
+      return false;
+    if (id.compare(end, 5, ";INS=") == 0)
+      f.kind = SITE_ID_INSERTION;
+    else if (id.compare(end, 5, ";DEL=") != 0)
+      return false;
+    else if (id.compare(e, string::npos, ";FRACDEL=1.0") == 0)
+      f.kind = SITE_ID_DELETED;
+  }
+  f.count = count;
+  return true;
+}
+
+
+string GenomicRegion::str() const
+{
+  if ( empty() )
+    return "";
+  string s = chrom + ":";
+  appendUnsigned(s, beg);
+  if (end != ULONG_MAX) {
+    s += '-';
+    appendUnsigned(s, end);
+  }
+  return s;
+}
+
+
+GenomicRegion parseRegion(string const & str)
+{
+  GenomicRegion region;
+  string::size_type colon = str.find_last_of(':');
+  region.chrom = str.substr(0, colon);
+  if (colon != string::npos) {
+    string range;
+    for (string::size_type i = colon + 1; i < str.size(); i++)
+      if (str[i] != ',')
+	range += str[i];
+    char * end;
+    region.beg = strtoul(range.c_str(), & end, 10);
+    if (*end == '-' and end[1] != '\0')
+      region.end = strtoul(end + 1, & end, 10);
+    else if (*end == '-')
+      end++;
+    if (*end != '\0' or range.empty() or region.beg == 0 or region.end < region.beg)
+      errorAbort("From parseRegion: malformed region '" + str + "'. Use chr, chr:beg, or chr:beg-end.");
+  }
+  if ( region.chrom.empty() )
+    errorAbort("From parseRegion: malformed region '" + str + "'. Use chr, chr:beg, or chr:beg-end.");
+  return region;
+}
+
+
+PileupReader::PileupReader(unsigned maxDepth, unsigned qualBase, bool noRef)
+  : ref_('N'), maxInsLength_(0), lineCount_(0), qualBase_(qualBase), sampleCount_(1), multiSample_(false), symbolStrings_(true), maxDepth_(maxDepth), noRef_(noRef), deletions_(0), avMapQ_(0)
+{
+  if (maxDepth_ == 0)
+    errorAbort("From PileupReader: maxDepth must be positive.");
+}
+
+
+void PileupReader::mkSiteRecord(SiteRecord & rec)
+{
+  // reads not deleted at this position
+  selected_.clear();
+  deletions_ = 0;
+  for (unsigned i = 0; i < reads_.size(); i++) {
+    if (reads_[i] == '*')
+      deletions_++;
+    else
+      selected_.push_back(i);
+  }
+  unsigned depth = selected_.size();
+
+  if (depth == 0) {
+    // whole position is deleted: mark and call with N
+    avMapQ_ = 0;
+    assignIdPrefix(rec.id, chrom_, pos_, ref_);
+    appendUnsigned(rec.id, qualBase_);
+    rec.id += "_1;DEL=";
+    appendUnsigned(rec.id, deletions_);
+    rec.id += ";FRACDEL=1.0";
+    rec.codes.resize(2);
+    rec.codes[0] = nucleotideCode('N');
+    rec.codes[1] = obsCode('N', qualBase_);
+    rec.depth = 1;
+    mkSymbols(rec);
+    return;
+  }
+
+  // randomly down sample to maxDepth reads
+  if (depth > maxDepth_) {
+    for (unsigned i = 0; i < maxDepth_; i++) {
+      unsigned j = i + rand() % (depth - i);
+      std::swap(selected_[i], selected_[j]);
+    }
+    selected_.resize(maxDepth_);
+  }
+
+  // use the minimum of base quality, mapping quality, and PILEUP_MAX_QUAL
+  unsigned long mapQSum = 0;
+  rec.codes.resize( selected_.size() + 1 );
+  for (unsigned k = 0; k < selected_.size(); k++) {
+    unsigned i = selected_[k];
+    int bq = baseQ_[i];
+    int mq = mapQ_[i];
+    mapQSum += (mq > 0) ? mq : 0;
+    int q = std::min( std::min(bq, mq), (int) PILEUP_MAX_QUAL);
+    rec.codes[k + 1] = obsCode(normalizeBase(reads_[i]), (q > 0) ? q : 1);
+  }
+  avMapQ_ = (unsigned) ( (double) mapQSum / selected_.size() + 0.5);
+  rec.depth = selected_.size();
+
+  assignIdPrefix(rec.id, chrom_, pos_, ref_);
+  appendUnsigned(rec.id, avMapQ_);
+  rec.id += '_';
+  appendUnsigned(rec.id, depth);
+  if (deletions_ > 0) {
+    rec.id += ";DEL=";
+    appendUnsigned(rec.id, deletions_);
+    rec.id += ";FRACDEL=";
+    appendPerlNumber(rec.id, (double) deletions_ / (deletions_ + depth) );
+  }
+  rec.codes[0] = nucleotideCode( noRef_ ? 'N' : normalizeBase(ref_) );
+  mkSymbols(rec);
+}
+
+
+// the symbol strings of the codes of rec, if they are made
+void PileupReader::mkSymbols(SiteRecord & rec)
+{
+  if (symbolStrings_)
+    mkSymbolStrings(rec);
+  else
+    rec.symbols.clear();
+}
+
+
+void mkSymbolStrings(SiteRecord & rec)
+{
+  rec.symbols.resize( rec.codes.size() );
+  rec.symbols[0] = nucleotideCodeSymbol(rec.codes[0]);
+  for (unsigned k = 1; k < rec.codes.size(); k++)
+    rec.symbols[k] = obsCodeSymbol(rec.codes[k]);
+}
+
+
+// pseudo site for the offset'th inserted position after this site; the
+// inserted bases get the average mapping quality of the site
+void PileupReader::mkInsertionRecord(SiteRecord & rec, unsigned offset)
+{
+  unsigned q = std::min(avMapQ_, PILEUP_MAX_QUAL);
+  if (q == 0)
+    q = 1;
+  rec.codes.resize(1);
+  rec.codes[0] = nucleotideCode('N');
+  for (unsigned j = 0; j < insertions_.size() and rec.codes.size() <= maxDepth_; j++)
+    if (insertions_[j].size() > offset)
+      rec.codes.push_back( obsCode(insertions_[j][offset], q) );
+  rec.depth = rec.codes.size() - 1;
+  mkSymbols(rec);
+  unsigned reported = (rec.depth == maxDepth_) ? insertions_.size() : rec.depth;
+  assignIdPrefix(rec.id, chrom_, pos_, 'N');
+  appendUnsigned(rec.id, avMapQ_);
+  rec.id += '_';
+  appendUnsigned(rec.id, reported);
+  rec.id += ";INS=";
+  appendUnsigned(rec.id, reported);
+}
+
+
+// site without reads, of a sample of multi-sample input
+void PileupReader::mkEmptyRecord(SiteRecord & rec, char ref)
+{
+  rec.codes.assign( 1, nucleotideCode(ref) );
+  rec.depth = 0;
+  mkSymbols(rec);
+  assignIdPrefix(rec.id, chrom_, pos_, ref);
+  rec.id += "0_0";
+}
+
+
+bool PileupReader::readSample(unsigned)
+{
+  errorAbort("From PileupReader::readSample: the input is not multi-sample input.");
+  return false;
+}
+
+
+unsigned PileupReader::nextSamples(vector<SiteRecord> & records)
+{
+  unsigned sc = sampleCount_;
+  if (records.size() < sc)
+    records.resize(sc);
+  sampleInsLength_.resize(sc);
+  unsigned insLength = 0;
+  for (unsigned s = 0; s < sc; s++) {
+    if ( not readSample(s) ) {
+      mkEmptyRecord(records[s], noRef_ ? 'N' : normalizeBase(ref_) );
+      sampleInsLength_[s] = 0;
+      continue;
+    }
+    if (records.size() < (1 + maxInsLength_) * sc)
+      records.resize( (1 + maxInsLength_) * sc );
+    mkSiteRecord(records[s]);
+    for (unsigned i = 0; i < maxInsLength_; i++)
+      mkInsertionRecord(records[(i + 1) * sc + s], i);
+    sampleInsLength_[s] = maxInsLength_;
+    insLength = max(insLength, maxInsLength_);
+  }
+  // pseudo sites of the samples with shorter insertions
+  for (unsigned s = 0; s < sc; s++)
+    for (unsigned i = sampleInsLength_[s]; i < insLength; i++)
+      mkEmptyRecord(records[(i + 1) * sc + s], 'N');
+  return (1 + insLength) * sc;
+}
+
+
+unsigned PileupReader::next(vector<SiteRecord> & records)
+{
+  if ( not readSite() )
+    return 0;
+  if (multiSample_) {
+    unsigned count = nextSamples(records);
+    lineCount_++;
+    return count;
+  }
+  lineCount_++;
+  unsigned count = 1 + maxInsLength_;
+  if (records.size() < count)
+    records.resize(count);
+  mkSiteRecord(records[0]);
+  for (unsigned i = 0; i < maxInsLength_; i++)
+    mkInsertionRecord(records[i + 1], i);
+  return count;
+}
+
+
+MpileupReader::MpileupReader(istream & str, unsigned maxDepth, unsigned qualBase, bool noRef, GenomicRegion const & region, unsigned sampleCount)
+  : PileupReader(maxDepth, qualBase, noRef), str_(str), region_(region), inRegion_(false)
+{
+  multiSample_ = (sampleCount > 0);
+  sampleCount_ = multiSample_ ? sampleCount : 1;
+}
+
+
+// Reduce the read string of a pileup line to one character per read:
+// read starts (^ and the mapping quality following it) and read ends
+// ($) are dropped, '.' and ',' become the reference base, the bases of
+// indels (+N/-N followed by N bases) are removed from the read string
+// and inserted sequences are remembered. Deleted reads ('*', or '#' on
+// the reverse strand in newer samtools) are kept as '*' since they have
+// a quality value.
+void MpileupReader::parseBases(char const * bases, string::size_type n, char ref)
+{
+  reads_.clear();
+  unsigned insCount = 0;
+  maxInsLength_ = 0;
+  for (string::size_type i = 0; i < n; i++) {
+    char c = bases[i];
+    switch (c) {
+    case '^':
+      i++; // skip mapping quality of read start
+      break;
+    case '$':
+      break;
+    case '+':
+    case '-': {
+      unsigned len = 0;
+      while (i + 1 < n and isdigit(bases[i + 1]) ) {
+	len = 10 * len + (bases[i + 1] - '0');
+	i++;
+      }
+      if (i + len >= n)
+	len = n - i - 1;
+      if (c == '+') {
+	if (insCount == insertions_.size())
+	  insertions_.push_back("");
+	string & ins = insertions_[insCount++];
+	ins.assign(bases + i + 1, len);
+	for (unsigned k = 0; k < len; k++)
+	  ins[k] = normalizeBase(ins[k]);
+	if (len > maxInsLength_)
+	  maxInsLength_ = len;
+      }
+      i += len;
+      break;
+    }
+    case '.':
+    case ',':
+      reads_ += ref;
+      break;
+    case '*':
+    case '#':
+      reads_ += '*';
+      break;
+    default:
+      reads_ += toupper(c);
+    }
+  }
+  insertions_.resize(insCount);
+}
+
+
+bool MpileupReader::readSite()
+{
+  while ( getline(str_, line_) ) {
+    unsigned fieldCount = splitFields(line_, fieldBegin_, fieldEnd_);
+    if (fieldCount == 0) {
+      lineCount_++;
+      continue;
+    }
+    if (fieldCount < 7)
+      errorAbort("From MpileupReader: line " + toString(lineCount_ + 1) + " has fewer than the seven columns of 'samtools mpileup -s' output:\n" + line_);
+    if (fieldCount < 3 + 4 * sampleCount_)
+      errorAbort("From MpileupReader: line " + toString(lineCount_ + 1) + " has fewer than the " + toString(3 + 4 * sampleCount_) + " columns of 'samtools mpileup -s' output of " + toString(sampleCount_) + " samples:\n" + line_);
+
+    chrom_.assign(line_, fieldBegin_[0], fieldEnd_[0] - fieldBegin_[0]);
+    if ( not region_.empty() ) {
+      if ( region_.contains(chrom_, strtoul(line_.c_str() + fieldBegin_[1], NULL, 10) ) )
+	inRegion_ = true;
+      else if (inRegion_)
+	return false;
+      else {
+	lineCount_++;
+	continue;
+      }
+    }
+
+    pos_.assign(line_, fieldBegin_[1], fieldEnd_[1] - fieldBegin_[1]);
+    ref_ = toupper(line_[ fieldBegin_[2] ]);
+    if (not multiSample_)
+      readSample(0);
+    return true;
+  }
+  return false;
+}
+
+
+// the columns of sample s of the line; a sample without reads has depth
+// 0 and '*' for the bases and qualities
+bool MpileupReader::readSample(unsigned s)
+{
+  unsigned c = 3 + 4 * s;
+  if ( multiSample_ and fieldEnd_[c] - fieldBegin_[c] == 1 and line_[ fieldBegin_[c] ] == '0' )
+    return false;
+  char const * line = line_.data();
+  parseBases(line + fieldBegin_[c + 1], fieldEnd_[c + 1] - fieldBegin_[c + 1], ref_);
+  char const * quals = line + fieldBegin_[c + 2];
+  char const * mapqs = line + fieldBegin_[c + 3];
+  if ( reads_.size() != fieldEnd_[c + 2] - fieldBegin_[c + 2] or reads_.size() != fieldEnd_[c + 3] - fieldBegin_[c + 3] )
+    errorAbort("From MpileupReader: line " + toString(lineCount_ + 1) + " has unequal number of bases and qualities:\n" + line_);
+  baseQ_.resize( reads_.size() );
+  mapQ_.resize( reads_.size() );
+  for (unsigned i = 0; i < reads_.size(); i++) {
+    baseQ_[i] = (int) (unsigned char) quals[i] - (int) qualBase_;
+    mapQ_[i] = (int) (unsigned char) mapqs[i] - (int) qualBase_;
+  }
+  return true;
+}
+
+
+// .tab files
+
+void checkTabHeader(string const & header, string const & file)
+{
+  bool ok = (header == "NAME:\tC" or header.compare(0, 8, "NAME:\tC\t") == 0);
+  string::size_type b = 8;
+  for (unsigned i = 1; ok and b < header.size(); i++) {
+    string::size_type e = header.find('\t', b);
+    if (e == string::npos)
+      e = header.size();
+    ok = ( header.compare(b, e - b, "O" + toString(i)) == 0 );
+    b = e + 1;
+  }
+  if (not ok)
+    errorAbort("From checkTabHeader: the header of '" + file + "' must be 'NAME:' followed by the columns C, O1, O2, ... separated by tabs.");
+}
+
+
+unsigned readTabRecord(istream & input, SiteRecord & rec, string & line)
+{
+  if ( not getline(input, line) )
+    return 0;
+  string::size_type b = 0, e = line.find('\t');
+  rec.id.assign(line, 0, e);
+  rec.codes.clear();
+  unsigned n = 0;
+  while (e != string::npos) {
+    b = e + 1;
+    e = line.find('\t', b);
+    if (rec.symbols.size() <= n)
+      rec.symbols.resize(n + 1);
+    rec.symbols[n++].assign(line, b, e == string::npos ? string::npos : e - b);
+  }
+  rec.symbols.resize(n);
+  rec.depth = (n > 0) ? n - 1 : 0;
+  return 1;
+}
+
+
+unsigned idDepth(string const & id)
+{
+  return (unsigned) atoi( id.c_str() + id.find_last_of('_') + 1 );
+}
+
+
+string mkTabHeader(unsigned maxDepth)
+{
+  string header = "NAME:\tC";
+  for (unsigned i = 1; i <= maxDepth; i++)
+    header += "\tO" + toString(i);
+  return header;
+}
+
+
+void writeTabRecord(ostream & str, SiteRecord const & rec)
+{
+  str << rec.id;
+  for (unsigned i = 0; i < rec.symbols.size(); i++)
+    str << '\t' << rec.symbols[i];
+  str << '\n';
+}
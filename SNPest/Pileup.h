@@ -0,0 +1,220 @@
+#ifndef __Pileup_h
+#define __Pileup_h
+
+#include <string>
+#include <vector>
+#include <istream>
+#include <ostream>
+#include <climits>
+
+// Native replacement for the pileup parsing in SNPest.pl. Each line of
+// 'samtools mpileup' output (or each covered position of a BAM/CRAM
+// file) is turned into one or more site records with the same content
+// as the lines SNPest.pl writes to its .tab file, i.e. an identifier of
+// the form id_pos_ref_avmapq_depth followed by the symbols for C, O1,
+// ..., On.
+
+// maximum base quality used (the inputMap only defines symbols A1..T50)
+unsigned const PILEUP_MAX_QUAL = 50;
+
+
+// Integer codes of the symbols of a site, so the input path need not
+// make a string per read: C (a nucleotide, e.g. A) is the index of its
+// base in A, C, G, T, N and an observation (e.g. A37) is the index of
+// its base times SYMBOL_QUALS plus its quality. Models map the codes
+// to their states through tables (see StarModel).
+typedef unsigned short symbol_code_t;
+unsigned const SYMBOL_QUALS = 256;
+unsigned const SYMBOL_CODE_COUNT = 5 * SYMBOL_QUALS;
+
+// index of a normalized base (see normalizeBase) in A, C, G, T, N
+inline unsigned baseCode(char base)
+{
+  switch (base) {
+  case 'A': return 0;
+  case 'C': return 1;
+  case 'G': return 2;
+  case 'T': return 3;
+  default:  return 4;
+  }
+}
+
+inline symbol_code_t nucleotideCode(char base) {return baseCode(base);}
+inline symbol_code_t obsCode(char base, unsigned qual) {return baseCode(base) * SYMBOL_QUALS + qual;}
+
+// the symbols of codes, e.g. A and A37
+std::string nucleotideCodeSymbol(symbol_code_t code);
+std::string obsCodeSymbol(symbol_code_t code);
+
+
+// One site as seen by the genotyper.
+struct SiteRecord {
+  std::string id;                    // id_pos_ref_avmapq_depth[;DEL=..;FRACDEL=..] or [;INS=..]
+  std::vector<std::string> symbols;  // C, O1, ..., On; empty if the reader makes codes only
+  std::vector<symbol_code_t> codes;  // C, O1, ..., On as codes; empty for .tab input
+  unsigned depth;                    // number of observations, i.e. symbols.size() - 1
+};
+
+// set the symbol strings of rec from its codes
+void mkSymbolStrings(SiteRecord & rec);
+
+
+// The fields of a site id after the chromosome: the position, the
+// reference base, the average mapping quality and the depth, and the
+// number of reads with a deletion or with an inserted base. A site all
+// of whose reads are deleted (FRACDEL=1.0) is called with N.
+enum SiteIdKind {SITE_ID_SITE, SITE_ID_DELETED, SITE_ID_INSERTION};
+
+struct SiteIdFields {
+  unsigned long pos;
+  char ref;
+  unsigned avMapQ, depth;
+  SiteIdKind kind;
+  unsigned count;  // reads with a deletion (DEL=, if any), or with an inserted base (INS=)
+};
+
+// the id of a site on chrom with fields f
+void mkSiteId(std::string & id, std::string const & chrom, SiteIdFields const & f);
+// Split id into the chromosome and the fields; returns false if it is
+// not of the form made by mkSiteId.
+bool parseSiteId(std::string const & id, std::string & chrom, SiteIdFields & f);
+
+
+// A genomic region chrom:beg-end (1-based, inclusive). The empty region
+// (no chrom) contains everything.
+struct GenomicRegion {
+  std::string chrom;
+  unsigned long beg, end;
+
+  GenomicRegion() : beg(1), end(ULONG_MAX) {}
+
+  bool empty() const {return chrom.empty();}
+  bool contains(std::string const & c, unsigned long pos) const {return empty() or (c == chrom and pos >= beg and pos <= end);}
+  std::string str() const;
+};
+
+// parse 'chr', 'chr:beg' or 'chr:beg-end' (commas in the numbers are ignored)
+GenomicRegion parseRegion(std::string const & str);
+
+
+// Turns the reads covering one site into a site record and insertion
+// pseudo sites. Subclasses read the reads of the next site from
+// 'samtools mpileup' output (MpileupReader) or from alignments
+// (BamPileupReader, see BamPileup.h).
+class PileupReader {
+public:
+  virtual ~PileupReader() {}
+
+  // Read the next site. The site record is placed in records[0],
+  // followed by one pseudo site per inserted position. Records are
+  // reused between calls. Returns the number of records filled, or zero
+  // at end of input.
+  //
+  // With multi-sample input, there are records for each sample, sample
+  // s of position k (0 the site, k > 0 its k'th inserted position) in
+  // records[k * sampleCount() + s]. Every sample has the pseudo sites of
+  // the longest insertion of any sample; where a sample has no reads
+  // its record has depth 0 and an id ending in _0_0.
+  unsigned next(std::vector<SiteRecord> & records);
+
+  // number of sites (input lines) read
+  unsigned lineCount() const {return lineCount_;}
+  unsigned sampleCount() const {return sampleCount_;}
+
+  // Whether the records get the symbol strings besides the codes (the
+  // default). Without them, no string is made per read.
+  void setSymbolStrings(bool symbolStrings) {symbolStrings_ = symbolStrings;}
+
+protected:
+  PileupReader(unsigned maxDepth, unsigned qualBase, bool noRef);
+
+  // Fill in the reads of the next site below; returns false at end of input.
+  // With multi-sample input, only the position is set.
+  virtual bool readSite() = 0;
+  // With multi-sample input, fill in the reads of sample s of the site;
+  // returns false if the sample has no reads.
+  virtual bool readSample(unsigned s);
+
+  std::string chrom_, pos_;              // position as in the input (pos_ is 1-based)
+  char ref_;                             // reference base in upper case
+  std::string reads_;                    // one base per read, '*' marks a deleted read
+  std::vector<int> baseQ_, mapQ_;        // qualities of each read
+  std::vector<std::string> insertions_;  // inserted sequences in upper case
+  unsigned maxInsLength_;
+  unsigned lineCount_;
+  unsigned qualBase_;
+  unsigned sampleCount_;
+  bool multiSample_;
+  bool symbolStrings_;
+
+private:
+  unsigned nextSamples(std::vector<SiteRecord> & records);
+  void mkSiteRecord(SiteRecord & rec);
+  void mkInsertionRecord(SiteRecord & rec, unsigned offset);
+  void mkEmptyRecord(SiteRecord & rec, char ref);
+  void mkSymbols(SiteRecord & rec);
+
+  unsigned maxDepth_;
+  bool noRef_;
+
+  std::vector<unsigned> selected_;       // indices of the reads used
+  unsigned deletions_;
+  unsigned avMapQ_;
+  std::vector<unsigned> sampleInsLength_;
+};
+
+
+// Reads 'samtools mpileup -s' output. With a region, only the lines in
+// the region are used, and reading stops after it (the input is sorted).
+// Output of several BAM files has the four columns depth, bases, base
+// and mapping qualities for each sample, in the order of the files;
+// with sampleCount > 0 the input is read as multi-sample input of that
+// many samples (see next), also for one sample.
+class MpileupReader : public PileupReader {
+public:
+  MpileupReader(std::istream & str, unsigned maxDepth, unsigned qualBase = 33, bool noRef = false, GenomicRegion const & region = GenomicRegion(), unsigned sampleCount = 0);
+
+protected:
+  virtual bool readSite();
+  virtual bool readSample(unsigned s);
+
+private:
+  void parseBases(char const * bases, std::string::size_type n, char ref);
+
+  std::istream & str_;
+  GenomicRegion region_;
+  bool inRegion_;  // a line in the region has been seen
+
+  // scratch data for the current line; field i is [fieldBegin_[i], fieldEnd_[i]) of line_
+  std::string line_;
+  std::vector<std::string::size_type> fieldBegin_, fieldEnd_;
+};
+
+
+// The .tab files written by SNPest.pl have a header line 'NAME:' C O1
+// ... On and one line per site record: its id followed by the symbols
+// C, O1, ..., separated by tabs.
+
+// Check that the header of a .tab file names the columns C, O1, O2, ...,
+// which is the order readTabRecord assumes.
+void checkTabHeader(std::string const & header, std::string const & file);
+
+// Read the next line of a .tab file into rec, using line as buffer. The
+// strings of rec are reused. Returns 0 at end of input.
+unsigned readTabRecord(std::istream & input, SiteRecord & rec, std::string & line);
+
+// header for records of at most maxDepth reads, as SNPest.pl writes it
+std::string mkTabHeader(unsigned maxDepth);
+void writeTabRecord(std::ostream & str, SiteRecord const & rec);
+
+// depth field of a site id, i.e. the reads of the site before down sampling
+unsigned idDepth(std::string const & id);
+
+
+// upper case nucleotide, anything but ACGT becomes N
+char normalizeBase(char c);
+
+// observation symbol as used in inputMap, e.g. A37
+std::string mkObsSymbol(char base, unsigned qual);
+
+#endif  // __Pileup_h
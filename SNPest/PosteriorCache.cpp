@@ -0,0 +1,125 @@
+#include "PosteriorCache.h"
+#include "phy/utils.h"
+#include <boost/cstdint.hpp>
+#include <algorithm>
+
+using namespace phy;
+
+// number of locks; slot i is guarded by lock i % CACHE_STRIPES
+static unsigned const CACHE_STRIPES = 64;
+
+
+PosteriorCache::PosteriorCache(unsigned slots)
+  : slots_(slots)
+{
+  if (slots == 0)
+    errorAbort("From PosteriorCache: the cache must have at least one slot.");
+  for (unsigned i = 0; i < CACHE_STRIPES; i++)
+    stripes_.push_back( boost::shared_ptr<Stripe>(new Stripe) );
+}
+
+
+// FNV-1a
+unsigned PosteriorCache::slotIndex(string const & key) const
+{
+  boost::uint64_t h = 14695981039346656037ULL;
+  for (unsigned i = 0; i < key.size(); i++) {
+    h ^= (unsigned char) key[i];
+    h *= 1099511628211ULL;
+  }
+  return h % slots_.size();
+}
+
+
+bool PosteriorCache::lookup(string const & key, xvector_t & pp)
+{
+  unsigned i = slotIndex(key);
+  Stripe & stripe = *stripes_[i % CACHE_STRIPES];
+  boost::mutex::scoped_lock lock(stripe.mutex);
+  Slot const & slot = slots_[i];
+  if (slot.key != key) {
+    stripe.misses++;
+    return false;
+  }
+  stripe.hits++;
+  if ( pp.size() != slot.pp.size() )
+    pp.resize( slot.pp.size() );
+  std::copy( slot.pp.begin(), slot.pp.end(), pp.begin() );
+  return true;
+}
+
+
+void PosteriorCache::store(string const & key, xvector_t const & pp)
+{
+  unsigned i = slotIndex(key);
+  boost::mutex::scoped_lock lock(stripes_[i % CACHE_STRIPES]->mutex);
+  Slot & slot = slots_[i];
+  slot.key = key;
+  slot.pp.assign( pp.begin(), pp.end() );
+}
+
+
+unsigned long PosteriorCache::hits() const
+{
+  unsigned long n = 0;
+  for (unsigned i = 0; i < stripes_.size(); i++) {
+    boost::mutex::scoped_lock lock(stripes_[i]->mutex);
+    n += stripes_[i]->hits;
+  }
+  return n;
+}
+
+
+unsigned long PosteriorCache::misses() const
+{
+  unsigned long n = 0;
+  for (unsigned i = 0; i < stripes_.size(); i++) {
+    boost::mutex::scoped_lock lock(stripes_[i]->mutex);
+    n += stripes_[i]->misses;
+  }
+  return n;
+}
+
+
+static void appendUnsigned32(string & s, boost::uint32_t x)
+{
+  s.append( (char const *) & x, sizeof(x) );
+}
+
+
+void mkEvidenceKey(string & key, SymbolHistogram & hist)
+{
+  std::sort( hist.present.begin(), hist.present.end() );
+  key.clear();
+  appendUnsigned32(key, hist.ref);
+  for (unsigned k = 0; k < hist.present.size(); k++) {
+    appendUnsigned32(key, hist.present[k]);
+    appendUnsigned32(key, hist.count[ hist.present[k] ]);
+  }
+}
+
+
+void mkEvidenceKey(string & key, vector<string> const & symbols, unsigned depth, bool exchangeable, vector<string> & canonical)
+{
+  assert(symbols.size() > depth);
+  canonical.resize(depth + 1);
+  for (unsigned i = 0; i <= depth; i++)
+    canonical[i] = symbols[i];
+  if (exchangeable)
+    std::sort( canonical.begin() + 1, canonical.end() );
+  key.clear();
+  for (unsigned i = 0; i <= depth; i++) {
+    key += canonical[i];
+    key += '\n';
+  }
+}
+
+
+void mkEvidenceKey(string & key, vector<symbol_code_t> const & codes, unsigned depth, bool exchangeable, vector<symbol_code_t> & canonical)
+{
+  assert(codes.size() > depth);
+  canonical.assign(codes.begin(), codes.begin() + depth + 1);
+  if (exchangeable)
+    std::sort( canonical.begin() + 1, canonical.end() );
+  key.assign( (char const *) & canonical[0], canonical.size() * sizeof(symbol_code_t) );
+}
@@ -0,0 +1,66 @@
+#ifndef __PosteriorCache_h
+#define __PosteriorCache_h
+
+#include "phy/DfgIO.h"
+#include "StarModel.h"
+#include <boost/thread/mutex.hpp>
+#include <boost/shared_ptr.hpp>
+#include <string>
+#include <vector>
+
+// Bounded cache of the G posteriors of sites, keyed by their evidence:
+// the reference symbol and the multiset of read symbols. At low and
+// moderate depth many sites have the same evidence (e.g. reference C
+// and twelve A reads of quality 37) and so the same posteriors. A cache
+// belongs to one model, so the ploidity and model are the same for all
+// keys.
+//
+// The cache has a fixed number of slots; a key goes in the slot given
+// by its hash, replacing what was there. It is shared by the evaluator
+// threads, with one lock per stripe of slots. Once the slots have held
+// keys of the usual size, lookups and stores do not allocate.
+class PosteriorCache {
+public:
+  PosteriorCache(unsigned slots);
+
+  // If key is cached, set pp to its posteriors and return true
+  bool lookup(std::string const & key, phy::xvector_t & pp);
+  void store(std::string const & key, phy::xvector_t const & pp);
+
+  unsigned slotCount() const {return slots_.size();}
+  unsigned long hits() const;
+  unsigned long misses() const;
+
+private:
+  PosteriorCache(PosteriorCache const &);
+  PosteriorCache & operator=(PosteriorCache const &);
+
+  struct Slot {
+    std::string key;  // empty if unused
+    std::vector<phy::xnumber_t> pp;
+  };
+  struct Stripe {
+    boost::mutex mutex;
+    unsigned long hits, misses;
+    Stripe() : hits(0), misses(0) {}
+  };
+
+  unsigned slotIndex(std::string const & key) const;
+
+  std::vector<Slot> slots_;
+  std::vector< boost::shared_ptr<Stripe> > stripes_;
+};
+
+
+// Cache key of the counts of hist, with its present symbols sorted (the
+// order the posterior is then evaluated in).
+void mkEvidenceKey(std::string & key, SymbolHistogram & hist);
+
+// Cache key of the symbols C, O1, ..., O_depth. The symbols are copied
+// to canonical, with the reads sorted if they are exchangeable (as in
+// the SNPest read model), for evaluating the posterior of the key.
+void mkEvidenceKey(std::string & key, std::vector<std::string> const & symbols, unsigned depth, bool exchangeable, std::vector<std::string> & canonical);
+// the same for symbol codes, two bytes each
+void mkEvidenceKey(std::string & key, std::vector<symbol_code_t> const & codes, unsigned depth, bool exchangeable, std::vector<symbol_code_t> & canonical);
+
+#endif  // __PosteriorCache_h
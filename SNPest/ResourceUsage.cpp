@@ -0,0 +1,24 @@
+#include "ResourceUsage.h"
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <sys/resource.h>
+
+
+double wallTime()
+{
+  using namespace boost::posix_time;
+  return ( microsec_clock::universal_time() - ptime( boost::gregorian::date(2000, 1, 1) ) ).total_microseconds() * 1e-6;
+}
+
+
+unsigned long peakResidentKb()
+{
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, & usage) != 0)
+    return 0;
+#ifdef __APPLE__
+  // bytes on OS X, kB elsewhere
+  return usage.ru_maxrss / 1024;
+#else
+  return usage.ru_maxrss;
+#endif
+}
@@ -0,0 +1,14 @@
+#ifndef __ResourceUsage_h
+#define __ResourceUsage_h
+
+// Wall clock and memory use of the process, for benchmarks and run
+// statistics.
+
+// seconds since a fixed time in the past, with microsecond resolution
+double wallTime();
+
+// largest resident set size of the process so far, in kB (0 where the
+// system does not report it)
+unsigned long peakResidentKb();
+
+#endif  // __ResourceUsage_h
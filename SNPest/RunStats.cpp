@@ -0,0 +1,118 @@
+#include "RunStats.h"
+#include <cmath>
+#include <cstdio>
+
+using namespace std;
+
+
+SiteStats::SiteStats()
+  : sites_(0), reads_(0), clampedSites_(0), evaluateSeconds_(0), outputSeconds_(0)
+{}
+
+
+// bin of depth n: 0 for 0, else 1 + floor(log2(n))
+static unsigned depthBin(unsigned n)
+{
+  unsigned k = 0;
+  while (n > 0) {
+    n >>= 1;
+    k++;
+  }
+  return k;
+}
+
+
+unsigned depthBinFirst(unsigned k)
+{
+  return (k == 0) ? 0 : 1u << (k - 1);
+}
+
+
+unsigned depthBinLast(unsigned k)
+{
+  // 2^k - 1, also for k = 32
+  return (k == 0) ? 0 : (1u << (k - 1)) + ((1u << (k - 1)) - 1);
+}
+
+
+void SiteStats::addSite(string const & id, unsigned inputDepth, unsigned depth, double seconds)
+{
+  sites_++;
+  reads_ += depth;
+  if (inputDepth > depth)
+    clampedSites_++;
+  unsigned k = depthBin(inputDepth);
+  if (depthHistogram_.size() <= k)
+    depthHistogram_.resize(k + 1, 0);
+  depthHistogram_[k]++;
+  evaluateSeconds_ += seconds;
+
+  // sites not timed on their own (0 s) are not ranked
+  if ( seconds <= 0 or (slowest_.size() == SLOWEST_SITES and seconds <= slowest_.back().seconds) )
+    return;
+  SlowSite site;
+  site.id = id;
+  site.inputDepth = inputDepth;
+  site.seconds = seconds;
+  addSlowSite(site);
+}
+
+
+// insert site in the list ordered by decreasing time and drop the fastest
+void SiteStats::addSlowSite(SlowSite const & site)
+{
+  vector<SlowSite>::iterator it = slowest_.begin();
+  while (it != slowest_.end() and it->seconds >= site.seconds)
+    ++it;
+  slowest_.insert(it, site);
+  if (slowest_.size() > SLOWEST_SITES)
+    slowest_.pop_back();
+}
+
+
+void SiteStats::merge(SiteStats const & other)
+{
+  sites_ += other.sites_;
+  reads_ += other.reads_;
+  clampedSites_ += other.clampedSites_;
+  if ( depthHistogram_.size() < other.depthHistogram_.size() )
+    depthHistogram_.resize(other.depthHistogram_.size(), 0);
+  for (unsigned k = 0; k < other.depthHistogram_.size(); k++)
+    depthHistogram_[k] += other.depthHistogram_[k];
+  evaluateSeconds_ += other.evaluateSeconds_;
+  outputSeconds_ += other.outputSeconds_;
+  for (unsigned i = 0; i < other.slowest_.size(); i++)
+    addSlowSite(other.slowest_[i]);
+}
+
+
+string jsonString(string const & str)
+{
+  string s = "\"";
+  for (unsigned i = 0; i < str.size(); i++) {
+    unsigned char c = str[i];
+    if (c == '"' or c == '\\') {
+      s += '\\';
+      s += c;
+    }
+    else if (c < 0x20) {
+      char buf[8];
+      sprintf(buf, "\\u%04x", c);
+      s += buf;
+    }
+    else
+      s += c;
+  }
+  return s + "\"";
+}
+
+
+string jsonNumber(double x)
+{
+  // JSON has no infinities or NaN, e.g. for a rate over no time
+  if ( not std::isfinite(x) )
+    return "null";
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%.6g", x);
+  return buf;
+}
@@ -0,0 +1,66 @@
+#ifndef __RunStats_h
+#define __RunStats_h
+
+#include <string>
+#include <vector>
+#include <ostream>
+
+// A site that took long to evaluate
+struct SlowSite {
+  std::string id;
+  unsigned inputDepth;  // reads of the site in the input, before down sampling
+  double seconds;
+};
+
+
+// Counts and times of the sites evaluated by one thread, for --stats.
+// The sites are counted in a histogram of their depth in the input
+// (the depth field of the site id, before down sampling to maxDepth),
+// with bins 0, 1, 2-3, 4-7, ..., and the slowest sites are kept, so
+// that deep regions which dominate the run time show up. The stats of
+// the threads are merged at the end.
+class SiteStats {
+public:
+  SiteStats();
+
+  // a site evaluated on depth reads (of inputDepth) in seconds, 0 if
+  // not timed on its own
+  void addSite(std::string const & id, unsigned inputDepth, unsigned depth, double seconds);
+  // time of evaluation not attributed to a site (e.g. of a batch)
+  void addEvaluateTime(double seconds) {evaluateSeconds_ += seconds;}
+  // time of formatting and writing output, which is part of the evaluation time
+  void addOutputTime(double seconds) {outputSeconds_ += seconds;}
+
+  void merge(SiteStats const & other);
+
+  unsigned long sites() const {return sites_;}
+  unsigned long reads() const {return reads_;}
+  unsigned long clampedSites() const {return clampedSites_;}
+  std::vector<unsigned long> const & depthHistogram() const {return depthHistogram_;}
+  double evaluateSeconds() const {return evaluateSeconds_;}
+  double outputSeconds() const {return outputSeconds_;}
+  // slowest first
+  std::vector<SlowSite> const & slowestSites() const {return slowest_;}
+
+  // number of slowest sites kept
+  static unsigned const SLOWEST_SITES = 10;
+
+private:
+  void addSlowSite(SlowSite const & site);
+
+  unsigned long sites_, reads_, clampedSites_;
+  std::vector<unsigned long> depthHistogram_;
+  double evaluateSeconds_, outputSeconds_;
+  std::vector<SlowSite> slowest_;
+};
+
+// smallest and largest depth of bin k of the depth histogram
+unsigned depthBinFirst(unsigned k);
+unsigned depthBinLast(unsigned k);
+
+// str as a JSON string, in quotes
+std::string jsonString(std::string const & str);
+// x as a JSON number, null if it is not finite
+std::string jsonNumber(double x);
+
+#endif  // __RunStats_h
@@ -52,8 +52,9 @@ my $DATE = strftime "%Y%m%d", localtime;
 my $VERSION="SNPest ver. 1.0\n";
 
 # We use maxdepth as the maximum read depth. If depth is greater, we randomly down sample the reads
-# Default is 200X but this can be set by the parameter --maxdepth <int>
-my $maxdepth=200;
+# Default is 0, meaning that all reads are used (the reads are collapsed into counts of each
+# base and quality by dfgEval_SNPest --histogram). This can be set by the parameter --maxdepth <int>
+my $maxdepth=0;
 
 # This is where the executables etc. are places. 
 # The path can be changed by the parameter --execpath <string>
@@ -76,13 +77,49 @@ my $noref=0;
 # Default is 5,000,000,000 but this can be set by the parameter --batchsize <int>
 my $batchsize=5000000000;
 
+# This tells us whether to let dfgEval_SNPest parse the pileup directly.
+# This avoids the temporary files and is much faster. Set by the parameter --native
+my $native=0;
+
 # This is the quality score offset used. It is either Phred+64 (i.e., Illumina 1.3+ and 1.5+) or Phred+33 (Illumina 1.8+).
 # The default is 33
 my $qualbase=33; 
 
+# The number of threads used by dfgEval_SNPest to evaluate the sites.
+# Default is 1 but this can be set by the parameter --threads <int>
+my $threads=1;
+
+# A model bundle made with 'dfgEval_SNPest --compileModel <FILE>', used instead of the dfgspec files.
+# Default is none but this can be set by the parameter --modelbundle <FILE>
+my $modelbundle="";
+
+# A coordinate sorted BAM or CRAM file read by dfgEval_SNPest instead of the pileup on STDIN (implies --native).
+# Default is none but this can be set by the parameter --bam <FILE>. The --reference file is used for the reference bases.
+my $bamfile="";
+
+# Only call the sites in this region (chr, chr:beg or chr:beg-end; implies --native).
+# Default is the whole input but this can be set by the parameter --region <string>
+my $region="";
+
+# With --bam, the number of shards evaluated at the same time by separate dfgEval_SNPest processes,
+# and the size of each shard in bases (0 means one shard per contig). The VCF of the shards is
+# merged in genome order. Default is 1 (no sharding) but this can be set by --shards <int> and --shardsize <int>
+my $shards=1;
+my $shardsize=0;
+
+# Merge runs of confident hom-ref sites into gVCF style reference blocks (implies --native).
+# Default is one line per site but this can be set by the parameter --gvcf
+my $gvcf=0;
+
+# Also write the sites read to an evidence store (implies --native), from which --evidence genotypes them
+# again, e.g. with another --model or --ploidity, without the pileup or BAM file.
+# Default is none but this can be set by the parameters --evidenceout <FILE> and --evidence <FILE>
+my $evidenceout="";
+my $evidence="";
+
 # The help text
 # Use --h/--help/-h/-H for help
-my $HELPTEXT="This is SNPest, a program for calculating genotypes based on sequencing reads with quality scores. It reads input in generated by 'samtools mpileup' from STDIN and outputs genotype data in VCF format on STDOUT. You can use the following parameters:\n--maxdepth <MAX>:\tSet the maximum depth used in the calculations to MAX. If more than MAX reads cover a position, we randomly down-sample the reads to MAX. Default is 200.\n--execpath <PATH>:\tSet the PATH to where the programs and models are located. Default is '.' and implicitly the sub directory ./dfgspec/ (see the manpage for details).\n--ploidity <VALUE>:\tSet to either diploid (default) or haploid\n--model <VALUE>:\tSpecify model (ancient) or nothing (default).\n--noref:\tPer default, the reference genome is used as prior information. Use this parameter to only use the observed data.\n--batchsize <SIZE>:\tSet the number of lines to process at a time. By default, the value is ".$batchsize.". Larger values makes the program run faster but also demands more memory.\n--version:\tPrint the version number and exit.\n--h/--help/-h/-help:\tPrint this nifty little text and exit.\n ";
+my $HELPTEXT="This is SNPest, a program for calculating genotypes based on sequencing reads with quality scores. It reads input in generated by 'samtools mpileup' from STDIN and outputs genotype data in VCF format on STDOUT. You can use the following parameters:\n--maxdepth <MAX>:\tSet the maximum depth used in the calculations to MAX. If more than MAX reads cover a position, we randomly down-sample the reads to MAX. Default is 0, which uses all reads at any depth.\n--execpath <PATH>:\tSet the PATH to where the programs and models are located. Default is '.' and implicitly the sub directory ./dfgspec/ (see the manpage for details).\n--ploidity <VALUE>:\tSet to either diploid (default) or haploid\n--model <VALUE>:\tSpecify model (ancient) or nothing (default).\n--noref:\tPer default, the reference genome is used as prior information. Use this parameter to only use the observed data.\n--batchsize <SIZE>:\tSet the number of lines to process at a time. By default, the value is ".$batchsize.". Larger values makes the program run faster but also demands more memory.\n--native:\tLet dfgEval_SNPest read the pileup directly instead of going through temporary files. Much faster.\n--threads <N>:\tEvaluate the sites on N threads. The output is the same for any N. Default is 1.\n--bam <FILE>:\tRead the reads from a coordinate sorted BAM or CRAM file instead of a pileup on STDIN (implies --native). Give the reference FASTA file with --reference <FILE>.\n--region <REGION>:\tOnly call the sites in REGION (chr, chr:beg or chr:beg-end; implies --native).\n--shards <N>:\tWith --bam, split the genome (or --region) into shards and evaluate N of them at a time in separate processes. The output is merged in genome order.\n--shardsize <SIZE>:\tWith --shards, the size of each shard in bases. Default is 0, which uses one shard per contig.\n--gvcf:\tMerge runs of adjacent confident hom-ref sites into reference blocks (SNPest lines with END and the smallest DP, PP and AVMQ in INFO, not gVCF blocks; implies --native).\n--modelbundle <FILE>:\tRead the model from a bundle made with 'dfgEval_SNPest --compileModel <FILE>' instead of the dfgspec files. With the default --maxdepth of 0, concurrent runs share one copy of the emission table of the bundle in memory; the rest of the model is copied into each run.\n--evidenceout <FILE>:\tAlso write the sites read to FILE, a binary evidence store (implies --native).\n--evidence <FILE>:\tRead the sites from an evidence store written with --evidenceout instead of a pileup on STDIN, e.g. to genotype them again with another --model or --ploidity (implies --native). The reads are as stored: use the same --maxdepth.\n--version:\tPrint the version number and exit.\n--h/--help/-h/-help:\tPrint this nifty little text and exit.\n ";
 
 # The reference file name (if supplied by the user)
 my $REFERENCEFILE="";
@@ -95,6 +132,16 @@ GetOptions( "maxdepth:i" => \$maxdepth,
 	    "qualbase:i" => \$qualbase,
 	    "version" => \$version,
 	    "noref" => \$noref,
+	    "native" => \$native,
+	    "threads:i" => \$threads,
+	    "modelbundle:s" => \$modelbundle,
+	    "bam:s" => \$bamfile,
+	    "region:s" => \$region,
+	    "shards:i" => \$shards,
+	    "shardsize:i" => \$shardsize,
+	    "gvcf" => \$gvcf,
+	    "evidenceout:s" => \$evidenceout,
+	    "evidence:s" => \$evidence,
 	    "help"  => \$help,
 	    "reference:s" => \$REFERENCEFILE)
 or die("Unrecognized arguments.\n");
@@ -109,9 +156,22 @@ if($help){
     exit;
 }
 
+my $fastafile=$REFERENCEFILE;
 if($REFERENCEFILE ne ""){
     $REFERENCEFILE="##reference=file:".$REFERENCEFILE."\n";
 }
+if($bamfile ne "" || $region ne "" || $gvcf || $evidenceout ne "" || $evidence ne ""){
+    $native=1;
+}
+if($shards>1 && $bamfile eq ""){
+    die("The --shards option requires --bam.\n");
+}
+if($shards>1 && $evidenceout ne ""){
+    die("The --evidenceout option cannot be combined with --shards.\n");
+}
+if($evidence ne "" && ($bamfile ne "" || $evidenceout ne "")){
+    die("The --evidence option cannot be combined with --bam or --evidenceout.\n");
+}
 
 # The VCF header. Update information as appropriate.
 # We only use a subset of the fields, but this might be extended in time.
@@ -123,6 +183,149 @@ if($ploidity eq "haploid"){
     $genotypenumber=4;
 }
 
+# Parse the output from dfgEval_SNPest and print it as VCF on STDOUT
+sub writeVCF{
+    my $fh=shift;
+
+    #Read the first line containing NAME ranVar [genotypes]
+    $temp=<$fh>;
+    chomp $temp;
+    @genotypes=(split(/\t/,$temp))[2 .. $genotypenumber+1];
+
+    #Parse each line corresponding to a position in the genome
+    while(<$fh>){
+	chomp $_;
+	@posteriors=(split(/\t/,$_));
+	#The first field contains identifier, position, reference nucleotide, average maping quality and read depth (cf. how we generate the tab-file above)
+	@fields=split(/_/,$posteriors[0]);
+
+	$id=join('_',@fields[0..$#fields-4]);
+	$pos=$fields[$#fields-3];
+	$ref=$fields[$#fields-2];
+	$avmapq=$fields[$#fields-1];
+	$depth=$fields[$#fields];
+	#Positions 2 and on contain posterior probabilities corresponding to the genotypes
+	@posteriors=@posteriors[2 .. $genotypenumber+1];
+	$postprob=2.0;
+	$genotype="NN";
+	for($i=0;$i<$genotypenumber;$i++){
+	    if($posteriors[$i]<$postprob){
+		#We found a better candidate
+		$postprob=$posteriors[$i];
+		$genotype=$genotypes[$i];
+	    }
+	}
+	$postprob=($postprob<$minprob)?$minprob:$postprob;
+	#Write vcf output. We set the ID (e.g. dbSNP) to '.', and the same for filter. 
+	#This might be changed in the future (e.g. filter predictions based on posterior probability, depth etc.)
+	#For ALT, we use '.' to indicate a reference hit so e.g. "." means a homozygous position identical to the reference,
+	#'.A' would mean a heterozygous position with one allelle being the reference and the other in this case an A, and
+	#'CG' would mean a heterozygous position with both allelles different from the reference.
+	if(substr($genotype,0,1) eq substr($genotype,1,1)){
+	    #If homozygous, only print nucleotide once
+	    $genotype=substr($genotype,0,1);
+	}
+	else{
+	    #It's heterozygous. Put a comma between the two nucleotides
+	    $genotype=substr($genotype,0,1).",".substr($genotype,1,1);
+	}
+	#Finally, replace any reference nucleotides with .
+	$genotype =~ s/$ref/./;
+
+	#The phred quality is: -10log_10 prob(call in ALT is wrong)
+	#The value in $postprob is actually 1-posterior.
+	$phred=-10*(log($postprob)/$log10) + 1;
+	#Now, set $postprob to the actual posterior probability
+	$postprob=1-$postprob;
+	$INFO="DP=".$depth.";PP=".$postprob.";AVMQ=".$avmapq;
+	print STDOUT $id."\t".$pos."\t.\t".$ref."\t".$genotype."\t".int($phred)."\t.\t".$INFO."\n";
+    }
+}
+
+# Without a max depth, dfgEval_SNPest evaluates the counts of each base and quality, which works for any depth,
+# in batches of sites with the vectorized kernel. Otherwise, it uses the factor graphs for depth 1 to maxdepth.
+my $dfgoptions="--ppVars=G --dfgSpecPrefix=".$dfgpath."/dfgspec/ --ploidity=".$ploidity." --model=".$model;
+if($threads>1){
+    $dfgoptions=$dfgoptions." --threads=".$threads;
+}
+if($modelbundle ne ""){
+    $dfgoptions=$dfgoptions." --modelBundle=".$modelbundle;
+}
+if($maxdepth>0){
+    $dfgoptions=$dfgoptions." --maxDepth=".$maxdepth;
+}
+else{
+    $dfgoptions=$dfgoptions." --histogram --batch=4096";
+}
+
+if($native){
+    # dfgEval_SNPest parses the pileup on our STDIN (or reads the BAM file) and writes the VCF itself
+    print STDERR "The program settings are:\nMax depth: ".$maxdepth."\nPloidity: ".$ploidity." (".$genotypenumber." genotypes)\nModel specified: ".$model."\nUse reference: ".($noref?"no":"yes")."\nExecution path: ".$dfgpath."\nQuality base: ".$qualbase."\n";
+    if($bamfile ne ""){
+	$mycommand=$dfgpath."/dfgEval_SNPest --bam=".$bamfile;
+    }
+    elsif($evidence ne ""){
+	$mycommand=$dfgpath."/dfgEval_SNPest --evidence=".$evidence;
+    }
+    else{
+	$mycommand=$dfgpath."/dfgEval_SNPest --mpileup --qualBase=".$qualbase;
+    }
+    $mycommand=$mycommand.($fastafile ne ""?" --reference=".$fastafile:"").($noref?" --noRef":"")." ".$dfgoptions;
+    # Confident hom-ref sites are called from a bound on the other genotypes. Below $minprob
+    # (the smallest error probability we write) the output is the same as with full evaluation.
+    $mycommand=$mycommand." --homRefBound=".$minprob.($gvcf?" --gvcf":"");
+    if($shards>1){
+	# One dfgEval_SNPest per shard, at most $shards at a time, each writing the VCF of its
+	# shard to a temporary file. The files are concatenated in shard (i.e. genome) order,
+	# keeping the header of the first.
+	my $listcommand=$dfgpath."/dfgEval_SNPest --bam=".$bamfile." --listShards=".$shardsize.($region ne ""?" --region=".$region:"");
+	my @shardregions=`$listcommand`;
+	$? == 0 or die "dfgEval_SNPest could not list the shards of ".$bamfile."\n";
+	chomp @shardregions;
+	print STDERR "Evaluating ".scalar(@shardregions)." shards, ".$shards." at a time: ".$mycommand." --region=<shard> --vcf=<file>\n";
+	my @shardfiles;
+	my %running;
+	my $next=0;
+	while($next<@shardregions || %running){
+	    while($next<@shardregions && keys(%running)<$shards){
+		$shardfiles[$next]=$dfgpath."/".$$."_shard".$next.".vcf";
+		my $pid=fork();
+		defined($pid) or die $!;
+		if($pid==0){
+		    exec($mycommand." --region=".$shardregions[$next]." --vcf=".$shardfiles[$next]) or die $!;
+		}
+		$running{$pid}=$next++;
+	    }
+	    my $pid=wait();
+	    if($? != 0){
+		kill('TERM', keys(%running));
+		unlink @shardfiles;
+		die "Shard ".$shardregions[$running{$pid}]." failed\n";
+	    }
+	    delete $running{$pid};
+	}
+	for(my $i=0;$i<@shardfiles;$i++){
+	    open(SHARDFILE, "<", $shardfiles[$i]) or die $!;
+	    while(<SHARDFILE>){
+		print STDOUT $_ if($i==0 || substr($_,0,1) ne "#");
+	    }
+	    close(SHARDFILE);
+	    unlink $shardfiles[$i];
+	}
+	exit;
+    }
+    if($region ne ""){
+	$mycommand=$mycommand." --region=".$region;
+    }
+    if($evidenceout ne ""){
+	$mycommand=$mycommand." --evidenceOut=".$evidenceout;
+    }
+    $mycommand=$mycommand." --vcf=-";
+    print STDERR $mycommand."\n";
+    system($mycommand) == 0 or die "dfgEval_SNPest failed\n";
+    exit;
+}
+
 #We create a file for the input needed by dfgeval
 #Since we are treating the input in batches, we are reusing the same file
 my $randomid=int(rand(1000000));
@@ -234,7 +437,7 @@ while(<STDIN>){
 	#We do this by randomly shuffling the indices from 0 to $#nucs
 	#and using the first $maxdepth indices
 	my @indices=(0..$#nucs);
-	if($depth > $maxdepth){
+	if($maxdepth > 0 && $depth > $maxdepth){
 	    #Shuffle and only use the first $maxdepth indices
 	    @indices=shuffle(@indices);
 	    $#indices=$maxdepth-1;
@@ -273,7 +476,7 @@ while(<STDIN>){
 	$firstfield=$id."_".$pos."_N_".$avmapq;
 	$depth=0;
 	$tabline="";
-	for(my $j=0;$j<$MAXINSDEPTH && $depth<$maxdepth;$j++){
+	for(my $j=0;$j<$MAXINSDEPTH && ($maxdepth==0 || $depth<$maxdepth);$j++){
             $qual=($avmapq>$maxqual)?$maxqual:$avmapq;
             if(length($INSLIST[$j])>$i){
                 $depth++;
@@ -289,66 +492,14 @@ while(<STDIN>){
     if($counter==$batchsize || eof){
 	close(TABFILE);
 	# Call dfgeval with input file
-	$mycommand=$dfgpath."/dfgEval_SNPest --ppVars=G --ppSumOther --ppFile=- --dfgSpecPrefix=".$dfgpath."/dfgspec/ --maxDepth=".$maxdepth." --ploidity=".$ploidity." --model=".$model." ".$tabfilename." > ".$genotypefilename;
+	$mycommand=$dfgpath."/dfgEval_SNPest ".$dfgoptions." --ppSumOther --ppFile=- ".$tabfilename." > ".$genotypefilename;
 	print STDERR $mycommand."\n";
 	system $mycommand;
 
 	# Parse the generated output from dfgeval and print to STDOUT
 	open GENOFILE, "<", $genotypefilename or die $!;
 	
-	#Read the first line containing NAME ranVar [genotypes]
-	$temp=<GENOFILE>;
-	chomp $temp;
-	@genotypes=(split(/\t/,$temp))[2 .. $genotypenumber+1];
-
-	#Parse each line corresponding to a position in the genome
-	while(<GENOFILE>){
-	    chomp $_;
-	    @posteriors=(split(/\t/,$_));
-	    #The first field contains identifier, position, reference nucleotide, average maping quality and read depth (cf. how we generate the tab-file above)
-	    @fields=split(/_/,$posteriors[0]);
-
-	    $id=join('_',@fields[0..$#fields-4]);
-	    $pos=$fields[$#fields-3];
-	    $ref=$fields[$#fields-2];
-	    $avmapq=$fields[$#fields-1];
-	    $depth=$fields[$#fields];
-	    #Positions 2 and on contain posterior probabilities corresponding to the genotypes
-	    @posteriors=@posteriors[2 .. $genotypenumber+1];
-	    $postprob=2.0;
-	    $genotype="NN";
-	    for($i=0;$i<$genotypenumber;$i++){
-		if($posteriors[$i]<$postprob){
-		    #We found a better candidate
-		    $postprob=$posteriors[$i];
-		    $genotype=$genotypes[$i];
-		}
-	    }
-	    $postprob=($postprob<$minprob)?$minprob:$postprob;
-	    #Write vcf output. We set the ID (e.g. dbSNP) to '.', and the same for filter. 
-	    #This might be changed in the future (e.g. filter predictions based on posterior probability, depth etc.)
-	    #For ALT, we use '.' to indicate a reference hit so e.g. "." means a homozygous position identical to the reference,
-	    #'.A' would mean a heterozygous position with one allelle being the reference and the other in this case an A, and
-	    #'CG' would mean a heterozygous position with both allelles different from the reference.
-	    if(substr($genotype,0,1) eq substr($genotype,1,1)){
-		#If homozygous, only print nucleotide once
-		$genotype=substr($genotype,0,1);
-	    }
-	    else{
-		#It's heterozygous. Put a comma between the two nucleotides
-		$genotype=substr($genotype,0,1).",".substr($genotype,1,1);
-	    }
-	    #Finally, replace any reference nucleotides with .
-	    $genotype =~ s/$ref/./;
-	    
-	    #The phred quality is: -10log_10 prob(call in ALT is wrong)
-	    #The value in $postprob is actually 1-posterior.
-	    $phred=-10*(log($postprob)/$log10) + 1;
-	    #Now, set $postprob to the actual posterior probability
-	    $postprob=1-$postprob;
-	    $INFO="DP=".$depth.";PP=".$postprob.";AVMQ=".$avmapq;
-	    print STDOUT $id."\t".$pos."\t.\t".$ref."\t".$genotype."\t".int($phred)."\t.\t".$INFO."\n";
-  	}
+	writeVCF(\*GENOFILE);
 
 	close(GENOFILE);
 	# Reset counter and input file
@@ -0,0 +1,371 @@
+#include "StarModel.h"
+#include "ModelSpec.h"
+#include <boost/foreach.hpp>
+#include <cmath>
+#include <climits>
+#include <algorithm>
+
+using namespace phy;
+
+
+// potential with name and the expected dimensions
+static PotentialSpec const & getPotential(map<string, PotentialSpec> const & pots, string const & name, unsigned rows, unsigned cols, string const & file)
+{
+  map<string, PotentialSpec>::const_iterator it = pots.find(name);
+  if ( it == pots.end() )
+    errorAbort("From StarModel: potential '" + name + "' not found in file '" + file + "'.");
+  if (it->second.rows != rows or it->second.cols != cols)
+    errorAbort("From StarModel: potential '" + name + "' in file '" + file + "' has dimensions [" + toString(it->second.rows) + ", " + toString(it->second.cols) + "], expected [" + toString(rows) + ", " + toString(cols) + "].");
+  return it->second;
+}
+
+
+static StateMapSpec const & getStateMap(map<string, StateMapSpec> const & maps, string const & name, string const & file)
+{
+  map<string, StateMapSpec>::const_iterator it = maps.find(name);
+  if ( it == maps.end() )
+    errorAbort("From StarModel: state map '" + name + "' not found in file '" + file + "'.");
+  return it->second;
+}
+
+
+// symbol (or meta symbol) -> indices of the states it covers
+static vector< pair<string, vector<unsigned> > > mkSymbolMasks(StateMapSpec const & sm)
+{
+  vector< pair<string, vector<unsigned> > > masks;
+  for (unsigned i = 0; i < sm.symbols.size(); i++)
+    masks.push_back( make_pair(sm.symbols[i], vector<unsigned>(1, i) ) );
+  for (map<string, vector<unsigned> >::const_iterator it = sm.metaSymbols.begin(); it != sm.metaSymbols.end(); ++it)
+    masks.push_back( *it );
+  return masks;
+}
+
+
+StarModel::StarModel(string const & stateMapsFile, string const & potentialsFile)
+{
+  init( readStateMapSpecs(stateMapsFile), stateMapsFile, readPotentialSpecs(potentialsFile), potentialsFile);
+}
+
+
+StarModel::StarModel(map<string, StateMapSpec> const & maps, map<string, PotentialSpec> const & pots, string const & source)
+{
+  init(maps, source, pots, source);
+}
+
+
+void StarModel::init(map<string, StateMapSpec> const & maps, string const & stateMapsFile, map<string, PotentialSpec> const & pots, string const & potentialsFile)
+{
+  StateMapSpec const & nucMap = getStateMap(maps, "nucleotideMap", stateMapsFile);
+  StateMapSpec const & genoMap = getStateMap(maps, "genotypeMap", stateMapsFile);
+  StateMapSpec const & inputMap = getStateMap(maps, "inputMap", stateMapsFile);
+  unsigned nN = nucMap.symbols.size(), nG = genoMap.symbols.size(), nO = inputMap.symbols.size();
+  genotypeSymbols_ = genoMap.symbols;
+
+  PotentialSpec const & prior = getPotential(pots, "prior", 1, nN, potentialsFile);
+  PotentialSpec const & genotype = getPotential(pots, "genotype", nN, nG, potentialsFile);
+  PotentialSpec const & original = getPotential(pots, "original", nG, nN, potentialsFile);
+  PotentialSpec const & observation = getPotential(pots, "observation", nN, nO, potentialsFile);
+
+  // reference (C) factors
+  vector< pair<string, vector<unsigned> > > nucMasks = mkSymbolMasks(nucMap);
+  for (unsigned k = 0; k < nucMasks.size(); k++) {
+    nucIndex_[ nucMasks[k].first ] = k;
+    vector<xnumber_t> f(nG, 0);
+    vector<double> logF(nG, 0);
+    for (unsigned g = 0; g < nG; g++) {
+      double sum = 0;
+      BOOST_FOREACH(unsigned c, nucMasks[k].second)
+	sum += prior(0, c) * genotype(c, g);
+      f[g] = sum;
+      logF[g] = log(sum);
+    }
+    refFactor_.push_back(f);
+    logRefFactor_.push_back(logF);
+
+    string const & c = nucMasks[k].first;
+    vector<string>::const_iterator hom = std::find( genotypeSymbols_.begin(), genotypeSymbols_.end(), c + c );
+    homGenotype_.push_back( (nucMasks[k].second.size() == 1 and hom != genotypeSymbols_.end()) ? hom - genotypeSymbols_.begin() : -1 );
+    vector<double> logOther(nG, 0);
+    for (unsigned g = 0; g < nG; g++) {
+      double other = 0;
+      for (unsigned h = 0; h < nG; h++)
+	if (h != g)
+	  other += exp(logF[h]);
+      logOther[g] = log(other) - logF[g];
+    }
+    logOtherRef_.push_back(logOther);
+  }
+
+  // emission factors for each input symbol
+  vector< pair<string, vector<unsigned> > > obsMasks = mkSymbolMasks(inputMap);
+  for (unsigned k = 0; k < obsMasks.size(); k++) {
+    obsIndex_[ obsMasks[k].first ] = k;
+    vector<double> obsSum(nN, 0);
+    for (unsigned a = 0; a < nN; a++)
+      BOOST_FOREACH(unsigned o, obsMasks[k].second)
+	obsSum[a] += observation(a, o);
+    vector<xnumber_t> e(nG, 0);
+    vector<double> logE(nG, 0);
+    for (unsigned g = 0; g < nG; g++) {
+      double sum = 0;
+      for (unsigned a = 0; a < nN; a++)
+	sum += original(g, a) * obsSum[a];
+      e[g] = sum;
+      logE[g] = log(sum);
+    }
+    emission_.push_back(e);
+    logEmission_.push_back(logE);
+
+    vector<double> maxRatio(nG, -HUGE_VAL);
+    for (unsigned g = 0; g < nG; g++)
+      for (unsigned h = 0; h < nG; h++)
+	if (h != g)
+	  maxRatio[g] = std::max(maxRatio[g], logE[h] - logE[g]);
+    maxLogRatio_.push_back(maxRatio);
+  }
+
+  // symbol code tables, so the input path need not make strings
+  nucCodeIndex_.assign(5, UINT_MAX);
+  for (symbol_code_t c = 0; c < nucCodeIndex_.size(); c++) {
+    map<string, unsigned>::const_iterator it = nucIndex_.find( nucleotideCodeSymbol(c) );
+    if ( it != nucIndex_.end() )
+      nucCodeIndex_[c] = it->second;
+  }
+  obsCodeIndex_.assign(SYMBOL_CODE_COUNT, UINT_MAX);
+  for (unsigned c = 0; c < SYMBOL_CODE_COUNT; c++) {
+    map<string, unsigned>::const_iterator it = obsIndex_.find( obsCodeSymbol(c) );
+    if ( it != obsIndex_.end() )
+      obsCodeIndex_[c] = it->second;
+  }
+}
+
+
+bool StarModel::isStarGraph(string const & variablesFile, string const & factorGraphFile, string & reason)
+{
+  map<string, string> varMaps = readVariablesSpec(variablesFile);
+  vector<FactorSpec> facs = readFactorGraphSpec(factorGraphFile);
+
+  if (varMaps.count("C") == 0 or varMaps["C"] != "nucleotideMap" or varMaps.count("G") == 0 or varMaps["G"] != "genotypeMap") {
+    reason = "variables C and G must use nucleotideMap and genotypeMap";
+    return false;
+  }
+  unsigned depth = (varMaps.size() - 2) / 2;
+  if (varMaps.size() != 2 * depth + 2 or facs.size() != 2 * depth + 2) {
+    reason = "unexpected number of variables or factors";
+    return false;
+  }
+
+  // factor signature -> potential used
+  map<string, string> sigs;
+  for (unsigned i = 0; i < facs.size(); i++) {
+    string sig;
+    for (unsigned j = 0; j < facs[i].neighbors.size(); j++)
+      sig += facs[i].neighbors[j] + ".";
+    sigs[sig] = facs[i].potential;
+  }
+  if (sigs["C."] != "prior" or sigs["C.G."] != "genotype") {
+    reason = "factors C.prior and C.G must use the potentials prior and genotype";
+    return false;
+  }
+  for (unsigned i = 1; i <= depth; i++) {
+    string a = "A" + toString(i), o = "O" + toString(i);
+    if (varMaps[a] != "nucleotideMap" or varMaps[o] != "inputMap") {
+      reason = "variables " + a + " and " + o + " must use nucleotideMap and inputMap";
+      return false;
+    }
+    if (sigs["G." + a + "."] != "original" or sigs[a + "." + o + "."] != "observation") {
+      reason = "factors G." + a + " and " + a + "." + o + " must use the potentials original and observation";
+      return false;
+    }
+  }
+  return true;
+}
+
+
+unsigned StarModel::nucleotideIndex(string const & symbol) const
+{
+  map<string, unsigned>::const_iterator it = nucIndex_.find(symbol);
+  if ( it == nucIndex_.end() )
+    errorAbort("From StarModel: unknown nucleotide symbol '" + symbol + "'.");
+  return it->second;
+}
+
+
+unsigned StarModel::observationIndex(string const & symbol) const
+{
+  map<string, unsigned>::const_iterator it = obsIndex_.find(symbol);
+  if ( it == obsIndex_.end() )
+    errorAbort("From StarModel: unknown input symbol '" + symbol + "'.");
+  return it->second;
+}
+
+
+unsigned StarModel::nucleotideIndex(symbol_code_t code) const
+{
+  unsigned k = nucCodeIndex_[code];
+  if (k == UINT_MAX)
+    errorAbort("From StarModel: unknown nucleotide symbol '" + nucleotideCodeSymbol(code) + "'.");
+  return k;
+}
+
+
+unsigned StarModel::observationIndex(symbol_code_t code) const
+{
+  unsigned k = obsCodeIndex_[code];
+  if (k == UINT_MAX)
+    errorAbort("From StarModel: unknown input symbol '" + obsCodeSymbol(code) + "'.");
+  return k;
+}
+
+
+void StarModel::calcPosterior(vector<string> const & symbols, unsigned depth, xvector_t & pp) const
+{
+  calcPosteriorOf(symbols, depth, pp);
+}
+
+
+void StarModel::calcPosterior(vector<symbol_code_t> const & codes, unsigned depth, xvector_t & pp) const
+{
+  calcPosteriorOf(codes, depth, pp);
+}
+
+
+template<class Symbol>
+void StarModel::calcPosteriorOf(vector<Symbol> const & symbols, unsigned depth, xvector_t & pp) const
+{
+  assert(symbols.size() > depth);
+  unsigned nG = genotypeCount();
+  assert(pp.size() == nG);
+
+  vector<xnumber_t> const & ref = refFactor_[ nucleotideIndex(symbols[0]) ];
+  for (unsigned g = 0; g < nG; g++)
+    pp[g] = ref[g];
+
+  for (unsigned i = 1; i <= depth; i++) {
+    vector<xnumber_t> const & e = emission_[ observationIndex(symbols[i]) ];
+    for (unsigned g = 0; g < nG; g++)
+      pp[g] *= e[g];
+#ifndef XNUMBER_IS_XDOUBLE
+    // keep within the range of double; only the ratios matter
+    xnumber_t m = pp[0];
+    for (unsigned g = 1; g < nG; g++)
+      if (pp[g] > m)
+	m = pp[g];
+    if (m > 0 and m < 1e-200)
+      for (unsigned g = 0; g < nG; g++)
+	pp[g] /= m;
+#endif
+  }
+
+  xnumber_t sum = 0;
+  for (unsigned g = 0; g < nG; g++)
+    sum += pp[g];
+  if ( not (sum > 0) )
+    errorAbort("From StarModel: data has zero probability under the model.");
+  for (unsigned g = 0; g < nG; g++)
+    pp[g] /= sum;
+}
+
+
+void StarModel::countSymbols(vector<string> const & symbols, unsigned depth, SymbolHistogram & hist) const
+{
+  countSymbolsOf(symbols, depth, hist);
+}
+
+
+void StarModel::countSymbols(vector<symbol_code_t> const & codes, unsigned depth, SymbolHistogram & hist) const
+{
+  countSymbolsOf(codes, depth, hist);
+}
+
+
+template<class Symbol>
+void StarModel::countSymbolsOf(vector<Symbol> const & symbols, unsigned depth, SymbolHistogram & hist) const
+{
+  assert(symbols.size() > depth);
+  if (hist.count.size() != emission_.size()) {
+    hist.count.assign(emission_.size(), 0);
+    hist.present.clear();
+    hist.depth = 0;
+  }
+  hist.clear();
+  hist.ref = nucleotideIndex(symbols[0]);
+  for (unsigned i = 1; i <= depth; i++)
+    hist.add( observationIndex(symbols[i]) );
+}
+
+
+double StarModel::otherGenotypesBound(SymbolHistogram const & hist, unsigned g) const
+{
+  // log of the bound on the odds of the other genotypes
+  double x = logOtherRef_[hist.ref][g];
+  for (unsigned k = 0; k < hist.present.size(); k++) {
+    unsigned o = hist.present[k];
+    x += hist.count[o] * maxLogRatio_[o][g];
+  }
+  if ( not (x < 0) )
+    return 1;
+  double odds = exp(x);
+  return odds / (1 + odds);
+}
+
+
+#ifdef XNUMBER_IS_XDOUBLE
+// x^n by repeated squaring
+static xnumber_t power(xnumber_t x, unsigned n)
+{
+  xnumber_t r = 1;
+  while (n > 0) {
+    if (n & 1)
+      r *= x;
+    x *= x;
+    n >>= 1;
+  }
+  return r;
+}
+#endif
+
+
+void StarModel::calcPosterior(SymbolHistogram const & hist, xvector_t & pp) const
+{
+  unsigned nG = genotypeCount();
+  assert(pp.size() == nG);
+
+#ifdef XNUMBER_IS_XDOUBLE
+  // the extended range of xdouble holds the powers directly
+  for (unsigned g = 0; g < nG; g++) {
+    xnumber_t l = refFactor_[hist.ref][g];
+    for (unsigned k = 0; k < hist.present.size(); k++) {
+      unsigned o = hist.present[k];
+      l *= power(emission_[o][g], hist.count[o]);
+    }
+    pp[g] = l;
+  }
+#else
+  // in double precision the powers underflow at high depth, so sum the
+  // logs (kept in pp) and scale by the largest term
+  double m = -HUGE_VAL;
+  for (unsigned g = 0; g < nG; g++) {
+    double l = logRefFactor_[hist.ref][g];
+    for (unsigned k = 0; k < hist.present.size(); k++) {
+      unsigned o = hist.present[k];
+      l += hist.count[o] * logEmission_[o][g];
+    }
+    pp[g] = l;
+    if (l > m)
+      m = l;
+  }
+  if (m == -HUGE_VAL)
+    errorAbort("From StarModel: data has zero probability under the model.");
+  for (unsigned g = 0; g < nG; g++)
+    pp[g] = exp(pp[g] - m);
+#endif
+
+  xnumber_t sum = 0;
+  for (unsigned g = 0; g < nG; g++)
+    sum += pp[g];
+  if ( not (sum > 0) )
+    errorAbort("From StarModel: data has zero probability under the model.");
+  for (unsigned g = 0; g < nG; g++)
+    pp[g] /= sum;
+}
@@ -0,0 +1,177 @@
+#ifndef __StarModel_h
+#define __StarModel_h
+
+#include "phy/DfgIO.h"
+#include "ModelSpec.h"
+#include "Pileup.h"
+#include <string>
+#include <vector>
+#include <map>
+
+// Reads of a site collapsed into the number of reads with each input
+// symbol. The posterior only depends on these counts, not on the order
+// or number of the reads.
+struct SymbolHistogram {
+  unsigned ref;                  // nucleotide symbol index of C
+  std::vector<unsigned> count;   // count per input symbol index
+  std::vector<unsigned> present; // input symbol indices with count > 0
+  unsigned depth;
+
+  SymbolHistogram() : ref(0), depth(0) {}
+
+  void add(unsigned symbol, unsigned n = 1)
+  {
+    if (count[symbol] == 0)
+      present.push_back(symbol);
+    count[symbol] += n;
+    depth += n;
+  }
+
+  // reset the counts in O(distinct symbols)
+  void clear()
+  {
+    for (unsigned i = 0; i < present.size(); i++)
+      count[ present[i] ] = 0;
+    present.clear();
+    depth = 0;
+  }
+};
+
+
+// The symbol counts of many sites, stored compactly (for benchmarks,
+// which evaluate the same sites many times).
+struct CountedSites {
+  std::vector<unsigned> ref;
+  std::vector<unsigned> entryStart;  // site i has entries [entryStart[i], entryStart[i+1])
+  std::vector<unsigned> symbols, counts;
+
+  CountedSites() : entryStart(1, 0) {}
+
+  unsigned size() const {return ref.size();}
+
+  void add(SymbolHistogram const & hist)
+  {
+    ref.push_back(hist.ref);
+    for (unsigned k = 0; k < hist.present.size(); k++) {
+      symbols.push_back( hist.present[k] );
+      counts.push_back( hist.count[ hist.present[k] ] );
+    }
+    entryStart.push_back( symbols.size() );
+  }
+
+  // hist must have the counts of all input symbols
+  void get(unsigned i, SymbolHistogram & hist) const
+  {
+    hist.clear();
+    hist.ref = ref[i];
+    for (unsigned k = entryStart[i]; k < entryStart[i + 1]; k++)
+      hist.add(symbols[k], counts[k]);
+  }
+};
+
+
+// Closed form evaluation of the SNPest read model. All the depthN
+// factor graphs made by GenerateFactorGraphs.pl are the same tree:
+//
+//   C.prior, C.G, and for each read i: G.A_i and A_i.O_i
+//
+// Summing out C and the A_i's, the posterior of the genotype G is
+//
+//   P(G | C, O_1..O_n)  ~  sum_C prior(C) genotype(C, G)  *  prod_i sum_A original(G, A) observation(A, O_i)
+//
+// so there is no need to pass messages through the 2n+2 variables of
+// the full DFG. The per symbol factors are computed once, when the
+// model is read.
+class StarModel {
+public:
+  StarModel(std::string const & stateMapsFile, std::string const & potentialsFile);
+  // from already parsed specifications (source names them in error messages)
+  StarModel(std::map<std::string, StateMapSpec> const & maps, std::map<std::string, PotentialSpec> const & pots, std::string const & source);
+
+  // Check that the variables/factor graph specification is the star
+  // shaped graph evaluated by this class. If not, reason is set.
+  static bool isStarGraph(std::string const & variablesFile, std::string const & factorGraphFile, std::string & reason);
+
+  unsigned genotypeCount() const {return genotypeSymbols_.size();}
+  std::vector<std::string> const & genotypeSymbols() const {return genotypeSymbols_;}
+
+  // Posterior probabilities of G given the symbols of C, O1, ..., On
+  // (as in a line of the .tab input). pp must have genotypeCount()
+  // entries.
+  void calcPosterior(std::vector<std::string> const & symbols, unsigned depth, phy::xvector_t & pp) const;
+  // the same for the symbol codes of a SiteRecord
+  void calcPosterior(std::vector<symbol_code_t> const & codes, unsigned depth, phy::xvector_t & pp) const;
+
+  // Collapse the symbols of C, O1, ..., On into hist (which is cleared
+  // first) and evaluate the posterior from the counts using per symbol
+  // powers, in O(distinct symbols) per genotype.
+  void countSymbols(std::vector<std::string> const & symbols, unsigned depth, SymbolHistogram & hist) const;
+  void countSymbols(std::vector<symbol_code_t> const & codes, unsigned depth, SymbolHistogram & hist) const;
+  // from the codes of rec if it has them, else from its symbols
+  void countSymbols(SiteRecord const & rec, unsigned depth, SymbolHistogram & hist) const
+  {
+    if ( rec.codes.empty() )
+      countSymbols(rec.symbols, depth, hist);
+    else
+      countSymbols(rec.codes, depth, hist);
+  }
+  void calcPosterior(SymbolHistogram const & hist, phy::xvector_t & pp) const;
+
+  unsigned observationSymbolCount() const {return emission_.size();}
+
+  // Index of the homozygous genotype of the reference symbol with index
+  // c (as SymbolHistogram::ref), or -1 if c is not a single base (e.g. N).
+  int homGenotype(unsigned c) const {return homGenotype_[c];}
+
+  // Upper bound on the posterior probability of the genotypes other
+  // than g, i.e. on 1 - P(G = g | counts), in O(distinct symbols). With
+  // r_h the reference factors and e_h(o) the emission factors,
+  //
+  //   sum_{h != g} r_h prod_o e_h(o)^n_o  <=  (sum_{h != g} r_h) prod_o max_{h != g} (e_h(o) / e_g(o))^n_o  *  prod_o e_g(o)^n_o
+  //
+  // so only one ratio per symbol is needed instead of one per genotype.
+  double otherGenotypesBound(SymbolHistogram const & hist, unsigned g) const;
+
+  // log factors, indexed by the SymbolHistogram indices ([c][g] and [o][g])
+  std::vector< std::vector<double> > const & logRefFactors() const {return logRefFactor_;}
+  std::vector< std::vector<double> > const & logEmissions() const {return logEmission_;}
+
+protected:
+  void init(std::map<std::string, StateMapSpec> const & maps, std::string const & stateMapsFile, std::map<std::string, PotentialSpec> const & pots, std::string const & potentialsFile);
+
+  unsigned nucleotideIndex(std::string const & symbol) const;
+  unsigned observationIndex(std::string const & symbol) const;
+  unsigned nucleotideIndex(symbol_code_t code) const;
+  unsigned observationIndex(symbol_code_t code) const;
+
+  template<class Symbol>
+  void calcPosteriorOf(std::vector<Symbol> const & symbols, unsigned depth, phy::xvector_t & pp) const;
+  template<class Symbol>
+  void countSymbolsOf(std::vector<Symbol> const & symbols, unsigned depth, SymbolHistogram & hist) const;
+
+  std::vector<std::string> genotypeSymbols_;
+
+  // nucleotide symbol (incl. meta symbols) -> index into refFactor_
+  std::map<std::string, unsigned> nucIndex_;
+  // input symbol (incl. meta symbols) -> index into emission_
+  std::map<std::string, unsigned> obsIndex_;
+  // the same for symbol codes (see Pileup.h), UINT_MAX for symbols not in the maps
+  std::vector<unsigned> nucCodeIndex_;
+  std::vector<unsigned> obsCodeIndex_;
+
+  // refFactor_[c][g] = sum_{C in c} prior(C) genotype(C, g)
+  std::vector< std::vector<phy::xnumber_t> > refFactor_;
+  // emission_[o][g] = sum_A original(g, A) sum_{O in o} observation(A, O)
+  std::vector< std::vector<phy::xnumber_t> > emission_;
+  // log of the above, for evaluating powers of the factors in double precision
+  std::vector< std::vector<double> > logRefFactor_;
+  std::vector< std::vector<double> > logEmission_;
+
+  // for otherGenotypesBound: homGenotype_[c], logOtherRef_[c][g] = log(sum_{h != g} r_h / r_g)
+  // and maxLogRatio_[o][g] = max_{h != g} log(e_h(o) / e_g(o))
+  std::vector<int> homGenotype_;
+  std::vector< std::vector<double> > logOtherRef_;
+  std::vector< std::vector<double> > maxLogRatio_;
+};
+
+#endif  // __StarModel_h
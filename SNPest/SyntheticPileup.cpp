@@ -0,0 +1,165 @@
+#include "SyntheticPileup.h"
+#include "phy/utils.h"
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_real_distribution.hpp>
+#include <boost/random/uniform_int_distribution.hpp>
+#include <boost/random/gamma_distribution.hpp>
+#include <boost/random/poisson_distribution.hpp>
+#include <vector>
+#include <cmath>
+#include <cctype>
+#include <cstdio>
+
+using namespace phy;
+
+// fraction of reference bases that are N
+static double const SYNTH_N_RATE = 0.001;
+// fraction of reads starting or ending at a site
+static double const SYNTH_READ_END_RATE = 0.01;
+// fraction of reads with mapping quality below 60
+static double const SYNTH_LOW_MAPQ_RATE = 0.1;
+// base qualities are within this of the Phred score of the error rate
+static int const SYNTH_QUAL_SPREAD = 8;
+// largest base quality (as Illumina 1.8+)
+static int const SYNTH_MAX_QUAL = 41;
+
+
+// writes the data of one spec
+class SyntheticPileupWriter {
+public:
+  SyntheticPileupWriter(SyntheticPileupSpec const & spec) : spec_(spec), rng_(spec.seed) {}
+
+  unsigned long write(std::ostream & str);
+
+private:
+  double uniform() {return boost::random::uniform_real_distribution<double>(0, 1)(rng_);}
+  int uniformInt(int a, int b) {return boost::random::uniform_int_distribution<int>(a, b)(rng_);}
+  unsigned drawDepth();
+  char otherBase(char b) {return BASES[ (baseIndex(b) + uniformInt(1, 3)) % 4 ];}
+  static unsigned baseIndex(char b);
+  void addRead(char base, char ref, unsigned long site);
+
+  static char const BASES[];
+
+  SyntheticPileupSpec const & spec_;
+  boost::random::mt19937 rng_;
+  int meanQual_;
+  std::string refSeq_;
+  std::vector<unsigned> deletions_;  // bases left of deletions from earlier sites, one per read
+  std::string bases_, quals_, mapqs_;
+};
+
+char const SyntheticPileupWriter::BASES[] = "ACGT";
+
+
+unsigned SyntheticPileupWriter::baseIndex(char b)
+{
+  switch (b) {
+  case 'A': return 0;
+  case 'C': return 1;
+  case 'G': return 2;
+  default: return 3;
+  }
+}
+
+
+unsigned SyntheticPileupWriter::drawDepth()
+{
+  double mean = spec_.meanDepth;
+  if (spec_.depthDispersion > 0)
+    mean = boost::random::gamma_distribution<double>(1 / spec_.depthDispersion, spec_.meanDepth * spec_.depthDispersion)(rng_);
+  if ( not (mean > 0) )
+    return 0;
+  return boost::random::poisson_distribution<unsigned, double>(mean)(rng_);
+}
+
+
+void SyntheticPileupWriter::addRead(char base, char ref, unsigned long site)
+{
+  int q = std::max( 2, std::min( SYNTH_MAX_QUAL, meanQual_ + uniformInt(-SYNTH_QUAL_SPREAD, SYNTH_QUAL_SPREAD) ) );
+  if ( uniform() < pow(10.0, -q / 10.0) )
+    base = otherBase(base);
+  int mapq = ( uniform() < SYNTH_LOW_MAPQ_RATE ) ? uniformInt(0, 59) : 60;
+  bool reverse = uniform() < 0.5;
+
+  if ( uniform() < SYNTH_READ_END_RATE ) {
+    bases_ += '^';
+    bases_ += (char) (mapq + 33);
+  }
+  if (base == ref)
+    bases_ += reverse ? ',' : '.';
+  else
+    bases_ += reverse ? (char) tolower(base) : base;
+  if ( uniform() < SYNTH_READ_END_RATE )
+    bases_ += '$';
+  else if ( uniform() < spec_.indelRate ) {
+    unsigned len = uniformInt(1, 3);
+    bool del = uniform() < 0.5;
+    char buf[8];
+    sprintf(buf, "%c%u", del ? '-' : '+', len);
+    bases_ += buf;
+    for (unsigned k = 0; k < len; k++) {
+      char b = del ? refSeq_[site + 1 + k] : BASES[ uniformInt(0, 3) ];
+      bases_ += reverse ? (char) tolower(b) : b;
+    }
+    if (del)
+      deletions_.push_back(len);
+  }
+  quals_ += (char) (q + 33);
+  mapqs_ += (char) (mapq + 33);
+}
+
+
+unsigned long SyntheticPileupWriter::write(std::ostream & str)
+{
+  meanQual_ = std::max( 2, std::min( SYNTH_MAX_QUAL, (int) floor( -10 * log10( std::max(spec_.errorRate, 1e-6) ) + 0.5 ) ) );
+
+  // reference, with room for deletions at the end
+  refSeq_.resize(spec_.sites + 3);
+  for (unsigned long i = 0; i < refSeq_.size(); i++)
+    refSeq_[i] = ( uniform() < SYNTH_N_RATE ) ? 'N' : BASES[ uniformInt(0, 3) ];
+
+  unsigned long lines = 0;
+  for (unsigned long i = 0; i < spec_.sites; i++) {
+    char ref = refSeq_[i];
+    char allele1 = (ref == 'N') ? BASES[ uniformInt(0, 3) ] : ref;
+    char allele2 = allele1;
+    if ( uniform() < spec_.snpRate ) {
+      char alt = otherBase(allele1);
+      if ( spec_.haploid or uniform() < 1 / 3.0 )
+	allele1 = alt;
+      allele2 = alt;
+    }
+
+    bases_.clear();
+    quals_.clear();
+    mapqs_.clear();
+    // reads deleted here, then the reads covering the site
+    std::vector<unsigned> deleted;
+    deleted.swap(deletions_);
+    for (unsigned k = 0; k < deleted.size(); k++) {
+      bases_ += '*';
+      quals_ += (char) (meanQual_ + 33);
+      mapqs_ += (char) (60 + 33);
+      if (deleted[k] > 1)
+	deletions_.push_back(deleted[k] - 1);
+    }
+    unsigned depth = drawDepth();
+    for (unsigned r = 0; r < depth; r++)
+      addRead( ( uniform() < 0.5 ) ? allele1 : allele2, ref, i );
+    if ( quals_.empty() )
+      continue;
+
+    str << spec_.chrom << '\t' << i + 1 << '\t' << ref << '\t' << quals_.size() << '\t' << bases_ << '\t' << quals_ << '\t' << mapqs_ << '\n';
+    lines++;
+  }
+  return lines;
+}
+
+
+unsigned long writeSyntheticPileup(std::ostream & str, SyntheticPileupSpec const & spec)
+{
+  if ( spec.sites == 0 or not (spec.meanDepth >= 0) or spec.depthDispersion < 0 or not (spec.errorRate >= 0 and spec.errorRate < 1) or not (spec.indelRate >= 0 and spec.indelRate <= 1) or not (spec.snpRate >= 0 and spec.snpRate <= 1) )
+    errorAbort("From writeSyntheticPileup: the number of sites must be positive, the depth and dispersion non-negative and the rates within [0, 1).");
+  return SyntheticPileupWriter(spec).write(str);
+}
@@ -0,0 +1,36 @@
+#ifndef __SyntheticPileup_h
+#define __SyntheticPileup_h
+
+#include <string>
+#include <ostream>
+
+// Settings of synthetic 'samtools mpileup -s' data. Each site has a
+// random reference base (occasionally N) and genotype; a site is
+// variant with probability snpRate, heterozygous in two of three cases
+// for diploid data. The depth is Poisson with a gamma distributed mean
+// (negative binomial, over dispersed as real coverage), the base
+// qualities vary around the Phred score of errorRate and each base is
+// wrong with the probability given by its quality. A read carries an
+// insertion or deletion of 1 to 3 bases after a site with probability
+// indelRate; deleted bases show as '*' at the following sites. Most
+// reads have mapping quality 60. The same seed gives the same data.
+struct SyntheticPileupSpec {
+  std::string chrom;
+  unsigned long sites;
+  double meanDepth;
+  double depthDispersion;  // variance is meanDepth + depthDispersion * meanDepth^2; 0 is Poisson
+  double errorRate;
+  double indelRate;
+  double snpRate;
+  bool haploid;
+  unsigned seed;
+
+  SyntheticPileupSpec()
+    : chrom("synth"), sites(100000), meanDepth(30), depthDispersion(0.1), errorRate(0.01), indelRate(0.001), snpRate(0.001), haploid(false), seed(1) {}
+};
+
+// Write the lines of the sites of spec to str. Sites without reads are
+// left out, as mpileup does. Returns the number of lines written.
+unsigned long writeSyntheticPileup(std::ostream & str, SyntheticPileupSpec const & spec);
+
+#endif  // __SyntheticPileup_h
@@ -0,0 +1,276 @@
+#include "VcfCleanup.h"
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+using namespace std;
+
+
+// the value of the string as a Perl number: the decimal number at its
+// start, after white space, and 0 if there is none
+static double perlNumber(char const * begin, char const * end)
+{
+  char buf[64];
+  size_t n = std::min( (size_t) (end - begin), sizeof(buf) - 1 );
+  memcpy(buf, begin, n);
+  buf[n] = '\0';
+  char const * p = buf;
+  while ( isspace( (unsigned char) * p ) )
+    p++;
+  char const * q = (* p == '+' or * p == '-') ? p + 1 : p;
+  if (q[0] == '0' and (q[1] == 'x' or q[1] == 'X') )
+    return 0;  // no hexadecimal numbers in Perl
+  return strtod(p, NULL);
+}
+
+
+static double perlNumber(string const & s)
+{
+  return perlNumber( s.data(), s.data() + s.size() );
+}
+
+
+// x as Perl prints a number
+static void appendPerlNumber(string & s, double x)
+{
+  if (x != x)
+    s += "NaN";
+  else if ( std::isinf(x) )
+    s += (x > 0) ? "Inf" : "-Inf";
+  else {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.15g", x);
+    s += buf;
+  }
+}
+
+
+static bool isDigit(char c)
+{
+  return c >= '0' and c <= '9';
+}
+
+
+// the end of the digits at s[i], or npos if there are none or they are
+// not followed by ';', i.e. of a match of [0-9]+; at i
+static size_t digitsThenSemicolon(string const & s, size_t i)
+{
+  size_t j = i;
+  while ( j < s.size() and isDigit(s[j]) )
+    j++;
+  return (j > i and j < s.size() and s[j] == ';') ? j : string::npos;
+}
+
+
+// s/DP=([0-9]+);.*/$1/ on info
+static void matchDepth(string const & info, string & depth)
+{
+  for (size_t i = info.find("DP="); i != string::npos; i = info.find("DP=", i + 1) ) {
+    size_t e = digitsThenSemicolon(info, i + 3);
+    if (e != string::npos) {
+      depth.assign(info, 0, i);
+      depth.append(info, i + 3, e - i - 3);
+      return;
+    }
+  }
+  depth = info;
+}
+
+
+// s/.*AVMQ=([0-9]+)/$1/ on info, as a number
+static double matchAvMapQ(string const & info)
+{
+  for (size_t i = info.rfind("AVMQ="); i != string::npos; i = (i == 0) ? string::npos : info.rfind("AVMQ=", i - 1) )
+    if ( i + 5 < info.size() and isDigit(info[i + 5]) )
+      return perlNumber( info.data() + i + 5, info.data() + info.size() );
+  return perlNumber(info);
+}
+
+
+// s/.*FRACDEL=([0-9]\.[0-9]+);.*/$1/ on info
+static void matchFracDel(string const & info, string & fracDel)
+{
+  for (size_t i = info.rfind("FRACDEL="); i != string::npos; i = (i == 0) ? string::npos : info.rfind("FRACDEL=", i - 1) ) {
+    size_t b = i + 8;
+    if (b + 2 < info.size() and isDigit(info[b]) and info[b + 1] == '.') {
+      size_t e = digitsThenSemicolon(info, b + 2);
+      if (e != string::npos) {
+	fracDel.assign(info, b, e - b);
+	return;
+      }
+    }
+  }
+  fracDel = info;
+}
+
+
+// s/.*\DEL=([0-9]+);.*/$1/ on info (\D is any character but a digit,
+// so FRACDEL= matches too), as a number
+static double matchDeletedReads(string const & info)
+{
+  for (size_t i = info.rfind("EL="); i != string::npos; i = (i == 0) ? string::npos : info.rfind("EL=", i - 1) ) {
+    if ( i == 0 or isDigit(info[i - 1]) )
+      continue;
+    size_t e = digitsThenSemicolon(info, i + 3);
+    if (e != string::npos)
+      return perlNumber( info.data() + i + 3, info.data() + e );
+  }
+  return perlNumber(info);
+}
+
+
+// s/DEL.*PP/PP/ on info
+static void removeDeletion(string & info)
+{
+  size_t i = info.find("DEL");
+  if (i == string::npos)
+    return;
+  size_t k = info.rfind("PP");
+  if (k == string::npos or k < i + 3)
+    return;
+  info.erase(i, k - i);
+}
+
+
+VcfCleaner::VcfCleaner(VcfCleanupSettings const & settings)
+  : settings_(settings), lastDepth_(-1), substitution_(false), insCount_(0), delCount_(0)
+{}
+
+
+void VcfCleaner::parse(char const * begin, char const * end, VcfCleanupLine & line) const
+{
+  line.header = (begin < end and * begin == '#');
+  if (line.header) {
+    line.text.assign(begin, end);
+    return;
+  }
+
+  // the first eight tab separated fields, empty if missing
+  string * fields[8] = {& line.id, & line.pos, NULL, & line.ref, & line.geno, & line.qual, NULL, & line.info};
+  char const * p = begin;
+  for (unsigned k = 0; k < 8; k++) {
+    char const * e = (p == NULL) ? NULL : std::find(p, end, '\t');
+    if (fields[k] != NULL) {
+      if (p == NULL)
+	fields[k]->clear();
+      else
+	fields[k]->assign(p, e);
+    }
+    p = (p == NULL or e == end) ? NULL : e + 1;
+  }
+
+  matchDepth(line.info, line.depth);
+  line.depthValue = perlNumber(line.depth);
+  double avMapQ = matchAvMapQ(line.info);
+
+  line.deletion = false;
+  if (line.info.find("DEL") != string::npos) {
+    matchFracDel(line.info, line.fracDel);
+    line.depthValue += matchDeletedReads(line.info);
+    line.depth.clear();
+    appendPerlNumber(line.depth, line.depthValue);
+    if (perlNumber(line.fracDel) >= settings_.minFracDel and line.depthValue >= settings_.minDepth)
+      line.deletion = true;
+    else
+      removeDeletion(line.info);
+  }
+
+  line.insertion = (line.info.find("INS=") != string::npos);
+  line.site = (not line.insertion and line.info.find("DEL") == string::npos);
+  line.substitution = (line.site and line.depthValue >= settings_.minDepth and perlNumber(line.qual) >= settings_.minQual and avMapQ >= settings_.minQual and line.geno != ".");
+}
+
+
+bool VcfCleaner::add(VcfCleanupLine const & line, string & out)
+{
+  if (line.header) {
+    out += line.text;
+    out += '\n';
+    return true;
+  }
+  id_ = line.id;
+
+  if (line.deletion) {
+    if (delCount_ == 0) {
+      delDepths_ = "DEL=" + line.depth;
+      delFracs_ = "FRACDEL=" + line.fracDel;
+    }
+    else {
+      delDepths_ += "," + line.depth;
+      delFracs_ += "," + line.fracDel;
+    }
+    delGenos_ += line.ref;
+    delCount_++;
+  }
+
+  if (line.insertion) {
+    if (lastDepth_ == 0)
+      return false;
+    double fracIns = line.depthValue / lastDepth_;
+    if (fracIns >= settings_.minFracIns and line.depthValue >= settings_.minDepth) {
+      if (insCount_ == 0) {
+	insDepths_ = "INS=" + line.depth;
+	insFracs_ = "FRACINS=";
+      }
+      else {
+	insDepths_ += "," + line.depth;
+	insFracs_ += ",";
+      }
+      appendPerlNumber(insFracs_, fracIns);
+      insGenos_ += line.geno;
+      insCount_++;
+    }
+  }
+
+  if (line.site) {
+    // the last site, with its insertions and deletions
+    if (insCount_ > 0 or delCount_ > 0) {
+      writeIndels(out);
+      substitution_ = false;
+    }
+    if (substitution_)
+      out += id_ + "\t" + lastPos_ + "\t.\t" + lastRef_ + "\t" + lastGeno_ + "\t" + lastQual_ + "\t.\t" + lastInfo_ + "\n";
+
+    substitution_ = line.substitution;
+    lastPos_ = line.pos;
+    lastRef_ = line.ref;
+    lastDepth_ = line.depthValue;
+    lastGeno_ = line.substitution ? line.geno : line.ref;
+    lastQual_ = line.qual;
+    lastInfo_ = line.info;
+  }
+  return true;
+}
+
+
+void VcfCleaner::writeIndels(string & out)
+{
+  if (insCount_ > 0) {
+    out += id_ + "\t" + lastPos_ + "\t.\t" + lastRef_ + "\t" + lastGeno_ + insGenos_ + "\t" + lastQual_ + "\t.\t" + lastInfo_ + ";" + insDepths_ + ";" + insFracs_ + "\n";
+    insCount_ = 0;
+    insDepths_.clear();
+    insFracs_.clear();
+    insGenos_.clear();
+  }
+  if (delCount_ > 0) {
+    out += id_ + "\t" + lastPos_ + "\t.\t" + lastRef_ + delGenos_ + "\t" + lastGeno_ + "\t" + lastQual_ + "\t.\t" + lastInfo_ + ";" + delDepths_ + ";" + delFracs_ + "\n";
+    delCount_ = 0;
+    delDepths_.clear();
+    delFracs_.clear();
+    delGenos_.clear();
+  }
+}
+
+
+void VcfCleaner::finish(string & out)
+{
+  // unlike at a site, the script also writes the substitution after
+  // the insertions and deletions
+  writeIndels(out);
+  if (substitution_)
+    out += id_ + "\t" + lastPos_ + "\t.\t" + lastRef_ + "\t" + lastGeno_ + "\t" + lastQual_ + "\t.\t" + lastInfo_ + "\n";
+  substitution_ = false;
+}
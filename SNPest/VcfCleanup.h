@@ -0,0 +1,84 @@
+#ifndef __VcfCleanup_h
+#define __VcfCleanup_h
+
+#include <string>
+
+// The filtering of cleanupvcf.pl, with the same output for the same
+// input and settings: high quality substitutions are kept, and the
+// deletion and insertion lines of SNPest (INFO with DEL/FRACDEL or INS)
+// that enough reads support are merged into the preceding site, as
+//
+//   chrom  pos  .  REF+deleted bases  ALT  QUAL  .  INFO;DEL=..;FRACDEL=..
+//   chrom  pos  .  REF  ALT+inserted bases  QUAL  .  INFO;INS=..;FRACINS=..
+//
+// with comma separated lists of the reads supporting each deleted or
+// inserted base. The INFO fields are found as the regular expressions
+// of the script find them, and numbers are converted and printed as
+// Perl does. The quirks of the script are kept, e.g. a merged line has
+// the chromosome of the line that follows it.
+//
+// Each line is parsed on its own (VcfCleaner::parse), so blocks of
+// lines can be parsed in parallel; only the merging (VcfCleaner::add)
+// runs through the lines in order.
+struct VcfCleanupSettings {
+  long minDepth, minQual;
+  double minFracDel, minFracIns;
+
+  // the defaults of cleanupvcf.pl
+  VcfCleanupSettings() : minDepth(10), minQual(30), minFracDel(0.9), minFracIns(0.9) {}
+};
+
+
+// One input line as parsed by VcfCleaner::parse. The strings are
+// reused, so a vector of lines parses block after block without
+// allocating.
+struct VcfCleanupLine {
+  bool header;       // a '#' line, written as is (text)
+  std::string text;
+
+  // the fields of a data line; info without a deletion that fails the
+  // thresholds, as the script removes it
+  std::string id, pos, ref, geno, qual, info;
+  std::string depth;  // DP (plus the deleted reads), as the script prints it
+  double depthValue;
+  bool deletion;      // a deletion that passes the thresholds
+  std::string fracDel;
+  bool insertion;     // info has INS=
+  bool site;          // info has neither INS= nor DEL
+  bool substitution;  // a site that passes the thresholds
+};
+
+
+class VcfCleaner {
+public:
+  VcfCleaner(VcfCleanupSettings const & settings);
+
+  // Parse the line [begin, end), without the newline, into line.
+  void parse(char const * begin, char const * end, VcfCleanupLine & line) const;
+
+  // Append the output of the next line to out. Returns false if the
+  // line is an insertion following a site of depth 0, where the script
+  // dies from a division by zero.
+  bool add(VcfCleanupLine const & line, std::string & out);
+
+  // the output pending at the end of the input
+  void finish(std::string & out);
+
+private:
+  void writeIndels(std::string & out);
+
+  VcfCleanupSettings settings_;
+
+  // the id of the last line, and the fields of the last site
+  std::string id_;
+  std::string lastPos_, lastRef_, lastGeno_, lastQual_, lastInfo_;
+  double lastDepth_;
+  bool substitution_;
+
+  // the insertions and deletions following the last site
+  unsigned insCount_, delCount_;
+  std::string insDepths_, insFracs_, insGenos_;
+  std::string delDepths_, delFracs_, delGenos_;
+};
+
+#endif  // __VcfCleanup_h
@@ -0,0 +1,563 @@
+#include "VcfWriter.h"
+#include "phy/utils.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <ctime>
+#include <sstream>
+#include <algorithm>
+
+using namespace phy;
+
+// as written by SNPest.pl
+static char const VCF_SOURCE[] = "SNPest ver. 1.0";
+// smallest error probability of a call (QUAL at most 60)
+static double const VCF_MIN_PROB = 0.000001;
+
+
+string mkVcfHeader(string const & reference, string const & model, unsigned maxDepth, vector<GenomicRegion> const & contigs, bool refBlocks, vector<string> const & samples)
+{
+  char date[16];
+  time_t now = time(NULL);
+  strftime(date, sizeof(date), "%Y%m%d", localtime(& now) );
+
+  string h = "##fileformat=VCFv4.2\n";
+  h += string("##fileDate=") + date + "\n";
+  h += string("##source=") + VCF_SOURCE + "\n";
+  if ( not reference.empty() )
+    h += "##reference=file:" + reference + "\n";
+  h += "##model=" + model + "\n";
+  h += "##maxDepth=" + toString(maxDepth) + "\n";
+  h += "##INFO=<ID=DP,Number=1,Type=Integer,Description=\"Total Depth\">\n";
+  h += "##INFO=<ID=PP,Number=1,Type=Float,Description=\"Posterior probability\">\n";
+  h += "##INFO=<ID=AVMQ,Number=1,Type=Integer,Description=\"Average mapping quality\">\n";
+  h += "##INFO=<ID=DEL,Number=1,Type=Integer,Description=\"Comma separated list of number of reads supporting deletion(s)\">\n";
+  h += "##INFO=<ID=FRACDEL,Number=1,Type=Float,Description=\"Comma separated list of fraction of reads supporting deletion(s)\">\n";
+  h += "##INFO=<ID=INS,Number=1,Type=Integer,Description=\"Comma separated list of number of reads supporting insertion(s)\">\n";
+  h += "##INFO=<ID=FRACINS,Number=1,Type=Float,Description=\"Comma separated list of fraction of reads supporting insertion(s)\">\n";
+  if (refBlocks) {
+    h += "##INFO=<ID=END,Number=1,Type=Integer,Description=\"Last position of the reference block starting at POS\">\n";
+    h += "##referenceBlocks=SNPest reference blocks, not gVCF blocks: a line with END in INFO is a run of adjacent confident hom-ref sites from POS to END, with the smallest QUAL, DP, PP and AVMQ of the sites\n";
+  }
+  if ( not samples.empty() ) {
+    h += "##FORMAT=<ID=GT,Number=1,Type=String,Description=\"Genotype\">\n";
+    h += "##FORMAT=<ID=GQ,Number=1,Type=Integer,Description=\"Genotype quality\">\n";
+    h += "##FORMAT=<ID=DP,Number=1,Type=Integer,Description=\"Read depth\">\n";
+  }
+  for (unsigned i = 0; i < contigs.size(); i++)
+    h += "##contig=<ID=" + contigs[i].chrom + ",length=" + toString(contigs[i].end) + ">\n";
+  h += "#CHROM\tPOS\tID\tREF\tALT\tQUAL\tFILTER\tINFO";
+  if ( not samples.empty() )
+    h += "\tFORMAT";
+  for (unsigned i = 0; i < samples.size(); i++)
+    h += '\t' + samples[i];
+  h += '\n';
+  return h;
+}
+
+
+// x as read back from output with prec significant digits
+static double roundToPrecision(xnumber_t const & x, unsigned prec)
+{
+#ifdef XNUMBER_IS_XDOUBLE
+  ostringstream s;
+  s.precision(prec);
+  s << x;
+  return strtod(s.str().c_str(), NULL);
+#else
+  char buf[40];
+  snprintf(buf, sizeof(buf), "%.*g", (int) prec, (double) x);
+  return strtod(buf, NULL);
+#endif
+}
+
+
+// split chrom_pos_ref_avmapq_depth from the right at sep; chrom may contain '_'
+static void splitSiteId(string const & id, size_t sep[4])
+{
+  size_t end = id.size();
+  for (unsigned k = 4; k-- > 0; ) {
+    sep[k] = (end == 0) ? string::npos : id.rfind('_', end - 1);
+    if (sep[k] == string::npos)
+      errorAbort("From mkVcfRecord: site id '" + id + "' is not of the form chrom_pos_ref_avmapq_depth.");
+    end = sep[k];
+  }
+}
+
+
+// the first genotype with the smallest error probability, -1 if there
+// are none
+static int bestGenotype(xnumber_t const * ppOther, unsigned genotypeCount, unsigned prec, double & prob)
+{
+  int best = -1;
+  prob = 2.0;
+  for (unsigned i = 0; i < genotypeCount; i++) {
+    double p = roundToPrecision(ppOther[i], prec);
+    if (p < prob) {
+      prob = p;
+      best = i;
+    }
+  }
+  return best;
+}
+
+
+// QUAL (and GQ) of an error probability
+static int phredQual(double prob)
+{
+  return (int) ( -10 * ( log(prob) / log(10.0) ) + 1 );
+}
+
+
+void mkVcfRecord(string & line, string const & id, vector<string> const & genotypes, vector<xnumber_t> const & ppOther, unsigned prec)
+{
+  assert( genotypes.size() == ppOther.size() );
+  size_t sep[4];
+  splitSiteId(id, sep);
+  double prob;
+  int best = bestGenotype(& ppOther[0], genotypes.size(), prec, prob);
+  char const * call = (best >= 0) ? genotypes[best].c_str() : "NN";
+  if (prob < VCF_MIN_PROB)
+    prob = VCF_MIN_PROB;
+
+  // homozygous as one base, heterozygous as 'X,Y'; the reference base as '.'
+  char alt[4] = {call[0], ',', call[1], '\0'};
+  if (call[0] == call[1])
+    alt[1] = '\0';
+  size_t refLength = sep[2] - sep[1] - 1;
+  char * refPos = (refLength == 1) ? strchr(alt, id[sep[1] + 1]) : NULL;
+  if (refPos != NULL)
+    * refPos = '.';
+
+  char buf[64];
+  line.assign(id, 0, sep[0]);
+  line += '\t';
+  line.append(id, sep[0] + 1, sep[1] - sep[0] - 1);
+  line += "\t.\t";
+  line.append(id, sep[1] + 1, refLength);
+  line += '\t';
+  line += alt;
+  snprintf(buf, sizeof(buf), "\t%d\t.\tDP=", phredQual(prob) );
+  line += buf;
+  line.append(id, sep[3] + 1, string::npos);
+  snprintf(buf, sizeof(buf), ";PP=%.15g;AVMQ=", 1 - prob);
+  line += buf;
+  line.append(id, sep[2] + 1, sep[3] - sep[2] - 1);
+  line += '\n';
+}
+
+
+MultiSampleVcfFormatter::MultiSampleVcfFormatter(vector<string> const & genotypes, unsigned prec)
+  : genotypes_(genotypes), prec_(prec), haploid_(true)
+{
+  for (unsigned g = 0; g < genotypes_.size(); g++) {
+    if (genotypes_[g].size() != 2)
+      errorAbort("From MultiSampleVcfFormatter: genotype symbols must have two bases, not '" + genotypes_[g] + "'.");
+    if (genotypes_[g][0] != genotypes_[g][1])
+      haploid_ = false;
+  }
+}
+
+
+// value of the INFO field tag (e.g. ";DEL=") in the site id, 0 if absent
+static unsigned long idInfoValue(string const & id, char const * tag)
+{
+  size_t i = id.find(tag);
+  return (i == string::npos) ? 0 : strtoul(id.c_str() + i + strlen(tag), NULL, 10);
+}
+
+
+void MultiSampleVcfFormatter::mkRecord(string & line, vector<string> const & ids, vector<xnumber_t> const & ppOther)
+{
+  unsigned nG = genotypes_.size(), sampleCount = ids.size();
+  assert( ppOther.size() == sampleCount * nG );
+  calls_.resize(sampleCount);
+  probs_.resize(sampleCount);
+  depths_.resize(sampleCount);
+
+  // the calls, and the sums over the samples of the fields of the ids
+  size_t sep[4];
+  splitSiteId(ids[0], sep);
+  size_t refLength = sep[2] - sep[1] - 1;
+  char ref = (refLength == 1) ? ids[0][sep[1] + 1] : '\0';
+  bool altBase[256] = {false};
+  double errorSum = 0;
+  unsigned long depthSum = 0, mapQSum = 0, delSum = 0, insSum = 0;
+  bool hasIns = false;
+  for (unsigned s = 0; s < sampleCount; s++) {
+    string const & id = ids[s];
+    size_t sampleSep[4];
+    splitSiteId(id, sampleSep);
+    depths_[s] = strtoul(id.c_str() + sampleSep[3] + 1, NULL, 10);
+    calls_[s] = -1;
+    if (depths_[s] == 0)
+      continue;
+    calls_[s] = bestGenotype(& ppOther[s * nG], nG, prec_, probs_[s]);
+    errorSum += probs_[s];
+    probs_[s] = max(probs_[s], VCF_MIN_PROB);
+    if (calls_[s] >= 0)
+      for (unsigned k = 0; k < 2; k++)
+	if (genotypes_[ calls_[s] ][k] != ref)
+	  altBase[ (unsigned char) genotypes_[ calls_[s] ][k] ] = true;
+    depthSum += depths_[s];
+    mapQSum += depths_[s] * strtoul(id.c_str() + sampleSep[2] + 1, NULL, 10);
+    delSum += idInfoValue(id, ";DEL=");
+    if (id.find(";INS=") != string::npos) {
+      hasIns = true;
+      insSum += idInfoValue(id, ";INS=");
+    }
+  }
+
+  // the alternative alleles in the order of the genotype symbols
+  alleles_.assign(1, ref);
+  for (unsigned g = 0; g < nG; g++)
+    for (unsigned k = 0; k < 2; k++) {
+      char b = genotypes_[g][k];
+      if (altBase[(unsigned char) b] and alleles_.find(b) == string::npos)
+	alleles_ += b;
+    }
+
+  char buf[64];
+  line.assign(ids[0], 0, sep[0]);
+  line += '\t';
+  line.append(ids[0], sep[0] + 1, sep[1] - sep[0] - 1);
+  line += "\t.\t";
+  line.append(ids[0], sep[1] + 1, refLength);
+  line += '\t';
+  for (unsigned a = 1; a < alleles_.size(); a++) {
+    if (a > 1)
+      line += ',';
+    line += alleles_[a];
+  }
+  if (alleles_.size() == 1)
+    line += '.';
+  bool covered = (depthSum > 0);
+  double prob = max( min(errorSum, 1.0), VCF_MIN_PROB );
+  if (covered)
+    snprintf(buf, sizeof(buf), "\t%d\t.\tDP=%lu", phredQual(prob), depthSum);
+  else
+    snprintf(buf, sizeof(buf), "\t.\t.\tDP=0");
+  line += buf;
+  if (delSum > 0) {
+    snprintf(buf, sizeof(buf), ";DEL=%lu;FRACDEL=%.15g", delSum, (double) delSum / (delSum + depthSum) );
+    line += buf;
+  }
+  if (hasIns) {
+    snprintf(buf, sizeof(buf), ";INS=%lu", insSum);
+    line += buf;
+  }
+  if (covered) {
+    snprintf(buf, sizeof(buf), ";PP=%.15g;AVMQ=%lu", 1 - prob, (unsigned long) ( (double) mapQSum / depthSum + 0.5 ) );
+    line += buf;
+  }
+  line += "\tGT:GQ:DP";
+
+  for (unsigned s = 0; s < sampleCount; s++) {
+    line += '\t';
+    if (calls_[s] < 0) {
+      line += haploid_ ? "." : "./.";
+      snprintf(buf, sizeof(buf), ":.:%lu", depths_[s]);
+      line += buf;
+      continue;
+    }
+    string const & call = genotypes_[ calls_[s] ];
+    size_t a0 = alleles_.find(call[0]), a1 = alleles_.find(call[1]);
+    if (haploid_)
+      snprintf(buf, sizeof(buf), "%u:%d:%lu", (unsigned) a0, phredQual(probs_[s]), depths_[s]);
+    else
+      snprintf(buf, sizeof(buf), "%u/%u:%d:%lu", (unsigned) min(a0, a1), (unsigned) max(a0, a1), phredQual(probs_[s]), depths_[s]);
+    line += buf;
+  }
+  line += '\n';
+}
+
+
+static bool hasSuffix(string const & s, string const & suffix)
+{
+  return s.size() >= suffix.size() and s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+
+bool isHtsVcfFile(string const & file)
+{
+  return hasSuffix(file, ".gz") or hasSuffix(file, ".bcf");
+}
+
+
+VcfLineBuf::int_type VcfLineBuf::overflow(int_type c)
+{
+  if ( traits_type::eq_int_type( c, traits_type::eof() ) )
+    return traits_type::not_eof(c);
+  char ch = traits_type::to_char_type(c);
+  xsputn(& ch, 1);
+  return c;
+}
+
+
+streamsize VcfLineBuf::xsputn(char const * s, streamsize n)
+{
+  char const * end = s + n;
+  while (s < end) {
+    char const * nl = (char const *) memchr(s, '\n', end - s);
+    if (nl == NULL) {
+      line_.append(s, end - s);
+      break;
+    }
+    line_.append(s, nl - s);
+    writeLine();
+    line_.clear();
+    s = nl + 1;
+  }
+  return n;
+}
+
+
+void VcfLineBuf::finishLine()
+{
+  if ( not line_.empty() ) {
+    writeLine();
+    line_.clear();
+  }
+}
+
+
+VcfFileBuf::VcfFileBuf(string const & file, bool index)
+  : file_(file), index_(index), fp_(NULL), header_(NULL), rec_(NULL)
+{
+  ks_.l = ks_.m = 0;
+  ks_.s = NULL;
+  fp_ = hts_open(file.c_str(), hasSuffix(file, ".bcf") ? "wb" : "wz");
+  if (fp_ == NULL)
+    errorAbort("From VcfFileBuf: cannot open file '" + file + "' for writing.");
+  rec_ = bcf_init();
+}
+
+
+VcfFileBuf::~VcfFileBuf()
+{
+  close();
+}
+
+
+void VcfFileBuf::writeLine()
+{
+  if (header_ == NULL) {
+    if (line_.empty() or line_[0] != '#')
+      errorAbort("From VcfFileBuf: site written to '" + file_ + "' before the VCF header.");
+    headerText_ += line_;
+    headerText_ += '\n';
+    if (line_.compare(0, 6, "#CHROM") != 0)
+      return;
+
+    header_ = bcf_hdr_init("r");
+    if (bcf_hdr_parse(header_, & headerText_[0]) != 0 or bcf_hdr_write(fp_, header_) != 0)
+      errorAbort("From VcfFileBuf: cannot write the VCF header to '" + file_ + "'.");
+    if (index_) {
+      bool bcf = hasSuffix(file_, ".bcf");
+      string indexFile = file_ + (bcf ? ".csi" : ".tbi");
+      if (bcf_idx_init(fp_, header_, bcf ? 14 : 0, indexFile.c_str()) != 0)
+	errorAbort("From VcfFileBuf: cannot index '" + file_ + "'.");
+    }
+    return;
+  }
+
+  // a contig missing from the header would be added to it after it was written
+  size_t tab = line_.find('\t');
+  if (tab == string::npos)
+    errorAbort("From VcfFileBuf: cannot write site '" + line_ + "' to '" + file_ + "'.");
+  line_[tab] = '\0';
+  if (bcf_hdr_name2id(header_, line_.c_str()) < 0)
+    errorAbort("From VcfFileBuf: contig '" + line_.substr(0, tab) + "' of a site is not in the header of '" + file_ + "'.");
+  line_[tab] = '\t';
+
+  ks_.l = 0;
+  kputsn(line_.data(), line_.size(), & ks_);
+  if (vcf_parse(& ks_, header_, rec_) != 0 or bcf_write(fp_, header_, rec_) != 0)
+    errorAbort("From VcfFileBuf: cannot write site '" + line_ + "' to '" + file_ + "'.");
+}
+
+
+void VcfFileBuf::close()
+{
+  if (fp_ == NULL)
+    return;
+  finishLine();
+  if (header_ == NULL)
+    errorAbort("From VcfFileBuf: no VCF header written to '" + file_ + "'.");
+  if (index_ and bcf_idx_save(fp_) != 0)
+    errorAbort("From VcfFileBuf: cannot write the index of '" + file_ + "'.");
+  if (hts_close(fp_) != 0)
+    errorAbort("From VcfFileBuf: error writing '" + file_ + "'.");
+  fp_ = NULL;
+  bcf_hdr_destroy(header_);
+  header_ = NULL;
+  bcf_destroy(rec_);
+  rec_ = NULL;
+  free(ks_.s);
+  ks_.s = NULL;
+}
+
+
+vector<unsigned> parseBands(string const & str)
+{
+  vector<unsigned> bands;
+  char const * p = str.c_str();
+  while (true) {
+    char * end;
+    unsigned long x = strtoul(p, & end, 10);
+    if (end == p or (*end != ',' and *end != '\0') or (not bands.empty() and x <= bands.back()) )
+      errorAbort("From parseBands: '" + str + "' is not a comma separated list of increasing numbers.");
+    bands.push_back(x);
+    if (*end == '\0')
+      return bands;
+    p = end + 1;
+  }
+}
+
+
+// index of the last band with lower limit at most x, -1 if none
+static int bandIndex(unsigned long x, vector<unsigned> const & bands)
+{
+  int i = 0;
+  while ( i < (int) bands.size() and bands[i] <= x )
+    i++;
+  return i - 1;
+}
+
+
+VcfBlockBuf::VcfBlockBuf(streambuf * out, vector<unsigned> const & gqBands, vector<unsigned> const & dpBands)
+  : out_(out), gqBands_(gqBands), dpBands_(dpBands), blockSites_(0)
+{}
+
+
+VcfBlockBuf::~VcfBlockBuf()
+{
+  close();
+}
+
+
+void VcfBlockBuf::put(string const & s)
+{
+  if (out_->sputn( s.data(), s.size() ) != (streamsize) s.size() )
+    errorAbort("From VcfBlockBuf: error writing the VCF output.");
+}
+
+
+void VcfBlockBuf::minStats(BlockStats & a, BlockStats const & b)
+{
+  a.qual = std::min(a.qual, b.qual);
+  a.depth = std::min(a.depth, b.depth);
+  a.avmq = std::min(a.avmq, b.avmq);
+  a.pp = std::min(a.pp, b.pp);
+}
+
+
+void VcfBlockBuf::putBlock(BlockStats const & stats)
+{
+  if (blockSites_ == 1) {
+    put(blockLine_);
+    put("\n");
+    return;
+  }
+  char buf[128];
+  buf_.assign(blockChrom_);
+  snprintf(buf, sizeof(buf), "\t%lu\t.\t", blockBeg_);
+  buf_ += buf;
+  buf_ += blockRef_;
+  snprintf(buf, sizeof(buf), "\t.\t%lu\t.\tDP=%lu;END=%lu;PP=%.15g;AVMQ=%lu\n", stats.qual, stats.depth, blockEnd_, stats.pp, stats.avmq);
+  buf_ += buf;
+  put(buf_);
+}
+
+
+void VcfBlockBuf::writeBlock(bool splitLast)
+{
+  if (blockSites_ == 0)
+    return;
+  if (splitLast and blockSites_ > 1) {
+    blockSites_--;
+    blockEnd_--;
+    putBlock(runStats_);
+    put(lastLine_);
+    put("\n");
+  }
+  else {
+    BlockStats stats = lastStats_;
+    if (blockSites_ > 1)
+      minStats(stats, runStats_);
+    putBlock(stats);
+  }
+  blockSites_ = 0;
+}
+
+
+void VcfBlockBuf::writeLine()
+{
+  // tabs after CHROM POS ID REF ALT QUAL FILTER of a site line
+  size_t tab[7];
+  unsigned n = 0;
+  if (line_.empty() or line_[0] != '#')
+    for (size_t p = line_.find('\t'); p != string::npos and n < 7; p = line_.find('\t', p + 1))
+      tab[n++] = p;
+
+  int gqBand = -1, dpBand = -1;
+  BlockStats stats;
+  if (n == 7 and line_.compare(tab[3] + 1, tab[4] - tab[3] - 1, ".") == 0
+      and line_.compare(tab[6] + 1, 3, "DP=") == 0 and line_.find("DEL=", tab[6]) == string::npos) {
+    stats.qual = strtoul(line_.c_str() + tab[4] + 1, NULL, 10);
+    stats.depth = strtoul(line_.c_str() + tab[6] + 4, NULL, 10);
+    size_t pp = line_.find(";PP=", tab[6]);
+    size_t avmq = line_.find(";AVMQ=", tab[6]);
+    stats.pp = (pp == string::npos) ? 0 : strtod(line_.c_str() + pp + 4, NULL);
+    stats.avmq = (avmq == string::npos) ? 0 : strtoul(line_.c_str() + avmq + 6, NULL, 10);
+    gqBand = bandIndex(stats.qual, gqBands_);
+    dpBand = bandIndex(stats.depth, dpBands_);
+  }
+  if (gqBand < 0 or dpBand < 0) {
+    // cleanupvcf merges an insertion or deletion into the line before it
+    bool indel = (n == 7 and (line_.find("INS=", tab[6]) != string::npos or line_.find("DEL", tab[6]) != string::npos) );
+    writeBlock(indel);
+    put(line_);
+    put("\n");
+    return;
+  }
+
+  unsigned long pos = strtoul(line_.c_str() + tab[0] + 1, NULL, 10);
+  if (blockSites_ == 0 or pos != blockEnd_ + 1 or gqBand != gqBand_ or dpBand != dpBand_ or line_.compare(0, tab[0], blockChrom_) != 0) {
+    writeBlock();
+    blockLine_ = line_;
+    blockChrom_.assign(line_, 0, tab[0]);
+    blockRef_.assign(line_, tab[2] + 1, tab[3] - tab[2] - 1);
+    blockBeg_ = pos;
+    gqBand_ = gqBand;
+    dpBand_ = dpBand;
+  }
+  else if (blockSites_ == 1)
+    runStats_ = lastStats_;
+  else
+    minStats(runStats_, lastStats_);
+  blockSites_++;
+  blockEnd_ = pos;
+  lastStats_ = stats;
+  lastLine_ = line_;
+}
+
+
+int VcfBlockBuf::sync()
+{
+  // the current block may continue, so it is only written at close
+  return out_->pubsync();
+}
+
+
+void VcfBlockBuf::close()
+{
+  if (out_ == NULL)
+    return;
+  finishLine();
+  writeBlock();
+  if (out_->pubsync() != 0)
+    errorAbort("From VcfBlockBuf: error writing the VCF output.");
+  out_ = NULL;
+}
@@ -0,0 +1,168 @@
+#ifndef __VcfWriter_h
+#define __VcfWriter_h
+
+#include "Pileup.h"
+#include "phy/DfgIO.h"
+#include <htslib/vcf.h>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+// VCF output of the genotype posteriors, as SNPest.pl writes it from
+// the --ppSumOther output: one line per site with the most probable
+// genotype in ALT (the reference allele as '.'), its phred scaled error
+// probability in QUAL, and DP, PP and AVMQ (and DEL/FRACDEL or INS from
+// the site id) in INFO.
+
+// The VCF header, with a ##contig line for each contig if they are
+// known, and the INFO fields of reference blocks if refBlocks is set.
+// maxDepth is 0 when all reads are used. With samples, the header of
+// multi-sample VCF (see MultiSampleVcfFormatter).
+std::string mkVcfHeader(std::string const & reference, std::string const & model, unsigned maxDepth, std::vector<GenomicRegion> const & contigs, bool refBlocks = false, std::vector<std::string> const & samples = std::vector<std::string>());
+
+// Set line to the VCF line of a site, given its id chrom_pos_ref_avmapq_depth
+// (depth possibly followed by ;DEL=..;FRACDEL=.. or ;INS=..) and for each
+// genotype the sum of the posteriors of the other genotypes. The sums
+// are first rounded to prec significant digits, so the calls are those
+// SNPest.pl makes from text output of the same precision.
+void mkVcfRecord(std::string & line, std::string const & id, std::vector<std::string> const & genotypes, std::vector<phy::xnumber_t> const & ppOther, unsigned prec);
+
+// Multi-sample VCF of sites genotyped in several samples: ALT has the
+// alleles of the calls of all samples, and each sample has GT, GQ (as
+// QUAL of a single sample) and DP. QUAL is from the sum of the error
+// probabilities of the calls, so it is that of mkVcfRecord for one
+// sample, and DP, DEL, INS and AVMQ in INFO are summed (averaged) over
+// the samples. Samples without reads are './.'. Haploid models, which
+// only have homozygous genotypes, are called with one allele. The
+// buffers are reused between sites.
+class MultiSampleVcfFormatter {
+public:
+  MultiSampleVcfFormatter(std::vector<std::string> const & genotypes, unsigned prec);
+
+  // Set line to the line of a site given the id of each sample's record
+  // (depth 0 for samples without reads, see PileupReader::next) and the
+  // sums of the other posteriors of the genotypes, sample by sample.
+  void mkRecord(std::string & line, std::vector<std::string> const & ids, std::vector<phy::xnumber_t> const & ppOther);
+
+private:
+  std::vector<std::string> genotypes_;
+  unsigned prec_;
+  bool haploid_;
+  std::vector<int> calls_;
+  std::vector<double> probs_;
+  std::vector<unsigned long> depths_;
+  std::string alleles_;  // REF and then the ALT alleles
+};
+
+
+// True for file names written through htslib: bgzip compressed VCF
+// (.vcf.gz) and BCF (.bcf). Other names are plain text VCF.
+bool isHtsVcfFile(std::string const & file);
+
+// Stream buffer handing the text written to it to writeLine one line
+// (without the newline) at a time
+class VcfLineBuf : public std::streambuf {
+protected:
+  virtual int_type overflow(int_type c);
+  virtual std::streamsize xsputn(char const * s, std::streamsize n);
+
+  // the line is in line_
+  virtual void writeLine() = 0;
+  // write an unterminated last line
+  void finishLine();
+
+  std::string line_;
+};
+
+
+// Stream buffer converting the VCF text written to it, a header and then
+// one line per site, to a .vcf.gz or .bcf file, optionally writing its
+// index (.tbi or .csi) in the same pass. The header must have a
+// ##contig line for each contig of the sites.
+class VcfFileBuf : public VcfLineBuf {
+public:
+  VcfFileBuf(std::string const & file, bool index);
+  virtual ~VcfFileBuf();
+
+  // write the remaining output and the index; errors abort
+  void close();
+
+protected:
+  virtual void writeLine();
+
+private:
+  VcfFileBuf(VcfFileBuf const &);
+  VcfFileBuf & operator=(VcfFileBuf const &);
+
+  std::string file_;
+  bool index_;
+  htsFile * fp_;
+  bcf_hdr_t * header_;  // NULL until the header is complete
+  bcf1_t * rec_;
+  std::string headerText_;
+  kstring_t ks_;
+};
+
+
+// Stream buffer merging runs of confident homozygous reference sites of
+// the VCF written to it into reference blocks, and writing the result to
+// out. The blocks are SNPest's own, not gVCF blocks (<NON_REF>, FORMAT
+// GQ and MIN_DP), as the VCF has no sample column: a block is one line
+// at the first site of the run, with ALT '.', the smallest QUAL of the
+// run, and INFO DP=<smallest depth>;END=<last position>;PP=<smallest
+// PP>;AVMQ=<smallest AVMQ>, so cleanupvcf reads it as a site.
+// A run continues while the sites are adjacent, called '.', without
+// deletions, and in the same QUAL (GQ) and depth bands, given by their
+// lower limits. Hom-ref sites below the first band of either, and all
+// other sites, are written as they are, and so is the last site of a
+// run followed by an insertion or deletion line, which cleanupvcf
+// merges into the line before it.
+class VcfBlockBuf : public VcfLineBuf {
+public:
+  VcfBlockBuf(std::streambuf * out, std::vector<unsigned> const & gqBands, std::vector<unsigned> const & dpBands);
+  virtual ~VcfBlockBuf();
+
+  // write the last block and flush out
+  void close();
+
+protected:
+  virtual void writeLine();
+  virtual int sync();
+
+private:
+  VcfBlockBuf(VcfBlockBuf const &);
+  VcfBlockBuf & operator=(VcfBlockBuf const &);
+
+  // the smallest values of the sites of a run
+  struct BlockStats {
+    unsigned long qual, depth, avmq;
+    double pp;
+  };
+  static void minStats(BlockStats & a, BlockStats const & b);
+
+  // write the current run, without its last site if splitLast, which
+  // is then written as it is
+  void writeBlock(bool splitLast = false);
+  void putBlock(BlockStats const & stats);
+  void put(std::string const & s);
+
+  std::streambuf * out_;
+  std::vector<unsigned> gqBands_, dpBands_;
+
+  // current run; empty if none
+  unsigned blockSites_;
+  std::string blockLine_;  // the line of its first site
+  std::string blockChrom_;
+  unsigned long blockBeg_, blockEnd_;
+  std::string blockRef_;
+  int gqBand_, dpBand_;
+  BlockStats runStats_;    // of the sites before the last one
+  BlockStats lastStats_;   // of the last site
+  std::string lastLine_;
+  std::string buf_;
+};
+
+// Parse comma separated, increasing band limits such as "20,30,40".
+std::vector<unsigned> parseBands(std::string const & str);
+
+#endif  // __VcfWriter_h
@@ -0,0 +1,330 @@
+#include <boost/program_options.hpp>
+#include "phy/DfgIO.h"
+#include "Pileup.h"
+#include "SyntheticPileup.h"
+#include "StarModel.h"
+#include "GenotypeKernel.h"
+#include "DepthModels.h"
+#include "VcfWriter.h"
+#include "ResourceUsage.h"
+#include "RunStats.h"
+#include <sstream>
+#include <fstream>
+#include <cstdio>
+
+namespace po = boost::program_options;
+using namespace phy;
+
+// Benchmark of the stages of dfgEval_SNPest on synthetic data: the
+// data are generated in memory (see SyntheticPileup.h) and each stage
+// is timed on its own over all the sites, with the input of a stage
+// prepared by the stage before it. The results are written as JSON
+// (sites per second, ns per read and the peak resident set size after
+// each stage), to be compared between releases.
+
+// sites formatted between resets of the output buffer
+unsigned const BENCH_FORMAT_FLUSH = 4096;
+
+
+struct StageResult {
+  string name;
+  unsigned long sites, reads;
+  double seconds;
+  unsigned long peakKb;
+};
+
+
+// time since start of the sites and reads of a stage
+StageResult mkStageResult(string const & name, unsigned long sites, unsigned long reads, double start)
+{
+  StageResult r;
+  r.name = name;
+  r.sites = sites;
+  r.reads = reads;
+  r.seconds = wallTime() - start;
+  r.peakKb = peakResidentKb();
+  cerr << name << ": " << r.seconds << " s." << endl;
+  return r;
+}
+
+
+void writeJsonReport(ostream & str, vector< pair<string, string> > const & settings, vector<StageResult> const & stages)
+{
+  str << "{\n  \"program\": \"bench_SNPest\",\n  \"settings\": {";
+  for (unsigned i = 0; i < settings.size(); i++)
+    str << (i ? ", " : "") << "\"" << settings[i].first << "\": " << settings[i].second;
+  str << "},\n  \"stages\": [\n";
+  for (unsigned i = 0; i < stages.size(); i++) {
+    StageResult const & r = stages[i];
+    str << "    {\"stage\": \"" << r.name << "\", \"sites\": " << r.sites << ", \"reads\": " << r.reads
+	<< ", \"seconds\": " << jsonNumber(r.seconds)
+	<< ", \"sitesPerSecond\": " << jsonNumber(r.seconds > 0 ? r.sites / r.seconds : 0)
+	<< ", \"nsPerRead\": " << jsonNumber(r.reads > 0 ? r.seconds * 1e9 / r.reads : 0)
+	<< ", \"peakRssKb\": " << r.peakKb << "}" << (i + 1 < stages.size() ? "," : "") << "\n";
+  }
+  str << "  ],\n  \"peakRssKb\": " << peakResidentKb() << "\n}\n";
+}
+
+
+int main(int argc, char * argv[])
+{
+  SyntheticPileupSpec spec;
+  string dfgSpecPrefix, ploidity, model;
+  unsigned maxDepth, dfgDepth, dfgSites;
+  string mpileupOut, tabOut, jsonFile;
+  bool generateOnly;
+
+  po::options_description visible(string("bench_SNPest generates synthetic 'samtools mpileup -s' data and times the stages of dfgEval_SNPest on it: parsing of mpileup and .tab input, mapping of the read symbols (symbol counts for the star engine, symbols2StateMasks for the DFG), inference and output formatting. The results are written as JSON.\n\n")
+				  + "  Usage: bench_SNPest [options]\n\n"
+				  + "Allowed options");
+  visible.add_options()
+    ("help,h", "produce help message")
+    ("dfgSpecPrefix,s", po::value<string>(& dfgSpecPrefix)->default_value("./dfgSpec/"), "Prefix of DFG specification files.")
+    ("ploidity", po::value<string>(& ploidity)->default_value("diploid"), "The ploidity of the model and of the data.")
+    ("model", po::value<string>(& model)->default_value("none"), "Specific model used (if any).")
+    ("sites", po::value<unsigned long>(& spec.sites)->default_value(spec.sites), "Number of sites generated.")
+    ("depth", po::value<double>(& spec.meanDepth)->default_value(spec.meanDepth), "Mean read depth.")
+    ("depthDispersion", po::value<double>(& spec.depthDispersion)->default_value(spec.depthDispersion), "Over dispersion of the depth: its variance is depth + depthDispersion * depth^2 (0 is Poisson).")
+    ("errorRate", po::value<double>(& spec.errorRate)->default_value(spec.errorRate), "Mean sequencing error rate, which sets the base qualities.")
+    ("indelRate", po::value<double>(& spec.indelRate)->default_value(spec.indelRate), "Probability that a read has an insertion or deletion after a site.")
+    ("snpRate", po::value<double>(& spec.snpRate)->default_value(spec.snpRate), "Probability that a site is variant.")
+    ("seed", po::value<unsigned>(& spec.seed)->default_value(spec.seed), "Seed of the random numbers; the same seed gives the same data.")
+    ("maxDepth", po::value<unsigned>(& maxDepth)->default_value(200), "The maximum read depth; deeper sites are down sampled, as by dfgEval_SNPest.")
+    ("dfgDepth", po::value<unsigned>(& dfgDepth)->default_value(30), "Depth the sites are truncated to for the DFG stages.")
+    ("dfgSites", po::value<unsigned>(& dfgSites)->default_value(2000), "Number of sites (the first ones) of the DFG stages, which are much slower than the others. 0 skips them.")
+    ("mpileupOut", po::value<string>(& mpileupOut)->default_value(""), "Also write the generated mpileup data to this file.")
+    ("tabOut", po::value<string>(& tabOut)->default_value(""), "Also write the sites as a .tab file, as SNPest.pl makes it, to this file.")
+    ("generateOnly", po::bool_switch(& generateOnly)->default_value(false), "Only write the files of --mpileupOut and --tabOut.")
+    ("json", po::value<string>(& jsonFile)->default_value("-"), "File of the JSON report ('-' for STDOUT).");
+
+  po::variables_map vm;
+  po::store(po::command_line_parser(argc, argv).options(visible).run(), vm);
+  po::notify(vm);
+  if (vm.count("help")) {
+    cout << visible << endl;
+    return 1;
+  }
+  if (ploidity != "diploid" and ploidity != "haploid")
+    errorAbort("The ploidity must be diploid or haploid.");
+  spec.haploid = (ploidity == "haploid");
+  if (maxDepth == 0)
+    errorAbort("The maximum depth must be positive.");
+
+  vector<StageResult> stages;
+  double start;
+
+  // generate
+  ostringstream mpileupStr;
+  start = wallTime();
+  writeSyntheticPileup(mpileupStr, spec);
+  string mpileupText = mpileupStr.str();
+  stages.push_back( mkStageResult("generate", spec.sites, 0, start) );
+  if ( not mpileupOut.empty() ) {
+    ofstream f;
+    openOutFile(f, mpileupOut);
+    f << mpileupText;
+  }
+
+  // parse mpileup, keeping the records
+  vector<SiteRecord> sites, records(1);
+  unsigned long reads = 0;
+  unsigned tabDepth = 0;
+  {
+    istringstream in(mpileupText);
+    MpileupReader reader(in, maxDepth);
+    unsigned n = 0;
+    start = wallTime();
+    while (unsigned recordCount = reader.next(records) ) {
+      if (sites.size() < n + recordCount)
+	sites.resize( max(2 * sites.size(), (size_t) n + recordCount) );
+      for (unsigned r = 0; r < recordCount; r++, n++) {
+	swap(sites[n], records[r]);
+	reads += sites[n].depth;
+      }
+    }
+    sites.resize(n);
+    stages.push_back( mkStageResult("parse_mpileup", sites.size(), reads, start) );
+    stages[0].reads = reads;
+  }
+  for (unsigned i = 0; i < sites.size(); i++)
+    tabDepth = max(tabDepth, sites[i].depth);
+
+  // parse .tab
+  ostringstream tabStr;
+  tabStr << mkTabHeader(tabDepth) << '\n';
+  for (unsigned i = 0; i < sites.size(); i++)
+    writeTabRecord(tabStr, sites[i]);
+  string tabText = tabStr.str();
+  if ( not tabOut.empty() ) {
+    ofstream f;
+    openOutFile(f, tabOut);
+    f << tabText;
+  }
+  if (generateOnly)
+    return 0;
+  {
+    istringstream in(tabText);
+    string line;
+    getline(in, line);
+    checkTabHeader(line, "synthetic data");
+    SiteRecord rec;
+    unsigned long n = 0, tabReads = 0;
+    start = wallTime();
+    while ( readTabRecord(in, rec, line) ) {
+      n++;
+      tabReads += rec.depth;
+    }
+    stages.push_back( mkStageResult("parse_tab", n, tabReads, start) );
+  }
+
+  // models
+  if ( not model.empty() )
+    model = "_" + model;
+  string statemaps = dfgSpecPrefix + ploidity + "_stateMaps.txt";
+  string potentials = dfgSpecPrefix + ploidity + model + "_factorPotentials.txt";
+  StarModel starModel(statemaps, potentials);
+  unsigned nG = starModel.genotypeCount();
+
+  // map symbols to counts
+  SymbolHistogram hist;
+  CountedSites counted;
+  unsigned long checksum = 0;
+  start = wallTime();
+  for (unsigned i = 0; i < sites.size(); i++) {
+    starModel.countSymbols(sites[i], sites[i].depth, hist);
+    checksum += hist.present.size();
+  }
+  stages.push_back( mkStageResult("map_counts", sites.size(), reads, start) );
+  for (unsigned i = 0; i < sites.size(); i++) {
+    starModel.countSymbols(sites[i], sites[i].depth, hist);
+    counted.add(hist);
+  }
+
+  // inference with the star engine and the log space kernels
+  vector<xnumber_t> pps(sites.size() * nG);
+  xvector_t pp(nG);
+  start = wallTime();
+  for (unsigned i = 0; i < sites.size(); i++) {
+    counted.get(i, hist);
+    starModel.calcPosterior(hist, pp);
+    std::copy( pp.begin(), pp.end(), pps.begin() + i * nG );
+  }
+  stages.push_back( mkStageResult("infer_star", sites.size(), reads, start) );
+  NumericBackend backends[] = {NUMERIC_LOG, NUMERIC_LOGF};
+  vector<double> logPP(nG), logOther(nG);
+  for (unsigned b = 0; b < 2; b++) {
+    GenotypeKernel * kernel = mkGenotypeKernel(starModel, backends[b]);
+    start = wallTime();
+    for (unsigned i = 0; i < sites.size(); i++) {
+      counted.get(i, hist);
+      kernel->calcLogPosterior(hist, & logPP[0], & logOther[0]);
+    }
+    stages.push_back( mkStageResult("infer_" + numericBackendName(backends[b]), sites.size(), reads, start) );
+    delete kernel;
+  }
+
+  // the DFG of each depth: map the symbols to state masks, then run sum-product
+  unsigned dfgCount = min( (unsigned) sites.size(), dfgSites );
+  if (dfgCount > 0 and dfgDepth > 0) {
+    DepthModels depthModels(statemaps, potentials);
+    vector<DfgInfo *> dfgs(dfgDepth, (DfgInfo *) NULL);
+    vector< vector<unsigned> > varMaps(dfgDepth);
+    vector< vector<symbol_t> > dfgSymbols;
+    vector<unsigned> depths;
+    unsigned long dfgReads = 0;
+    for (unsigned i = 0; i < dfgCount; i++) {
+      unsigned depth = min(sites[i].depth, dfgDepth);
+      if (depth == 0)
+	continue;
+      if (dfgs[depth - 1] == NULL) {
+	vector<string> names(1, "C");
+	for (unsigned k = 1; k <= depth; k++)
+	  names.push_back( "O" + toString(k) );
+	dfgs[depth - 1] = new DfgInfo( depthModels.get(depth) );
+	varMaps[depth - 1] = mkSubsetMap(dfgs[depth - 1]->varNames, names);
+      }
+      dfgSymbols.push_back( vector<symbol_t>(sites[i].symbols.begin(), sites[i].symbols.begin() + depth + 1) );
+      depths.push_back(depth);
+      dfgReads += depth;
+    }
+
+    vector<stateMaskVec_t> stateMasks( depths.size() );
+    for (unsigned i = 0; i < depths.size(); i++)
+      stateMasks[i].resize( dfgs[depths[i] - 1]->varNames.size() );
+    start = wallTime();
+    for (unsigned i = 0; i < depths.size(); i++) {
+      DfgInfo const & dfgInfo = *dfgs[depths[i] - 1];
+      dfgInfo.stateMaskMapSet.symbols2StateMasks(stateMasks[i], dfgSymbols[i], varMaps[depths[i] - 1]);
+    }
+    stages.push_back( mkStageResult("map_dfg", depths.size(), dfgReads, start) );
+
+    vector< vector<xvector_t> > marginals(dfgDepth);
+    for (unsigned d = 0; d < dfgDepth; d++)
+      if (dfgs[d] != NULL)
+	initGenericVariableMarginals(marginals[d], dfgs[d]->dfg);
+    start = wallTime();
+    for (unsigned i = 0; i < depths.size(); i++) {
+      DfgInfo & dfgInfo = *dfgs[depths[i] - 1];
+      dfgInfo.dfg.runSumProduct(stateMasks[i]);
+      dfgInfo.dfg.calcVariableMarginals(marginals[depths[i] - 1], stateMasks[i]);
+    }
+    stages.push_back( mkStageResult("infer_dfg", depths.size(), dfgReads, start) );
+    for (unsigned d = 0; d < dfgDepth; d++)
+      if (dfgs[d] != NULL)
+	delete dfgs[d];
+  }
+
+  // output formatting of the posteriors of the other genotypes, as
+  // --ppSumOther and --vcf write them
+  vector<xnumber_t> ppOther(nG);
+  ostringstream out;
+  string name, line;
+  for (unsigned f = 0; f < 2; f++) {
+    start = wallTime();
+    for (unsigned i = 0; i < sites.size(); i++) {
+      for (unsigned g = 0; g < nG; g++) {
+	ppOther[g] = 0;
+	for (unsigned h = 0; h < nG; h++)
+	  if (h != g)
+	    ppOther[g] += pps[i * nG + h];
+      }
+      if (f == 0) {
+	name.assign(sites[i].id);
+	name += "\tG";
+	writeNamedData(out, name, ppOther, 5);
+      }
+      else {
+	mkVcfRecord(line, sites[i].id, starModel.genotypeSymbols(), ppOther, 5);
+	out << line;
+      }
+      if (i % BENCH_FORMAT_FLUSH == 0)
+	out.str("");
+    }
+    stages.push_back( mkStageResult(f == 0 ? "format_tab" : "format_vcf", sites.size(), reads, start) );
+  }
+
+  vector< pair<string, string> > settings;
+  settings.push_back( make_pair("ploidity", "\"" + ploidity + "\"") );
+  settings.push_back( make_pair("model", "\"" + model.substr(model.empty() ? 0 : 1) + "\"") );
+  settings.push_back( make_pair("sites", toString(spec.sites)) );
+  settings.push_back( make_pair("depth", jsonNumber(spec.meanDepth)) );
+  settings.push_back( make_pair("depthDispersion", jsonNumber(spec.depthDispersion)) );
+  settings.push_back( make_pair("errorRate", jsonNumber(spec.errorRate)) );
+  settings.push_back( make_pair("indelRate", jsonNumber(spec.indelRate)) );
+  settings.push_back( make_pair("snpRate", jsonNumber(spec.snpRate)) );
+  settings.push_back( make_pair("seed", toString(spec.seed)) );
+  settings.push_back( make_pair("maxDepth", toString(maxDepth)) );
+  settings.push_back( make_pair("dfgDepth", toString(dfgDepth)) );
+  settings.push_back( make_pair("dfgSites", toString(dfgCount)) );
+  if (checksum == 0)
+    cerr << "No reads in the data." << endl;
+
+  if (jsonFile == "-")
+    writeJsonReport(cout, settings, stages);
+  else {
+    ofstream f;
+    openOutFile(f, jsonFile);
+    writeJsonReport(f, settings, stages);
+  }
+  return 0;
+}
@@ -0,0 +1,250 @@
+#include <boost/program_options.hpp>
+#include <boost/thread.hpp>
+#include "phy/utils.h"
+#include "VcfCleanup.h"
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace po = boost::program_options;
+using namespace phy;
+
+// cleanupvcf: the filtering of cleanupvcf.pl (see VcfCleanup.h) in one
+// streaming pass, in the manner of the --pipeline of dfgEval_SNPest: a
+// reader thread reads the input in blocks of about CLEANUP_BLOCK_BYTES,
+// the parser threads, started once, parse ranges of the lines of the
+// blocks in input order, and the calling thread merges the lines of each
+// block in order (VcfCleaner::add) and writes the output as soon as the
+// block is parsed. The blocks are kept in a ring of CLEANUP_BLOCKS slots,
+// reused once written, so reading, parsing and writing overlap and the
+// memory does not depend on the size of the input.
+size_t const CLEANUP_BLOCK_BYTES = 1 << 24;
+unsigned const CLEANUP_BLOCKS = 4;
+// the lines of a block are parsed in tasks of at least this many lines
+unsigned const CLEANUP_TASK_LINES = 1024;
+
+
+class CleanupPipeline {
+public:
+  CleanupPipeline(VcfCleaner & cleaner, FILE * in, string const & inputFile, unsigned threadCount);
+
+  // Run until the end of the input, writing the output to stdout.
+  void run();
+
+private:
+  struct Block {
+    vector<char> data;
+    vector<size_t> starts;        // the start of each line, and the end of the last
+    vector<VcfCleanupLine> lines;
+    unsigned lineCount;
+    vector<unsigned> taskStarts;  // the first line of each task, and lineCount
+    unsigned tasksLeft;           // tasks not yet parsed
+  };
+
+  void readLoop();
+  void parseLoop();
+
+  VcfCleaner & cleaner_;
+  FILE * in_;
+  string inputFile_;
+  unsigned threadCount_;
+  vector<Block> ring_;
+
+  // Blocks are numbered in input order; block n is in slot n % CLEANUP_BLOCKS.
+  // Blocks before readCount_ are read, and those before writtenCount_ written.
+  // The next task to parse is task nextTask_ of block taskBlock_.
+  boost::mutex mutex_;
+  boost::condition_variable changed_;
+  unsigned long readCount_, writtenCount_, taskBlock_;
+  unsigned nextTask_;
+  bool endOfInput_;
+};
+
+
+CleanupPipeline::CleanupPipeline(VcfCleaner & cleaner, FILE * in, string const & inputFile, unsigned threadCount)
+  : cleaner_(cleaner), in_(in), inputFile_(inputFile), threadCount_(threadCount), ring_(CLEANUP_BLOCKS),
+    readCount_(0), writtenCount_(0), taskBlock_(0), nextTask_(0), endOfInput_(false)
+{}
+
+
+void CleanupPipeline::readLoop()
+{
+  vector<char> carry;  // a partial line at the end of the last block
+  bool end = false;
+  while (not end) {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      while (readCount_ - writtenCount_ == CLEANUP_BLOCKS)
+	changed_.wait(lock);
+    }
+    // the slot is not used by the other threads until published
+    Block & block = ring_[readCount_ % CLEANUP_BLOCKS];
+    block.data.resize( max(CLEANUP_BLOCK_BYTES, 2 * carry.size()) );
+    size_t size = carry.size();
+    if (size > 0)
+      memcpy(& block.data[0], & carry[0], size);
+    size_t used;
+    while (true) {
+      size += fread(& block.data[0] + size, 1, block.data.size() - size, in_);
+      if ( ferror(in_) )
+	errorAbort("Could not read file '" + inputFile_ + "'.");
+      end = feof(in_);
+      // the whole lines of the block, and the last line at the end of the input
+      used = size;
+      if (not end)
+	while (used > 0 and block.data[used - 1] != '\n')
+	  used--;
+      if (used > 0 or end)
+	break;
+      block.data.resize(2 * block.data.size());  // a line longer than the block
+    }
+    char const * data = & block.data[0];
+    carry.assign(data + used, data + size);
+
+    block.starts.clear();
+    for (size_t i = 0; i < used; ) {
+      block.starts.push_back(i);
+      char const * nl = (char const *) memchr(data + i, '\n', used - i);
+      i = (nl == NULL) ? used : nl - data + 1;
+    }
+    block.lineCount = block.starts.size();
+    block.starts.push_back(used);
+    if (block.lines.size() < block.lineCount)
+      block.lines.resize(block.lineCount);
+    unsigned taskCount = max(1u, min(4 * threadCount_, block.lineCount / CLEANUP_TASK_LINES));
+    block.taskStarts.clear();
+    for (unsigned k = 0; k <= taskCount; k++)
+      block.taskStarts.push_back( (unsigned long) block.lineCount * k / taskCount );
+    block.tasksLeft = taskCount;
+
+    boost::mutex::scoped_lock lock(mutex_);
+    if (block.lineCount > 0)
+      readCount_++;
+    endOfInput_ = end;
+    changed_.notify_all();
+  }
+}
+
+
+void CleanupPipeline::parseLoop()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  while (true) {
+    while (taskBlock_ == readCount_ and not endOfInput_)
+      changed_.wait(lock);
+    if (taskBlock_ == readCount_)
+      return;
+    Block & block = ring_[taskBlock_ % CLEANUP_BLOCKS];
+    unsigned first = block.taskStarts[nextTask_], end = block.taskStarts[nextTask_ + 1];
+    if (++nextTask_ == block.taskStarts.size() - 1) {
+      taskBlock_++;
+      nextTask_ = 0;
+    }
+    lock.unlock();
+    char const * data = & block.data[0];
+    for (unsigned i = first; i < end; i++) {
+      size_t e = block.starts[i + 1];
+      if (e > block.starts[i] and data[e - 1] == '\n')
+	e--;
+      cleaner_.parse(data + block.starts[i], data + e, block.lines[i]);
+    }
+    lock.lock();
+    if (--block.tasksLeft == 0)
+      changed_.notify_all();
+  }
+}
+
+
+void CleanupPipeline::run()
+{
+  boost::thread_group threads;
+  threads.add_thread( new boost::thread(& CleanupPipeline::readLoop, this) );
+  for (unsigned i = 0; i < threadCount_; i++)
+    threads.add_thread( new boost::thread(& CleanupPipeline::parseLoop, this) );
+
+  string out;
+  unsigned long lineCount = 0;
+  while (true) {
+    Block * block;
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      while ( not (writtenCount_ < readCount_ and ring_[writtenCount_ % CLEANUP_BLOCKS].tasksLeft == 0) and not (endOfInput_ and writtenCount_ == readCount_) )
+	changed_.wait(lock);
+      if (writtenCount_ == readCount_)
+	break;
+      block = & ring_[writtenCount_ % CLEANUP_BLOCKS];
+    }
+    out.clear();
+    for (unsigned i = 0; i < block->lineCount; i++)
+      if ( not cleaner_.add(block->lines[i], out) ) {
+	fwrite(out.data(), 1, out.size(), stdout);
+	fflush(stdout);
+	errorAbort("Illegal division by zero: the insertion at line " + toString(lineCount + i + 1) + " follows a site of depth 0.");
+      }
+    fwrite(out.data(), 1, out.size(), stdout);
+    lineCount += block->lineCount;
+
+    boost::mutex::scoped_lock lock(mutex_);
+    writtenCount_++;
+    changed_.notify_all();
+  }
+  threads.join_all();
+
+  out.clear();
+  cleaner_.finish(out);
+  fwrite(out.data(), 1, out.size(), stdout);
+}
+
+
+int main(int argc, char * argv[])
+{
+  VcfCleanupSettings settings;
+  unsigned threadCount;
+  string inputFile;
+
+  po::options_description visible(string("cleanupvcf filters the VCF of SNPest as cleanupvcf.pl does, with the same output: it keeps the substitutions of high depth and quality and merges the insertions and deletions that most reads support into the preceding site.\n\n")
+				  + "  Usage: cleanupvcf [options] [input.vcf] > output.vcf\n\n"
+				  + "Reads STDIN if no input file is given.\n\n"
+				  + "Allowed options");
+  visible.add_options()
+    ("help,h", "produce help message")
+    ("mindepth", po::value<long>(& settings.minDepth)->default_value(settings.minDepth), "Minimum read depth of substitutions, insertions and deletions.")
+    ("minqual", po::value<long>(& settings.minQual)->default_value(settings.minQual), "Minimum phred scaled quality and average mapping quality of substitutions.")
+    ("minfracdel", po::value<double>(& settings.minFracDel)->default_value(settings.minFracDel), "Minimum fraction of the reads supporting a deletion.")
+    ("minfracins", po::value<double>(& settings.minFracIns)->default_value(settings.minFracIns), "Minimum fraction of the reads supporting an insertion.")
+    ("threads", po::value<unsigned>(& threadCount)->default_value(1), "Number of threads parsing the lines of the input, besides the threads reading the input and writing the output.");
+
+  po::options_description hidden("Hidden options");
+  hidden.add_options()
+    ("inputFile", po::value<string>(& inputFile)->default_value("-"), "Input VCF.");
+  po::positional_options_description positional;
+  positional.add("inputFile", 1);
+  po::options_description all;
+  all.add(visible).add(hidden);
+
+  po::variables_map vm;
+  po::store(po::command_line_parser(argc, argv).options(all).positional(positional).run(), vm);
+  po::notify(vm);
+  if (vm.count("help")) {
+    cout << visible << endl;
+    return 1;
+  }
+  if (threadCount == 0)
+    errorAbort("The number of threads must be at least 1.");
+
+  FILE * in = stdin;
+  if (inputFile != "-") {
+    in = fopen(inputFile.c_str(), "rb");
+    if (in == NULL)
+      errorAbort("Could not open file '" + inputFile + "'.");
+  }
+
+  VcfCleaner cleaner(settings);
+  CleanupPipeline pipeline(cleaner, in, inputFile, threadCount);
+  pipeline.run();
+  if (in != stdin)
+    fclose(in);
+  if ( fflush(stdout) != 0 )
+    errorAbort("Could not write the output.");
+  return 0;
+}
@@ -1,9 +1,42 @@
 #include <boost/program_options.hpp>
+#include <climits>
+#include <boost/thread.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_real_distribution.hpp>
 #include "phy/DfgIO.h"
+#include "Pileup.h"
+#include "BamPileup.h"
+#include "StarModel.h"
+#include "EmissionTable.h"
+#include "AllocCounter.h"
+#include "DepthModels.h"
+#include "ModelBundle.h"
+#include "VcfWriter.h"
+#include "PosteriorCache.h"
+#include "GenotypeKernel.h"
+#include "ResourceUsage.h"
+#include "RunStats.h"
+#include "EvidenceStore.h"
+#include "DamageSweep.h"
+#include "ErrorEstimate.h"
 
 namespace po = boost::program_options;
 using namespace phy;
 
+// estimated cost of evaluating a site of depth n is n + SITE_COST_OFFSET reads
+unsigned const SITE_COST_OFFSET = 4;
+// in multithreaded mode, sites are read in chunks of at most this many
+// sites or reads per thread
+unsigned const CHUNK_SITES_PER_THREAD = 1024;
+unsigned const CHUNK_COST_PER_THREAD = 20000;
+// with --batch, a batch is also written when this many times the batch
+// size sites (mostly hom-ref shortcuts) are queued
+unsigned const PENDING_SITES_PER_BATCH = 8;
+// with one thread, the time for --progress is checked every this many input lines
+unsigned const PROGRESS_CHECK_LINES = 4096;
+// chunks read ahead of the writer by SitePipeline, at most
+unsigned const PIPELINE_CHUNKS = 8;
+
 // SL: I added this function
 vector<string> &split(const string &s, char delim, vector<string> &elems) {
     stringstream ss(s);
@@ -42,26 +75,24 @@ void takeMinusLog(xvector_t & v, string const & id)
 }
 
 
-// useful with post probs close to one, where precision is lost  
-void ppSumOther(xvector_t & v)
+// useful with post probs close to one, where precision is lost; u is
+// scratch space of the same size as v
+void ppSumOther(xvector_t & v, xvector_t & u)
 {
-  xvector_t u( v.size(), 0);
   for (unsigned i = 0; i < v.size(); i++) {
     u[i] = 0;
     for (unsigned j = 0; j < v.size(); j++)
       if (i != j)
 	u[i] += v[j];
   }
-  v = u;
+  v.swap(u);
 }
 
 
-void transformByOptions(xvector_t & v, bool minusLogarithm, bool sumOther, string const & id)
+void ppSumOther(xvector_t & v)
 {
-  if (sumOther)
-    ppSumOther(v);
-  if (minusLogarithm)
-    takeMinusLog(v, id);
+  xvector_t u( v.size(), 0);
+  ppSumOther(v, u);
 }
 
 
@@ -152,9 +183,1001 @@ void writePostProbLegend(ostream & str, vector<string> const & varNames, vector<
 }
 
 
+// names of the observed variables in the DFG for a given read depth: C, O1, ..., On
+vector<string> mkDataVarNames(unsigned depth)
+{
+  vector<string> names(1, "C");
+  for (unsigned i = 1; i <= depth; i++)
+    names.push_back("O" + itoa(i));
+  return names;
+}
+
+
+// smallest depth whose DFG has all the given variables (A<i> and O<i>
+// exist from depth i)
+unsigned minDepthOfVars(vector<string> const & varNames)
+{
+  unsigned depth = 1;
+  BOOST_FOREACH(string const & v, varNames)
+    if (v.size() > 1 and (v[0] == 'A' or v[0] == 'O') and isdigit(v[1]))
+      depth = max(depth, (unsigned) atoi(v.c_str() + 1));
+  return depth;
+}
+
+
+// equal within relative tolerance (also for xdouble)
+bool closeTo(xnumber_t const & a, xnumber_t const & b, double relTol)
+{
+  xnumber_t diff = (a > b) ? a - b : b - a;
+  xnumber_t m = (a > b) ? a : b;
+  return not (diff > m * relTol);
+}
+
+
+// Compare the posteriors of G from the star engine with sum-product on
+// the full DFG for a fixed set of pseudo random sites of depth 1 to
+// maxDepth. Aborts on disagreement and returns the number of sites
+// compared.
+unsigned checkStarModel(StarModel const & starModel, DepthModels & depthModels, unsigned maxDepth)
+{
+  char const bases[] = "ACGTN";
+  unsigned seed = 1;
+  unsigned checked = 0;
+  xvector_t starPP( starModel.genotypeCount() ), histPP( starModel.genotypeCount() );
+  SymbolHistogram hist;
+  for (unsigned depth = 1; depth <= maxDepth; depth = (depth < 3) ? depth + 1 : 3 * depth) {
+    DfgInfo dfgInfo = depthModels.get(depth);
+    vector<unsigned> theMap = mkSubsetMap(dfgInfo.varNames, mkDataVarNames(depth));
+    unsigned gIndex = mkSubsetMap(dfgInfo.varNames, vector<string>(1, "G"))[0];
+    vector<xvector_t> marginals;
+    initGenericVariableMarginals(marginals, dfgInfo.dfg);
+
+    for (unsigned site = 0; site < 20; site++) {
+      // reads from one or two alleles with the occasional N and error
+      vector<symbol_t> symbols;
+      symbols.push_back( string(1, bases[site % 5]) );
+      char allele1 = bases[(seed = seed * 1103515245 + 12345) % 4];
+      char allele2 = bases[(seed = seed * 1103515245 + 12345) % 4];
+      for (unsigned i = 0; i < depth; i++) {
+	unsigned r = (seed = seed * 1103515245 + 12345) >> 8;
+	char b = (r % 2) ? allele1 : allele2;
+	if (r % 23 == 0)
+	  b = bases[(r >> 5) % 5];
+	symbols.push_back( b + itoa(1 + (r >> 10) % PILEUP_MAX_QUAL) );
+      }
+
+      stateMaskVec_t stateMasks( dfgInfo.varNames.size() );
+      dfgInfo.stateMaskMapSet.symbols2StateMasks(stateMasks, symbols, theMap);
+      dfgInfo.dfg.runSumProduct(stateMasks);
+      dfgInfo.dfg.calcVariableMarginals(marginals, stateMasks);
+      xvector_t dfgPP = marginals[gIndex];
+      starModel.calcPosterior(symbols, depth, starPP);
+      starModel.countSymbols(symbols, depth, hist);
+      starModel.calcPosterior(hist, histPP);
+      for (unsigned g = 0; g < starPP.size(); g++)
+	if ( not closeTo(starPP[g], histPP[g], 1e-9) and (starPP[g] > 1e-250 or histPP[g] > 1e-250) )
+	  errorAbort("From checkStarModel: histogram and per read evaluation disagree at depth " + toString(depth) + ".");
+
+      xvector_t dfgOther = dfgPP, starOther = starPP;
+      ppSumOther(dfgOther);
+      ppSumOther(starOther);
+      for (unsigned g = 0; g < starPP.size(); g++) {
+	bool ok = closeTo(dfgPP[g], starPP[g], 1e-6) or not (dfgPP[g] > 1e-12 or starPP[g] > 1e-12);
+	ok = ok and ( closeTo(dfgOther[g], starOther[g], 1e-6) or not (dfgOther[g] > 1e-250 or starOther[g] > 1e-250) );
+	if (not ok)
+	  errorAbort("From checkStarModel: star engine and DFG disagree at depth " + toString(depth) + " for genotype " + starModel.genotypeSymbols()[g] + " (" + toString(starPP[g]) + " vs. " + toString(dfgPP[g]) + "). Use --engine=dfg.");
+      }
+      checked++;
+    }
+  }
+  return checked;
+}
+
+
+// Compare the batched kernel with the per site histogram evaluation of
+// the star engine on pseudo random sites of up to a few hundred reads.
+// Aborts on disagreement and returns the number of sites compared.
+unsigned checkEmissionTable(StarModel const & starModel, EmissionTable const & table)
+{
+  unsigned nO = starModel.observationSymbolCount(), nG = starModel.genotypeCount();
+  unsigned seed = 7;
+  vector<SymbolHistogram> hists(3 * SITE_BLOCK_WIDTH + 3);
+  SiteBatch batch;
+  for (unsigned i = 0; i < hists.size(); i++) {
+    SymbolHistogram & hist = hists[i];
+    hist.count.assign(nO, 0);
+    hist.ref = i % 5;
+    unsigned depth = 1 + (seed = seed * 1103515245 + 12345) % (1 + 40 * i);
+    for (unsigned j = 0; j < depth; j++)
+      hist.add( ((seed = seed * 1103515245 + 12345) >> 8) % nO );
+    batch.add(hist);
+  }
+  table.evaluate(batch);
+
+  xvector_t histPP(nG), tablePP(nG);
+  for (unsigned i = 0; i < hists.size(); i++) {
+    starModel.calcPosterior(hists[i], histPP);
+    table.calcPosterior(batch.logLik(i), tablePP);
+    for (unsigned g = 0; g < nG; g++)
+      if ( not closeTo(histPP[g], tablePP[g], 1e-9) and (histPP[g] > 1e-250 or tablePP[g] > 1e-250) )
+	errorAbort("From checkEmissionTable: " + simdLevelName( table.simdLevel() ) + " batch kernel and star engine disagree for genotype " + starModel.genotypeSymbols()[g] + " (" + toString(tablePP[g]) + " vs. " + toString(histPP[g]) + ").");
+  }
+  return hists.size();
+}
+
+
+// Compare a log space genotype kernel with the star engine on pseudo
+// random sites, as checkEmissionTable. The float kernel is only checked
+// to a few digits. Aborts on disagreement and returns the number of
+// sites compared.
+unsigned checkGenotypeKernel(StarModel const & starModel, GenotypeKernel const & kernel)
+{
+  unsigned nO = starModel.observationSymbolCount(), nG = starModel.genotypeCount();
+  double tol = (kernel.backend() == NUMERIC_LOGF) ? 1e-3 : 1e-9;
+  unsigned seed = 7;
+  SymbolHistogram hist;
+  hist.count.assign(nO, 0);
+  xvector_t pp(nG), other(nG);
+  vector<double> logPP(nG), logOther(nG);
+  unsigned checked = 0;
+  for (unsigned i = 0; i < 3 * SITE_BLOCK_WIDTH + 3; i++, checked++) {
+    hist.clear();
+    hist.ref = i % 5;
+    unsigned depth = 1 + (seed = seed * 1103515245 + 12345) % (1 + 40 * i);
+    for (unsigned j = 0; j < depth; j++)
+      hist.add( ((seed = seed * 1103515245 + 12345) >> 8) % nO );
+    starModel.calcPosterior(hist, pp);
+    other = pp;
+    ppSumOther(other);
+    kernel.calcLogPosterior(hist, & logPP[0], & logOther[0]);
+    for (unsigned g = 0; g < nG; g++) {
+      bool ok = closeTo(exp(logPP[g]), pp[g], tol) or not (pp[g] > 1e-250 or exp(logPP[g]) > 1e-250);
+      ok = ok and ( closeTo(exp(logOther[g]), other[g], tol) or not (other[g] > 1e-250 or exp(logOther[g]) > 1e-250) );
+      if (not ok)
+	errorAbort("From checkGenotypeKernel: " + numericBackendName( kernel.backend() ) + " kernel and star engine disagree for genotype " + starModel.genotypeSymbols()[g] + " (" + toString( exp(logPP[g]) ) + " vs. " + toString(pp[g]) + ").");
+    }
+  }
+  return checked;
+}
+
+
+// For --benchNumeric: evaluate the sites with the star engine, which
+// works in xnumber_t (xdouble in the usual phy build) and is the
+// reference, and with each log space kernel. Report on stderr the time
+// per site, and for the kernels the largest absolute error of the
+// posteriors, the largest error of the log of the posterior of the
+// other genotypes (where the reference is above 1e-250), and the number
+// of sites with another most probable genotype. Each backend evaluates
+// the sites at least a million times in all, including collapsing the
+// counts into a histogram and the sums of the other posteriors, as
+// needed for --ppSumOther and --vcf.
+void benchmarkNumeric(StarModel const & starModel, CountedSites const & sites)
+{
+  unsigned nG = starModel.genotypeCount();
+  unsigned n = sites.size();
+  if (n == 0)
+    errorAbort("From benchmarkNumeric: no sites in the input.");
+  unsigned passes = 1 + 1000000 / n;
+  SymbolHistogram hist;
+  hist.count.assign(starModel.observationSymbolCount(), 0);
+
+  // reference
+  xvector_t pp(nG), other(nG);
+  double checksum = 0;
+  double start = wallTime();
+  for (unsigned p = 0; p < passes; p++)
+    for (unsigned i = 0; i < n; i++) {
+      sites.get(i, hist);
+      starModel.calcPosterior(hist, pp);
+      ppSumOther(pp, other);
+      checksum += pp[0];
+    }
+  double refTime = wallTime() - start;
+  cerr << "Numeric backend " << numericBackendName(NUMERIC_XNUMBER) << ": " << refTime / (passes * (double) n) * 1e9 << " ns per site (reference)." << endl;
+
+  NumericBackend backends[] = {NUMERIC_LOG, NUMERIC_LOGF};
+  vector<double> logPP(nG), logOther(nG);
+  for (unsigned b = 0; b < 2; b++) {
+    GenotypeKernel * kernel = mkGenotypeKernel(starModel, backends[b]);
+    start = wallTime();
+    for (unsigned p = 0; p < passes; p++)
+      for (unsigned i = 0; i < n; i++) {
+	sites.get(i, hist);
+	kernel->calcLogPosterior(hist, & logPP[0], & logOther[0]);
+	checksum += logPP[0];
+      }
+    double time = wallTime() - start;
+
+    double ppError = 0, otherError = 0;
+    unsigned long callsDiffer = 0;
+    for (unsigned i = 0; i < n; i++) {
+      sites.get(i, hist);
+      starModel.calcPosterior(hist, pp);
+      other = pp;
+      ppSumOther(other);
+      kernel->calcLogPosterior(hist, & logPP[0], & logOther[0]);
+      unsigned refBest = 0, best = 0;
+      for (unsigned g = 0; g < nG; g++) {
+	ppError = max( ppError, fabs( exp(logPP[g]) - (double) pp[g] ) );
+	if (other[g] > 1e-250)
+	  otherError = max( otherError, fabs( logOther[g] - (double) log(other[g]) ) );
+	if (pp[g] > pp[refBest])
+	  refBest = g;
+	if (logPP[g] > logPP[best])
+	  best = g;
+      }
+      if (best != refBest)
+	callsDiffer++;
+    }
+    cerr << "Numeric backend " << numericBackendName( kernel->backend() ) << ": " << time / (passes * (double) n) * 1e9 << " ns per site (" << refTime / time << " times the reference), largest posterior error " << ppError << ", largest error of log P(other genotypes) " << otherError << ", most probable genotype differs at " << callsDiffer << " of " << n << " sites." << endl;
+    delete kernel;
+  }
+  // keeps the compiler from dropping the timed loops
+  volatile double sink = checksum;
+  (void) sink;
+}
+
+
+// For --sweepTau and --sweepDelta: the comma separated rates
+vector<double> parseRates(string const & list, string const & option)
+{
+  vector<string> fields = split(list, ',');
+  vector<double> rates;
+  for (unsigned i = 0; i < fields.size(); i++) {
+    char * end;
+    double x = strtod(fields[i].c_str(), & end);
+    if ( fields[i].empty() or * end != '\0' or not (x >= 0 and x < 1) )
+      errorAbort("The --" + option + " option takes comma separated rates in [0, 1), not '" + list + "'.");
+    rates.push_back(x);
+  }
+  return rates;
+}
+
+
+// Compile the model of each ploidity and model with specification files
+// in dfgSpecPrefix into the bundle file. Each model is checked against
+// the DFG (up to depth checkDepth) and its emission table against the
+// star engine before it is written.
+void compileModelBundle(string const & dfgSpecPrefix, string const & file, unsigned checkDepth)
+{
+  char const * ploidities[] = {"diploid", "haploid"};
+  char const * models[] = {"", "_none", "_error", "_damage"};
+  vector<ModelVariant> variants;
+  vector< vector<double> > tables;
+  for (unsigned i = 0; i < 2; i++)
+    for (unsigned j = 0; j < 4; j++) {
+      string statemaps = dfgSpecPrefix + ploidities[i] + "_stateMaps.txt";
+      string potentials = dfgSpecPrefix + ploidities[i] + models[j] + "_factorPotentials.txt";
+      if ( not ifstream( statemaps.c_str() ) or not ifstream( potentials.c_str() ) )
+	continue;
+
+      ModelVariant v;
+      v.name = string(ploidities[i]) + models[j];
+      v.stateMaps = readStateMapSpecs(statemaps);
+      v.potentials = readPotentialSpecs(potentials);
+      StarModel starModel(v.stateMaps, v.potentials, potentials);
+      DepthModels depthModels(statemaps, potentials);
+      v.checkedSites = checkStarModel(starModel, depthModels, checkDepth);
+      EmissionTable table(starModel, SIMD_SCALAR);
+      checkEmissionTable(starModel, table);
+      v.genotypeCount = starModel.genotypeCount();
+      v.symbolCount = starModel.observationSymbolCount();
+      v.stride = table.stride();
+      tables.push_back( vector<double>(table.table(), table.table() + v.genotypeCount * v.stride) );
+      variants.push_back(v);
+      cerr << "Compiled model " << v.name << " (" << v.genotypeCount << " genotypes, " << v.symbolCount << " input symbols, agrees with the DFG on " << v.checkedSites << " test sites)." << endl;
+    }
+  if ( variants.empty() )
+    errorAbort("From compileModelBundle: no state maps and factor potentials found in '" + dfgSpecPrefix + "'.");
+
+  for (unsigned i = 0; i < variants.size(); i++)
+    variants[i].logEmission = & tables[i][0];
+  writeModelBundle(file, variants);
+}
+
+
+// read depth of a site: the number of reads in the record, or for .tab
+// input evaluated with the DFGs the depth in the id, at most maxDepth
+unsigned siteDepth(SiteRecord const & rec, bool useRecordDepth, unsigned maxDepth)
+{
+  if (useRecordDepth)
+    return rec.depth;
+  return min( maxDepth, idDepth(rec.id) );
+}
+
+
+// The site records of the input, from a pileup reader, an evidence
+// store or a .tab file, one input line at a time
+struct SiteInput {
+  PileupReader * pileupReader;  // NULL for other input
+  EvidenceReader * evidenceReader;  // NULL for other input
+  istream * tabInput;
+  EvidenceWriter * evidenceWriter;  // if not NULL, the records read are stored
+  bool useRecordDepth;
+  unsigned maxDepth;
+  vector<SiteRecord> records;
+  string tabLine;
+  double parseSeconds;          // with timed set, the time spent in next
+  bool timed;
+
+  // Read the records of the next line into records; returns their
+  // number, zero at the end of the input.
+  unsigned next()
+  {
+    double start = timed ? wallTime() : 0;
+    unsigned recordCount;
+    if (pileupReader != NULL)
+      recordCount = pileupReader->next(records);
+    else if (evidenceReader != NULL)
+      recordCount = evidenceReader->next(records);
+    else
+      recordCount = readTabRecord(*tabInput, records[0], tabLine);
+    if (evidenceWriter != NULL and recordCount > 0)
+      evidenceWriter->add(records, recordCount);
+    if (timed)
+      parseSeconds += wallTime() - start;
+    return recordCount;
+  }
+
+  unsigned depth(SiteRecord const & rec) const {return siteDepth(rec, useRecordDepth, maxDepth);}
+};
+
+
+// Read the sites of the next chunk for threadCount threads, at most
+// CHUNK_SITES_PER_THREAD sites or CHUNK_COST_PER_THREAD reads per
+// thread (whole input lines), into sites, and their depths. The line
+// count is increased by the lines read. Returns the number of sites,
+// and sets end at the end of the input.
+unsigned readChunk(SiteInput & input, unsigned threadCount, vector<SiteRecord> & sites, vector<unsigned> & depths, unsigned long & lineCount, bool & end)
+{
+  unsigned siteCount = 0;
+  unsigned long cost = 0;
+  end = false;
+  while (siteCount < threadCount * CHUNK_SITES_PER_THREAD and cost < (unsigned long) threadCount * CHUNK_COST_PER_THREAD) {
+    unsigned recordCount = input.next();
+    if (recordCount == 0) {
+      end = true;
+      break;
+    }
+    if (sites.size() < siteCount + recordCount) {
+      sites.resize(siteCount + recordCount);
+      depths.resize(siteCount + recordCount);
+    }
+    for (unsigned r = 0; r < recordCount; r++, siteCount++) {
+      // swap, so the reader reuses the buffers of an old record
+      swap(sites[siteCount], input.records[r]);
+      depths[siteCount] = input.depth(sites[siteCount]);
+      cost += depths[siteCount] + SITE_COST_OFFSET;
+    }
+    lineCount++;
+  }
+  return siteCount;
+}
+
+
+// Models and output options shared (read only) by all site evaluators
+struct EvalSettings {
+  DepthModels * depthModels;
+  StarModel const * starModel;         // NULL with the dfg engine
+  EmissionTable const * emissionTable; // non NULL with --batch
+  unsigned batchSites;
+  bool histogram;
+  vector<string> ppVarNames;
+  vector< vector<unsigned> > ppVarStateMap;
+  bool minusLogarithm, ppSumOther;
+  unsigned prec;
+  vector<string> vcfGenotypes;  // with --vcf, the genotypes of the output states
+  double homRefBound;           // 0, or the bound below which the hom-ref shortcut is taken
+  PosteriorCache * cache;       // NULL unless --cache (and not --batch)
+  GenotypeKernel const * genotypeKernel; // non NULL with a log space --numeric backend
+  bool exchangeableReads;       // posteriors do not depend on the order of the reads
+  bool collectStats;            // time the sites for --stats
+  unsigned sampleCount;         // with --samples the records per site, one per sample, else 0
+};
+
+
+// Workspace for evaluating sites and writing their posteriors. With
+// several samples, the records of the samples of a site come one after
+// the other, and their line is written after the last one. Each
+// thread has its own evaluator, with its own copy of the DFG, state
+// masks and variable map of each depth, made on first use, so that the
+// shared models are only read. All scratch buffers are reused, so once
+// the depths and batch sizes of the input have been seen no heap
+// allocations are made per site.
+class SiteEvaluator {
+public:
+  SiteEvaluator(EvalSettings const & settings);
+  ~SiteEvaluator();
+
+  // Write the posteriors of the site to str. With --batch, the site is
+  // queued and written when the batch is full or at flush.
+  void evaluate(SiteRecord const & rec, unsigned depth, ostream & str);
+  void flush(ostream & str);
+
+  unsigned long siteCount() const {return siteCount_;}
+  unsigned long shortcutCount() const {return shortcutCount_;}
+  // counts and times of the sites, with collectStats
+  SiteStats const & stats() const {return stats_;}
+
+private:
+  SiteEvaluator(SiteEvaluator const &);
+  SiteEvaluator & operator=(SiteEvaluator const &);
+
+  // per depth workspace
+  struct DepthWorkspace {
+    DfgInfo * dfgInfo;
+    stateMaskVec_t stateMasks;
+    vector<unsigned> varMap;    // C, O1, ..., On -> DFG variables
+    vector<unsigned> ppVarMap;  // output variables -> DFG variables
+    vector<xvector_t> variableMarginals;
+    DepthWorkspace() : dfgInfo(NULL) {}
+  };
+  DepthWorkspace & depthWorkspace(unsigned depth);
+
+  // evaluate, without the stats
+  void evaluateSite(SiteRecord const & rec, unsigned depth, ostream & str);
+  // write pp (transformed by the options) for the states of output variable i
+  void writePostProbs(ostream & str, string const & id, unsigned i, xvector_t const & pp);
+  // write the posteriors of G of the site in hist_ from the genotype kernel
+  void writeKernelPostProbs(ostream & str, string const & id);
+  // write ppVec_ (already transformed) for the states of output variable i
+  void writeStates(ostream & str, string const & id, unsigned i);
+
+  // With --homRefBound, the hom-ref genotype of the site in hist_ if the
+  // posterior of the other genotypes is bounded by the option (bound is
+  // set), otherwise -1.
+  int homRefShortcut(double & bound);
+  // write the hom-ref call of a shortcut site
+  void writeHomRef(ostream & str, string const & id, unsigned g, double bound);
+
+  EvalSettings const & s_;
+  SymbolHistogram hist_;
+  xvector_t starPP_;
+  SiteBatch batch_;
+  // sites queued with --batch, in input order; the hom-ref genotype and
+  // bound of shortcut sites, -1 for the sites of batch_
+  vector<string> pendingIds_;
+  vector<int> pendingHomRef_;
+  vector<double> pendingBound_;
+  unsigned pendingCount_;
+  unsigned long siteCount_, shortcutCount_;
+  vector<DepthWorkspace> workspaces_;
+  vector<symbol_t> varVec_;
+  xvector_t ppVec_, ppScratch_;
+  vector<xnumber_t> ppOut_;
+  string name_;
+  string vcfLine_;
+  string cacheKey_;
+  vector<symbol_t> canonicalSymbols_;
+  vector<symbol_code_t> canonicalCodes_;
+  xvector_t cachedPP_;
+  vector<double> logPP_, logOther_;
+  SiteStats stats_;
+  // the samples of the current site so far
+  unsigned sample_;
+  vector<string> sampleIds_;
+  vector<xnumber_t> samplePP_;
+  MultiSampleVcfFormatter sampleVcf_;
+};
+
+
+SiteEvaluator::SiteEvaluator(EvalSettings const & settings)
+  : s_(settings),
+    starPP_( settings.starModel ? settings.starModel->genotypeCount() : 0 ),
+    pendingCount_(0), siteCount_(0), shortcutCount_(0),
+    sample_(0), sampleIds_(settings.sampleCount), sampleVcf_(settings.vcfGenotypes, settings.prec)
+{}
+
+
+SiteEvaluator::~SiteEvaluator()
+{
+  for (unsigned i = 0; i < workspaces_.size(); i++)
+    if (workspaces_[i].dfgInfo != NULL)
+      delete workspaces_[i].dfgInfo;
+}
+
+
+SiteEvaluator::DepthWorkspace & SiteEvaluator::depthWorkspace(unsigned depth)
+{
+  if (workspaces_.size() < depth)
+    workspaces_.resize(depth);
+  DepthWorkspace & ws = workspaces_[depth - 1];
+  if (ws.dfgInfo == NULL) {
+    ws.dfgInfo = new DfgInfo( s_.depthModels->get(depth) );
+    ws.stateMasks.resize( ws.dfgInfo->varNames.size() );
+    ws.varMap = mkSubsetMap(ws.dfgInfo->varNames, mkDataVarNames(depth));
+    ws.ppVarMap = mkSubsetMap(ws.dfgInfo->varNames, s_.ppVarNames);
+    initGenericVariableMarginals(ws.variableMarginals, ws.dfgInfo->dfg);
+  }
+  return ws;
+}
+
+
+void SiteEvaluator::writePostProbs(ostream & str, string const & id, unsigned i, xvector_t const & pp)
+{
+  if (ppVec_.size() != pp.size()) {
+    ppVec_.resize( pp.size() );
+    ppScratch_.resize( pp.size() );
+  }
+  std::copy(pp.begin(), pp.end(), ppVec_.begin());
+  if (s_.ppSumOther)
+    ppSumOther(ppVec_, ppScratch_);
+  if (s_.minusLogarithm)
+    takeMinusLog(ppVec_, id);
+  writeStates(str, id, i);
+}
+
+
+void SiteEvaluator::writeKernelPostProbs(ostream & str, string const & id)
+{
+  unsigned nG = s_.genotypeKernel->genotypeCount();
+  if (logPP_.size() != nG) {
+    logPP_.resize(nG);
+    logOther_.resize(nG);
+    ppVec_.resize(nG);
+    ppScratch_.resize(nG);
+  }
+  s_.genotypeKernel->calcLogPosterior(hist_, & logPP_[0], & logOther_[0]);
+  // the sums of the other posteriors are computed directly in log space,
+  // and minus their logs are exact even where they underflow as doubles
+  vector<double> const & v = s_.ppSumOther ? logOther_ : logPP_;
+  for (unsigned g = 0; g < nG; g++)
+    ppVec_[g] = s_.minusLogarithm ? - v[g] : exp(v[g]);
+  writeStates(str, id, 0);
+}
+
+
+void SiteEvaluator::writeStates(ostream & str, string const & id, unsigned i)
+{
+  vector<unsigned> const & stateMap = s_.ppVarStateMap[i];
+  ppOut_.resize( stateMap.size() );
+  for (unsigned j = 0; j < stateMap.size(); j++)
+    ppOut_[j] = ppVec_[ stateMap[j] ];
+  double start = s_.collectStats ? wallTime() : 0;
+  if (s_.sampleCount > 0) {
+    sampleIds_[sample_] = id;
+    samplePP_.resize( s_.sampleCount * ppOut_.size() );
+    std::copy( ppOut_.begin(), ppOut_.end(), samplePP_.begin() + sample_ * ppOut_.size() );
+    if (++sample_ == s_.sampleCount) {
+      sampleVcf_.mkRecord(vcfLine_, sampleIds_, samplePP_);
+      str << vcfLine_;
+      sample_ = 0;
+    }
+  }
+  else if ( not s_.vcfGenotypes.empty() ) {
+    mkVcfRecord(vcfLine_, id, s_.vcfGenotypes, ppOut_, s_.prec);
+    str << vcfLine_;
+  }
+  else {
+    name_.assign(id);
+    name_ += '\t';
+    name_ += s_.ppVarNames[i];
+    writeNamedData(str, name_, ppOut_, s_.prec);
+  }
+  if (s_.collectStats)
+    stats_.addOutputTime(wallTime() - start);
+}
+
+
+int SiteEvaluator::homRefShortcut(double & bound)
+{
+  if (s_.homRefBound <= 0)
+    return -1;
+  int g = s_.starModel->homGenotype(hist_.ref);
+  if (g < 0)
+    return -1;
+  bound = s_.starModel->otherGenotypesBound(hist_, g);
+  if ( not (bound < s_.homRefBound) )
+    return -1;
+  shortcutCount_++;
+  return g;
+}
+
+
+void SiteEvaluator::writeHomRef(ostream & str, string const & id, unsigned g, double bound)
+{
+  // posteriors within the bound of the exact ones: g has 1 - bound and
+  // the other genotypes share bound
+  for (unsigned h = 0; h < starPP_.size(); h++)
+    starPP_[h] = (h == g) ? 1 - bound : bound / (starPP_.size() - 1);
+  writePostProbs(str, id, 0, starPP_);
+}
+
+
+void SiteEvaluator::evaluate(SiteRecord const & rec, unsigned depth, ostream & str)
+{
+  if (not s_.collectStats) {
+    evaluateSite(rec, depth, str);
+    return;
+  }
+  double start = wallTime();
+  evaluateSite(rec, depth, str);
+  double seconds = wallTime() - start;
+  // with --batch, the sites are evaluated at flush and only the batch is timed
+  if (s_.emissionTable != NULL) {
+    stats_.addEvaluateTime(seconds);
+    seconds = 0;
+  }
+  stats_.addSite(rec.id, idDepth(rec.id), depth, seconds);
+}
+
+
+void SiteEvaluator::evaluateSite(SiteRecord const & rec, unsigned depth, ostream & str)
+{
+  string const & idVar = rec.id;
+  siteCount_++;
+
+  if (s_.emissionTable != NULL) {
+    s_.starModel->countSymbols(rec, depth, hist_);
+    double bound = 0;
+    int homRef = homRefShortcut(bound);
+    if (homRef < 0)
+      batch_.add(hist_);
+    if (pendingIds_.size() <= pendingCount_) {
+      // room for typical ids, so the slots rarely need to grow later
+      pendingIds_.resize(pendingCount_ + 1);
+      pendingIds_.back().reserve(64);
+      pendingHomRef_.resize(pendingCount_ + 1);
+      pendingBound_.resize(pendingCount_ + 1);
+    }
+    pendingIds_[pendingCount_] = idVar;
+    pendingHomRef_[pendingCount_] = homRef;
+    pendingBound_[pendingCount_] = bound;
+    pendingCount_++;
+    // shortcut sites are cheap, but their output waits for the batch
+    if (batch_.size() >= s_.batchSites or pendingCount_ >= PENDING_SITES_PER_BATCH * s_.batchSites)
+      flush(str);
+    return;
+  }
+
+  if (s_.starModel != NULL) {
+    if (s_.histogram or s_.homRefBound > 0 or s_.genotypeKernel != NULL) {
+      s_.starModel->countSymbols(rec, depth, hist_);
+      double bound;
+      int homRef = homRefShortcut(bound);
+      if (homRef >= 0) {
+	writeHomRef(str, idVar, homRef, bound);
+	return;
+      }
+    }
+    if (s_.genotypeKernel != NULL) {
+      writeKernelPostProbs(str, idVar);
+      return;
+    }
+    // with the cache, the posteriors are evaluated from the key, so
+    // they do not depend on whether the site was a hit
+    vector<symbol_t> const * symbols = & rec.symbols;
+    vector<symbol_code_t> const * codes = & rec.codes;
+    if (s_.cache != NULL) {
+      if (s_.histogram)
+	mkEvidenceKey(cacheKey_, hist_);
+      else if ( not rec.codes.empty() ) {
+	mkEvidenceKey(cacheKey_, rec.codes, depth, true, canonicalCodes_);
+	codes = & canonicalCodes_;
+      }
+      else {
+	mkEvidenceKey(cacheKey_, rec.symbols, depth, true, canonicalSymbols_);
+	symbols = & canonicalSymbols_;
+      }
+      if ( s_.cache->lookup(cacheKey_, starPP_) ) {
+	writePostProbs(str, idVar, 0, starPP_);
+	return;
+      }
+    }
+    if (s_.histogram)
+      s_.starModel->calcPosterior(hist_, starPP_);
+    else if ( not codes->empty() )
+      s_.starModel->calcPosterior(*codes, depth, starPP_);
+    else
+      s_.starModel->calcPosterior(*symbols, depth, starPP_);
+    if (s_.cache != NULL)
+      s_.cache->store(cacheKey_, starPP_);
+    writePostProbs(str, idVar, 0, starPP_);
+    return;
+  }
+
+  // .tab lines may have more reads than the depth used
+  vector<symbol_t> const * symbols = & rec.symbols;
+  if (s_.cache != NULL) {
+    mkEvidenceKey(cacheKey_, rec.symbols, depth, s_.exchangeableReads, canonicalSymbols_);
+    if ( s_.cache->lookup(cacheKey_, cachedPP_) ) {
+      writePostProbs(str, idVar, 0, cachedPP_);
+      return;
+    }
+    symbols = & canonicalSymbols_;
+  }
+  else if (rec.symbols.size() != depth + 1) {
+    varVec_.assign(rec.symbols.begin(), rec.symbols.begin() + depth + 1);
+    symbols = & varVec_;
+  }
+  DepthWorkspace & ws = depthWorkspace(depth);
+  DfgInfo & dfgInfo = *ws.dfgInfo;
+  dfgInfo.stateMaskMapSet.symbols2StateMasks(ws.stateMasks, *symbols, ws.varMap);
+
+  dfgInfo.dfg.runSumProduct(ws.stateMasks);
+
+  dfgInfo.dfg.calcVariableMarginals(ws.variableMarginals, ws.stateMasks);
+  if (s_.cache != NULL)
+    s_.cache->store(cacheKey_, ws.variableMarginals[ ws.ppVarMap[0] ]);
+  for (unsigned i = 0; i < s_.ppVarNames.size(); i++)
+    writePostProbs(str, idVar, i, ws.variableMarginals[ ws.ppVarMap[i] ]);
+}
+
+
+void SiteEvaluator::flush(ostream & str)
+{
+  if (s_.emissionTable == NULL or pendingCount_ == 0)
+    return;
+  double start = s_.collectStats ? wallTime() : 0;
+  if (batch_.size() > 0)
+    s_.emissionTable->evaluate(batch_);
+  for (unsigned i = 0, b = 0; i < pendingCount_; i++) {
+    if (pendingHomRef_[i] >= 0)
+      writeHomRef(str, pendingIds_[i], pendingHomRef_[i], pendingBound_[i]);
+    else {
+      s_.emissionTable->calcPosterior(batch_.logLik(b++), starPP_);
+      writePostProbs(str, pendingIds_[i], 0, starPP_);
+    }
+  }
+  batch_.clear();
+  pendingCount_ = 0;
+  if (s_.collectStats)
+    stats_.addEvaluateTime(wallTime() - start);
+}
+
+
+// A contiguous range of the sites in a chunk and its output
+struct SiteTask {
+  unsigned begin, end;
+  string output;
+};
+
+
+// Cut a chunk of sites into about four tasks per thread of about the
+// same estimated cost, which is linear in the read depth, so deep sites
+// do not hold up the other threads. Tasks only end after the last of
+// the sampleCount records of a site.
+void mkSiteTasks(vector<unsigned> const & depths, unsigned siteCount, unsigned threadCount, unsigned sampleCount, vector<SiteTask> & tasks)
+{
+  unsigned long totalCost = 0;
+  for (unsigned i = 0; i < siteCount; i++)
+    totalCost += depths[i] + SITE_COST_OFFSET;
+  unsigned long taskCost = totalCost / (4 * threadCount) + 1;
+
+  tasks.clear();
+  SiteTask task;
+  task.begin = 0;
+  unsigned long cost = 0;
+  for (unsigned i = 0; i < siteCount; i++) {
+    cost += depths[i] + SITE_COST_OFFSET;
+    if ( (cost >= taskCost and (i + 1) % sampleCount == 0) or i + 1 == siteCount ) {
+      task.end = i + 1;
+      tasks.push_back(task);
+      task.begin = i + 1;
+      cost = 0;
+    }
+  }
+}
+
+
+void evaluateTask(SiteEvaluator & evaluator, vector<SiteRecord> const & sites, vector<unsigned> const & depths, SiteTask & task)
+{
+  ostringstream str;
+  for (unsigned i = task.begin; i < task.end; i++)
+    evaluator.evaluate(sites[i], depths[i], str);
+  evaluator.flush(str);
+  task.output = str.str();
+}
+
+
+// With --progress, write a line on stderr when interval seconds have
+// passed since the last one (lastTime), and update lastTime.
+void writeProgress(double interval, double & lastTime, double startTime, unsigned long lines, unsigned long sites, string const & lastId)
+{
+  double now = wallTime();
+  if (now - lastTime < interval)
+    return;
+  lastTime = now;
+  cerr << "Progress: " << sites << " sites (" << lines << " input lines) in " << (unsigned long) (now - startTime) << " s, "
+       << (unsigned long) ( sites / max(now - startTime, 1e-9) ) << " sites/s, at " << lastId.substr( 0, lastId.find(';') )
+       << ", peak memory " << peakResidentKb() / 1024 << " MB." << endl;
+}
+
+
+// With several threads or --pipeline, the input is read, evaluated and
+// written by separate threads: a reader thread reads chunks of sites,
+// the worker threads evaluate the tasks of the chunks in input
+// order, taking up the next chunk while the last tasks of a chunk are
+// being finished, and the calling thread writes the output of each
+// chunk in input order as soon as all its tasks are done. The chunks
+// are kept in a ring of PIPELINE_CHUNKS slots, reused once written, so
+// the reader stalls when it is that far ahead of the writer and a slow
+// consumer of the output only slows the run down to its pace. Reading,
+// evaluation and writing overlap, so the run takes about the time of
+// the slowest of them instead of their sum.
+class SitePipeline {
+public:
+  SitePipeline(vector<SiteEvaluator *> & evaluators, SiteInput & input, unsigned sampleCount, ostream & str);
+
+  // Run until the end of the input. With progressInterval > 0, write
+  // progress lines (see writeProgress) as chunks are written.
+  void run(double progressInterval, double startTime);
+
+  unsigned long lineCount() const {return lineCount_;}
+  unsigned long siteCount() const {return siteCount_;}
+  double writeSeconds() const {return writeSeconds_;}
+
+private:
+  struct Chunk {
+    vector<SiteRecord> sites;
+    vector<unsigned> depths;
+    unsigned siteCount;
+    unsigned long lineCount;  // input lines up to the end of the chunk
+    vector<SiteTask> tasks;
+    unsigned tasksLeft;       // tasks not yet evaluated
+  };
+
+  void readLoop();
+  void workLoop(SiteEvaluator * evaluator);
+
+  vector<SiteEvaluator *> & evaluators_;
+  SiteInput & input_;
+  unsigned sampleCount_;
+  ostream & str_;
+  vector<Chunk> ring_;
+
+  // Chunks are numbered in input order; chunk n is in slot n % PIPELINE_CHUNKS.
+  // Chunks before readCount_ are read, and those before writtenCount_ written.
+  // The next task to evaluate is task nextTask_ of chunk taskChunk_.
+  boost::mutex mutex_;
+  boost::condition_variable changed_;
+  unsigned long readCount_, writtenCount_, taskChunk_;
+  unsigned nextTask_;
+  bool endOfInput_;
+
+  unsigned long lineCount_, siteCount_;
+  double writeSeconds_;
+};
+
+
+SitePipeline::SitePipeline(vector<SiteEvaluator *> & evaluators, SiteInput & input, unsigned sampleCount, ostream & str)
+  : evaluators_(evaluators), input_(input), sampleCount_(sampleCount), str_(str), ring_(PIPELINE_CHUNKS),
+    readCount_(0), writtenCount_(0), taskChunk_(0), nextTask_(0), endOfInput_(false),
+    lineCount_(0), siteCount_(0), writeSeconds_(0)
+{}
+
+
+void SitePipeline::readLoop()
+{
+  unsigned long lineCount = 0;
+  while (true) {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      while (readCount_ - writtenCount_ == PIPELINE_CHUNKS)
+	changed_.wait(lock);
+    }
+    // the slot is not used by the other threads until published
+    Chunk & chunk = ring_[readCount_ % PIPELINE_CHUNKS];
+    bool end;
+    chunk.siteCount = readChunk(input_, evaluators_.size(), chunk.sites, chunk.depths, lineCount, end);
+    chunk.lineCount = lineCount;
+    mkSiteTasks(chunk.depths, chunk.siteCount, evaluators_.size(), sampleCount_, chunk.tasks);
+    chunk.tasksLeft = chunk.tasks.size();
+
+    boost::mutex::scoped_lock lock(mutex_);
+    if (chunk.siteCount > 0)
+      readCount_++;
+    endOfInput_ = end;
+    changed_.notify_all();
+    if (end)
+      return;
+  }
+}
+
+
+void SitePipeline::workLoop(SiteEvaluator * evaluator)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  while (true) {
+    while (taskChunk_ == readCount_ and not endOfInput_)
+      changed_.wait(lock);
+    if (taskChunk_ == readCount_)
+      return;
+    Chunk & chunk = ring_[taskChunk_ % PIPELINE_CHUNKS];
+    SiteTask & task = chunk.tasks[nextTask_];
+    if (++nextTask_ == chunk.tasks.size()) {
+      taskChunk_++;
+      nextTask_ = 0;
+    }
+    lock.unlock();
+    evaluateTask(*evaluator, chunk.sites, chunk.depths, task);
+    lock.lock();
+    if (--chunk.tasksLeft == 0)
+      changed_.notify_all();
+  }
+}
+
+
+void SitePipeline::run(double progressInterval, double startTime)
+{
+  boost::thread_group threads;
+  threads.add_thread( new boost::thread(& SitePipeline::readLoop, this) );
+  for (unsigned i = 0; i < evaluators_.size(); i++)
+    threads.add_thread( new boost::thread(& SitePipeline::workLoop, this, evaluators_[i]) );
+
+  double lastProgressTime = startTime;
+  while (true) {
+    Chunk * chunk;
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      while ( not (writtenCount_ < readCount_ and ring_[writtenCount_ % PIPELINE_CHUNKS].tasksLeft == 0) and not (endOfInput_ and writtenCount_ == readCount_) )
+	changed_.wait(lock);
+      if (writtenCount_ == readCount_)
+	break;
+      chunk = & ring_[writtenCount_ % PIPELINE_CHUNKS];
+    }
+    double start = wallTime();
+    for (unsigned t = 0; t < chunk->tasks.size(); t++)
+      str_ << chunk->tasks[t].output;
+    writeSeconds_ += wallTime() - start;
+    lineCount_ = chunk->lineCount;
+    siteCount_ += chunk->siteCount;
+    if (progressInterval > 0)
+      writeProgress(progressInterval, lastProgressTime, startTime, lineCount_, siteCount_, chunk->sites[chunk->siteCount - 1].id);
+
+    boost::mutex::scoped_lock lock(mutex_);
+    writtenCount_++;
+    changed_.notify_all();
+  }
+  threads.join_all();
+}
+
+
+// JSON pairs of a --stats section: the values are already formatted
+typedef vector< pair<string, string> > JsonFields;
+
+void writeJsonFields(ostream & str, string const & name, JsonFields const & fields)
+{
+  str << "  " << jsonString(name) << ": {";
+  for (unsigned i = 0; i < fields.size(); i++)
+    str << (i ? ", " : "") << jsonString(fields[i].first) << ": " << fields[i].second;
+  str << "},\n";
+}
+
+
+// The --stats report. The times of parsing, writing, and the wall time
+// of the threads are measured by the main loop, the per site counts and
+// the evaluation times by the evaluators (summed over the threads).
+void writeStatsReport(ostream & str, JsonFields const & run, JsonFields const & models, JsonFields const & counts, JsonFields const & seconds, SiteStats const & stats)
+{
+  str << "{\n  \"program\": \"dfgEval_SNPest\",\n";
+  writeJsonFields(str, "run", run);
+  writeJsonFields(str, "models", models);
+  writeJsonFields(str, "counts", counts);
+  writeJsonFields(str, "seconds", seconds);
+
+  // reads per site, the depth in the input, in bins of powers of two
+  str << "  \"readsPerSite\": [";
+  vector<unsigned long> const & hist = stats.depthHistogram();
+  bool first = true;
+  for (unsigned k = 0; k < hist.size(); k++)
+    if (hist[k] > 0) {
+      str << (first ? "\n" : ",\n") << "    {\"from\": " << depthBinFirst(k) << ", \"to\": " << depthBinLast(k) << ", \"sites\": " << hist[k] << "}";
+      first = false;
+    }
+  str << "\n  ],\n";
+
+  str << "  \"slowestSites\": [";
+  vector<SlowSite> const & slowest = stats.slowestSites();
+  for (unsigned i = 0; i < slowest.size(); i++)
+    str << (i ? ",\n" : "\n") << "    {\"id\": " << jsonString(slowest[i].id) << ", \"inputDepth\": " << slowest[i].inputDepth << ", \"seconds\": " << jsonNumber(slowest[i].seconds) << "}";
+  str << "\n  ],\n";
+  str << "  \"peakRssKb\": " << peakResidentKb() << "\n}\n";
+}
+
 int main(int argc, char * argv[])
 {
-  
+  double startTime = wallTime();
 
   // option and argument variables
   string dfgSpecPrefix, stateMapsFile, factorPotentialsFile, variablesFile, factorGraphFile;  // specification files
@@ -165,8 +1188,40 @@ int main(int argc, char * argv[])
 
   // SL: I added the following
   unsigned maxDepth;
+  bool depthFiles;
   string ploidity;
   string model;
+  bool mpileup, noRef;
+  unsigned qualBase;
+  string bamFile, referenceFile, region;
+  string evidenceFile, evidenceOutFile;
+  unsigned long shardSize;
+  unsigned minBaseQ, minMapQ;
+  string engine;
+  bool histogram;
+  unsigned batchSites;
+  string simd;
+  string numeric;
+  bool benchNumeric;
+  string sweepFile, sweepTau, sweepDelta;
+  string estimateFile;
+  bool estimateMatrix;
+  double estimateFraction;
+  unsigned estimateSeed;
+  unsigned estimatePasses;
+  unsigned threadCount;
+  bool pipeline;
+  bool allocStats;
+  string compileModelFile, modelBundleFile;
+  string vcfFile;
+  bool vcfIndex;
+  double homRefBound;
+  unsigned cacheSlots;
+  bool gvcf;
+  string gqBands, dpBands;
+  string statsFile;
+  double progressInterval;
+  string sampleNames;
 
   // positional arguments (implemented as hidden options)
   po::options_description hidden("Hidden options");
@@ -176,8 +1231,12 @@ int main(int argc, char * argv[])
 
   // define help message and options
   po::options_description visible(string("dfgEval allows implementation of discrete factor graphs and evaluates the probability of data sets under these models.\n\n")
-				  + "  Usage: dfgEval [options] <inputVarData.tab> [inputFacData.tab]\n\n"
+				  + "  Usage: dfgEval [options] <inputVarData.tab> [inputFacData.tab]\n"
+				  + "         dfgEval --mpileup [options] [input.mpileup]\n"
+				  + "         dfgEval --bam=input.bam [--reference=ref.fa] [options]\n"
+				  + "         dfgEval --evidence=input.sev [options]\n\n"
 				  + "The arguments inputVarData.tab and inputFacData.tab are both in named data format.\n"
+				  + "With --mpileup the input is 'samtools mpileup -s' output, read from STDIN if no file is given.\n"
 				  + "Allowed options");
   visible.add_options()
     ("help,h", "produce help message")
@@ -185,6 +1244,12 @@ int main(int argc, char * argv[])
     ("ncFile,n", po::value<string>(& normConstFile)->default_value(""), "Calculate normalization constant output to file.")
     ("mpsFile,m", po::value<string>(& maxProbStateFile)->default_value(""), "Calculate most probable state for each random variable and output to file.")
     ("precision,p", po::value<unsigned>(& prec)->default_value(5), "Output precision of real numbers.")
+    ("vcf", po::value<string>(& vcfFile)->default_value(""), "Write the genotype calls as VCF to this file ('-' for STDOUT), as SNPest.pl does from the --ppSumOther output, instead of the posteriors. A file ending in .gz is bgzip compressed and one ending in .bcf is BCF; these need the contig names, from --bam or the .fai index of --reference. Requires --ppVars=G.")
+    ("index", po::bool_switch(& vcfIndex)->default_value(false), "With --vcf to a .gz (.bcf) file, also write its tabix (CSI) index while writing the file.")
+    ("gvcf", po::bool_switch(& gvcf)->default_value(false), "With --vcf, merge runs of adjacent confident hom-ref sites into reference blocks, like those of gVCF but SNPest's own: one line at the first site, with the smallest QUAL, DP, PP and AVMQ of the run and END (last position) in INFO, which cleanupvcf reads as a site. The last site before an insertion or deletion line keeps its own line. Variant sites, sites with deletions, and hom-ref sites below the first GQ or depth band get their own line.")
+    ("gqBands", po::value<string>(& gqBands)->default_value("20,40"), "With --gvcf, lower limits of the QUAL bands; a block only has sites of one band.")
+    ("dpBands", po::value<string>(& dpBands)->default_value("1,5"), "With --gvcf, lower limits of the depth bands; a block only has sites of one band.")
+    ("homRefBound", po::value<double>(& homRefBound)->default_value(0), "With --vcf (and the star engine), call a site homozygous reference without evaluating the model when a bound on the posterior of the other genotypes, computed from the read counts in one pass, is below this value (less than 0.5). The call is the same, with QUAL and PP from the bound, which is at least the exact value; with a value up to 1e-6, the smallest error probability written, the output is unchanged. 0 turns the shortcut off.")
     ("ppSumOther", po::bool_switch(& ppSumOther)->default_value(false), "For post probs, for each state output sum of post probs for all the other states for that variable. This retains precision for post probs very close to one.")
     ("minusLogarithm,l", po::bool_switch(& minusLogarithm)->default_value(false), "Output minus the natural logarithm of result values (program will terminate on negative results...).")
     ("mpsVars", po::value<string>(& mpsVarVecStr)->default_value(""), "Define the random variables for which the most probable state (mps) should be output. Default is to output the mps for all random variables. The specification string must be enclosed in citation marks and whitespace separated if it includes more than one random variable, e.g.: \"X Y\".")
@@ -195,20 +1260,55 @@ int main(int argc, char * argv[])
     ("stateMapFile", po::value<string>(& stateMapsFile)->default_value("stateMaps.txt"), "Specification of state maps.")
     ("facPotFile", po::value<string>(& factorPotentialsFile)->default_value("factorPotentials.txt"), "Specification of factor potentials.")
     // SL: I added the following
-    ("maxDepth", po::value<unsigned>(& maxDepth)->default_value(200), "The maximum read depth. We expect all factorGraph.txt and variables.txt exist.")
+    ("maxDepth", po::value<unsigned>(& maxDepth)->default_value(200), "The maximum read depth. Deeper sites are down sampled (--mpileup) or truncated. There is no upper limit; the DFG of each depth is made when first needed.")
+    ("depthFiles", po::bool_switch(& depthFiles)->default_value(false), "Read the DFG of depth N from depthN_variables.txt and depthN_factorGraph.txt in dfgSpecPrefix (when first needed), instead of generating the SNPest read model in memory.")
     ("ploidity", po::value<string>(& ploidity)->default_value("diploid"), "The ploidity of the data.")
-    ("model", po::value<string>(& model)->default_value("none"), "Specific model used (if any).");
+    ("model", po::value<string>(& model)->default_value("none"), "Specific model used (if any).")
+    ("compileModel", po::value<string>(& compileModelFile)->default_value(""), "Compile the state maps and factor potentials of each ploidity and model in dfgSpecPrefix into a binary model bundle in this file, and exit.")
+    ("modelBundle", po::value<string>(& modelBundleFile)->default_value(""), "Read the model given by --ploidity and --model from a bundle made with --compileModel instead of from dfgSpecPrefix. The bundle is memory mapped, and with --batch processes using it share one copy of the emission table; the state maps and potentials are copied into each process, so without --batch the memory use is that of the dfgspec files. Requires the star engine and --ppVars=G.")
+    ("mpileup", po::bool_switch(& mpileup)->default_value(false), "Input is samtools mpileup output (with mapping qualities, i.e. -s), which is parsed directly instead of going through a .tab file.")
+    ("samples", po::value<string>(& sampleNames)->default_value(""), "With --mpileup and --vcf, the input is 'samtools mpileup -s' output of several BAM files, with the columns of one sample per file; genotype all samples of each site in one pass and write one multi-sample VCF. The value names the samples, comma separated, in the order of the files. Requires the star engine.")
+    ("qualBase", po::value<unsigned>(& qualBase)->default_value(33), "Quality score offset of the mpileup input: 33 (Illumina 1.8+) or 64 (Illumina 1.3+ and 1.5+).")
+    ("noRef", po::bool_switch(& noRef)->default_value(false), "With --mpileup or --bam, do not use the reference base as prior information.")
+    ("bam", po::value<string>(& bamFile)->default_value(""), "Read the sites from this coordinate sorted BAM or CRAM file instead of mpileup or .tab input. The reads are piled up as by 'samtools mpileup -B -s' with its default read filters.")
+    ("reference", po::value<string>(& referenceFile)->default_value(""), "With --bam, the reference FASTA file (indexed with samtools faidx) giving the reference base of each site; also needed for CRAM. Without it, the reference base is N. With --vcf, it is named in the header, and gives the contigs of .gz or .bcf output of mpileup input.")
+    ("region", po::value<string>(& region)->default_value(""), "With --bam, --mpileup or --evidence, only evaluate the sites in this region (chr, chr:beg, or chr:beg-end, 1-based). With --bam (--evidence) only the overlapping alignments (sites) are read, through the index of the file; mpileup input is read until the end of the region.")
+    ("evidenceOut", po::value<string>(& evidenceOutFile)->default_value(""), "With --mpileup or --bam, also write the sites read to this file, as an indexed binary evidence store (the reference base, the fields of the site id and two bytes per read) which --evidence reads instead of the pileup. The reads of a site are stored as evaluated, i.e. down sampled to --maxDepth unless --histogram is given.")
+    ("evidence", po::value<string>(& evidenceFile)->default_value(""), "Read the sites from this evidence store, made with --evidenceOut, instead of mpileup, BAM or .tab input, e.g. to genotype them again with another --model, --ploidity or prior. The reads are as stored: --qualBase, --noRef, --minBaseQ and --minMapQ applied when the store was written. Sites with more reads than --maxDepth are down sampled, unless --histogram is given.")
+    ("listShards", po::value<unsigned long>(& shardSize), "With --bam, print regions splitting the contigs of the file (or --region) into shards of at most this many bases (0: one shard per contig), one per line in file order, and exit. Running --region on each shard and concatenating the output in this order gives the output of the whole file.")
+    ("minBaseQ", po::value<unsigned>(& minBaseQ)->default_value(13), "With --bam, skip bases with lower base quality (as samtools mpileup -Q, which keeps the deletions).")
+    ("minMapQ", po::value<unsigned>(& minMapQ)->default_value(0), "With --bam, skip reads with lower mapping quality (as samtools mpileup -q).")
+    ("engine", po::value<string>(& engine)->default_value("star"), "Inference engine: 'star' evaluates the read model (C -> G -> A_i -> O_i) in closed form, 'dfg' runs sum-product on the full factor graph of each depth. The star engine is only used for --ppVars=G and is checked against the DFG at startup.")
+    ("histogram", po::bool_switch(& histogram)->default_value(false), "With the star engine, collapse the reads of each site into counts of each input symbol and evaluate the model on the counts. All reads are used (no maxDepth limit or down sampling) at a cost independent of the depth.")
+    ("batch", po::value<unsigned>(& batchSites)->default_value(0), "With the star engine, evaluate sites in batches of this many sites using precomputed log emission tables and a vectorized kernel (log space, double precision). 0 evaluates each site on its own.")
+    ("simd", po::value<string>(& simd)->default_value("auto"), "Instruction set of the --batch kernel: auto, avx512, avx2, or scalar.")
+    ("numeric", po::value<string>(& numeric)->default_value("xnumber"), "Numbers used by the star engine: 'xnumber' evaluates the posteriors in the number type of phy (xdouble in the usual build), 'log' in log space in double precision and 'logf' in float, with the code specialized for the haploid and diploid models. The log space kernels compute the sums of the other posteriors (--ppSumOther, --vcf) directly, keeping their precision near one, and with --minusLogarithm write minus the logs without underflow. Not with --batch.")
+    ("benchNumeric", po::bool_switch(& benchNumeric)->default_value(false), "Instead of writing the posteriors, collapse the sites of the input into read counts and evaluate them with each --numeric backend of the star engine. Report the time per site and the largest differences of the log space backends from 'xnumber' on stderr.")
+    ("sweep", po::value<string>(& sweepFile)->default_value(""), "Instead of writing the posteriors, genotype the sites under the damage model of each pair of rates of --sweepTau and --sweepDelta, in one pass over the input, and write a summary of the calls of each model to this file (- for stdout): the number of sites, variant, heterozygous and homozygous alternative calls, variant calls with a posterior of at least 0.99, the mean posterior of the calls and of the variant calls, and the transitions and transversions of the variant calls. The models are the --model (e.g. _error) with the observation potential of dfgspec/CalculateDamageMatrix. Requires the star engine; the models are split over the --threads.")
+    ("sweepTau", po::value<string>(& sweepTau)->default_value("0"), "Comma separated error rates tau of --sweep.")
+    ("sweepDelta", po::value<string>(& sweepDelta)->default_value("0"), "Comma separated deamination rates delta (C->T and G->A) of --sweep.")
+    ("estimate", po::value<string>(& estimateFile)->default_value(""), "Instead of writing the posteriors, estimate the observation potential of the --model from the input by expectation-maximization and write the potentials, with the estimate, to this file (e.g. dfgspec/diploid_estimated_factorPotentials.txt for --model=estimated). The sites are read once and kept as read counts; each pass evaluates the genotype posteriors of all of them (on --threads threads) and updates the potential. By default the rates tau and delta of the damage model of dfgspec/CalculateDamageMatrix are estimated. The passes, rates and log-likelihood are reported on stderr. Requires the star engine.")
+    ("estimateMatrix", po::bool_switch(& estimateMatrix)->default_value(false), "With --estimate, estimate every entry of the observation potential, as P(O | A), instead of the damage rates.")
+    ("estimateFraction", po::value<double>(& estimateFraction)->default_value(1), "With --estimate, use this random fraction of the sites, e.g. 0.001 to estimate from a few million sites of a whole genome.")
+    ("estimateSeed", po::value<unsigned>(& estimateSeed)->default_value(1), "Seed of the random choice of the sites of --estimateFraction; the same seed and input give the same sites and estimate.")
+    ("estimatePasses", po::value<unsigned>(& estimatePasses)->default_value(50), "With --estimate, stop after this many passes, or when no rate or entry of the potential changes by more than 1e-6.")
+    ("threads", po::value<unsigned>(& threadCount)->default_value(1), "Number of threads evaluating sites. The output is the same as with one thread and in input order.")
+    ("pipeline", po::bool_switch(& pipeline)->default_value(false), "With one thread, read the input, evaluate the sites and write the output in separate threads, so that reading, evaluation and writing overlap, e.g. when the input is on a network file system or the output goes to a slow pipe; with several --threads this is always done. At most a few chunks of sites are read ahead of the output. The output is the same.")
+    ("cache", po::value<unsigned>(& cacheSlots)->default_value(0), "Cache the G posteriors of this many distinct site evidences (reference symbol and multiset of read symbols), shared by the threads, so repeated evidence is evaluated once. Sites are then evaluated with their reads in sorted order. The hits and misses are reported on stderr, for sizing the cache. Not used with --batch or several --ppVars. 0 turns the cache off.")
+    ("stats", po::value<string>(& statsFile)->default_value(""), "Write a report of the run as JSON to this file: the settings and models used, the numbers of input lines, sites and reads, a histogram of the reads per site in the input (before --maxDepth), the number of sites down sampled or truncated to --maxDepth, the time spent in setup, parsing, inference and output, the slowest sites, and the peak memory use. With several threads the inference and output times are summed over the threads. The sites are then timed one by one, which costs a little.")
+    ("progress", po::value<double>(& progressInterval)->default_value(0), "Report the number of sites evaluated, the rate, the current site and the peak memory use on stderr about every this many seconds. 0 turns the reports off.")
+    ("allocStats", po::bool_switch(& allocStats)->default_value(false), "Report the number of heap allocations before and in the site loop on stderr, and with one thread the number of input lines whose reading and evaluation allocated. Once all depths have been seen, lines should not allocate. Only in builds with the allocation counter (dfgEval_SNPest_alloc, 'make alloccheck').");
   
-  // SL: In the new version, we want to generate all DFGs for depth 1 to maxdepth
+  // SL: In the new version, we use a DFG for each depth from 1 to maxdepth
   // The files stateMapsFile and factorPotentialsFile depend on the ploidity parameter and the model used (if any).
   // diploid_stateMaps.txt and diploid_factorPotentials.txt or
   // haploid_stateMaps.txt and haploid_factorPotentials.txt
   // diploid_damage_stateMaps.txt and diploid_damage_factorPotentials.txt or
   // haploid_damage_stateMaps.txt and haploid_damage_factorPotentials.txt
-  // The files factorGraphFile and variablesFile depend on the read depth and are called
+  // The factor graph and variables of each read depth are generated in memory when the depth
+  // is first seen (see DepthModels.h), or with --depthFiles read from
   // depthN_factorGraph.txt and depthN_variables.txt
   // All files are placed in dfgSpecPrefix by default
-  // We are going to generate the filenames on the fly and generate all the DFGs instead of reading only one.
 
   // setting up options parser
   po::options_description cmdline_options;
@@ -227,33 +1327,59 @@ int main(int argc, char * argv[])
     return 1;
   }
 
+  if ( not compileModelFile.empty() ) {
+    compileModelBundle(dfgSpecPrefix, compileModelFile, min(maxDepth, 30u));
+    cerr << "Wrote model bundle " << compileModelFile << "." << endl;
+    return 0;
+  }
+
   // check arguments
-  if (vm.count("varFile") != 1)
+  if ( not bamFile.empty() and (mpileup or vm.count("varFile") != 0) )
+    errorAbort("\nThe --bam option cannot be combined with other input. Try -h for help");
+  if ( not evidenceFile.empty() and (mpileup or not bamFile.empty() or vm.count("varFile") != 0) )
+    errorAbort("\nThe --evidence option cannot be combined with other input. Try -h for help");
+  if ( not region.empty() and bamFile.empty() and not mpileup and evidenceFile.empty() )
+    errorAbort("\nThe --region option requires --bam, --mpileup or --evidence. Try -h for help");
+  if ( not evidenceOutFile.empty() and bamFile.empty() and not mpileup )
+    errorAbort("\nThe --evidenceOut option requires --bam or --mpileup. Try -h for help");
+  GenomicRegion genomicRegion;
+  if ( not region.empty() )
+    genomicRegion = parseRegion(region);
+  if ( vm.count("listShards") ) {
+    if ( bamFile.empty() )
+      errorAbort("\nThe --listShards option requires --bam. Try -h for help");
+    vector<GenomicRegion> shards = mkBamShards(bamFile, genomicRegion, shardSize);
+    for (unsigned i = 0; i < shards.size(); i++)
+      cout << shards[i].str() << endl;
+    return 0;
+  }
+  if (vm.count("varFile") != 1 and not mpileup and bamFile.empty() and evidenceFile.empty())
     errorAbort("\nWrong number of arguments. Try -h for help");
+  vector<string> samples;
+  if ( not sampleNames.empty() ) {
+    samples = split(sampleNames, ',');
+    if ( (not mpileup and evidenceFile.empty()) or vcfFile.empty() or gvcf )
+      errorAbort("\nThe --samples option requires --mpileup (or --evidence) and --vcf, and cannot be combined with --gvcf. Try -h for help");
+    for (unsigned i = 0; i < samples.size(); i++)
+      if ( samples[i].empty() or samples[i].find_first_of(" \t") != string::npos )
+	errorAbort("\nThe sample names of --samples must be non-empty and without blanks. Try -h for help");
+  }
 
   // set output precision at this point in case of xdouble type
 #ifdef XNUMBER_IS_XDOUBLE
   xnumber_t::SetOutputPrecision(prec);
 #endif
 
-  //SL: I removed the following ...
-  // read dfg
-  /*  DfgInfo dfgInfo = readDfgInfo(dfgSpecPrefix + stateMapsFile, 
-				dfgSpecPrefix + factorPotentialsFile, 
-				dfgSpecPrefix + variablesFile, 
-				dfgSpecPrefix + factorGraphFile);
-  */
-
-  // SL: ... and added this loop instead
-  // Well, that didn't work. I'm doing it the hard and stupid way instead...
-  // This should be dynamic ...  DfgInfo *dfgInfoList[maxDepth];
-  DfgInfo *dfgInfoList[200];
+  string modelName = model;
   if(!model.empty()){
     model="_" + model;
   }
   string statemaps=dfgSpecPrefix + ploidity +  "_stateMaps.txt";
   string potentials=dfgSpecPrefix + ploidity + model + "_factorPotentials.txt";
-  cerr<<statemaps<<endl<<potentials<<endl;
+  if ( modelBundleFile.empty() )
+    cerr<<statemaps<<endl<<potentials<<endl;
+  else
+    cerr<<modelBundleFile<<": "<<ploidity + model<<endl;
   FacData * facDataPtr = NULL;
   /*  if (facFile.size() != 0) {
     cout<<"facFile: "<<facFile<<endl;
@@ -261,506 +1387,489 @@ int main(int argc, char * argv[])
     }
   */
 
-  // Create maxDepth DFGs and corresponding information. 
-  // I do this the ugly way because loops and vectors didn't work. I should tidy this up at some point.
-  // You can skip the next 400 lines...
-  DfgInfo dfg1=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth1_variables.txt", dfgSpecPrefix + "depth1_factorGraph.txt");
-  dfgInfoList[0]=&dfg1;
-  DfgInfo dfg2=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth2_variables.txt", dfgSpecPrefix + "depth2_factorGraph.txt");
-  dfgInfoList[1]=&dfg2;
-  DfgInfo dfg3=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth3_variables.txt", dfgSpecPrefix + "depth3_factorGraph.txt");
-  dfgInfoList[2]=&dfg3;
-  DfgInfo dfg4=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth4_variables.txt", dfgSpecPrefix + "depth4_factorGraph.txt");
-  dfgInfoList[3]=&dfg4;
-  DfgInfo dfg5=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth5_variables.txt", dfgSpecPrefix + "depth5_factorGraph.txt");
-  dfgInfoList[4]=&dfg5;
-  DfgInfo dfg6=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth6_variables.txt", dfgSpecPrefix + "depth6_factorGraph.txt");
-  dfgInfoList[5]=&dfg6;
-  DfgInfo dfg7=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth7_variables.txt", dfgSpecPrefix + "depth7_factorGraph.txt");
-  dfgInfoList[6]=&dfg7;
-  DfgInfo dfg8=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth8_variables.txt", dfgSpecPrefix + "depth8_factorGraph.txt");
-  dfgInfoList[7]=&dfg8;
-  DfgInfo dfg9=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth9_variables.txt", dfgSpecPrefix + "depth9_factorGraph.txt");
-  dfgInfoList[8]=&dfg9;
-  DfgInfo dfg10=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth10_variables.txt", dfgSpecPrefix + "depth10_factorGraph.txt");
-  dfgInfoList[9]=&dfg10;
-  DfgInfo dfg11=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth11_variables.txt", dfgSpecPrefix + "depth11_factorGraph.txt");
-  dfgInfoList[10]=&dfg11;
-  DfgInfo dfg12=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth12_variables.txt", dfgSpecPrefix + "depth12_factorGraph.txt");
-  dfgInfoList[11]=&dfg12;
-  DfgInfo dfg13=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth13_variables.txt", dfgSpecPrefix + "depth13_factorGraph.txt");
-  dfgInfoList[12]=&dfg13;
-  DfgInfo dfg14=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth14_variables.txt", dfgSpecPrefix + "depth14_factorGraph.txt");
-  dfgInfoList[13]=&dfg14;
-  DfgInfo dfg15=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth15_variables.txt", dfgSpecPrefix + "depth15_factorGraph.txt");
-  dfgInfoList[14]=&dfg15;
-  DfgInfo dfg16=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth16_variables.txt", dfgSpecPrefix + "depth16_factorGraph.txt");
-  dfgInfoList[15]=&dfg16;
-  DfgInfo dfg17=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth17_variables.txt", dfgSpecPrefix + "depth17_factorGraph.txt");
-  dfgInfoList[16]=&dfg17;
-  DfgInfo dfg18=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth18_variables.txt", dfgSpecPrefix + "depth18_factorGraph.txt");
-  dfgInfoList[17]=&dfg18;
-  DfgInfo dfg19=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth19_variables.txt", dfgSpecPrefix + "depth19_factorGraph.txt");
-  dfgInfoList[18]=&dfg19;
-  DfgInfo dfg20=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth20_variables.txt", dfgSpecPrefix + "depth20_factorGraph.txt");
-  dfgInfoList[19]=&dfg20;
-  DfgInfo dfg21=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth21_variables.txt", dfgSpecPrefix + "depth21_factorGraph.txt");
-  dfgInfoList[20]=&dfg21;
-  DfgInfo dfg22=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth22_variables.txt", dfgSpecPrefix + "depth22_factorGraph.txt");
-  dfgInfoList[21]=&dfg22;
-  DfgInfo dfg23=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth23_variables.txt", dfgSpecPrefix + "depth23_factorGraph.txt");
-  dfgInfoList[22]=&dfg23;
-  DfgInfo dfg24=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth24_variables.txt", dfgSpecPrefix + "depth24_factorGraph.txt");
-  dfgInfoList[23]=&dfg24;
-  DfgInfo dfg25=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth25_variables.txt", dfgSpecPrefix + "depth25_factorGraph.txt");
-  dfgInfoList[24]=&dfg25;
-  DfgInfo dfg26=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth26_variables.txt", dfgSpecPrefix + "depth26_factorGraph.txt");
-  dfgInfoList[25]=&dfg26;
-  DfgInfo dfg27=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth27_variables.txt", dfgSpecPrefix + "depth27_factorGraph.txt");
-  dfgInfoList[26]=&dfg27;
-  DfgInfo dfg28=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth28_variables.txt", dfgSpecPrefix + "depth28_factorGraph.txt");
-  dfgInfoList[27]=&dfg28;
-  DfgInfo dfg29=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth29_variables.txt", dfgSpecPrefix + "depth29_factorGraph.txt");
-  dfgInfoList[28]=&dfg29;
-  DfgInfo dfg30=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth30_variables.txt", dfgSpecPrefix + "depth30_factorGraph.txt");
-  dfgInfoList[29]=&dfg30;
-  DfgInfo dfg31=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth31_variables.txt", dfgSpecPrefix + "depth31_factorGraph.txt");
-  dfgInfoList[30]=&dfg31;
-  DfgInfo dfg32=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth32_variables.txt", dfgSpecPrefix + "depth32_factorGraph.txt");
-  dfgInfoList[31]=&dfg32;
-  DfgInfo dfg33=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth33_variables.txt", dfgSpecPrefix + "depth33_factorGraph.txt");
-  dfgInfoList[32]=&dfg33;
-  DfgInfo dfg34=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth34_variables.txt", dfgSpecPrefix + "depth34_factorGraph.txt");
-  dfgInfoList[33]=&dfg34;
-  DfgInfo dfg35=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth35_variables.txt", dfgSpecPrefix + "depth35_factorGraph.txt");
-  dfgInfoList[34]=&dfg35;
-  DfgInfo dfg36=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth36_variables.txt", dfgSpecPrefix + "depth36_factorGraph.txt");
-  dfgInfoList[35]=&dfg36;
-  DfgInfo dfg37=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth37_variables.txt", dfgSpecPrefix + "depth37_factorGraph.txt");
-  dfgInfoList[36]=&dfg37;
-  DfgInfo dfg38=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth38_variables.txt", dfgSpecPrefix + "depth38_factorGraph.txt");
-  dfgInfoList[37]=&dfg38;
-  DfgInfo dfg39=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth39_variables.txt", dfgSpecPrefix + "depth39_factorGraph.txt");
-  dfgInfoList[38]=&dfg39;
-  DfgInfo dfg40=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth40_variables.txt", dfgSpecPrefix + "depth40_factorGraph.txt");
-  dfgInfoList[39]=&dfg40;
-  DfgInfo dfg41=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth41_variables.txt", dfgSpecPrefix + "depth41_factorGraph.txt");
-  dfgInfoList[40]=&dfg41;
-  DfgInfo dfg42=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth42_variables.txt", dfgSpecPrefix + "depth42_factorGraph.txt");
-  dfgInfoList[41]=&dfg42;
-  DfgInfo dfg43=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth43_variables.txt", dfgSpecPrefix + "depth43_factorGraph.txt");
-  dfgInfoList[42]=&dfg43;
-  DfgInfo dfg44=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth44_variables.txt", dfgSpecPrefix + "depth44_factorGraph.txt");
-  dfgInfoList[43]=&dfg44;
-  DfgInfo dfg45=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth45_variables.txt", dfgSpecPrefix + "depth45_factorGraph.txt");
-  dfgInfoList[44]=&dfg45;
-  DfgInfo dfg46=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth46_variables.txt", dfgSpecPrefix + "depth46_factorGraph.txt");
-  dfgInfoList[45]=&dfg46;
-  DfgInfo dfg47=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth47_variables.txt", dfgSpecPrefix + "depth47_factorGraph.txt");
-  dfgInfoList[46]=&dfg47;
-  DfgInfo dfg48=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth48_variables.txt", dfgSpecPrefix + "depth48_factorGraph.txt");
-  dfgInfoList[47]=&dfg48;
-  DfgInfo dfg49=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth49_variables.txt", dfgSpecPrefix + "depth49_factorGraph.txt");
-  dfgInfoList[48]=&dfg49;
-  DfgInfo dfg50=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth50_variables.txt", dfgSpecPrefix + "depth50_factorGraph.txt");
-  dfgInfoList[49]=&dfg50;
-  DfgInfo dfg51=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth51_variables.txt", dfgSpecPrefix + "depth51_factorGraph.txt");
-  dfgInfoList[50]=&dfg51;
-  DfgInfo dfg52=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth52_variables.txt", dfgSpecPrefix + "depth52_factorGraph.txt");
-  dfgInfoList[51]=&dfg52;
-  DfgInfo dfg53=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth53_variables.txt", dfgSpecPrefix + "depth53_factorGraph.txt");
-  dfgInfoList[52]=&dfg53;
-  DfgInfo dfg54=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth54_variables.txt", dfgSpecPrefix + "depth54_factorGraph.txt");
-  dfgInfoList[53]=&dfg54;
-  DfgInfo dfg55=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth55_variables.txt", dfgSpecPrefix + "depth55_factorGraph.txt");
-  dfgInfoList[54]=&dfg55;
-  DfgInfo dfg56=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth56_variables.txt", dfgSpecPrefix + "depth56_factorGraph.txt");
-  dfgInfoList[55]=&dfg56;
-  DfgInfo dfg57=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth57_variables.txt", dfgSpecPrefix + "depth57_factorGraph.txt");
-  dfgInfoList[56]=&dfg57;
-  DfgInfo dfg58=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth58_variables.txt", dfgSpecPrefix + "depth58_factorGraph.txt");
-  dfgInfoList[57]=&dfg58;
-  DfgInfo dfg59=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth59_variables.txt", dfgSpecPrefix + "depth59_factorGraph.txt");
-  dfgInfoList[58]=&dfg59;
-  DfgInfo dfg60=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth60_variables.txt", dfgSpecPrefix + "depth60_factorGraph.txt");
-  dfgInfoList[59]=&dfg60;
-  DfgInfo dfg61=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth61_variables.txt", dfgSpecPrefix + "depth61_factorGraph.txt");
-  dfgInfoList[60]=&dfg61;
-  DfgInfo dfg62=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth62_variables.txt", dfgSpecPrefix + "depth62_factorGraph.txt");
-  dfgInfoList[61]=&dfg62;
-  DfgInfo dfg63=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth63_variables.txt", dfgSpecPrefix + "depth63_factorGraph.txt");
-  dfgInfoList[62]=&dfg63;
-  DfgInfo dfg64=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth64_variables.txt", dfgSpecPrefix + "depth64_factorGraph.txt");
-  dfgInfoList[63]=&dfg64;
-  DfgInfo dfg65=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth65_variables.txt", dfgSpecPrefix + "depth65_factorGraph.txt");
-  dfgInfoList[64]=&dfg65;
-  DfgInfo dfg66=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth66_variables.txt", dfgSpecPrefix + "depth66_factorGraph.txt");
-  dfgInfoList[65]=&dfg66;
-  DfgInfo dfg67=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth67_variables.txt", dfgSpecPrefix + "depth67_factorGraph.txt");
-  dfgInfoList[66]=&dfg67;
-  DfgInfo dfg68=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth68_variables.txt", dfgSpecPrefix + "depth68_factorGraph.txt");
-  dfgInfoList[67]=&dfg68;
-  DfgInfo dfg69=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth69_variables.txt", dfgSpecPrefix + "depth69_factorGraph.txt");
-  dfgInfoList[68]=&dfg69;
-  DfgInfo dfg70=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth70_variables.txt", dfgSpecPrefix + "depth70_factorGraph.txt");
-  dfgInfoList[69]=&dfg70;
-  DfgInfo dfg71=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth71_variables.txt", dfgSpecPrefix + "depth71_factorGraph.txt");
-  dfgInfoList[70]=&dfg71;
-  DfgInfo dfg72=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth72_variables.txt", dfgSpecPrefix + "depth72_factorGraph.txt");
-  dfgInfoList[71]=&dfg72;
-  DfgInfo dfg73=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth73_variables.txt", dfgSpecPrefix + "depth73_factorGraph.txt");
-  dfgInfoList[72]=&dfg73;
-  DfgInfo dfg74=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth74_variables.txt", dfgSpecPrefix + "depth74_factorGraph.txt");
-  dfgInfoList[73]=&dfg74;
-  DfgInfo dfg75=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth75_variables.txt", dfgSpecPrefix + "depth75_factorGraph.txt");
-  dfgInfoList[74]=&dfg75;
-  DfgInfo dfg76=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth76_variables.txt", dfgSpecPrefix + "depth76_factorGraph.txt");
-  dfgInfoList[75]=&dfg76;
-  DfgInfo dfg77=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth77_variables.txt", dfgSpecPrefix + "depth77_factorGraph.txt");
-  dfgInfoList[76]=&dfg77;
-  DfgInfo dfg78=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth78_variables.txt", dfgSpecPrefix + "depth78_factorGraph.txt");
-  dfgInfoList[77]=&dfg78;
-  DfgInfo dfg79=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth79_variables.txt", dfgSpecPrefix + "depth79_factorGraph.txt");
-  dfgInfoList[78]=&dfg79;
-  DfgInfo dfg80=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth80_variables.txt", dfgSpecPrefix + "depth80_factorGraph.txt");
-  dfgInfoList[79]=&dfg80;
-  DfgInfo dfg81=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth81_variables.txt", dfgSpecPrefix + "depth81_factorGraph.txt");
-  dfgInfoList[80]=&dfg81;
-  DfgInfo dfg82=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth82_variables.txt", dfgSpecPrefix + "depth82_factorGraph.txt");
-  dfgInfoList[81]=&dfg82;
-  DfgInfo dfg83=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth83_variables.txt", dfgSpecPrefix + "depth83_factorGraph.txt");
-  dfgInfoList[82]=&dfg83;
-  DfgInfo dfg84=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth84_variables.txt", dfgSpecPrefix + "depth84_factorGraph.txt");
-  dfgInfoList[83]=&dfg84;
-  DfgInfo dfg85=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth85_variables.txt", dfgSpecPrefix + "depth85_factorGraph.txt");
-  dfgInfoList[84]=&dfg85;
-  DfgInfo dfg86=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth86_variables.txt", dfgSpecPrefix + "depth86_factorGraph.txt");
-  dfgInfoList[85]=&dfg86;
-  DfgInfo dfg87=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth87_variables.txt", dfgSpecPrefix + "depth87_factorGraph.txt");
-  dfgInfoList[86]=&dfg87;
-  DfgInfo dfg88=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth88_variables.txt", dfgSpecPrefix + "depth88_factorGraph.txt");
-  dfgInfoList[87]=&dfg88;
-  DfgInfo dfg89=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth89_variables.txt", dfgSpecPrefix + "depth89_factorGraph.txt");
-  dfgInfoList[88]=&dfg89;
-  DfgInfo dfg90=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth90_variables.txt", dfgSpecPrefix + "depth90_factorGraph.txt");
-  dfgInfoList[89]=&dfg90;
-  DfgInfo dfg91=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth91_variables.txt", dfgSpecPrefix + "depth91_factorGraph.txt");
-  dfgInfoList[90]=&dfg91;
-  DfgInfo dfg92=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth92_variables.txt", dfgSpecPrefix + "depth92_factorGraph.txt");
-  dfgInfoList[91]=&dfg92;
-  DfgInfo dfg93=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth93_variables.txt", dfgSpecPrefix + "depth93_factorGraph.txt");
-  dfgInfoList[92]=&dfg93;
-  DfgInfo dfg94=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth94_variables.txt", dfgSpecPrefix + "depth94_factorGraph.txt");
-  dfgInfoList[93]=&dfg94;
-  DfgInfo dfg95=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth95_variables.txt", dfgSpecPrefix + "depth95_factorGraph.txt");
-  dfgInfoList[94]=&dfg95;
-  DfgInfo dfg96=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth96_variables.txt", dfgSpecPrefix + "depth96_factorGraph.txt");
-  dfgInfoList[95]=&dfg96;
-  DfgInfo dfg97=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth97_variables.txt", dfgSpecPrefix + "depth97_factorGraph.txt");
-  dfgInfoList[96]=&dfg97;
-  DfgInfo dfg98=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth98_variables.txt", dfgSpecPrefix + "depth98_factorGraph.txt");
-  dfgInfoList[97]=&dfg98;
-  DfgInfo dfg99=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth99_variables.txt", dfgSpecPrefix + "depth99_factorGraph.txt");
-  dfgInfoList[98]=&dfg99;
-  DfgInfo dfg100=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth100_variables.txt", dfgSpecPrefix + "depth100_factorGraph.txt");
-  dfgInfoList[99]=&dfg100;
-  DfgInfo dfg101=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth101_variables.txt", dfgSpecPrefix + "depth101_factorGraph.txt");
-  dfgInfoList[100]=&dfg101;
-  DfgInfo dfg102=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth102_variables.txt", dfgSpecPrefix + "depth102_factorGraph.txt");
-  dfgInfoList[101]=&dfg102;
-  DfgInfo dfg103=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth103_variables.txt", dfgSpecPrefix + "depth103_factorGraph.txt");
-  dfgInfoList[102]=&dfg103;
-  DfgInfo dfg104=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth104_variables.txt", dfgSpecPrefix + "depth104_factorGraph.txt");
-  dfgInfoList[103]=&dfg104;
-  DfgInfo dfg105=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth105_variables.txt", dfgSpecPrefix + "depth105_factorGraph.txt");
-  dfgInfoList[104]=&dfg105;
-  DfgInfo dfg106=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth106_variables.txt", dfgSpecPrefix + "depth106_factorGraph.txt");
-  dfgInfoList[105]=&dfg106;
-  DfgInfo dfg107=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth107_variables.txt", dfgSpecPrefix + "depth107_factorGraph.txt");
-  dfgInfoList[106]=&dfg107;
-  DfgInfo dfg108=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth108_variables.txt", dfgSpecPrefix + "depth108_factorGraph.txt");
-  dfgInfoList[107]=&dfg108;
-  DfgInfo dfg109=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth109_variables.txt", dfgSpecPrefix + "depth109_factorGraph.txt");
-  dfgInfoList[108]=&dfg109;
-  DfgInfo dfg110=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth110_variables.txt", dfgSpecPrefix + "depth110_factorGraph.txt");
-  dfgInfoList[109]=&dfg110;
-  DfgInfo dfg111=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth111_variables.txt", dfgSpecPrefix + "depth111_factorGraph.txt");
-  dfgInfoList[110]=&dfg111;
-  DfgInfo dfg112=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth112_variables.txt", dfgSpecPrefix + "depth112_factorGraph.txt");
-  dfgInfoList[111]=&dfg112;
-  DfgInfo dfg113=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth113_variables.txt", dfgSpecPrefix + "depth113_factorGraph.txt");
-  dfgInfoList[112]=&dfg113;
-  DfgInfo dfg114=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth114_variables.txt", dfgSpecPrefix + "depth114_factorGraph.txt");
-  dfgInfoList[113]=&dfg114;
-  DfgInfo dfg115=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth115_variables.txt", dfgSpecPrefix + "depth115_factorGraph.txt");
-  dfgInfoList[114]=&dfg115;
-  DfgInfo dfg116=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth116_variables.txt", dfgSpecPrefix + "depth116_factorGraph.txt");
-  dfgInfoList[115]=&dfg116;
-  DfgInfo dfg117=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth117_variables.txt", dfgSpecPrefix + "depth117_factorGraph.txt");
-  dfgInfoList[116]=&dfg117;
-  DfgInfo dfg118=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth118_variables.txt", dfgSpecPrefix + "depth118_factorGraph.txt");
-  dfgInfoList[117]=&dfg118;
-  DfgInfo dfg119=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth119_variables.txt", dfgSpecPrefix + "depth119_factorGraph.txt");
-  dfgInfoList[118]=&dfg119;
-  DfgInfo dfg120=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth120_variables.txt", dfgSpecPrefix + "depth120_factorGraph.txt");
-  dfgInfoList[119]=&dfg120;
-  DfgInfo dfg121=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth121_variables.txt", dfgSpecPrefix + "depth121_factorGraph.txt");
-  dfgInfoList[120]=&dfg121;
-  DfgInfo dfg122=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth122_variables.txt", dfgSpecPrefix + "depth122_factorGraph.txt");
-  dfgInfoList[121]=&dfg122;
-  DfgInfo dfg123=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth123_variables.txt", dfgSpecPrefix + "depth123_factorGraph.txt");
-  dfgInfoList[122]=&dfg123;
-  DfgInfo dfg124=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth124_variables.txt", dfgSpecPrefix + "depth124_factorGraph.txt");
-  dfgInfoList[123]=&dfg124;
-  DfgInfo dfg125=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth125_variables.txt", dfgSpecPrefix + "depth125_factorGraph.txt");
-  dfgInfoList[124]=&dfg125;
-  DfgInfo dfg126=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth126_variables.txt", dfgSpecPrefix + "depth126_factorGraph.txt");
-  dfgInfoList[125]=&dfg126;
-  DfgInfo dfg127=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth127_variables.txt", dfgSpecPrefix + "depth127_factorGraph.txt");
-  dfgInfoList[126]=&dfg127;
-  DfgInfo dfg128=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth128_variables.txt", dfgSpecPrefix + "depth128_factorGraph.txt");
-  dfgInfoList[127]=&dfg128;
-  DfgInfo dfg129=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth129_variables.txt", dfgSpecPrefix + "depth129_factorGraph.txt");
-  dfgInfoList[128]=&dfg129;
-  DfgInfo dfg130=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth130_variables.txt", dfgSpecPrefix + "depth130_factorGraph.txt");
-  dfgInfoList[129]=&dfg130;
-  DfgInfo dfg131=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth131_variables.txt", dfgSpecPrefix + "depth131_factorGraph.txt");
-  dfgInfoList[130]=&dfg131;
-  DfgInfo dfg132=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth132_variables.txt", dfgSpecPrefix + "depth132_factorGraph.txt");
-  dfgInfoList[131]=&dfg132;
-  DfgInfo dfg133=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth133_variables.txt", dfgSpecPrefix + "depth133_factorGraph.txt");
-  dfgInfoList[132]=&dfg133;
-  DfgInfo dfg134=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth134_variables.txt", dfgSpecPrefix + "depth134_factorGraph.txt");
-  dfgInfoList[133]=&dfg134;
-  DfgInfo dfg135=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth135_variables.txt", dfgSpecPrefix + "depth135_factorGraph.txt");
-  dfgInfoList[134]=&dfg135;
-  DfgInfo dfg136=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth136_variables.txt", dfgSpecPrefix + "depth136_factorGraph.txt");
-  dfgInfoList[135]=&dfg136;
-  DfgInfo dfg137=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth137_variables.txt", dfgSpecPrefix + "depth137_factorGraph.txt");
-  dfgInfoList[136]=&dfg137;
-  DfgInfo dfg138=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth138_variables.txt", dfgSpecPrefix + "depth138_factorGraph.txt");
-  dfgInfoList[137]=&dfg138;
-  DfgInfo dfg139=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth139_variables.txt", dfgSpecPrefix + "depth139_factorGraph.txt");
-  dfgInfoList[138]=&dfg139;
-  DfgInfo dfg140=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth140_variables.txt", dfgSpecPrefix + "depth140_factorGraph.txt");
-  dfgInfoList[139]=&dfg140;
-  DfgInfo dfg141=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth141_variables.txt", dfgSpecPrefix + "depth141_factorGraph.txt");
-  dfgInfoList[140]=&dfg141;
-  DfgInfo dfg142=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth142_variables.txt", dfgSpecPrefix + "depth142_factorGraph.txt");
-  dfgInfoList[141]=&dfg142;
-  DfgInfo dfg143=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth143_variables.txt", dfgSpecPrefix + "depth143_factorGraph.txt");
-  dfgInfoList[142]=&dfg143;
-  DfgInfo dfg144=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth144_variables.txt", dfgSpecPrefix + "depth144_factorGraph.txt");
-  dfgInfoList[143]=&dfg144;
-  DfgInfo dfg145=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth145_variables.txt", dfgSpecPrefix + "depth145_factorGraph.txt");
-  dfgInfoList[144]=&dfg145;
-  DfgInfo dfg146=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth146_variables.txt", dfgSpecPrefix + "depth146_factorGraph.txt");
-  dfgInfoList[145]=&dfg146;
-  DfgInfo dfg147=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth147_variables.txt", dfgSpecPrefix + "depth147_factorGraph.txt");
-  dfgInfoList[146]=&dfg147;
-  DfgInfo dfg148=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth148_variables.txt", dfgSpecPrefix + "depth148_factorGraph.txt");
-  dfgInfoList[147]=&dfg148;
-  DfgInfo dfg149=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth149_variables.txt", dfgSpecPrefix + "depth149_factorGraph.txt");
-  dfgInfoList[148]=&dfg149;
-  DfgInfo dfg150=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth150_variables.txt", dfgSpecPrefix + "depth150_factorGraph.txt");
-  dfgInfoList[149]=&dfg150;
-  DfgInfo dfg151=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth151_variables.txt", dfgSpecPrefix + "depth151_factorGraph.txt");
-  dfgInfoList[150]=&dfg151;
-  DfgInfo dfg152=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth152_variables.txt", dfgSpecPrefix + "depth152_factorGraph.txt");
-  dfgInfoList[151]=&dfg152;
-  DfgInfo dfg153=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth153_variables.txt", dfgSpecPrefix + "depth153_factorGraph.txt");
-  dfgInfoList[152]=&dfg153;
-  DfgInfo dfg154=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth154_variables.txt", dfgSpecPrefix + "depth154_factorGraph.txt");
-  dfgInfoList[153]=&dfg154;
-  DfgInfo dfg155=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth155_variables.txt", dfgSpecPrefix + "depth155_factorGraph.txt");
-  dfgInfoList[154]=&dfg155;
-  DfgInfo dfg156=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth156_variables.txt", dfgSpecPrefix + "depth156_factorGraph.txt");
-  dfgInfoList[155]=&dfg156;
-  DfgInfo dfg157=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth157_variables.txt", dfgSpecPrefix + "depth157_factorGraph.txt");
-  dfgInfoList[156]=&dfg157;
-  DfgInfo dfg158=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth158_variables.txt", dfgSpecPrefix + "depth158_factorGraph.txt");
-  dfgInfoList[157]=&dfg158;
-  DfgInfo dfg159=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth159_variables.txt", dfgSpecPrefix + "depth159_factorGraph.txt");
-  dfgInfoList[158]=&dfg159;
-  DfgInfo dfg160=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth160_variables.txt", dfgSpecPrefix + "depth160_factorGraph.txt");
-  dfgInfoList[159]=&dfg160;
-  DfgInfo dfg161=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth161_variables.txt", dfgSpecPrefix + "depth161_factorGraph.txt");
-  dfgInfoList[160]=&dfg161;
-  DfgInfo dfg162=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth162_variables.txt", dfgSpecPrefix + "depth162_factorGraph.txt");
-  dfgInfoList[161]=&dfg162;
-  DfgInfo dfg163=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth163_variables.txt", dfgSpecPrefix + "depth163_factorGraph.txt");
-  dfgInfoList[162]=&dfg163;
-  DfgInfo dfg164=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth164_variables.txt", dfgSpecPrefix + "depth164_factorGraph.txt");
-  dfgInfoList[163]=&dfg164;
-  DfgInfo dfg165=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth165_variables.txt", dfgSpecPrefix + "depth165_factorGraph.txt");
-  dfgInfoList[164]=&dfg165;
-  DfgInfo dfg166=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth166_variables.txt", dfgSpecPrefix + "depth166_factorGraph.txt");
-  dfgInfoList[165]=&dfg166;
-  DfgInfo dfg167=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth167_variables.txt", dfgSpecPrefix + "depth167_factorGraph.txt");
-  dfgInfoList[166]=&dfg167;
-  DfgInfo dfg168=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth168_variables.txt", dfgSpecPrefix + "depth168_factorGraph.txt");
-  dfgInfoList[167]=&dfg168;
-  DfgInfo dfg169=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth169_variables.txt", dfgSpecPrefix + "depth169_factorGraph.txt");
-  dfgInfoList[168]=&dfg169;
-  DfgInfo dfg170=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth170_variables.txt", dfgSpecPrefix + "depth170_factorGraph.txt");
-  dfgInfoList[169]=&dfg170;
-  DfgInfo dfg171=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth171_variables.txt", dfgSpecPrefix + "depth171_factorGraph.txt");
-  dfgInfoList[170]=&dfg171;
-  DfgInfo dfg172=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth172_variables.txt", dfgSpecPrefix + "depth172_factorGraph.txt");
-  dfgInfoList[171]=&dfg172;
-  DfgInfo dfg173=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth173_variables.txt", dfgSpecPrefix + "depth173_factorGraph.txt");
-  dfgInfoList[172]=&dfg173;
-  DfgInfo dfg174=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth174_variables.txt", dfgSpecPrefix + "depth174_factorGraph.txt");
-  dfgInfoList[173]=&dfg174;
-  DfgInfo dfg175=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth175_variables.txt", dfgSpecPrefix + "depth175_factorGraph.txt");
-  dfgInfoList[174]=&dfg175;
-  DfgInfo dfg176=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth176_variables.txt", dfgSpecPrefix + "depth176_factorGraph.txt");
-  dfgInfoList[175]=&dfg176;
-  DfgInfo dfg177=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth177_variables.txt", dfgSpecPrefix + "depth177_factorGraph.txt");
-  dfgInfoList[176]=&dfg177;
-  DfgInfo dfg178=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth178_variables.txt", dfgSpecPrefix + "depth178_factorGraph.txt");
-  dfgInfoList[177]=&dfg178;
-  DfgInfo dfg179=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth179_variables.txt", dfgSpecPrefix + "depth179_factorGraph.txt");
-  dfgInfoList[178]=&dfg179;
-  DfgInfo dfg180=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth180_variables.txt", dfgSpecPrefix + "depth180_factorGraph.txt");
-  dfgInfoList[179]=&dfg180;
-  DfgInfo dfg181=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth181_variables.txt", dfgSpecPrefix + "depth181_factorGraph.txt");
-  dfgInfoList[180]=&dfg181;
-  DfgInfo dfg182=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth182_variables.txt", dfgSpecPrefix + "depth182_factorGraph.txt");
-  dfgInfoList[181]=&dfg182;
-  DfgInfo dfg183=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth183_variables.txt", dfgSpecPrefix + "depth183_factorGraph.txt");
-  dfgInfoList[182]=&dfg183;
-  DfgInfo dfg184=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth184_variables.txt", dfgSpecPrefix + "depth184_factorGraph.txt");
-  dfgInfoList[183]=&dfg184;
-  DfgInfo dfg185=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth185_variables.txt", dfgSpecPrefix + "depth185_factorGraph.txt");
-  dfgInfoList[184]=&dfg185;
-  DfgInfo dfg186=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth186_variables.txt", dfgSpecPrefix + "depth186_factorGraph.txt");
-  dfgInfoList[185]=&dfg186;
-  DfgInfo dfg187=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth187_variables.txt", dfgSpecPrefix + "depth187_factorGraph.txt");
-  dfgInfoList[186]=&dfg187;
-  DfgInfo dfg188=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth188_variables.txt", dfgSpecPrefix + "depth188_factorGraph.txt");
-  dfgInfoList[187]=&dfg188;
-  DfgInfo dfg189=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth189_variables.txt", dfgSpecPrefix + "depth189_factorGraph.txt");
-  dfgInfoList[188]=&dfg189;
-  DfgInfo dfg190=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth190_variables.txt", dfgSpecPrefix + "depth190_factorGraph.txt");
-  dfgInfoList[189]=&dfg190;
-  DfgInfo dfg191=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth191_variables.txt", dfgSpecPrefix + "depth191_factorGraph.txt");
-  dfgInfoList[190]=&dfg191;
-  DfgInfo dfg192=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth192_variables.txt", dfgSpecPrefix + "depth192_factorGraph.txt");
-  dfgInfoList[191]=&dfg192;
-  DfgInfo dfg193=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth193_variables.txt", dfgSpecPrefix + "depth193_factorGraph.txt");
-  dfgInfoList[192]=&dfg193;
-  DfgInfo dfg194=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth194_variables.txt", dfgSpecPrefix + "depth194_factorGraph.txt");
-  dfgInfoList[193]=&dfg194;
-  DfgInfo dfg195=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth195_variables.txt", dfgSpecPrefix + "depth195_factorGraph.txt");
-  dfgInfoList[194]=&dfg195;
-  DfgInfo dfg196=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth196_variables.txt", dfgSpecPrefix + "depth196_factorGraph.txt");
-  dfgInfoList[195]=&dfg196;
-  DfgInfo dfg197=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth197_variables.txt", dfgSpecPrefix + "depth197_factorGraph.txt");
-  dfgInfoList[196]=&dfg197;
-  DfgInfo dfg198=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth198_variables.txt", dfgSpecPrefix + "depth198_factorGraph.txt");
-  dfgInfoList[197]=&dfg198;
-  DfgInfo dfg199=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth199_variables.txt", dfgSpecPrefix + "depth199_factorGraph.txt");
-  dfgInfoList[198]=&dfg199;
-  DfgInfo dfg200=readDfgInfo(statemaps, potentials,dfgSpecPrefix + "depth200_variables.txt", dfgSpecPrefix + "depth200_factorGraph.txt");
-  dfgInfoList[199]=&dfg200;
-  // Done with DFGs...
+  // The DFG of each depth is made when first needed, so only the depths
+  // present in the input are built
+  if (maxDepth == 0)
+    errorAbort("The maximum depth must be positive.");
+  DepthModels * depthModels;
+  if (depthFiles)
+    depthModels = new DepthModels(statemaps, potentials, dfgSpecPrefix);
+  else
+    depthModels = new DepthModels(statemaps, potentials);
 
 
   // open output stream - Fixed (SL)
+  if ( not vcfFile.empty() ) {
+    if ( not postProbFile.empty() or minusLogarithm )
+      errorAbort("The --vcf option cannot be combined with --ppFile or --minusLogarithm.");
+    postProbFile = vcfFile;
+  }
+  if ( vcfIndex and not isHtsVcfFile(vcfFile) )
+    errorAbort("The --index option requires --vcf with a .gz or .bcf file.");
   ofstream ppF;
-  if (postProbFile != "-")
+  VcfFileBuf * vcfBuf = NULL;
+  if ( isHtsVcfFile(vcfFile) )
+    vcfBuf = new VcfFileBuf(vcfFile, vcfIndex);
+  else if (postProbFile != "-")
     openOutFile(ppF, postProbFile);
-  ostream & ppStr = ( ppF.is_open() ) ? ppF : cout;
+  ostream vcfStr(vcfBuf);
+  ostream & outStr = (vcfBuf != NULL) ? vcfStr : ( ppF.is_open() ? ppF : cout );
+  VcfBlockBuf * blockBuf = NULL;
+  if (gvcf) {
+    if ( vcfFile.empty() )
+      errorAbort("The --gvcf option requires --vcf.");
+    blockBuf = new VcfBlockBuf( outStr.rdbuf(), parseBands(gqBands), parseBands(dpBands) );
+  }
+  ostream blockStr(blockBuf);
+  ostream & ppStr = (blockBuf != NULL) ? blockStr : outStr;
 
   // pp init data structures - Fixed (SL)
   vector<string>  ppVarNames;
   vector< vector<symbol_t> >  ppVarStates;
   mkVarAndStateSymbolList(ppVarVecStr,  ppVarNames, ppVarStates); 
-
-  // We need a DFG to set some variables
-  DfgInfo dfgInfo=*(dfgInfoList[maxDepth-1]);
-
-  // pp output data structures
-  vector<xvector_t> variableMarginals;
-  initGenericVariableMarginals(variableMarginals, dfgInfo.dfg);
-
-  // define which random variables and which states to output post probs for
   assert( ppVarNames.size() == ppVarStates.size() );
-  vector<unsigned> ppVarMap = mkSubsetMap(dfgInfo.varNames, ppVarNames);
 
-  // state maps
-  vector< vector<string> > ssTable = mkStateSymbolTable(dfgInfo.stateMapVec); 
+  // The closed form engine only gives the posteriors of G and relies on
+  // the factor graphs having the usual star shape. A model from a bundle
+  // was checked against the DFG when the bundle was compiled.
+  ModelBundle * modelBundle = NULL;
+  ModelVariant variant;
+  StarModel * starModel = NULL;
+  if ( not modelBundleFile.empty() ) {
+    if (engine != "star" or ppVarNames.size() != 1 or ppVarNames[0] != "G")
+      errorAbort("The --modelBundle option requires the star engine and --ppVars=G.");
+    modelBundle = new ModelBundle(modelBundleFile);
+    variant = modelBundle->variant(ploidity + model);
+    starModel = new StarModel(variant.stateMaps, variant.potentials, modelBundleFile);
+    if (starModel->genotypeCount() != variant.genotypeCount or starModel->observationSymbolCount() != variant.symbolCount)
+      errorAbort("The emission table of model '" + variant.name + "' in '" + modelBundleFile + "' does not match its state maps.");
+    cerr << "Using the star engine with model " << variant.name << " of the bundle (agreed with the DFG on " << variant.checkedSites << " test sites when compiled)." << endl;
+  }
+  else if (engine == "star") {
+    string reason;
+    if (ppVarNames.size() != 1 or ppVarNames[0] != "G")
+      cerr << "Posteriors requested for other variables than G, using the dfg engine." << endl;
+    else if ( depthFiles and not StarModel::isStarGraph(dfgSpecPrefix + "depth1_variables.txt", dfgSpecPrefix + "depth1_factorGraph.txt", reason) )
+      cerr << "Factor graph is not of the form handled by the star engine (" << reason << "), using the dfg engine." << endl;
+    else {
+      starModel = new StarModel(statemaps, potentials);
+      unsigned checked = checkStarModel(*starModel, *depthModels, min(maxDepth, 30u));
+      cerr << "Using the star engine (agrees with the DFG on " << checked << " test sites)." << endl;
+    }
+  }
+  else if (engine != "dfg")
+    errorAbort("Unknown engine '" + engine + "'. Use 'star' or 'dfg'.");
+
+  // define which states to output post probs for; the star engine only
+  // has G, otherwise we need a DFG to set some variables
   vector< vector<unsigned> > ppVarStateMap;
-  for (unsigned i = 0; i < ppVarStates.size(); i++) {
-    if (ppVarStates[i].size() == 0)      ppVarStates[i] = ssTable[ ppVarMap[i] ];
-    ppVarStateMap.push_back( mkSubsetMap( ssTable[ ppVarMap[i] ], ppVarStates[i] ) );
+  if (starModel != NULL) {
+    if (ppVarStates[0].size() == 0)      ppVarStates[0] = starModel->genotypeSymbols();
+    ppVarStateMap.push_back( mkSubsetMap( starModel->genotypeSymbols(), ppVarStates[0] ) );
   }
-  writeNamedData(ppStr, "NAME:\tranVar", ppVarStates[0]);
+  else {
+    DfgInfo const & dfgInfo = depthModels->get( minDepthOfVars(ppVarNames) );
+    vector<unsigned> ppVarMap = mkSubsetMap(dfgInfo.varNames, ppVarNames);
 
-  // variables needed in data loop
-  string idVar;
-  vector<symbol_t> varVec;
-  unsigned lineCount = 1;
-  int depth;
+    // state maps
+    vector< vector<string> > ssTable = mkStateSymbolTable(dfgInfo.stateMapVec); 
+    for (unsigned i = 0; i < ppVarStates.size(); i++) {
+      if (ppVarStates[i].size() == 0)      ppVarStates[i] = ssTable[ ppVarMap[i] ];
+      ppVarStateMap.push_back( mkSubsetMap( ssTable[ ppVarMap[i] ], ppVarStates[i] ) );
+    }
+  }
+  // with --sweep or --estimate the summaries or the potentials are the output
+  if ( not sweepFile.empty() or not estimateFile.empty() ) {
+    if ( not vcfFile.empty() )
+      errorAbort("The --sweep and --estimate options write no posteriors and cannot be combined with --vcf.");
+  }
+  else if ( vcfFile.empty() )
+    writeNamedData(ppStr, "NAME:\tranVar", ppVarStates[0]);
+  else {
+    if (ppVarNames.size() != 1 or ppVarNames[0] != "G")
+      errorAbort("The --vcf option requires --ppVars=G.");
+    for (unsigned i = 0; i < ppVarStates[0].size(); i++)
+      if (ppVarStates[0][i].size() != 2)
+	errorAbort("The --vcf option requires genotype symbols of two bases, not '" + ppVarStates[0][i] + "'.");
+    vector<GenomicRegion> contigs;
+    if ( not bamFile.empty() )
+      contigs = mkBamShards(bamFile, GenomicRegion(), 0);
+    else if (vcfBuf != NULL) {
+      if ( referenceFile.empty() )
+	errorAbort("The --vcf option with a .gz or .bcf file requires --bam or --reference for the contig names.");
+      contigs = readFastaContigs(referenceFile);
+    }
+    ppStr << mkVcfHeader(referenceFile, modelName, histogram ? 0 : maxDepth, contigs, gvcf, samples);
+  }
 
-  // Set the mapping using the largest DFG
-  VarData varData(varFile, dfgInfo.varNames);
-  vector<unsigned> theFullMap=varData.map();
-  ifstream input(varFile.c_str());
-  string myline;
+  if (histogram and starModel == NULL)
+    errorAbort("The --histogram mode requires the star engine.");
+  // samples without reads have sites of depth 0, which the DFGs do not have
+  if ( not samples.empty() and starModel == NULL )
+    errorAbort("The --samples option requires the star engine.");
+  EmissionTable * emissionTable = NULL;
+  if (batchSites > 0) {
+    if (starModel == NULL)
+      errorAbort("The --batch mode requires the star engine.");
+    if (modelBundle != NULL)
+      emissionTable = new EmissionTable( *starModel, parseSimdLevel(simd), variant.logEmission );
+    else
+      emissionTable = new EmissionTable( *starModel, parseSimdLevel(simd) );
+    unsigned checked = checkEmissionTable(*starModel, *emissionTable);
+    cerr << "Using the " << simdLevelName( emissionTable->simdLevel() ) << " batch kernel (agrees with the star engine on " << checked << " test sites)." << endl;
+  }
+  NumericBackend numericBackend = parseNumericBackend(numeric);
+  GenotypeKernel * genotypeKernel = NULL;
+  if (numericBackend != NUMERIC_XNUMBER) {
+    if (starModel == NULL or emissionTable != NULL)
+      errorAbort("The --numeric option requires the star engine and cannot be combined with --batch.");
+    genotypeKernel = mkGenotypeKernel(*starModel, numericBackend);
+    unsigned checked = checkGenotypeKernel(*starModel, *genotypeKernel);
+    cerr << "Using the " << numericBackendName(numericBackend) << " genotype kernel (agrees with the star engine on " << checked << " test sites)." << endl;
+  }
+  if (benchNumeric and starModel == NULL)
+    errorAbort("The --benchNumeric option requires the star engine.");
+  DamageSweep * sweep = NULL;
+  if ( not sweepFile.empty() ) {
+    if (starModel == NULL)
+      errorAbort("The --sweep option requires the star engine.");
+    vector<double> taus = parseRates(sweepTau, "sweepTau"), deltas = parseRates(sweepDelta, "sweepDelta");
+    vector< pair<double, double> > grid;
+    for (unsigned i = 0; i < taus.size(); i++)
+      for (unsigned j = 0; j < deltas.size(); j++)
+	grid.push_back( make_pair(taus[i], deltas[j]) );
+    if (modelBundle != NULL)
+      sweep = new DamageSweep(variant.stateMaps, variant.potentials, modelBundleFile, grid);
+    else
+      sweep = new DamageSweep(readStateMapSpecs(statemaps), readPotentialSpecs(potentials), potentials, grid);
+    cerr << "Sweeping " << sweep->modelCount() << " damage models." << endl;
+  }
+  ErrorEstimator * estimator = NULL;
+  if ( not estimateFile.empty() ) {
+    if (starModel == NULL)
+      errorAbort("The --estimate option requires the star engine.");
+    if (sweep != NULL)
+      errorAbort("The --estimate and --sweep options cannot be combined.");
+    if ( not (estimateFraction > 0 and estimateFraction <= 1) )
+      errorAbort("The --estimateFraction must be in (0, 1].");
+    if (estimatePasses == 0)
+      errorAbort("The --estimatePasses must be at least 1.");
+    ErrorEstimator::Parameters params = estimateMatrix ? ErrorEstimator::ESTIMATE_MATRIX : ErrorEstimator::ESTIMATE_DAMAGE;
+    if (modelBundle != NULL)
+      estimator = new ErrorEstimator(variant.stateMaps, variant.potentials, modelBundleFile, params);
+    else
+      estimator = new ErrorEstimator(readStateMapSpecs(statemaps), readPotentialSpecs(potentials), potentials, params);
+  }
+  if (threadCount == 0)
+    errorAbort("The number of threads must be at least 1.");
+  if (allocStats and not HEAP_ALLOCATIONS_COUNTED)
+    errorAbort("--allocStats needs the allocation counter, which this build does not have; use dfgEval_SNPest_alloc ('make alloccheck').");
 
-  // Skip the first line with NAME: ...
-  getline(input,myline);
+  EvalSettings settings;
+  settings.depthModels = depthModels;
+  settings.starModel = starModel;
+  settings.emissionTable = emissionTable;
+  settings.batchSites = batchSites;
+  settings.histogram = histogram;
+  settings.ppVarNames = ppVarNames;
+  settings.ppVarStateMap = ppVarStateMap;
+  settings.minusLogarithm = minusLogarithm;
+  settings.ppSumOther = ppSumOther or not vcfFile.empty();
+  settings.prec = prec;
+  if ( not vcfFile.empty() )
+    settings.vcfGenotypes = ppVarStates[0];
+  if ( homRefBound != 0 and (vcfFile.empty() or homRefBound < 0 or homRefBound >= 0.5) )
+    errorAbort("The --homRefBound option requires --vcf and a value below 0.5.");
+  if (homRefBound > 0 and starModel == NULL) {
+    cerr << "The hom-ref shortcut needs the star engine, evaluating all sites." << endl;
+    homRefBound = 0;
+  }
+  settings.homRefBound = homRefBound;
+  settings.genotypeKernel = genotypeKernel;
+  PosteriorCache * cache = NULL;
+  if (cacheSlots > 0) {
+    if (ppVarNames.size() != 1 or emissionTable != NULL or genotypeKernel != NULL)
+      cerr << "The posterior cache is not used with --batch, --numeric or several --ppVars, evaluating all sites." << endl;
+    else
+      cache = new PosteriorCache(cacheSlots);
+  }
+  settings.cache = cache;
+  // the generated read model is exchangeable in the reads, graphs read
+  // from files are if they have the star form
+  string exchangeReason;
+  settings.exchangeableReads = starModel != NULL or not depthFiles or StarModel::isStarGraph(dfgSpecPrefix + "depth1_variables.txt", dfgSpecPrefix + "depth1_factorGraph.txt", exchangeReason);
+  if (progressInterval < 0)
+    errorAbort("The --progress interval must not be negative.");
+  bool collectStats = not statsFile.empty();
+  settings.collectStats = collectStats;
+  settings.sampleCount = samples.size();
+  ofstream statsF;
+  if (collectStats)
+    openOutFile(statsF, statsFile);
+
+  // variables needed in data loop
+  ifstream input;
+  PileupReader * pileupReader = NULL;
+  EvidenceReader * evidenceReader = NULL;
+  EvidenceWriter * evidenceWriter = NULL;
 
-  while ( getline(input, myline) ) {
-    vector<string> elements=split(myline,'\t');
-    idVar=elements[0];
-    vector<symbol_t> varVec( elements.size()-1 );
-    vector<unsigned> theMap( elements.size()-1 );
-    
-    // Find depth at the next position
-    depth=min((int)maxDepth,atoi( (idVar.substr(idVar.find_last_of("_")+1)).c_str()) );
-    for(int i=0;i<=depth;i++){
-      varVec[i]=elements[i+1];
-      theMap[i]=theFullMap[i];
+  unsigned readerDepth = histogram ? UINT_MAX : maxDepth;
+  if ( not bamFile.empty() )
+    // pile up the alignments ourselves; the sites are as from mpileup
+    pileupReader = new BamPileupReader(bamFile, referenceFile, genomicRegion.str(), readerDepth, minBaseQ, minMapQ, noRef);
+  else if (mpileup) {
+    // Parse the mpileup input directly; each line gives a site record
+    // and possibly insertion pseudo sites. In histogram mode all reads are used.
+    if (varFile.empty() or varFile == "-")
+      pileupReader = new MpileupReader(cin, readerDepth, qualBase, noRef, genomicRegion, settings.sampleCount);
+    else {
+      openInFile(input, varFile);
+      pileupReader = new MpileupReader(input, readerDepth, qualBase, noRef, genomicRegion, settings.sampleCount);
     }
+  }
+  else if ( not evidenceFile.empty() ) {
+    // the sites of an earlier run, as they were read
+    evidenceReader = new EvidenceReader(evidenceFile, genomicRegion, readerDepth);
+    unsigned storedSamples = evidenceReader->sampleCount();
+    if (storedSamples != settings.sampleCount)
+      errorAbort("The evidence store '" + evidenceFile + "' was written " + (storedSamples == 0 ? string("without --samples") : "with " + toString(storedSamples) + " --samples") + "; give the same number of --samples.");
+  }
+  else {
+    // C, O1, ..., On are mapped to the DFG variables of each depth by the evaluators
+    openInFile(input, varFile);
+    string header;
+    getline(input, header);
+    checkTabHeader(header, varFile);
+  }
+  // the star engines only need the symbol codes of the pileup sites
+  if (pileupReader != NULL)
+    pileupReader->setSymbolStrings(starModel == NULL);
+  if (evidenceReader != NULL)
+    evidenceReader->setSymbolStrings(starModel == NULL);
+  bool useRecordDepth = pileupReader != NULL or evidenceReader != NULL or histogram;
+  if ( not evidenceOutFile.empty() )
+    evidenceWriter = new EvidenceWriter(evidenceOutFile, settings.sampleCount);
 
-    DfgInfo dfgInfo=*(dfgInfoList[depth-1]);
-    stateMaskVec_t stateMasks( dfgInfo.varNames.size() );
+  SiteInput siteInput;
+  siteInput.pileupReader = pileupReader;
+  siteInput.evidenceReader = evidenceReader;
+  siteInput.tabInput = & input;
+  siteInput.evidenceWriter = evidenceWriter;
+  siteInput.useRecordDepth = useRecordDepth;
+  siteInput.maxDepth = maxDepth;
+  siteInput.records.resize(1);
+  siteInput.parseSeconds = 0;
+  siteInput.timed = collectStats;
+  vector<SiteRecord> & records = siteInput.records;
 
-    dfgInfo.stateMaskMapSet.symbols2StateMasks(stateMasks, varVec, theMap);
-    /*    for(int i=0;i<stateMasks.size();i++){
-      cout<<stateMasks[i]<<" ";
+  unsigned long startAllocs = heapAllocationCount();
+  unsigned long lineCount = 0, allocatingLines = 0;
+  unsigned long evaluatedSites = 0, shortcutSites = 0;
+  SiteStats siteStats;
+  // times of the main loop for --stats
+  double loopStartTime = wallTime(), lastProgressTime = loopStartTime;
+  double writeSeconds = 0;
+  if (benchNumeric) {
+    CountedSites sites;
+    SymbolHistogram hist;
+    while (unsigned recordCount = siteInput.next() )
+      for (unsigned r = 0; r < recordCount; r++) {
+	starModel->countSymbols(records[r], siteInput.depth(records[r]), hist);
+	sites.add(hist);
+      }
+    benchmarkNumeric(*starModel, sites);
+  }
+  else if (sweep != NULL) {
+    vector<SiteRecord> chunk;
+    vector<unsigned> depths;
+    bool end = false;
+    while (not end) {
+      unsigned siteCount = readChunk(siteInput, threadCount, chunk, depths, lineCount, end);
+      sweep->addSites(chunk, depths, siteCount, threadCount);
+      evaluatedSites += siteCount;
+      if (progressInterval > 0 and siteCount > 0)
+	writeProgress(progressInterval, lastProgressTime, loopStartTime, lineCount, evaluatedSites, chunk[siteCount - 1].id);
     }
-    cout<<endl;
-    for(int i=0;i<varVec.size();i++){
-      cout<<varVec[i]<<" ";
+    if (sweepFile == "-")
+      sweep->writeSummaries(cout);
+    else {
+      ofstream sweepStr( sweepFile.c_str() );
+      if (not sweepStr)
+	errorAbort("Could not open the --sweep file '" + sweepFile + "'.");
+      sweep->writeSummaries(sweepStr);
     }
-    cout<<endl;
-
-    for(int i=0;i<theMap.size();i++){
-      cout<<theMap[i]<<" ";
+    cerr << "Evaluated " << evaluatedSites << " sites under " << sweep->modelCount() << " damage models." << endl;
+    delete sweep;
+  }
+  else if (estimator != NULL) {
+    // a random subset of the sites with reads, as counts
+    CountedSites sites;
+    SymbolHistogram hist;
+    boost::random::mt19937 rng(estimateSeed);
+    boost::random::uniform_real_distribution<double> uniform(0, 1);
+    while (unsigned recordCount = siteInput.next() ) {
+      lineCount++;
+      for (unsigned r = 0; r < recordCount; r++) {
+	unsigned depth = siteInput.depth(records[r]);
+	if (depth == 0 or (estimateFraction < 1 and uniform(rng) >= estimateFraction) )
+	  continue;
+	starModel->countSymbols(records[r], depth, hist);
+	sites.add(hist);
+      }
     }
-    cout<<endl;
-    */
-
-    dfgInfo.dfg.runSumProduct(stateMasks);  
+    evaluatedSites = sites.size();
+    cerr << "Estimating the observation potential from " << sites.size() << " sites." << endl;
 
-    dfgInfo.dfg.calcVariableMarginals(variableMarginals, stateMasks);
-    for (unsigned i = 0; i < ppVarNames.size(); i++) {
-      xvector_t ppVec = variableMarginals[ ppVarMap[i] ];
-      transformByOptions(ppVec, minusLogarithm, ppSumOther, idVar);
-      writeNamedData(ppStr, idVar + "\t" + ppVarNames[i], mkSubset(toStdVector(ppVec), ppVarStateMap[i]), prec);
+    unsigned p = 0;
+    double change = HUGE_VAL;
+    while (p < estimatePasses and change > 1e-6) {
+      change = estimator->pass(sites, threadCount);
+      p++;
+      cerr << "EM pass " << p << ": mean log-likelihood " << estimator->meanLogLikelihood() << " per site";
+      if (not estimateMatrix)
+	cerr << ", tau " << estimator->tau() << ", delta " << estimator->delta();
+      cerr << ", largest change " << change << "." << endl;
     }
-    
+    string comment = "Potentials of '" + (modelBundle != NULL ? modelBundleFile : potentials) + "' with the observation potential estimated by dfgEval_SNPest --estimate";
+    if (estimateMatrix)
+      comment += "Matrix";
+    comment += " from " + toString(sites.size()) + " sites (" + toString(estimator->readCount()) + " reads)";
+    if (estimateFraction < 1)
+      comment += " sampled with --estimateFraction=" + toString(estimateFraction) + " --estimateSeed=" + toString(estimateSeed) + ",";
+    comment += " in " + toString(p) + " passes";
+    if (not estimateMatrix)
+      comment += ": tau = " + toString(estimator->tau()) + ", delta = " + toString(estimator->delta());
+    estimator->write(estimateFile, comment + ".");
+    cerr << "Wrote the potentials to " << estimateFile << "." << endl;
+    delete estimator;
+  }
+  else if (threadCount == 1 and not pipeline) {
+    SiteEvaluator evaluator(settings);
+    while (true) {
+      unsigned long allocs = heapAllocationCount();
+      unsigned recordCount = siteInput.next();
+      if (recordCount == 0)
+	break;
+      for (unsigned r = 0; r < recordCount; r++)
+	evaluator.evaluate(records[r], siteInput.depth(records[r]), ppStr);
+      lineCount++;
+      if (heapAllocationCount() != allocs)
+	allocatingLines++;
+      if (progressInterval > 0 and lineCount % PROGRESS_CHECK_LINES == 0)
+	writeProgress(progressInterval, lastProgressTime, loopStartTime, lineCount, evaluator.siteCount(), records[recordCount - 1].id);
+    }
+    evaluator.flush(ppStr);
+    evaluatedSites = evaluator.siteCount();
+    shortcutSites = evaluator.shortcutCount();
+    siteStats = evaluator.stats();
+  }
+  else {
+    // the threads are started once, and read the next chunks while
+    // the last ones are evaluated and written
+    vector<SiteEvaluator *> evaluators;
+    for (unsigned i = 0; i < threadCount; i++)
+      evaluators.push_back( new SiteEvaluator(settings) );
+    SitePipeline sitePipeline(evaluators, siteInput, max(settings.sampleCount, 1u), ppStr);
+    sitePipeline.run(progressInterval, loopStartTime);
+    lineCount = sitePipeline.lineCount();
+    writeSeconds = sitePipeline.writeSeconds();
+    for (unsigned i = 0; i < evaluators.size(); i++) {
+      evaluatedSites += evaluators[i]->siteCount();
+      shortcutSites += evaluators[i]->shortcutCount();
+      siteStats.merge( evaluators[i]->stats() );
+      delete evaluators[i];
+    }
+  }
+  if (allocStats) {
+    cerr << "Heap allocations: " << startAllocs << " before the site loop, " << heapAllocationCount() - startAllocs << " in the site loop";
+    if (threadCount == 1 and not pipeline)
+      cerr << " (" << allocatingLines << " of " << lineCount << " input lines allocated)";
+    cerr << "." << endl;
+  }
 
-    lineCount++;
+  if (homRefBound > 0)
+    cerr << "Hom-ref shortcut taken at " << shortcutSites << " of " << evaluatedSites << " sites." << endl;
+  if (cache != NULL)
+    cerr << "Posterior cache (" << cache->slotCount() << " slots): " << cache->hits() << " hits, " << cache->misses() << " misses." << endl;
+
+  if (evidenceWriter != NULL) {
+    evidenceWriter->close();
+    cerr << "Wrote " << evidenceWriter->lineCount() << " input lines to the evidence store " << evidenceOutFile << "." << endl;
   }
 
   // clean up
+  double flushStart = wallTime();
+  ppStr.flush();
+  if (blockBuf != NULL) {
+    blockBuf->close();
+    delete blockBuf;
+  }
+  if (vcfBuf != NULL) {
+    vcfBuf->close();
+    delete vcfBuf;
+  }
+  writeSeconds += wallTime() - flushStart;
+
+  if (collectStats) {
+    double endTime = wallTime();
+    JsonFields run, models, counts, seconds;
+    run.push_back( make_pair("engine", jsonString(starModel != NULL ? "star" : "dfg")) );
+    run.push_back( make_pair("input", jsonString( not bamFile.empty() ? "bam" : (mpileup ? "mpileup" : (evidenceReader != NULL ? "evidence" : "tab")) )) );
+    run.push_back( make_pair("ploidity", jsonString(ploidity)) );
+    run.push_back( make_pair("model", jsonString(modelName)) );
+    run.push_back( make_pair("maxDepth", toString(maxDepth)) );
+    run.push_back( make_pair("histogram", histogram ? "true" : "false") );
+    run.push_back( make_pair("batch", toString(batchSites)) );
+    run.push_back( make_pair("numeric", jsonString(numericBackendName(numericBackend))) );
+    run.push_back( make_pair("threads", toString(threadCount)) );
+    run.push_back( make_pair("pipeline", (pipeline or threadCount > 1) ? "true" : "false") );
+    run.push_back( make_pair("samples", toString(settings.sampleCount)) );
+    run.push_back( make_pair("homRefBound", jsonNumber(homRefBound)) );
+    run.push_back( make_pair("cacheSlots", toString(cache != NULL ? cache->slotCount() : 0)) );
+    if ( modelBundleFile.empty() ) {
+      models.push_back( make_pair("stateMaps", jsonString(statemaps)) );
+      models.push_back( make_pair("factorPotentials", jsonString(potentials)) );
+    }
+    else {
+      models.push_back( make_pair("bundle", jsonString(modelBundleFile)) );
+      models.push_back( make_pair("variant", jsonString(variant.name)) );
+    }
+    models.push_back( make_pair("dfgDepthsBuilt", toString( depthModels->builtCount() )) );
+    counts.push_back( make_pair("inputLines", toString(lineCount)) );
+    counts.push_back( make_pair("sites", toString(siteStats.sites())) );
+    counts.push_back( make_pair("reads", toString(siteStats.reads())) );
+    counts.push_back( make_pair("clampedSites", toString(siteStats.clampedSites())) );
+    counts.push_back( make_pair("shortcutSites", toString(shortcutSites)) );
+    if (cache != NULL) {
+      counts.push_back( make_pair("cacheHits", toString(cache->hits())) );
+      counts.push_back( make_pair("cacheMisses", toString(cache->misses())) );
+    }
+    seconds.push_back( make_pair("total", jsonNumber(endTime - startTime)) );
+    seconds.push_back( make_pair("setup", jsonNumber(loopStartTime - startTime)) );
+    seconds.push_back( make_pair("parse", jsonNumber(siteInput.parseSeconds)) );
+    seconds.push_back( make_pair("inference", jsonNumber(siteStats.evaluateSeconds() - siteStats.outputSeconds())) );
+    seconds.push_back( make_pair("output", jsonNumber(siteStats.outputSeconds())) );
+    seconds.push_back( make_pair("write", jsonNumber(writeSeconds)) );
+    writeStatsReport(statsF, run, models, counts, seconds, siteStats);
+    statsF.close();
+  }
   if (facDataPtr != NULL)
     delete facDataPtr;
+  if (pileupReader != NULL)
+    delete pileupReader;
+  if (evidenceReader != NULL)
+    delete evidenceReader;
+  if (evidenceWriter != NULL)
+    delete evidenceWriter;
+  if (emissionTable != NULL)
+    delete emissionTable;
+  if (modelBundle != NULL)
+    delete modelBundle;
+  if (cache != NULL)
+    delete cache;
+  if (genotypeKernel != NULL)
+    delete genotypeKernel;
+  delete depthModels;
   input.close();
 
   return 0;
@@ -0,0 +1,70 @@
+#include <boost/program_options.hpp>
+#include "phy/utils.h"
+#include "ConsensusFasta.h"
+#include <fstream>
+#include <iostream>
+
+namespace po = boost::program_options;
+using namespace phy;
+
+// vcf2fasta: the consensus genome of a filtered VCF (see
+// ConsensusFasta.h), streamed contig by contig: the reference is read
+// through mmap and its .fai index, and the sequence of each contig is
+// written as it is made, so the memory does not depend on the size of
+// the genome.
+
+int main(int argc, char * argv[])
+{
+  string referenceFile, inputFile;
+  unsigned lineWidth;
+
+  po::options_description visible(string("vcf2fasta writes the consensus genome of a VCF filtered by cleanupvcf: the reference with the substitutions, insertions and deletions of the VCF, one sequence per contig of the reference. The VCF must be sorted, with its contigs in the order of the reference.\n\n")
+				  + "  Usage: vcf2fasta [options] reference.fa [input.vcf] > consensus.fa\n\n"
+				  + "The reference must be indexed with 'samtools faidx'. Reads the VCF on STDIN if no input file is given.\n\n"
+				  + "Allowed options");
+  visible.add_options()
+    ("help,h", "produce help message")
+    ("lineWidth", po::value<unsigned>(& lineWidth)->default_value(60), "Bases per line of the output; 0 writes each sequence on one line, as vcf2fasta.pl.");
+
+  po::options_description hidden("Hidden options");
+  hidden.add_options()
+    ("reference", po::value<string>(& referenceFile)->default_value(""), "Reference FASTA file.")
+    ("inputFile", po::value<string>(& inputFile)->default_value("-"), "Input VCF.");
+  po::positional_options_description positional;
+  positional.add("reference", 1).add("inputFile", 1);
+  po::options_description all;
+  all.add(visible).add(hidden);
+
+  po::variables_map vm;
+  po::store(po::command_line_parser(argc, argv).options(all).positional(positional).run(), vm);
+  po::notify(vm);
+  if (vm.count("help") or referenceFile.empty() ) {
+    cout << visible << endl;
+    return 1;
+  }
+
+  ifstream inputStream;
+  if (inputFile != "-") {
+    inputStream.open( inputFile.c_str() );
+    if (not inputStream)
+      errorAbort("Could not open file '" + inputFile + "'.");
+  }
+  else
+    ios::sync_with_stdio(false);
+  istream & in = (inputFile != "-") ? inputStream : cin;
+
+  IndexedFasta reference(referenceFile);
+  FastaLineWriter out(stdout, lineWidth);
+  ConsensusBuilder builder(reference, out);
+  string line;
+  while ( getline(in, line) )
+    if (not line.empty() and line[0] != '#')
+      builder.add(line);
+  if ( in.bad() )
+    errorAbort("Could not read file '" + inputFile + "'.");
+  builder.finish();
+  out.finish();
+
+  cerr << "Wrote the consensus of " << reference.contigs().size() << " contigs: " << builder.insertions() << " inserted and " << builder.deletions() << " deleted bases, " << builder.substitutions() << " substitutions." << endl;
+  return 0;
+}